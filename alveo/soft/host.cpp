@@ -9,15 +9,16 @@
 #include "host.hpp"
 
 #include "utils.hpp"
+#include "online_cpa.hpp"
 
 //#define DEBUG 0
 
 int main(int argc, char *argv[]) {
     // Parse the command line arguments
-    if (argc != 13) {
+    if (argc != 13 && argc != 14) {
         std::cerr << "usage: " << argv[0]
                   << " XCLBIN N_SENSORS N_SAMPLES SENSOR_WIDTH IDC_SIZE "
-                     "IDF_SIZE N_TRACES CALIB_PATH OUT_PATH KEY CALIB TEMPERATURE"
+                     "IDF_SIZE N_TRACES CALIB_PATH OUT_PATH KEY CALIB TEMPERATURE [ONLINE_CPA]"
                   << std::endl;
         printf("Error\n");
         std::exit(-1);
@@ -32,6 +33,12 @@ int main(int argc, char *argv[]) {
     char *CALIB_PATH = argv[8];
     char *OUT_PATH = argv[9];
 
+    // The sensors share the 512-bit sample rows of the dump with 32 other bits
+    if (N_SENSORS < 1 || N_SENSORS * SENSOR_WIDTH + 32 > 512) {
+        printf("%d sensors of %d bits do not fit in a 512-bit sample\n", N_SENSORS, SENSOR_WIDTH);
+        std::exit(-1);
+    }
+
     // read key from command line
     const char *src = argv[10];
     char cmd_buffer[16];
@@ -52,6 +59,9 @@ int main(int argc, char *argv[]) {
 
     int TEMPERATURE = atoi(argv[12]);
 
+    // online CPA: number of traces between two reports, 0 (default) for none
+    int ONLINE_CPA = (argc == 14) ? atoi(argv[13]) : 0;
+
     char file_path[10000];
 
     FILE *traces_bin;
@@ -155,6 +165,12 @@ int main(int argc, char *argv[]) {
         fprintf(temperature_f, "trace,date,PCB_top_front,PCB_top_rear,PCB_bottom_front,FPGA,Int_VCC\n");
     }
 
+    // The online CPA attacks the traces on a worker thread as they are saved
+    OnlineCPA online;
+    uint8_t trace_encoded[N_SENSORS * N_SAMPLES];
+    if (ONLINE_CPA > 0 && online_cpa_init(&online, N_SENSORS * N_SAMPLES, ONLINE_CPA, key, OUT_PATH) != 0)
+        return 0;
+
     for (int trace = 0; trace < N_TRACES; trace++) {
         // Run AES encryption
         aes_encrypt(kernel, key, plaintext, ciphertext);
@@ -168,7 +184,10 @@ int main(int argc, char *argv[]) {
         printf("CT : 0x");
         for (int i = 0; i < 16; i++) printf("%02x", ciphertext[i]);
         printf("\n");
-        save_trace(buffer, hbuf, N_SAMPLES, SENSOR_WIDTH, traces_bin, traces_raw_bin);
+        save_trace(buffer, hbuf, N_SENSORS, N_SAMPLES, SENSOR_WIDTH, traces_bin, traces_raw_bin,
+                   ONLINE_CPA > 0 ? trace_encoded : NULL);
+        if (ONLINE_CPA > 0)
+            online_cpa_push(&online, trace_encoded, ciphertext);
         if(TEMPERATURE==1 && ((trace % 100000) == 0)) {
             // Save temperature
             save_temperature(temperature_f, trace);
@@ -178,6 +197,9 @@ int main(int argc, char *argv[]) {
         memcpy(plaintext, ciphertext, 16 * sizeof(ciphertext[0]));
     }
 
+    if (ONLINE_CPA > 0)
+        online_cpa_finish(&online);
+
     fclose(traces_bin);
     fclose(traces_raw_bin);
     fclose(ciphertext_f);
@@ -0,0 +1,265 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+ */
+
+#include "online_cpa.hpp"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// Byte of the ciphertext XORed with byte n of the state before the last round
+static const int inv_shift[16] = {0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11};
+
+static const uint8_t inv_sbox[256] = { 0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb, 
+      0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb, 
+      0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e, 
+      0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25, 
+      0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92, 
+      0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84, 
+      0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06, 
+      0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b, 
+      0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73, 
+      0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e, 
+      0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b, 
+      0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4, 
+      0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f, 
+      0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef, 
+      0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61, 
+      0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d };
+
+static uint8_t sbox[256];
+
+// Last round key of an AES-128 key, by running the key schedule forwards
+static void last_round_key(uint8_t *key, uint8_t *round_key) {
+    uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+
+    memcpy(round_key, key, 16);
+    for (int round = 0; round < 10; round++) {
+        round_key[0] ^= sbox[round_key[13]] ^ rcon[round];
+        round_key[1] ^= sbox[round_key[14]];
+        round_key[2] ^= sbox[round_key[15]];
+        round_key[3] ^= sbox[round_key[12]];
+        for (int n = 4; n < 16; n++)
+            round_key[n] ^= round_key[n - 4];
+    }
+}
+
+// Hamming distance between the state bytes before and after the last round,
+// for the key guess k of byte n
+static inline uint64_t hypothesis(uint8_t *ciphertext, int n, int k) {
+    return __builtin_popcount(inv_sbox[ciphertext[n] ^ k] ^ ciphertext[inv_shift[n]]);
+}
+
+static void accumulate(OnlineCPA *cpa, uint8_t *trace, uint8_t *ciphertext) {
+    int n_samples = cpa->n_samples;
+    uint32_t w[n_samples];
+
+    for (int j = 0; j < n_samples; j++) {
+        w[j] = trace[j];
+        cpa->sum_w[j] += w[j];
+        cpa->sum_w2[j] += w[j] * w[j];
+    }
+    for (int n = 0; n < 16; n++) {
+        for (int k = 0; k < 256; k++) {
+            uint64_t h = hypothesis(ciphertext, n, k);
+            cpa->sum_h[n * 256 + k] += h;
+            cpa->sum_h2[n * 256 + k] += h * h;
+            if (h == 0)
+                continue;
+            uint64_t *sum_wh = &cpa->sum_wh[(size_t)(n * 256 + k) * n_samples];
+            for (int j = 0; j < n_samples; j++)
+                sum_wh[j] += h * w[j];
+        }
+    }
+    cpa->n_traces++;
+}
+
+// Largest absolute correlation of the key guess k of byte n over the samples
+static double max_correlation(OnlineCPA *cpa, int n, int k, int *sample) {
+    __int128 n_traces = cpa->n_traces;
+    __int128 sum_h = cpa->sum_h[n * 256 + k];
+    __int128 sum_h2 = cpa->sum_h2[n * 256 + k];
+    uint64_t *sum_wh = &cpa->sum_wh[(size_t)(n * 256 + k) * cpa->n_samples];
+    double variance_h = sqrt((double)(n_traces * sum_h2 - sum_h * sum_h));
+    double max = 0;
+
+    for (int j = 0; j < cpa->n_samples; j++) {
+        __int128 sum_w = cpa->sum_w[j];
+        double variance_w = sqrt((double)(n_traces * (__int128)cpa->sum_w2[j] - sum_w * sum_w));
+        double correlation = fabs((double)(n_traces * (__int128)sum_wh[j] - sum_w * sum_h) / (variance_w * variance_h));
+        if (variance_w > 0 && variance_h > 0 && correlation > max) {
+            max = correlation;
+            *sample = j;
+        }
+    }
+    return max;
+}
+
+// Prints the rank of the key byte among the 256 guesses of every byte (1 when
+// ranked first), the peak correlation of the key and of the best wrong guess,
+// and appends them to online_cpa.csv. dropped is read under the lock of the
+// queue by the caller, as the acquisition loop updates it.
+static void report(OnlineCPA *cpa, uint64_t dropped) {
+    int ranks[16];
+    double key_peaks[16];
+    int key_samples[16];
+    double wrong_peaks[16];
+    int first = 0;
+    double log2_ranks = 0;
+
+    for (int n = 0; n < 16; n++) {
+        int key = cpa->round_key[n];
+        key_samples[n] = 0;
+        key_peaks[n] = max_correlation(cpa, n, key, &key_samples[n]);
+        ranks[n] = 1;
+        wrong_peaks[n] = 0;
+        for (int k = 0; k < 256; k++) {
+            int sample = 0;
+            double peak = (k == key) ? 0 : max_correlation(cpa, n, k, &sample);
+            if (peak > key_peaks[n])
+                ranks[n]++;
+            if (peak > wrong_peaks[n])
+                wrong_peaks[n] = peak;
+        }
+        first += (ranks[n] == 1);
+        log2_ranks += log2((double)ranks[n]);
+    }
+
+    printf("Online CPA: %lu traces (%lu not attacked), %d key bytes ranked first, log2 of the product of the ranks %.1f\n",
+           (unsigned long)cpa->n_traces, (unsigned long)dropped, first, log2_ranks);
+    for (int n = 0; n < 16; n++)
+        printf("  byte %2d: rank %3d, key %.4f at sample %d, best wrong guess %.4f\n",
+               n, ranks[n], key_peaks[n], key_samples[n], wrong_peaks[n]);
+    fflush(stdout);
+
+    fprintf(cpa->report_f, "%lu,%lu,%d,%.2f", (unsigned long)cpa->n_traces, (unsigned long)dropped, first, log2_ranks);
+    for (int n = 0; n < 16; n++)
+        fprintf(cpa->report_f, ",%d,%f,%d,%f", ranks[n], key_peaks[n], key_samples[n], wrong_peaks[n]);
+    fprintf(cpa->report_f, "\n");
+    fflush(cpa->report_f);
+}
+
+static void worker(OnlineCPA *cpa) {
+    uint8_t *traces = (uint8_t *)malloc((size_t)ONLINE_BATCH_SIZE * cpa->n_samples);
+    uint8_t ciphertexts[ONLINE_BATCH_SIZE * 16];
+    if (traces == NULL) {
+        printf("ERROR IN ALLOCATING THE ONLINE CPA\n");
+        return;
+    }
+
+    while (1) {
+        std::unique_lock<std::mutex> guard(cpa->lock);
+        cpa->ready.wait(guard, [cpa] { return cpa->count > 0 || cpa->done; });
+        if (cpa->count == 0)
+            break;
+        int n_traces = (cpa->count < ONLINE_BATCH_SIZE) ? cpa->count : ONLINE_BATCH_SIZE;
+        for (int t = 0; t < n_traces; t++) {
+            int slot = (cpa->head + t) % ONLINE_QUEUE_SIZE;
+            memcpy(&traces[(size_t)t * cpa->n_samples], &cpa->queue_traces[(size_t)slot * cpa->n_samples], cpa->n_samples);
+            memcpy(&ciphertexts[t * 16], &cpa->queue_ciphertexts[slot * 16], 16);
+        }
+        cpa->head = (cpa->head + n_traces) % ONLINE_QUEUE_SIZE;
+        cpa->count -= n_traces;
+        uint64_t dropped = cpa->dropped;
+        guard.unlock();
+
+        for (int t = 0; t < n_traces; t++) {
+            accumulate(cpa, &traces[(size_t)t * cpa->n_samples], &ciphertexts[t * 16]);
+            if (cpa->n_traces % cpa->interval == 0)
+                report(cpa, dropped);
+        }
+    }
+    free(traces);
+}
+
+int online_cpa_init(OnlineCPA *cpa, int n_samples, int interval, uint8_t *key, char *out_path) {
+    char file_path[10000];
+
+    for (int x = 0; x < 256; x++)
+        sbox[inv_sbox[x]] = x;
+
+    cpa->n_samples = n_samples;
+    cpa->interval = interval;
+    last_round_key(key, cpa->round_key);
+    cpa->head = 0;
+    cpa->count = 0;
+    cpa->done = 0;
+    cpa->dropped = 0;
+    cpa->n_traces = 0;
+
+    cpa->queue_traces = (uint8_t *)malloc((size_t)ONLINE_QUEUE_SIZE * n_samples);
+    cpa->queue_ciphertexts = (uint8_t *)malloc(ONLINE_QUEUE_SIZE * 16);
+    cpa->sum_w = (uint64_t *)calloc(n_samples, sizeof(uint64_t));
+    cpa->sum_w2 = (uint64_t *)calloc(n_samples, sizeof(uint64_t));
+    cpa->sum_h = (uint64_t *)calloc(16 * 256, sizeof(uint64_t));
+    cpa->sum_h2 = (uint64_t *)calloc(16 * 256, sizeof(uint64_t));
+    cpa->sum_wh = (uint64_t *)calloc((size_t)16 * 256 * n_samples, sizeof(uint64_t));
+    if (cpa->queue_traces == NULL || cpa->queue_ciphertexts == NULL || cpa->sum_w == NULL || cpa->sum_w2 == NULL
+        || cpa->sum_h == NULL || cpa->sum_h2 == NULL || cpa->sum_wh == NULL) {
+        printf("ERROR IN ALLOCATING THE ONLINE CPA\n");
+        return -1;
+    }
+
+    sprintf(file_path, "%s/online_cpa.csv", out_path);
+    cpa->report_f = fopen(file_path, "w");
+    if (cpa->report_f == NULL) {
+        printf("ERROR IN OPENING ONLINE CPA FILE\n");
+        printf("%s\n", file_path);
+        return -1;
+    }
+    fprintf(cpa->report_f, "traces,not_attacked,bytes_first,log2_ranks");
+    for (int n = 0; n < 16; n++)
+        fprintf(cpa->report_f, ",rank_%d,key_%d,sample_%d,wrong_%d", n, n, n, n);
+    fprintf(cpa->report_f, "\n");
+
+    cpa->worker = std::thread(worker, cpa);
+    return 0;
+}
+
+// Called by the acquisition loop: copies the trace to the queue, or drops it
+// if the worker thread is behind
+void online_cpa_push(OnlineCPA *cpa, uint8_t *trace, uint8_t *ciphertext) {
+    {
+        std::lock_guard<std::mutex> guard(cpa->lock);
+        if (cpa->count == ONLINE_QUEUE_SIZE) {
+            cpa->dropped++;
+            return;
+        }
+        int slot = (cpa->head + cpa->count) % ONLINE_QUEUE_SIZE;
+        memcpy(&cpa->queue_traces[(size_t)slot * cpa->n_samples], trace, cpa->n_samples);
+        memcpy(&cpa->queue_ciphertexts[slot * 16], ciphertext, 16);
+        cpa->count++;
+    }
+    cpa->ready.notify_one();
+}
+
+// Attacks the traces left in the queue, reports the last traces and frees the CPA
+void online_cpa_finish(OnlineCPA *cpa) {
+    uint64_t dropped;
+    {
+        std::lock_guard<std::mutex> guard(cpa->lock);
+        cpa->done = 1;
+    }
+    cpa->ready.notify_one();
+    cpa->worker.join();
+
+    {
+        std::lock_guard<std::mutex> guard(cpa->lock);
+        dropped = cpa->dropped;
+    }
+    if (cpa->n_traces % cpa->interval != 0)
+        report(cpa, dropped);
+    fclose(cpa->report_f);
+    free(cpa->queue_traces);
+    free(cpa->queue_ciphertexts);
+    free(cpa->sum_w);
+    free(cpa->sum_w2);
+    free(cpa->sum_h);
+    free(cpa->sum_h2);
+    free(cpa->sum_wh);
+}
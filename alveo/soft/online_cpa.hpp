@@ -0,0 +1,63 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+ */
+
+#ifndef ONLINE_CPA_H_
+#define ONLINE_CPA_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Traces waiting for the worker thread: the traces saved while the queue is
+// full are not attacked online, so that the acquisition never waits for it
+#define ONLINE_QUEUE_SIZE 4096
+
+// Traces taken from the queue at once by the worker thread
+#define ONLINE_BATCH_SIZE 64
+
+// CPA of the traces as they are acquired, with the Hamming distance of the
+// last round (the model of the attack in key_rank): a worker thread adds the
+// encoded traces and their ciphertexts to the sums of the CPA, and reports
+// the correlation peaks and the ranks of the key every interval traces.
+typedef struct OnlineCPA {
+
+    int n_samples;                  // N_SENSORS * N_SAMPLES samples per trace
+    int interval;                   // traces between two reports
+    uint8_t round_key[16];          // last round key of the AES key
+
+    // Queue of the traces, filled by the acquisition loop
+    uint8_t *queue_traces;
+    uint8_t *queue_ciphertexts;
+    int head;
+    int count;
+    int done;
+    uint64_t dropped;               // traces not queued, under lock
+    std::mutex lock;
+    std::condition_variable ready;
+    std::thread worker;
+
+    // Sums of the CPA, exact on 64-bit integers:
+    // sum_h[byte][guess], sum_wh[byte][guess][sample]
+    uint64_t n_traces;
+    uint64_t *sum_w;
+    uint64_t *sum_w2;
+    uint64_t *sum_h;
+    uint64_t *sum_h2;
+    uint64_t *sum_wh;
+
+    FILE *report_f;
+
+} OnlineCPA;
+
+int online_cpa_init(OnlineCPA *cpa, int n_samples, int interval, uint8_t *key, char *out_path);
+void online_cpa_push(OnlineCPA *cpa, uint8_t *trace, uint8_t *ciphertext);
+void online_cpa_finish(OnlineCPA *cpa);
+
+#endif
@@ -180,23 +180,37 @@ void aes_encrypt(xrt::ip kernel, uint8_t *key, uint8_t *plaintext,
     return;
 }
 
-void save_trace(xrt::bo buffer, uint32_t *hbuf, int N_SAMPLES, int SENSOR_WIDTH,
-                FILE *traces_bin, FILE *traces_raw) {
+// Writes one channel per sensor: sensor s holds the bits s * SENSOR_WIDTH to
+// (s + 1) * SENSOR_WIDTH - 1 of every 512-bit sample row of the dump. A trace
+// of traces_bin holds the N_SAMPLES Hamming weights of sensor 0, then those of
+// sensor 1, ..., and a trace of traces_raw its raw words in the same order,
+// so that the files of a single sensor are unchanged.
+// Saves the encoded and raw samples of the trace, and copies the encoded
+// samples to trace unless it is NULL
+void save_trace(xrt::bo buffer, uint32_t *hbuf, int N_SENSORS, int N_SAMPLES, int SENSOR_WIDTH,
+                FILE *traces_bin, FILE *traces_raw, uint8_t *trace) {
     // Read trace from DRAM
     buffer.sync(XCL_BO_SYNC_BO_FROM_DEVICE);
 
-    unsigned char sensor_trace[N_SAMPLES];
-    uint32_t sensor_trace_raw[N_SAMPLES*((int)SENSOR_WIDTH / 32)];
+    int chunks = (int)SENSOR_WIDTH / 32;
+    unsigned char sensor_trace[N_SENSORS*N_SAMPLES];
+    uint32_t sensor_trace_raw[N_SENSORS*N_SAMPLES*chunks];
 
-    for (int sample = 0; sample < N_SAMPLES; sample++) {
-        sensor_trace[sample] = 0;
-        for (int chunk = 0; chunk < (int)SENSOR_WIDTH / 32; chunk++) {
-            sensor_trace[sample] += hamming_weight(hbuf[sample * 16 + chunk]);
-            sensor_trace_raw[((int)SENSOR_WIDTH / 32)*sample+chunk] = hbuf[sample * 16 + chunk];
+    for (int sensor = 0; sensor < N_SENSORS; sensor++) {
+        for (int sample = 0; sample < N_SAMPLES; sample++) {
+            int channel_sample = sensor * N_SAMPLES + sample;
+            sensor_trace[channel_sample] = 0;
+            for (int chunk = 0; chunk < chunks; chunk++) {
+                uint32_t word = hbuf[sample * 16 + sensor * chunks + chunk];
+                sensor_trace[channel_sample] += hamming_weight(word);
+                sensor_trace_raw[chunks*channel_sample+chunk] = word;
+            }
         }
     }
-    fwrite(sensor_trace, sizeof(sensor_trace[0]), N_SAMPLES, traces_bin);
-    fwrite(sensor_trace_raw, sizeof(sensor_trace_raw[0]), N_SAMPLES*((int)SENSOR_WIDTH / 32), traces_raw);
+    fwrite(sensor_trace, sizeof(sensor_trace[0]), N_SENSORS*N_SAMPLES, traces_bin);
+    fwrite(sensor_trace_raw, sizeof(sensor_trace_raw[0]), N_SENSORS*N_SAMPLES*chunks, traces_raw);
+    if (trace != NULL)
+        memcpy(trace, sensor_trace, N_SENSORS*N_SAMPLES);
 
     return;
 }
@@ -19,7 +19,7 @@ uint32_t * pack_idc_idf(uint32_t * idc_idf, int idc, int idf, int IDC_SIZE, int
 void uint8_to_uint32(uint8_t * input, uint32_t * output);
 void uint32_to_uint8(uint32_t * input, uint8_t * output);
 void aes_encrypt(xrt::ip kernel, uint8_t * key, uint8_t * plaintext, uint8_t * ciphertext);
-void save_trace(xrt::bo buffer, uint32_t *hbuf, int N_SAMPLES, int SENSOR_WIDTH, FILE *traces_bin, FILE *traces_raw);
+void save_trace(xrt::bo buffer, uint32_t *hbuf, int N_SENSORS, int N_SAMPLES, int SENSOR_WIDTH, FILE *traces_bin, FILE *traces_raw, uint8_t *trace);
 void save_ciphertext(uint8_t *ciphertext, FILE *ciphertext_f);
 void save_key(uint8_t *key, FILE *key_f);
 void init_system(xrt::ip kernel, xrt::bo buffer);
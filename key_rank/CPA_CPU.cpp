@@ -0,0 +1,466 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Multithreaded CPU backend of the CPA key rank estimation attack.
+It takes the same arguments and writes the same result files as main-CPA (CPA_GPU.cu).
+*/
+
+#include "utils.cuh"
+#include "cpa_log.cuh"
+#include "cpa_engine.hpp"
+#include "cpa_bootstrap.hpp"
+#include "lra_engine.hpp"
+#include "bitslice_engine.hpp"
+#include "cpa_store.hpp"
+#include "trace_io.cuh"
+#include "poi.cuh"
+#include <stdint.h>
+#include <unistd.h>
+#include <chrono>
+
+int state_due(std::chrono::steady_clock::time_point last_save, double save_seconds, int interval);
+double save_state(char *path, cpa_store_header_t *header, cpa_state_t *states, int n_threads);
+
+int main(int argc, char *argv[]) {
+
+  config_t config;
+
+  // Load program config passed by the command line arguments
+  init_config(&config);
+  if(parse_args(argc, argv, &config) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if(print_config(&config) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+
+  int n_threads = get_n_threads(config.n_threads);
+  int n_models = config.n_models;
+
+  if (config.lra && config.n_rounds > 0) {
+    printf("The bootstrap attacks (-r) are not supported by the LRA (-lra)\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (config.bitslice > 0 && (config.lra || config.n_rounds > 0 || config.poi_samples > 0)) {
+    printf("The bitsliced CPA (-bs) processes all the raw sensor bits, without -lra, -r or -poi\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (config.state_path[0] != '\0' && (config.lra || config.n_rounds > 0 || config.hold > 0)) {
+    printf("The accumulator state file (-st) only holds the sums of the CPA, without -lra, -r or -u\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (config.lra)
+    printf("Running the LRA on %d CPU threads\n", n_threads);
+  else if (config.bitslice > 0)
+    printf("Running the bitsliced CPA on %d CPU threads\n", n_threads);
+  else
+    printf("Running the CPA on %d CPU threads\n", n_threads);
+
+  // Every leakage model attacks its own key and writes its own result files
+  int ROUNDKEY[N_MODELS][KEYBYTES];
+  char output_path[N_MODELS][1000];
+  for (int m = 0; m < n_models; m++) {
+    get_model_key(&config, config.models[m], ROUNDKEY[m]);
+    if (get_model_output_path(&config, config.models[m], output_path[m]) == EXIT_FAILURE)
+      exit(EXIT_FAILURE);
+  }
+
+  // The traces are streamed from the files in batches: the binary files are
+  // mapped, the text files are parsed one batch at a time within the ceiling given by -m
+  trace_reader_t reader;
+  if (trace_reader_open(&reader, config.trace_path, config.ciphertext_path, config.n_samples, config.sensor_width) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (config.n_channels > 1)
+    trace_reader_open_channels(&reader, config.n_channels, config.fuse ? config.channel_weights : NULL);
+  if (config_first_round(&config) && trace_reader_open_plaintexts(&reader, config.plaintext_path) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (config.shift_path[0] != '\0' && trace_reader_open_shifts(&reader, config.shift_path) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+
+  // Bitsliced CPA (-bs): the raw sensor words are transposed to one word of
+  // 64 traces per bit instead of being expanded to one sample per bit, and
+  // the samples of the CPA are the groups of config.bitslice bits
+  bitslice_batch_t sliced;
+  if (config.bitslice > 0) {
+    trace_reader_keep_packed(&reader);
+    bitslice_batch_init(&sliced, config.n_samples);
+  }
+
+  // Point of interest pre-pass (-poi): the CPA only processes the samples of
+  // highest NICV, so that its sums and time shrink in proportion
+  int n_samples = config.n_samples;
+  int *poi = NULL;
+  if (config.poi_samples > 0 && config.poi_samples < config.n_samples) {
+    poi = (int *)malloc(sizeof(int) * config.n_samples);
+    isMemoryFull((unsigned int *)poi);
+    n_samples = select_points_of_interest(&config, poi);
+    if (n_samples <= 0)
+      exit(EXIT_FAILURE);
+    trace_reader_select(&reader, poi, n_samples);
+  }
+
+  if (config.bitslice > 0)
+    n_samples = config.n_samples / config.bitslice;
+
+  // The uint8 traces are accumulated on exact integer sums, so that the
+  // results do not depend on the number of threads
+  int exact = (trace_sample_size(&reader) == sizeof(uint8_t));
+  if (exact)
+    printf("Accumulating the uint8 traces on exact integer sums\n");
+
+  // Trace counts at which the attack is evaluated, in increasing order. The
+  // accumulators are never reset: every checkpoint only adds the traces
+  // recorded since the previous one, so the whole attack is one pass.
+  int n_checkpoints;
+  int *checkpoints = get_checkpoints(&config, &n_checkpoints);
+  unsigned int keyByteIndex[N_MODELS][KEYBYTES];
+
+  // The traces are summed by ciphertext class when there are more traces per
+  // checkpoint than class sums to combine at every checkpoint, and when all
+  // the accumulators in class mode (the workers without the sums of the key
+  // guesses) fit within the memory ceiling with the sums of the bootstrap
+  // attacks and a batch of at least MIN_BATCH_TRACES traces. The batches take
+  // the rest.
+  // The bitsliced batches hold the mapped or shifted words and their transpose.
+  long limit_mb = config.memory_limit_mb > 0 ? config.memory_limit_mb : DEFAULT_MEMORY_LIMIT_MB;
+  size_t trace_size = config.bitslice > 0 ? config.n_samples / 4 + 2 * KEYBYTES
+      : trace_sample_size(&reader) * (config.n_samples + n_samples) + 2 * KEYBYTES;
+  size_t class_size = cpa_states_size(n_samples, 1, config.models, n_models, n_threads);
+  int n_rounds = config.n_rounds > 0 ? config.n_rounds : 0;
+  size_t round_size = 0, round_class_size = 0;
+  for (int m = 0; m < n_models && n_rounds > 0; m++) {
+    round_size += cpa_bootstrap_size(n_rounds, n_threads, n_samples, 0, config.models[m]);
+    round_class_size += cpa_bootstrap_size(n_rounds, n_threads, n_samples, 1, config.models[m]);
+  }
+  int class_rows = cpa_class_rows(cpa_worker_model(config.models, n_models));
+  int classes = !config.lra && config.bitslice == 0 && (config.n_traces >= (long)n_checkpoints * KEYS * class_rows)
+      && class_size + round_size + trace_size * MIN_BATCH_TRACES <= ((size_t)limit_mb << 20);
+  if (classes)
+    printf("Accumulating the traces by ciphertext class\n");
+
+  // The sums of the key guesses of every model and of every worker count in
+  // the memory ceiling as well: the workers are cut to the number whose
+  // states fit with a batch of MIN_BATCH_TRACES traces. The bitsliced CPA
+  // has no workers and checks its sums below.
+  size_t reserved = 0;
+  if (config.bitslice > 0) {
+    reserved = cpa_states_size(n_samples, 0, config.models, n_models, 0);
+  } else if (!config.lra) {
+    size_t limit = (size_t)limit_mb << 20;
+    size_t batch_min = trace_size * MIN_BATCH_TRACES;
+    int fit = batch_min < limit ? cpa_fit_threads(n_samples, classes, config.models, n_models, n_threads, limit - batch_min) : 0;
+    if (fit == 0) {
+      printf("The CPA needs %zu MB of sums and %zu MB for a batch of %d traces, more than the memory ceiling of %ld MB: raise -m or select fewer samples with -poi\n",
+             (cpa_states_size(n_samples, classes, config.models, n_models, 1) >> 20) + 1, (batch_min >> 20) + 1, MIN_BATCH_TRACES, limit_mb);
+      exit(EXIT_FAILURE);
+    }
+    if (fit < n_threads) {
+      printf("Running the CPA on %d CPU threads, whose sums fit in the memory ceiling\n", fit);
+      n_threads = fit;
+    }
+    reserved = cpa_states_size(n_samples, classes, config.models, n_models, n_threads);
+  }
+
+  // Bootstrap attacks (-r): n_rounds more accumulators per model, fed with
+  // subsamples of the same batches, one trace of every config.subsample.
+  // They are summed by ciphertext class only if they see enough traces and
+  // their class sums fit in the memory ceiling as well, and their sums must
+  // leave a batch of MIN_BATCH_TRACES traces in it in any case.
+  int round_classes = 0;
+  if (n_rounds > 0) {
+    round_classes = classes && config.n_traces / config.subsample >= (long)n_checkpoints * KEYS * class_rows
+        && reserved + round_class_size + trace_size * MIN_BATCH_TRACES <= ((size_t)limit_mb << 20);
+    reserved += round_classes ? round_class_size : round_size;
+    if (reserved + trace_size * MIN_BATCH_TRACES > ((size_t)limit_mb << 20)) {
+      printf("The %d bootstrap attacks need %zu MB of sums, more than the memory ceiling of %ld MB leaves: raise -m or lower -r\n", n_rounds, (round_size >> 20) + 1, limit_mb);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  long batch = get_batch_size(&config, trace_size, reserved);
+  printf("Streaming the traces in batches of %ld traces\n", batch);
+  trace_batch_t traces;
+
+  // One accumulator per model, and one per worker thread, merged into the
+  // accumulator of the model after every pass
+  cpa_state_t *states = NULL;
+  cpa_state_t *workers = NULL;
+  lra_state_t *lra_states = NULL;
+  lra_state_t *lra_workers = NULL;
+  if (config.bitslice > 0) {
+    // The bitsliced CPA accumulates the sums of every model directly, the
+    // bits being split over the threads
+    size_t bitslice_size = sizeof(uint64_t) * KEYBYTES * KEYS * n_samples * n_models;
+    if (bitslice_size > ((size_t)limit_mb << 20)) {
+      printf("The bitsliced CPA needs %zu MB of sums, more than the memory ceiling of %ld MB: raise -m or group the bits with -bs\n", (bitslice_size >> 20) + 1, limit_mb);
+      exit(EXIT_FAILURE);
+    }
+    states = (cpa_state_t *)malloc(sizeof(cpa_state_t) * n_models);
+    isMemoryFull((unsigned int *)states);
+    for (int m = 0; m < n_models; m++) {
+      if (cpa_state_init(&states[m], n_samples, 1, 0, config.models[m], 0) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+  } else if (!config.lra) {
+    states = (cpa_state_t *)malloc(sizeof(cpa_state_t) * n_models);
+    workers = (cpa_state_t *)malloc(sizeof(cpa_state_t) * n_threads);
+    isMemoryFull((unsigned int *)states);
+    isMemoryFull((unsigned int *)workers);
+    for (int m = 0; m < n_models; m++) {
+      if (cpa_state_init(&states[m], n_samples, exact, classes, config.models[m], 0) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < n_threads; t++) {
+      if (cpa_state_init(&workers[t], n_samples, exact, classes, cpa_worker_model(config.models, n_models), 1) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+  } else {
+    // The LRA always sums the traces by text byte class: the workers have
+    // the rows of the last round model if any model needs them
+    int worker_model = config.models[0];
+    for (int m = 0; m < n_models; m++) {
+      if (!model_first_round(config.models[m]))
+        worker_model = config.models[m];
+    }
+    size_t lra_size = lra_state_size(n_samples, worker_model) * n_threads;
+    for (int m = 0; m < n_models; m++)
+      lra_size += lra_state_size(n_samples, config.models[m]);
+    if (lra_size > ((size_t)limit_mb << 20)) {
+      printf("The LRA needs %zu MB of class sums, more than the memory ceiling of %ld MB: raise -m or select fewer samples with -poi\n", (lra_size >> 20) + 1, limit_mb);
+      exit(EXIT_FAILURE);
+    }
+    lra_states = (lra_state_t *)malloc(sizeof(lra_state_t) * n_models);
+    lra_workers = (lra_state_t *)malloc(sizeof(lra_state_t) * n_threads);
+    isMemoryFull((unsigned int *)lra_states);
+    isMemoryFull((unsigned int *)lra_workers);
+    for (int m = 0; m < n_models; m++) {
+      if (lra_state_init(&lra_states[m], n_samples, config.models[m]) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < n_threads; t++) {
+      if (lra_state_init(&lra_workers[t], n_samples, worker_model) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  cpa_bootstrap_t *bootstraps = NULL;
+  if (n_rounds > 0) {
+    printf("Running %d bootstrap attacks on one trace of %d per checkpoint\n", n_rounds, config.subsample);
+    bootstraps = (cpa_bootstrap_t *)malloc(sizeof(cpa_bootstrap_t) * n_models);
+    isMemoryFull((unsigned int *)bootstraps);
+    for (int m = 0; m < n_models; m++) {
+      if (cpa_bootstrap_init(&bootstraps[m], n_rounds, config.subsample, config.seed, n_samples, exact, round_classes, config.models[m]) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  // Attack until broken (-u): the attack stops once the key of every model
+  // has been ranked first for config.hold consecutive checkpoints
+  int held[N_MODELS];
+  int disclosure[N_MODELS];
+  for (int m = 0; m < n_models; m++) {
+    held[m] = 0;
+    disclosure[m] = -1;
+  }
+
+  // Checkpoint and resume (-st): the accumulators are saved to the state
+  // file as the attack runs, with the number of traces they hold, and a
+  // restarted attack continues from them after skipping those traces
+  uint64_t accumulated = 0;
+  cpa_store_header_t header;
+  std::chrono::steady_clock::time_point last_save = std::chrono::steady_clock::now();
+  double save_seconds = 0;
+  if (config.state_path[0] != '\0') {
+    cpa_store_header_init(&header, &config, n_samples, states[0].exact, states[0].classes);
+    if (access(config.state_path, F_OK) == 0) {
+      cpa_store_header_t saved;
+      cpa_state_t *saved_states;
+      if (cpa_store_read(config.state_path, &saved, &saved_states, 1) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+      if (!cpa_store_same_run(&header, &saved)) {
+        printf("%s was saved by an attack of other trace, ciphertext or plaintext files, samples, leakage models, class sums or -ft, -nt or -ss: resume it with the same files and options\n", config.state_path);
+        exit(EXIT_FAILURE);
+      }
+      for (int m = 0; m < n_models; m++)
+        cpa_state_free(&states[m]);
+      free(states);
+      states = saved_states;
+      accumulated = saved.n_traces;
+      if (trace_reader_skip(&reader, (long)accumulated) != (long)accumulated)
+        exit(EXIT_FAILURE);
+      printf("Resuming the attack after the %llu traces of %s\n", (unsigned long long)accumulated, config.state_path);
+      for (int m = 0; m < n_models; m++)
+        log_truncate_checkpoints((long)accumulated, checkpoints, n_checkpoints, output_path[m]);
+    }
+  }
+
+  // Scores of the key guesses at a checkpoint, [key guess][key byte]
+  double *scores = (double *)malloc(sizeof(double) * KEYS * KEYBYTES);
+  isMemoryFull((unsigned int *)scores);
+
+  int i = 0;
+  for (int c = 0; c < n_checkpoints; c++) {
+    i = checkpoints[c];
+    // Checkpoints evaluated before the state file was saved
+    if ((uint64_t)i <= accumulated)
+      continue;
+    char str_i[10];
+    sprintf(str_i, "%d", i);
+
+    fprintf(stderr, "%s %llu %d\n", "Calculating", (unsigned long long)accumulated, i);
+    while (accumulated < (uint64_t)i) {
+      long n = (long)(i - accumulated) < batch ? (long)(i - accumulated) : batch;
+      if (trace_reader_next(&reader, &traces, n) != n)
+        exit(EXIT_FAILURE);
+      accumulated += n;
+      if (config.bitslice > 0 && bitslice_transpose(&sliced, n_threads, traces.traces_u8, n) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+      // All the models go through the same batch
+      for (int m = 0; m < n_models; m++) {
+        const uint8_t *texts = model_first_round(config.models[m]) ? traces.plaintexts : traces.ciphertexts;
+        if (config.bitslice > 0)
+          bitslice_accumulate(&states[m], config.bitslice, n_threads, &sliced, texts);
+        else if (config.lra && traces.traces_u8 != NULL)
+          lra_accumulate_parallel(&lra_states[m], lra_workers, n_threads, traces.traces_u8, texts, n);
+        else if (config.lra)
+          lra_accumulate_parallel(&lra_states[m], lra_workers, n_threads, traces.traces, texts, n);
+        else if (traces.traces_u8 != NULL)
+          cpa_accumulate_parallel(&states[m], workers, n_threads, traces.traces_u8, texts, n);
+        else
+          cpa_accumulate_parallel(&states[m], workers, n_threads, traces.traces, texts, n);
+        if (n_rounds > 0 && traces.traces_u8 != NULL)
+          cpa_bootstrap_accumulate(&bootstraps[m], n_threads, traces.traces_u8, texts, n);
+        else if (n_rounds > 0)
+          cpa_bootstrap_accumulate(&bootstraps[m], n_threads, traces.traces, texts, n);
+      }
+      if (config.state_path[0] != '\0' && accumulated < (uint64_t)i && state_due(last_save, save_seconds, config.state_interval)) {
+        save_seconds = save_state(config.state_path, &header, states, n_threads);
+        last_save = std::chrono::steady_clock::now();
+      }
+    }
+    // The line of the checkpoint is only started once its traces are accumulated
+    for (int m = 0; m < n_models; m++) {
+      for (int n = 0; n < KEYBYTES; n++) {
+        keyByteIndex[m][n] = 0;
+      }
+      log_misc_string(str_i, output_path[m]);
+      log_misc_string(",", output_path[m]);
+    }
+    for (int m = 0; m < n_models; m++) {
+      // The LRA scores the key guesses by the coefficients of determination
+      // of the regressions, logged as the correlations of the CPA
+      if (config.lra)
+        lra_max_r2(&lra_states[m], scores, n_threads);
+      else
+        cpa_max_correlation(&states[m], scores, n_threads);
+      log_checkpoint(scores, (unsigned int)i, ROUNDKEY[m], output_path[m], keyByteIndex[m]);
+
+      log_keybyte_summary(i, keyByteIndex[m], output_path[m]);
+      log_misc_string("\n", output_path[m]);
+
+      if (n_rounds > 0) {
+        cpa_bootstrap_ranks(&bootstraps[m], n_threads, ROUNDKEY[m]);
+        log_bootstrap_summary(i / config.subsample, bootstraps[m].ranks, n_rounds, output_path[m]);
+      }
+    }
+
+    // The state is always saved after the last checkpoint, e.g. to merge it with cpa merge
+    if (config.state_path[0] != '\0' && (c == n_checkpoints - 1 || state_due(last_save, save_seconds, config.state_interval))) {
+      save_seconds = save_state(config.state_path, &header, states, n_threads);
+      last_save = std::chrono::steady_clock::now();
+    }
+
+    if (config.hold > 0) {
+      int broken = 1;
+      for (int m = 0; m < n_models; m++) {
+        if (update_disclosure(i, keyByteIndex[m], &held[m], &disclosure[m]) < config.hold)
+          broken = 0;
+      }
+      if (broken) {
+        printf("Key ranked first for %d checkpoints, stopping after %d traces\n", config.hold, i);
+        break;
+      }
+    }
+  }
+  for (int m = 0; m < n_models && config.hold > 0; m++)
+    log_disclosure(disclosure[m], i, output_path[m]);
+
+  // Correlation of the key with every group of raw sensor bits at the last checkpoint
+  if (config.bitslice > 0) {
+    double *correlations = (double *)malloc(sizeof(double) * n_samples * KEYBYTES);
+    isMemoryFull((unsigned int *)correlations);
+    for (int m = 0; m < n_models && correlations != NULL; m++) {
+      cpa_key_correlations(&states[m], ROUNDKEY[m], correlations);
+      log_tap_correlations(correlations, n_samples, config.bitslice, output_path[m]);
+    }
+    free(correlations);
+    bitslice_batch_free(&sliced);
+  }
+
+  // Largest correlation of the key with the samples of every channel
+  if (config.n_channels > 1 && !config.fuse && !config.lra) {
+    int length = config.n_samples / config.n_channels;
+    int group = config.bitslice > 0 ? config.bitslice : 1;
+    int *channels = (int *)malloc(sizeof(int) * n_samples);
+    double *correlations = (double *)malloc(sizeof(double) * n_samples * KEYBYTES);
+    isMemoryFull((unsigned int *)channels);
+    isMemoryFull((unsigned int *)correlations);
+    for (int j = 0; j < n_samples && channels != NULL; j++)
+      channels[j] = (poi != NULL ? poi[j] : j * group) / length;
+    for (int m = 0; m < n_models && channels != NULL && correlations != NULL; m++) {
+      cpa_key_correlations(&states[m], ROUNDKEY[m], correlations);
+      log_channel_correlations(correlations, channels, n_samples, config.n_channels, output_path[m]);
+    }
+    free(channels);
+    free(correlations);
+  }
+
+  free(scores);
+  free(checkpoints);
+  trace_reader_close(&reader);
+  free(poi);
+  for (int t = 0; t < n_threads && workers != NULL; t++)
+    cpa_state_free(&workers[t]);
+  free(workers);
+  for (int m = 0; m < n_models && states != NULL; m++)
+    cpa_state_free(&states[m]);
+  free(states);
+  for (int t = 0; t < n_threads && lra_workers != NULL; t++)
+    lra_state_free(&lra_workers[t]);
+  free(lra_workers);
+  for (int m = 0; m < n_models && lra_states != NULL; m++)
+    lra_state_free(&lra_states[m]);
+  free(lra_states);
+  for (int m = 0; m < n_models && bootstraps != NULL; m++)
+    cpa_bootstrap_free(&bootstraps[m]);
+  free(bootstraps);
+  return 0;
+}
+
+// The state file is saved every state_interval seconds at most, and 20 times
+// the duration of the last save apart at least, so that the saves take at
+// most 5% of the time of the attack
+int state_due(std::chrono::steady_clock::time_point last_save, double save_seconds, int interval) {
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_save).count();
+  return elapsed >= interval && elapsed >= 20 * save_seconds;
+}
+
+// Saves the accumulators, flattened in class mode, to the state file and
+// returns the duration of the save in seconds. A failed save is reported and
+// the attack goes on: the previous state file is left as it was.
+double save_state(char *path, cpa_store_header_t *header, cpa_state_t *states, int n_threads) {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  for (int m = 0; m < header->n_models; m++)
+    cpa_state_flatten(&states[m], n_threads);
+  header->n_traces = states[0].n_traces;
+  if (cpa_store_write(path, header, states) == EXIT_SUCCESS)
+    printf("Accumulators of %llu traces saved to %s\n", (unsigned long long)header->n_traces, path);
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
@@ -16,6 +16,9 @@ Please give due credit to the original authors by also citing their work:
 
 #include "data.cuh"
 #include "utils.cuh"
+#include "cpa_log.cuh"
+#include "trace_io.cuh"
+#include "poi.cuh"
 #include <cuda.h>
 #include <stdio.h>
 #include <string>
@@ -29,48 +32,49 @@ Please give due credit to the original authors by also citing their work:
 // Single run or multi run (comment the definition to switch to single run)
 #define MULTIRUN
 
-// length of the key
-#define KEYBYTES 16
-
-// there are 2^8 = 256 possibilities for each byte
-#define KEYS 256
-
 #ifdef MULTIRUN
-#define ROUNDS_PER_STEP 1 // Number of CPA executions with a given number of power traces - For random selection of traces
 #define MULTIRUN_SUMMARY
 #endif // MULTIRUN
 
 __device__ byte hamming_weight(byte M, byte R);
-__device__ byte hamming(unsigned int *cipherText, unsigned int sample, unsigned int n, unsigned int key);
+__device__ byte hamming(byte *cipherText, unsigned int sample, unsigned int n, unsigned int key);
+__global__ void hd_table_kernel();
 __global__ void max_correlation_kernel(double *correlation, double *waveStat, double *waveStat2, double *hammingStat, unsigned int samplesToProcess, int WAVELENGTH);
-__global__ void wave_stat_kernel(double *waveData, double *waveStat, double *waveStat2, byte *hammingArray, byte *hammingArray2, unsigned int samplesToProcess, int WAVELENGTH);
-__global__ void hamming_kernel(unsigned int *cipherText, byte *hammingArray,byte *hammingArray2, double *hammingStat, unsigned int samplesToProcess);
-
-#ifdef MULTIRUN_SUMMARY
-void cpa_single(int argc, char *trace_path, unsigned int *cipherTextRead, unsigned int samplesToProcess, int total, int ROUNDKEY[KEYBYTES], int WAVELENGTH, int CHUNK, char output_path[1000], unsigned int *keyByteIndex);
-#endif // MULTIRUN_SUMMARY
-#ifndef MULTIRUN_SUMMARY
-void cpa_single(int argc, char *trace_path, unsigned int *cipherTextRead, unsigned int samplesToProcess, int total, int ROUNDKEY[KEYBYTES], int WAVELENGTH, int CHUNK, char output_path[1000]);
-#endif // !MULTIRUN_SUMMARY
-void randomize_selection(unsigned int *selection, unsigned int samplesToProcess);
-void log_correlations_each_iteration(int iteration, double *correlation, unsigned int samplesToProcess, char output_path[1000]);
-void log_maxCorrelation(double *maxCorrelation, unsigned int samplesToProcess, unsigned int file_index, char output_path[1000]);
-void log_correlation_known_key_csv(double *maxCorrelation, int ROUNDKEY[KEYBYTES], char output_path[1000]);
-void sort_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], double *maxCorrelation);
-void log_highest_correlation_csv(double finalCorrelations[KEYS][KEYBYTES], char output_path[1000]);
-void log_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k, char output_path[1000]);
-void print_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k);
-void isMemoryFull(unsigned int *ptr);
-//functions for multiple CPA attacks
-void log_correct_keybyte_count_csv(int positions[KEYS][KEYBYTES], int ROUNDKEY[KEYBYTES], char output_path[1000]);
-void log_misc_string(char *str, char output_path[1000]);
-void multirun_update_summary(int positions[KEYS][KEYBYTES], unsigned int keyByteIndex[KEYBYTES], int ROUNDKEY[KEYBYTES]);
-void log_keybyte_summary(int i, unsigned int keyByteIndex[KEYBYTES], char output_path[1000]);
+// Type of the per-batch sums of wave_stat_kernel: the uint8 traces are summed
+// on exact integers, that the double statistics then hold exactly (below 2^53)
+template <typename sample_t> struct sample_sum { typedef double type; };
+template <> struct sample_sum<byte> { typedef unsigned long long type; };
+
+// Leakage models of the hypotheses (MODEL_ in utils.cuh), as in cpa_engine.cpp.
+// hyp() is the hypothesis of key byte n and key guess key for the 16-byte text
+// of a trace: the ciphertext for the last round model, the plaintext for the
+// first round ones. The kernels are instantiated for every model, so that it is inlined.
+struct model_last_round_hd {
+	__device__ static byte hyp(byte *text, unsigned int sample, unsigned int n, unsigned int key) { return hamming(text, sample, n, key); }
+};
+struct model_sbox_hw {
+	__device__ static byte hyp(byte *text, unsigned int sample, unsigned int n, unsigned int key) { return hamming_weight(sbox[text[1L * sample * KEYBYTES + n] ^ key], 0); }
+};
+struct model_identity {
+	__device__ static byte hyp(byte *text, unsigned int sample, unsigned int n, unsigned int key) { return sbox[text[1L * sample * KEYBYTES + n] ^ key]; }
+};
+template <int bit>
+struct model_sbox_bit {
+	__device__ static byte hyp(byte *text, unsigned int sample, unsigned int n, unsigned int key) { return (sbox[text[1L * sample * KEYBYTES + n] ^ key] >> bit) & 1; }
+};
+
+// Adds the sums of the given traces to waveStat and waveStat2
+template <typename sample_t, typename model_t>
+__global__ void wave_stat_kernel(sample_t *waveData, byte *text, double *waveStat, double *waveStat2, unsigned int samplesToProcess, int WAVELENGTH);
+template <typename model_t>
+__global__ void hamming_kernel(byte *text, double *hammingStat, unsigned int samplesToProcess);
+
+void cpa_accumulate(trace_batch_t *batch, int WAVELENGTH, int n_models, int *models, void *dev_waveData, byte *dev_cipherText, byte *dev_plainText, double **dev_waveStat, double **dev_waveStat2, double **dev_hammingStat);
+void cpa_checkpoint(unsigned int samplesToProcess, int WAVELENGTH, double *dev_waveStat, double *dev_waveStat2, double *dev_hammingStat, int ROUNDKEY[KEYBYTES], char output_path[1000], unsigned int *keyByteIndex);
 
 int main(int argc, char *argv[]) {
 	cudaSetDevice(GPUIDXINT);
 
-	FILE *file;
         config_t config;
 
         // Load program config passed by the command line arguments
@@ -79,305 +83,285 @@ int main(int argc, char *argv[]) {
 	  exit(EXIT_FAILURE);
         if(print_config(&config) == EXIT_FAILURE)
 	  exit(EXIT_FAILURE);
+        if(config.n_rounds > 0) {
+	  printf("The bootstrap attacks (-r) are only run by the CPU backend (main-CPA-cpu)\n");
+	  exit(EXIT_FAILURE);
+        }
+        if(config.lra) {
+	  printf("The linear regression analysis (-lra) is only run by the CPU backend (main-CPA-cpu)\n");
+	  exit(EXIT_FAILURE);
+        }
+        if(config.bitslice > 0) {
+	  printf("The bitsliced CPA (-bs) is only run by the CPU backend (main-CPA-cpu)\n");
+	  exit(EXIT_FAILURE);
+        }
+        if(config.state_path[0] != '\0') {
+	  printf("The accumulator state file (-st) is only written by the CPU backend (main-CPA-cpu)\n");
+	  exit(EXIT_FAILURE);
+        }
 
         int SAMPLES_WAVE = config.n_traces; 
         int TOTAL = config.n_samples; 
-        int STEPSIZE = config.step_size;
-        int ROUNDKEY[16];
-        memcpy(ROUNDKEY, config.key, sizeof(config.key));
         int WAVELENGTH = TOTAL;
-        int UPPERBOUND = SAMPLES_WAVE;
-        int LOWERBOUND = STEPSIZE;
-        int CHUNK = TOTAL;
-        char output_path[1000];
-        memcpy(output_path, config.dump_path, sizeof(config.dump_path));
-
-	unsigned int *cipherTextRead = (unsigned int *)malloc(sizeof(unsigned int) * SAMPLES_WAVE * KEYBYTES);
-
-	isMemoryFull(cipherTextRead);
-
-	//get ciphertexts
-        printf("Ciph file: %s\n", config.ciphertext_path);
-	file = fopen(config.ciphertext_path, "r");
-	//isFileOK(file);
-	for (int i = 0; i < SAMPLES_WAVE; i++) {
-		for (int j = 0; j < KEYBYTES; j++) {
-			fscanf(file, "%X", &cipherTextRead[(i / 1)*KEYBYTES + j]);
-		}
+        int n_models = config.n_models;
+
+	// Every leakage model attacks its own key and writes its own result files
+        int ROUNDKEY[N_MODELS][KEYBYTES];
+        char output_path[N_MODELS][1000];
+        for (int m = 0; m < n_models; m++) {
+                get_model_key(&config, config.models[m], ROUNDKEY[m]);
+                if (get_model_output_path(&config, config.models[m], output_path[m]) == EXIT_FAILURE)
+                        exit(EXIT_FAILURE);
+        }
+
+	// The traces and ciphertexts are streamed from the files in batches that fit
+	// in the memory ceiling given by -m on the GPU. The binary files are mapped
+	// and copied to the GPU straight from the mapping, in their own sample type.
+	// The ciphertexts (and plaintexts of the first round models) are kept as
+	// bytes: the hypotheses are computed from them on the fly.
+	trace_reader_t reader;
+	if (trace_reader_open(&reader, config.trace_path, config.ciphertext_path, WAVELENGTH, config.sensor_width) == EXIT_FAILURE)
+		exit(EXIT_FAILURE);
+	if (config.n_channels > 1)
+		trace_reader_open_channels(&reader, config.n_channels, config.fuse ? config.channel_weights : NULL);
+	if (config_first_round(&config) && trace_reader_open_plaintexts(&reader, config.plaintext_path) == EXIT_FAILURE)
+		exit(EXIT_FAILURE);
+	if (config.shift_path[0] != '\0' && trace_reader_open_shifts(&reader, config.shift_path) == EXIT_FAILURE)
+		exit(EXIT_FAILURE);
+	size_t sampleSize = trace_sample_size(&reader);
+
+	// Point of interest pre-pass (-poi): only the samples of highest NICV are
+	// copied to the GPU, so that its sums and time shrink in proportion
+	int *poi = NULL;
+	if (config.poi_samples > 0 && config.poi_samples < TOTAL) {
+		poi = (int *)malloc(sizeof(int) * TOTAL);
+		isMemoryFull((unsigned int *)poi);
+		WAVELENGTH = select_points_of_interest(&config, poi);
+		if (WAVELENGTH <= 0)
+			exit(EXIT_FAILURE);
+		trace_reader_select(&reader, poi, WAVELENGTH);
 	}
-	printf("ciphertext: %X %X \n", cipherTextRead[SAMPLES_WAVE*KEYBYTES-1], cipherTextRead[1]);
-	fclose(file);
-	
-#ifdef MULTIRUN
 
-#ifdef MULTIRUN_SUMMARY
-	unsigned int *keyByteIndex = (unsigned int *)malloc(sizeof(unsigned int) *  KEYBYTES);
-#endif // MULTIRUN_SUMMARY
-	
-	int i = UPPERBOUND;
-	while (i >= LOWERBOUND) {
-#ifdef MULTIRUN_SUMMARY
-		for (int n = 0; n < KEYBYTES; n++) {
-			keyByteIndex[n] = 0;
-		}
-#endif // MULTIRUN_SUMMARY
-		char str_i[10];
-		sprintf(str_i, "%d", i);
-		log_misc_string(str_i, output_path);
-		for (int j = 0; j < ROUNDS_PER_STEP; j++) {
-			log_misc_string(",", output_path);
-#ifdef MULTIRUN_SUMMARY
-			cpa_single(argc, config.trace_path, cipherTextRead, i, TOTAL, ROUNDKEY, WAVELENGTH, CHUNK, output_path, keyByteIndex);
-#endif // MULTIRUN_SUMMARY
-#ifndef MULTIRUN_SUMMARY
-			cpa_single(argc, config.trace_path, cipherTextRead, i, TOTAL, ROUNDKEY, WAVELENGTH, CHUNK, output_path);
-#endif // !MULTIRUN_SUMMARY
-		}	
-#ifdef MULTIRUN_SUMMARY
-		log_keybyte_summary(i, keyByteIndex, output_path);
+	long batch = get_batch_size(&config, sampleSize * (TOTAL + WAVELENGTH) + 2 * KEYBYTES, 0);
+	printf("Streaming the traces in batches of %ld traces\n", batch);
+	trace_batch_t traces;
 
-#endif //MULTIRUN_SUMMARY
-		log_misc_string("\n", output_path);
-		i = i - STEPSIZE;
+	void *dev_waveData;
+	byte *dev_cipherText;
+	byte *dev_plainText = NULL;
+	if(cudaMalloc((void**)&dev_waveData, 1L * batch * WAVELENGTH * sampleSize) != cudaSuccess){
+		printf("cuda malloc failed wave data \n");
+	}
+	if(cudaMalloc((void**)&dev_cipherText, 1L * batch * KEYBYTES * sizeof(byte)) != cudaSuccess){
+		printf("cuda malloc failed ciphertext\n");
+	}
+	if(config_first_round(&config) && cudaMalloc((void**)&dev_plainText, 1L * batch * KEYBYTES * sizeof(byte)) != cudaSuccess){
+		printf("cuda malloc failed plaintext\n");
 	}
-#endif // MULTIRUN
 
+	// Trace counts at which the attack is evaluated, in increasing order
+#ifdef MULTIRUN
+	int n_checkpoints;
+	int *checkpoints = get_checkpoints(&config, &n_checkpoints);
+#endif // MULTIRUN
 #ifndef MULTIRUN
-	cpa_single(argc, config.trace_path, cipherTextRead, SAMPLES_WAVE, TOTAL, ROUNDKEY, WAVELENGTH, CHUNK, output_path);
+	int n_checkpoints = 1;
+	int *checkpoints = (int *)malloc(sizeof(int));
+	checkpoints[0] = SAMPLES_WAVE;
 #endif // !MULTIRUN
 
-#ifdef MULTIRUN_SUMMARY
-	free(keyByteIndex);
-#endif //MULTIRUN_SUMMARY
-	free(cipherTextRead);
-	return 0;
-}
-
+	// Fill the Hamming distance table used by the kernels to compute the hypotheses
+	hd_table_kernel << <KEYS, KEYS >> > ();
+	cudaGetLastError();
 
-#ifdef MULTIRUN_SUMMARY
-void cpa_single(int argc, char *trace_path, unsigned int *cipherTextRead, unsigned int samplesToProcess, int total, int ROUNDKEY[KEYBYTES], int WAVELENGTH, int CHUNK, char output_path[1000], unsigned int *keyByteIndex) {
-#endif // MULTIRUN_SUMMARY
-#ifndef MULTIRUN_SUMMARY
-void cpa_single(int argc, char *trace_path, unsigned int *cipherTextRead, unsigned int samplesToProcess, int total, int ROUNDKEY[KEYBYTES], int WAVELENGTH, int CHUNK, char output_path[1000]) {
-#endif // !MULTIRUN_SUMMARY
-	FILE *file;
-	float dat;
-	unsigned int i, j, k, temp;
-
-	double *maxCorrelation = (double *)malloc(sizeof(double) * KEYS* KEYBYTES);
-	isMemoryFull( (unsigned int*) maxCorrelation);
-	for (i = 0; i < KEYS; i++) {
-		for (j = 0; j < KEYBYTES; j++) {
-			maxCorrelation[i*KEYBYTES + j] = 0;
+	// The sums over the traces of every model stay on the GPU during the whole
+	// attack: every checkpoint only adds the traces recorded since the previous one
+	double *dev_waveStat[N_MODELS], *dev_waveStat2[N_MODELS], *dev_hammingStat[N_MODELS];
+	for (int m = 0; m < n_models; m++) {
+		if(cudaMalloc((void**)&dev_waveStat[m], 2 * WAVELENGTH * sizeof(double)) != cudaSuccess){
+			printf("cuda malloc failed wave stat\n");
+		}
+		if(cudaMalloc((void**)&dev_waveStat2[m], 1L * KEYS * KEYBYTES * WAVELENGTH * sizeof(double)) != cudaSuccess){
+			printf("cuda malloc failed wavestat2\n");
 		}
+		if(cudaMalloc((void**)&dev_hammingStat[m], 2 * KEYS * KEYBYTES * sizeof(double)) != cudaSuccess){
+			printf("cuda malloc failed hammingstat");
+		}
+		cudaMemset(dev_waveStat[m], 0, 2 * WAVELENGTH * sizeof(double));
+		cudaMemset(dev_waveStat2[m], 0, 1L * KEYS * KEYBYTES * WAVELENGTH * sizeof(double));
+		cudaMemset(dev_hammingStat[m], 0, 2 * KEYS * KEYBYTES * sizeof(double));
 	}
 
-	double *waveDataRead = (double *)malloc(sizeof(double) * samplesToProcess * CHUNK);
-	
-	isMemoryFull((unsigned int*)  waveDataRead);
+	unsigned int *keyByteIndex = (unsigned int *)malloc(sizeof(unsigned int) * N_MODELS * KEYBYTES);
 
-	//space for correlation
-	double *correlation = (double *)malloc(sizeof(double) * KEYS * KEYBYTES);
-	isMemoryFull((unsigned int*)correlation);
-
-	unsigned int *selection = (unsigned int *)malloc(sizeof(unsigned int) * samplesToProcess);
-
-	isMemoryFull((unsigned int*)selection);
-
-	for (i = 0; i < samplesToProcess; i++) {
-		selection[i] = i;
+	// Attack until broken (-u): the attack stops once the key of every model
+	// has been ranked first for config.hold consecutive checkpoints
+	int held[N_MODELS];
+	int disclosure[N_MODELS];
+	for (int m = 0; m < n_models; m++) {
+		held[m] = 0;
+		disclosure[m] = -1;
 	}
-	//randomize_selection(selection, samplesToProcess);
-
-	int numOfChunks = total / CHUNK;
-	int l = 0;
-	for (l = 0; l < numOfChunks; l++) {
-		file = fopen(trace_path, "r");
-		//isFileOK(file);
-		int fileLength = strlen(trace_path);
-		char extention[5];
-		strncpy(extention, trace_path + fileLength - 4, 4);
-		extention[4] = 0;
-		if (strcmp(extention, "data") == 0) {
-			fprintf(stderr, "%s\n", ".data file detected");
-
-			for (i = 0; i < 1 * samplesToProcess; i++) {
-				fseek(file, sizeof(dat) * CHUNK * l, SEEK_CUR);
-
-				temp = 0;
-				for (j = 0; j < CHUNK; j++) {
-					fread((void*)(&dat), sizeof(dat), 1, file);
-					waveDataRead[(i / 1) * CHUNK + j] = (double)(dat);
-				if(i==samplesToProcess-1 && j==CHUNK-1){
-						printf("wave data %d %f \n",i*CHUNK,  waveDataRead[i*CHUNK + j] );
-					}
-				}
-				
-				fseek(file, sizeof(dat) * (total - (CHUNK  * (l + 1))), SEEK_CUR);
-			}
-		}
-		else {
-			long int dat;
-			fprintf(stderr, "%s\n", ".txt file detected");
-			for (i = 0; i < samplesToProcess; i++) {
-				for (j = 0; j < WAVELENGTH; j++) {
-					fscanf(file, "%d", &dat);
-					waveDataRead[i*CHUNK + j] = (double)dat;
-					if(i==samplesToProcess-1 && j==WAVELENGTH-1){
-						printf("wave data %f \n", waveDataRead[i*CHUNK + j] );
-					}
-				}
-			}
-			
-		}
 
-		fclose(file);
-
-		unsigned int innerRounds = CHUNK / WAVELENGTH;
-		if (CHUNK % WAVELENGTH != 0)
-			innerRounds++;
-		// main loop
-		for (k = 0; k < innerRounds; k++) {
-			//get wave data
-			double *waveData = (double *)malloc(sizeof(double) * samplesToProcess *  WAVELENGTH);
-			isMemoryFull((unsigned int*)waveData);
-			unsigned int *cipherText = (unsigned int *)malloc(sizeof(unsigned int) * samplesToProcess * KEYBYTES);
-			isMemoryFull(cipherText);
-
-			fprintf(stderr, "%s %d %d %d \n", "Calculating", l, k, innerRounds);
-
-			for (i = 0; i < samplesToProcess; i++) {
-				if(memcpy(&waveData[i * WAVELENGTH], &waveDataRead[selection[i] * CHUNK + k * WAVELENGTH], sizeof(double) * WAVELENGTH) == NULL){
-					printf("mem cpy failed\n");
-				}
-				if(memcpy(&cipherText[i * KEYBYTES], &cipherTextRead[selection[i] * KEYBYTES], sizeof(unsigned int) * KEYBYTES) == NULL){
-					printf("mem cpy failed\n");
-				}
+	int processed = 0;
+	int i = 0;
+	for (int c = 0; c < n_checkpoints; c++) {
+		i = checkpoints[c];
+		char str_i[10];
+		sprintf(str_i, "%d", i);
+		for (int m = 0; m < n_models; m++) {
+			for (int n = 0; n < KEYBYTES; n++) {
+				keyByteIndex[m * KEYBYTES + n] = 0;
 			}
-	        free(waveDataRead);
-	        free(selection);
+			log_misc_string(str_i, output_path[m]);
+			log_misc_string(",", output_path[m]);
+		}
 
+		fprintf(stderr, "%s %d %d\n", "Calculating", processed, i);
+		while (processed < i) {
+			long n = (long)(i - processed) < batch ? (long)(i - processed) : batch;
+			if (trace_reader_next(&reader, &traces, n) != n)
+				exit(EXIT_FAILURE);
+			cpa_accumulate(&traces, WAVELENGTH, n_models, config.models, dev_waveData, dev_cipherText, dev_plainText, dev_waveStat, dev_waveStat2, dev_hammingStat);
+			processed += n;
+		}
+		for (int m = 0; m < n_models; m++) {
+			cpa_checkpoint(i, WAVELENGTH, dev_waveStat[m], dev_waveStat2[m], dev_hammingStat[m], ROUNDKEY[m], output_path[m], &keyByteIndex[m * KEYBYTES]);
 
-			unsigned int *dev_cipherText;
-			double *dev_correlation, *dev_waveStat, *dev_waveStat2, *dev_hammingStat, *dev_waveData;
-			byte *dev_hammingArray, *dev_hammingArray2;
+#ifdef MULTIRUN_SUMMARY
+			log_keybyte_summary(i, &keyByteIndex[m * KEYBYTES], output_path[m]);
+#endif //MULTIRUN_SUMMARY
+			log_misc_string("\n", output_path[m]);
+		}
 
-			if(cudaMalloc((void**)&dev_waveData, 1L * samplesToProcess * WAVELENGTH * sizeof(double)) != cudaSuccess){
-				printf("cuda malloc failed wave data \n");
+		if (config.hold > 0) {
+			int broken = 1;
+			for (int m = 0; m < n_models; m++) {
+				if (update_disclosure(i, &keyByteIndex[m * KEYBYTES], &held[m], &disclosure[m]) < config.hold)
+					broken = 0;
 			}
-			if(cudaMalloc((void**)&dev_cipherText, 1L * samplesToProcess * KEYBYTES * sizeof(unsigned int)) != cudaSuccess){
-				printf("cuda malloc failed ciphertext\n");
+			if (broken) {
+				printf("Key ranked first for %d checkpoints, stopping after %d traces\n", config.hold, i);
+				break;
 			}
+		}
+	}
+	for (int m = 0; m < n_models && config.hold > 0; m++)
+		log_disclosure(disclosure[m], i, output_path[m]);
 
-			if(cudaMalloc((void**)&dev_hammingArray, 1L * KEYS * KEYBYTES * samplesToProcess * sizeof(byte))!= cudaSuccess){
-				printf("cuda malloc failed hamming array\n");
-				printf("samples to process %ld \n", 1L* KEYS * KEYBYTES * samplesToProcess);
-			}
-			unsigned long a =  KEYS * KEYBYTES * sizeof(byte);
-			double len_array = 1L * a* samplesToProcess;
+	if(cudaFree(dev_waveData) != cudaSuccess){
+		printf("cuda free failed\n");
+	}
+	if(cudaFree(dev_cipherText) != cudaSuccess){
+		printf("cuda free failed\n");
+	}
+	if(dev_plainText != NULL && cudaFree(dev_plainText) != cudaSuccess){
+		printf("cuda free failed\n");
+	}
+	for (int m = 0; m < n_models; m++) {
+		if(cudaFree(dev_waveStat[m]) != cudaSuccess){
+			printf("cuda free failed\n");
+		}
+		if(cudaFree(dev_waveStat2[m])!=cudaSuccess){
+			printf("cuda free failed\n");
+		}
+		if(cudaFree(dev_hammingStat[m])!=cudaSuccess){
+			printf("cuda free failed\n");
+		}
+	}
+	free(keyByteIndex);
+	free(checkpoints);
+	trace_reader_close(&reader);
+	free(poi);
+	return 0;
+}
 
-			if(len_array > 4294967295){
-				cudaMalloc((void**)&dev_hammingArray2, a * samplesToProcess  - 4294967295 );
-			}else{
-				cudaMalloc((void**)&dev_hammingArray2, 1 );
+// Launches the kernels of one leakage model on a batch already on the GPU
+template <typename model_t>
+void accumulate_model(unsigned int samplesToProcess, int WAVELENGTH, int u8, void *dev_waveData, byte *dev_text, double *dev_waveStat, double *dev_waveStat2, double *dev_hammingStat) {
+	//find hamming model
+	dim3 grid(KEYBYTES / 16, KEYS / 16);
+	dim3 block(16, 16);
+	hamming_kernel<model_t> << <grid, block >> > (dev_text, dev_hammingStat, samplesToProcess);
+	cudaGetLastError();
+
+	//find wave stats
+	dim3 block3d(16, 16, 4);
+	dim3 grid3d(KEYBYTES / 16, KEYS / 16, (WAVELENGTH + 3) / 4);
+	if (u8)
+		wave_stat_kernel<byte, model_t> << <grid3d, block3d >> > ((byte *)dev_waveData, dev_text, dev_waveStat, dev_waveStat2, samplesToProcess, WAVELENGTH);
+	else
+		wave_stat_kernel<float, model_t> << <grid3d, block3d >> > ((float *)dev_waveData, dev_text, dev_waveStat, dev_waveStat2, samplesToProcess, WAVELENGTH);
+	cudaGetLastError();
+}
 
-			}
+// Adds a batch of traces to the sums of every model held on the GPU, through
+// the device batch buffers dev_waveData, dev_cipherText and dev_plainText.
+// The batch is copied to the GPU once for all the models.
+void cpa_accumulate(trace_batch_t *batch, int WAVELENGTH, int n_models, int *models, void *dev_waveData, byte *dev_cipherText, byte *dev_plainText, double **dev_waveStat, double **dev_waveStat2, double **dev_hammingStat) {
+	unsigned int samplesToProcess = batch->n_traces;
+	int u8 = (batch->traces_u8 != NULL);
 
-			if(cudaMalloc((void**)&dev_hammingStat, 2 * KEYS * KEYBYTES * sizeof(double)) != cudaSuccess){
-				printf("cuda malloc failed hammingstat");
-			}
+	if(cudaMemcpy(dev_cipherText, batch->ciphertexts, 1L * samplesToProcess * KEYBYTES * sizeof(byte), cudaMemcpyHostToDevice) != cudaSuccess){
+		printf("cuda mem cpy failed\n");
+	}
+	if(dev_plainText != NULL && cudaMemcpy(dev_plainText, batch->plaintexts, 1L * samplesToProcess * KEYBYTES * sizeof(byte), cudaMemcpyHostToDevice) != cudaSuccess){
+		printf("cuda mem cpy failed\n");
+	}
+	if (u8) {
+		if(cudaMemcpy(dev_waveData, batch->traces_u8, 1L * samplesToProcess * WAVELENGTH * sizeof(byte), cudaMemcpyHostToDevice) != cudaSuccess){
+			printf("cuda mem cpy failed\n");
+		}
+	}
+	else {
+		if(cudaMemcpy(dev_waveData, batch->traces, 1L * samplesToProcess * WAVELENGTH * sizeof(float), cudaMemcpyHostToDevice) != cudaSuccess){
+			printf("cuda mem cpy failed\n");
+		}
+	}
 
-			
-			if(cudaMemcpy(dev_cipherText, cipherText, 1L * samplesToProcess * KEYBYTES * sizeof(unsigned int), cudaMemcpyHostToDevice) != cudaSuccess){
-				printf("cuda mem cpy failed\n");
-			}
-			free(cipherText);
-
-			//find hamming model
-			dim3 grid(KEYBYTES / 16, KEYS / 16);
-			dim3 block(16, 16);
-			hamming_kernel << <grid, block >> > (dev_cipherText, dev_hammingArray, dev_hammingArray2, dev_hammingStat, samplesToProcess);
-			cudaGetLastError();
-			cudaFree(dev_cipherText);
-
-			//find wave stats
-			if(cudaMemcpy(dev_waveData, waveData, 1L * samplesToProcess * WAVELENGTH * sizeof(double), cudaMemcpyHostToDevice) != cudaSuccess){
-				printf("cuda mem cpy failed\n");
-			}
-			printf("wave data %zu", 1L * samplesToProcess * WAVELENGTH * sizeof(double) - 1);
-			printf("wave data %zd", 1L * samplesToProcess * WAVELENGTH * sizeof(double) - 1);
-			free(waveData);
+	for (int m = 0; m < n_models; m++) {
+		byte *dev_text = model_first_round(models[m]) ? dev_plainText : dev_cipherText;
+		DISPATCH_MODEL(models[m], accumulate_model, samplesToProcess, WAVELENGTH, u8, dev_waveData, dev_text, dev_waveStat[m], dev_waveStat2[m], dev_hammingStat[m]);
+	}
 
-			if(cudaMalloc((void**)&dev_waveStat, 2 * WAVELENGTH * sizeof(double)) != cudaSuccess){
-				printf("cuda malloc failed wave stat\n");
-			}
-			if(cudaMalloc((void**)&dev_waveStat2, 1L * KEYS * KEYBYTES * WAVELENGTH * sizeof(double)) != cudaSuccess){
-				printf("cuda malloc failed wavestat2\n");
-			}
-			dim3 block3d(16, 16, 4);
-			dim3 grid3d(KEYBYTES / 16, KEYS / 16, WAVELENGTH / 4);
-			wave_stat_kernel << <grid3d, block3d >> > (dev_waveData, dev_waveStat, dev_waveStat2, dev_hammingArray,dev_hammingArray2, samplesToProcess, WAVELENGTH);
-			cudaGetLastError();
-			if(cudaFree(dev_waveData)!=cudaSuccess){
-				printf("cuda free failed\n");
-			}
-			if(cudaFree(dev_hammingArray)!=cudaSuccess){
-				printf("cuda free failed\n");
-			}
-			if(cudaFree(dev_hammingArray2)!=cudaSuccess){
-				printf("cuda free failed\n");
-			}
+	return;
+}
 
-			//calculate correlation coefficient
-			if(cudaMalloc((void**)&dev_correlation, KEYS * KEYBYTES * sizeof(double)) != cudaSuccess){
-				printf("cuda malloc failed correlation\n");
-			}
-			max_correlation_kernel << <grid, block >> > (dev_correlation, dev_waveStat, dev_waveStat2, dev_hammingStat, samplesToProcess, WAVELENGTH);
-			//printf("correlation %f\n", dev_correlation[0]);
-			//printf("correlation2 %f\n", dev_correlation[KEYS * KEYBYTES - 1]);
+// Computes the correlation from the sums of the first samplesToProcess traces and logs the results
+void cpa_checkpoint(unsigned int samplesToProcess, int WAVELENGTH, double *dev_waveStat, double *dev_waveStat2, double *dev_hammingStat, int ROUNDKEY[KEYBYTES], char output_path[1000], unsigned int *keyByteIndex) {
+	double *correlation = (double *)malloc(sizeof(double) * KEYS * KEYBYTES);
+	isMemoryFull((unsigned int*)correlation);
 
-			cudaGetLastError();
+	double *dev_correlation;
 
-			//copy back to host and free
-			if(cudaMemcpy(correlation, dev_correlation, KEYS * KEYBYTES * sizeof(double), cudaMemcpyDeviceToHost) != cudaSuccess){
-				printf("cuda mem cpy failed\n");
-			}
-			if(cudaFree(dev_correlation)!=cudaSuccess){
-				printf("cuda free failed\n");
-			}
-			if(cudaFree(dev_waveStat) != cudaSuccess){
-				printf("cuda free failed\n");
-			}
-			if(cudaFree(dev_waveStat2)!=cudaSuccess){
-				printf("cuda free failed\n");
-			}
-			if(cudaFree(dev_hammingStat)!=cudaSuccess){
-				printf("cuda free failed\n");
-			}
-			for (i = 0; i < KEYS; i++) {
-				for (j = 0; j < KEYBYTES; j++) {
-					double maxValue = maxCorrelation[i * KEYBYTES + j];
-					double thisIteration = correlation[i * KEYBYTES + j];
-					if (maxValue < thisIteration)
-						maxCorrelation[i * KEYBYTES + j] = thisIteration;
-				}
-			}
+	//calculate correlation coefficient
+	if(cudaMalloc((void**)&dev_correlation, KEYS * KEYBYTES * sizeof(double)) != cudaSuccess){
+		printf("cuda malloc failed correlation\n");
+	}
+	dim3 grid(KEYBYTES / 16, KEYS / 16);
+	dim3 block(16, 16);
+	max_correlation_kernel << <grid, block >> > (dev_correlation, dev_waveStat, dev_waveStat2, dev_hammingStat, samplesToProcess, WAVELENGTH);
 
-			//log_correlations_each_iteration(l + innerRounds * k, correlation, samplesToProcess, output_path);
-		}
+	cudaGetLastError();
 
+	//copy back to host and free
+	if(cudaMemcpy(correlation, dev_correlation, KEYS * KEYBYTES * sizeof(double), cudaMemcpyDeviceToHost) != cudaSuccess){
+		printf("cuda mem cpy failed\n");
 	}
-	free(correlation);
-	log_maxCorrelation(maxCorrelation, samplesToProcess, samplesToProcess, output_path);
+	if(cudaFree(dev_correlation)!=cudaSuccess){
+		printf("cuda free failed\n");
+	}
+
+	log_maxCorrelation(correlation, samplesToProcess, samplesToProcess, output_path);
 
-	//log_correlation_known_key_csv(maxCorrelation, ROUNDKEY, output_path);
+	//log_correlation_known_key_csv(correlation, ROUNDKEY, output_path);
 
 	double finalCorrelations[KEYS][KEYBYTES];
 	int positions[KEYS][KEYBYTES];
 	printf("sort\n");
-	sort_correlations(finalCorrelations, positions, maxCorrelation);
+	sort_correlations(finalCorrelations, positions, correlation);
 	printf("sort done\n");
-	free(maxCorrelation);
+	free(correlation);
 
 	//log_highest_correlation_csv(finalCorrelations, output_path);
 
@@ -408,11 +392,18 @@ __device__ byte hamming_weight(byte M, byte R) {
 }
 
 //3rd argument n is the index of the key byte
-__device__ byte hamming(unsigned int *cipherText, unsigned int sample, unsigned int n, unsigned int key) {
-	byte st10 = (byte)cipherText[sample * KEYBYTES + inv_shift[n]];
-	byte st9 = (byte)inv_sbox[cipherText[sample * KEYBYTES + n] ^ key];
-	byte dist = hamming_weight(st9, st10);
-	return dist;
+__device__ byte hamming(byte *cipherText, unsigned int sample, unsigned int n, unsigned int key) {
+	byte st10 = cipherText[1L * sample * KEYBYTES + inv_shift[n]];
+	byte st9_in = cipherText[1L * sample * KEYBYTES + n] ^ key;
+	return hd_table[st10 * KEYS + st9_in];
+}
+
+// hd_table[st10][x] = HD(inv_sbox[x], st10), launched with KEYS blocks of KEYS threads
+__global__ void hd_table_kernel() {
+	byte st10 = blockIdx.x;
+	byte x = threadIdx.x;
+	hd_table[st10 * KEYS + x] = hamming_weight(inv_sbox[x], st10);
+	return;
 }
 
 __global__ void max_correlation_kernel(double *correlation, double *waveStat, double *waveStat2, double *hammingStat, unsigned int samplesToProcess, int WAVELENGTH) {
@@ -444,40 +435,43 @@ __global__ void max_correlation_kernel(double *correlation, double *waveStat, do
 	return;
 }
 
-__global__ void wave_stat_kernel(double *waveData, double *waveStat, double *waveStat2, byte *hammingArray, byte *hammingArray2, unsigned int samplesToProcess, int WAVELENGTH) {
+// Adds the sums of the given traces to waveStat and waveStat2. The hypotheses
+// of model_t are recomputed from the texts instead of being stored for every trace.
+// The samples are float (.data and text files) or byte (.bin files).
+template <typename sample_t, typename model_t>
+__global__ void wave_stat_kernel(sample_t *waveData, byte *text, double *waveStat, double *waveStat2, unsigned int samplesToProcess, int WAVELENGTH) {
 	int keyguess = blockDim.y * blockIdx.y + threadIdx.y;
 	int keybyte = blockDim.x * blockIdx.x + threadIdx.x;
 	int wave = blockDim.z * blockIdx.z + threadIdx.z;
 
 	if (keyguess < KEYS && keybyte < KEYBYTES && wave < WAVELENGTH) {
+		typedef typename sample_sum<sample_t>::type sum_t;
 		unsigned int i;
-		double sigmaWH = 0;
+		sum_t sigmaWH = 0;
 		for (i = 0; i < samplesToProcess; i++) {
-			unsigned long a= KEYS * KEYBYTES;
-			if((i * a + keyguess * KEYBYTES + keybyte) < 4294967295){
-			sigmaWH += waveData[i * WAVELENGTH + wave] * (double)hammingArray[i * a + keyguess * KEYBYTES + keybyte];
-			}else{
-			sigmaWH += waveData[i * WAVELENGTH + wave] * (double)hammingArray2[(i * a + keyguess * KEYBYTES + keybyte) - 4294967295];
-			}
+			sigmaWH += (sum_t)waveData[1L * i * WAVELENGTH + wave] * (sum_t)model_t::hyp(text, i, keybyte, keyguess);
 		}
-		waveStat2[wave * KEYS * KEYBYTES + keyguess * KEYBYTES + keybyte] = sigmaWH;
+		waveStat2[wave * KEYS * KEYBYTES + keyguess * KEYBYTES + keybyte] += (double)sigmaWH;
 	}
 
 	if (keyguess == 0 && keybyte == 0 && wave < WAVELENGTH) {
+		typedef typename sample_sum<sample_t>::type sum_t;
 		unsigned int i;
-		double sigmaW = 0, sigmaW2 = 0, W = 0;
+		sum_t sigmaW = 0, sigmaW2 = 0, W = 0;
 		for (i = 0; i < samplesToProcess; i++) {
-			W = waveData[i * WAVELENGTH + wave];
+			W = (sum_t)waveData[1L * i * WAVELENGTH + wave];
 			sigmaW += W;
 			sigmaW2 += W * W;
 		}
-		waveStat[wave] = sigmaW;
-		waveStat[WAVELENGTH + wave] = sigmaW2;
+		waveStat[wave] += (double)sigmaW;
+		waveStat[WAVELENGTH + wave] += (double)sigmaW2;
 	}
 	return;
 }
 
-__global__ void hamming_kernel(unsigned int *cipherText, byte *hammingArray, byte *hammingArray2, double *hammingStat, unsigned int samplesToProcess) {
+// Adds the sums of the hypotheses of model_t for the given texts to hammingStat
+template <typename model_t>
+__global__ void hamming_kernel(byte *text, double *hammingStat, unsigned int samplesToProcess) {
 	int keyguess = blockDim.y * blockIdx.y + threadIdx.y;
 	int keybyte = blockDim.x * blockIdx.x + threadIdx.x;
 
@@ -486,244 +480,12 @@ __global__ void hamming_kernel(unsigned int *cipherText, byte *hammingArray, byt
 		byte H;
 		unsigned int i;
 		for (i = 0; i < samplesToProcess; i++) {
-			H = hamming(cipherText, i, keybyte, keyguess);
-			unsigned long a = KEYS * KEYBYTES;
-			if((i *a + keyguess * KEYBYTES + keybyte) < 4294967295){	
-			hammingArray[i * KEYS * KEYBYTES + keyguess * KEYBYTES + keybyte] = H;
-			}else{
-			hammingArray2[(i * a + keyguess * KEYBYTES + keybyte) - 4294967295] = H;
-			}
+			H = model_t::hyp(text, i, keybyte, keyguess);
 			sigmaH += (double)H;
 			sigmaH2 += (double)H * (double)H;
 		}
-		hammingStat[KEYBYTES * keyguess + keybyte] = sigmaH;
-		hammingStat[KEYS * KEYBYTES + KEYBYTES * keyguess + keybyte] = sigmaH2;
-	}
-	return;
-}
-
-void randomize_selection(unsigned int *selection, unsigned int samplesToProcess) {
-	srand(time(0));
-	unsigned int temp = 0;
-	for (int i = 0; i < samplesToProcess; i++) {
-		unsigned int swap_i = rand() % samplesToProcess;
-		temp = selection[i];
-		selection[i] = selection[swap_i];
-		selection[swap_i] = temp;
-	}
-	return;
-}
-
-void log_correlations_each_iteration(int iteration, double *correlation, unsigned int samplesToProcess, char output_path[1000]) {
-        char file_name[1000];
-        snprintf(file_name, sizeof(char) * 1000, "%s/all_kr_" GPUIDXSTR ".txt", output_path);
-	FILE *file;
-	if (iteration == 0)
-		file = fopen(file_name, "w");
-	else
-		file = fopen(file_name, "a");
-
-	fprintf(file, "%d,  pk0,  pk1,  pk2,  pk3,  pk4,  pk5,  pk6,  pk7,  pk8,  pk9, pk10, pk11, pk12, pk13, pk14, pk15, \n", samplesToProcess);
-	for (int i = 0; i < KEYS; i++) {
-		fprintf(file, "0x%02X,", i);
-		for (int j = 0; j < KEYBYTES; j++) {
-			fprintf(file, "%.15f,", i, correlation[i * KEYBYTES + j]);
-		}
-		fprintf(file, "\n");
-	}
-
-	fprintf(file, "\n\n");
-	fclose(file);
-	return;
-}
-
-//Among the multiple iterations, the maximum correlation for each key byte and key guess
-void log_maxCorrelation(double *maxCorrelation, unsigned int samplesToProcess, unsigned int file_index, char output_path[1000]) {
-  char file_name[1000];
-  snprintf(file_name, sizeof(char) * 1000, "%s/final_kr/%i.txt", output_path, file_index);
-  
-	FILE *file = fopen(file_name, "a");
-	for (int i = 0; i < KEYS; i++) {
-		for (int j = 0; j < KEYBYTES-1; j++) {
-			fprintf(file, "%.15f,", maxCorrelation[i * KEYBYTES + j]);
-		}
-		fprintf(file, "%.15f\n", maxCorrelation[i * KEYBYTES + KEYBYTES - 1]);
+		hammingStat[KEYBYTES * keyguess + keybyte] += sigmaH;
+		hammingStat[KEYS * KEYBYTES + KEYBYTES * keyguess + keybyte] += sigmaH2;
 	}
-  fclose(file);
 	return;
 }
-
-void log_correlation_known_key_csv(double *maxCorrelation, int ROUNDKEY[KEYBYTES], char output_path[1000]) {
-	//int key[KEYBYTES] = { ROUNDKEY };
-	int key[KEYBYTES]; 
-        for(int i=0;i<16; i++)
-          key[i] = ROUNDKEY[i];
-
-        char file_name[1000];
-        snprintf(file_name, sizeof(char) * 1000, "%s/corr_coef_key_kr_" GPUIDXSTR ".csv", output_path);
-	FILE *file = fopen(file_name, "a");
-
-	for (int i = 0; i < KEYBYTES; i++) {
-		for (int j = 0; j < KEYS; j++) {
-			if (key[i] == j) {
-				fprintf(file, "%.15f", maxCorrelation[j * KEYBYTES + i]);
-				if (i < KEYBYTES - 1)
-					fprintf(file, ", ");
-			}
-		}
-	}
-	fprintf(file, "\n");
-	fclose(file);
-	return;
-}
-
-void sort_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], double *maxCorrelation) {
-	double n = 0;
-	for (int j = 0; j < KEYBYTES; j++) {
-		for (int i = 0; i < KEYS; i++) {
-			finalCorrelations[i][j] = maxCorrelation[i * KEYBYTES + j];
-			positions[i][j] = i;
-		}
-		for (int p = 0; p < 255; p++) {
-			for (int i = 0; i < KEYS - p - 1; i++) {
-				if (finalCorrelations[i][j] < finalCorrelations[i + 1][j]) {
-					n = finalCorrelations[i][j];
-					finalCorrelations[i][j] = finalCorrelations[i + 1][j];
-					finalCorrelations[i + 1][j] = n;
-
-					n = positions[i][j];
-					positions[i][j] = positions[i + 1][j];
-					positions[i + 1][j] = n;
-				}
-			}
-		}
-	}
-	return;
-}
-
-void log_highest_correlation_csv(double finalCorrelations[KEYS][KEYBYTES], char output_path[1000]) {
-        char file_name[1000];
-        snprintf(file_name, sizeof(char) * 1000, "%s/corr_coef_highest_kr_" GPUIDXSTR ".csv", output_path);
-	FILE *file = fopen(file_name, "a");
-
-	for (int j = 0; j < KEYBYTES; j++) {
-		fprintf(file, "%.15f", finalCorrelations[0][j]);
-		if (j < KEYBYTES - 1) {
-			fprintf(file, ", ");
-		}
-	}
-	fprintf(file, "\n");
-	fclose(file);
-	return;
-}
-
-void log_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k, char output_path[1000]) {
-	FILE *file;
-	char filename[1000];
-	char str_k[4];
-	sprintf(str_k, "%d", k);
-        snprintf(filename, sizeof(char) * 1000, "%s/top_%s_keys.txt", output_path, str_k);
-	file = fopen(filename, "a");
-
-	for (int j = 0; j < KEYBYTES; j++) {
-		fprintf(file, "  |%02d|\t", j);
-	}
-	fprintf(file, "\n");
-
-	for (int i = 0; i < k; i++) {
-		for (int j = 0; j < KEYBYTES; j++) {
-			fprintf(file, "  %02x\t", positions[i][j]);
-		}
-		fprintf(file, "\n");
-		for (int j = 0; j < KEYBYTES; j++) {
-			fprintf(file, "%.15f \t", finalCorrelations[i][j]);
-		}
-		fprintf(file, "\n\n");
-	}
-	fprintf(file, "\n\n");
-	fclose(file);
-	return;
-}
-
-void print_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k) {
-	for (int j = 0; j < KEYBYTES; j++) {
-		printf("  |%02d|\t", j);
-	}
-	printf("\n");
-
-	for (int i = 0; i < k; i++) {
-		for (int j = 0; j < KEYBYTES; j++) {
-			printf("  %02x\t", positions[i][j]);
-		}
-		printf("\n");
-		for (int j = 0; j < KEYBYTES; j++) {
-			printf("%.15f \t", finalCorrelations[i][j]);
-		}
-		printf("\n\n");
-	}
-	printf("\n\n");
-	return;
-}
-
-void log_correct_keybyte_count_csv(int positions[KEYS][KEYBYTES], int ROUNDKEY[KEYBYTES], char output_path[1000]) {
-	//int key[KEYBYTES] = { ROUNDKEY };
-	int key[KEYBYTES]; 
-        for(int i=0;i<16; i++)
-          key[i] = ROUNDKEY[i];
-
-        char file_name[1000];
-        snprintf(file_name, sizeof(char) * 1000, "%s/correct_keybyte_count_kr_" GPUIDXSTR ".csv", output_path);
-	FILE *file = fopen(file_name, "a");
-	int cnt = 0;
-	for (int j = 0; j < KEYBYTES; j++) {
-		if (positions[0][j] == key[j])
-			cnt++;
-	}
-	printf("cnt %d \n", cnt);
-	fprintf(file, "%d", cnt);
-	fclose(file);
-	return;
-}
-
-void log_misc_string(char *str, char output_path[1000]) {
-        char file_name[1000];
-        snprintf(file_name, sizeof(char) * 1000, "%s/correct_keybyte_count_kr_" GPUIDXSTR ".csv", output_path);
-	FILE *file = fopen(file_name, "a");
-	fprintf(file, "%s", str);
-	fclose(file);
-	return;
-}
-
-void multirun_update_summary(int positions[KEYS][KEYBYTES], unsigned int keyByteIndex[KEYBYTES], int ROUNDKEY[KEYBYTES]) {
-	//int key[KEYBYTES] = { ROUNDKEY };
-	int key[KEYBYTES]; 
-        for(int i=0;i<16; i++)
-          key[i] = ROUNDKEY[i];
-
-	for (int j = 0; j < KEYBYTES; j++) {
-		for (int i = 0; i < KEYS; i++) {
-			if (positions[i][j] == key[j])
-				keyByteIndex[j] = keyByteIndex[j] + i;
-		}
-	}
-	return;
-}
-
-void log_keybyte_summary(int i, unsigned int keyByteIndex[KEYBYTES], char output_path[1000]) {
-        char file_name[1000];
-        snprintf(file_name, sizeof(char) * 32, "%s/summary_keybyte_kr_" GPUIDXSTR ".csv", output_path);
-	FILE *file = fopen(file_name, "a");
-	fprintf(file, "%d", i);
-	for (int j = 0; j < KEYBYTES; j++) {
-		fprintf(file, ", %d", keyByteIndex[j]);
-	}
-	fprintf(file, "\n");
-	fclose(file);
-	return;
-}
-
-void isMemoryFull(unsigned int *ptr){
-	if(ptr == NULL){
-		printf("----memory\n");
-	}
-}
@@ -0,0 +1,280 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Multithreaded CPU Gaussian template attack. The templates are built on a
+profiling set acquired with a random key per trace (key mode 1 of basys3 and
+sakura_x), then the attack traces are processed as by main-CPA-cpu: it takes
+the same arguments, plus the profiling set, and writes the same result files,
+with the probability of every key guess in place of its maximum correlation.
+*/
+
+#include "utils.cuh"
+#include "cpa_log.cuh"
+#include "cpa_engine.hpp"
+#include "template_engine.hpp"
+#include "trace_io.cuh"
+#include "poi.cuh"
+#include <stdint.h>
+#include <limits.h>
+
+int open_profiling_set(config_t *config, trace_reader_t *reader);
+long profile(config_t *config, trace_reader_t *reader, template_profile_t *profiles, template_profile_t *workers, int n_threads, long n_traces);
+
+int main(int argc, char *argv[]) {
+
+  config_t config;
+
+  // Load program config passed by the command line arguments
+  init_config(&config);
+  if(parse_args(argc, argv, &config) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if(print_config(&config) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (config.profile_trace_path[0] == '\0' || config.profile_ciphertext_path[0] == '\0' || config.profile_key_path[0] == '\0') {
+    printf("The template attack needs a profiling set: -pt, -pc and -pk\n");
+    exit(EXIT_FAILURE);
+  }
+  if (config.n_rounds > 0) {
+    printf("The bootstrap attacks (-r) are only run by the CPA\n");
+    exit(EXIT_FAILURE);
+  }
+  if (config.state_path[0] != '\0') {
+    printf("The accumulator state file (-st) holds the sums of the CPA\n");
+    exit(EXIT_FAILURE);
+  }
+
+  int n_threads = get_n_threads(config.n_threads);
+  int n_models = config.n_models;
+
+  printf("Running the template attack on %d CPU threads\n", n_threads);
+
+  // Every leakage model attacks its own key and writes its own result files
+  int ROUNDKEY[N_MODELS][KEYBYTES];
+  char output_path[N_MODELS][1000];
+  for (int m = 0; m < n_models; m++) {
+    get_model_key(&config, config.models[m], ROUNDKEY[m]);
+    if (get_model_output_path(&config, config.models[m], output_path[m]) == EXIT_FAILURE)
+      exit(EXIT_FAILURE);
+  }
+
+  long n_profile = config.profile_traces > 0 ? config.profile_traces : LONG_MAX;
+  trace_reader_t reader;
+  template_profile_t profiles[N_MODELS];
+  template_profile_t *workers = (template_profile_t *)malloc(sizeof(template_profile_t) * n_threads);
+  isMemoryFull((unsigned int *)workers);
+
+  // Point of interest pre-pass (-poi) on the first profiling traces, with the
+  // values of the models as classes: the templates only model the samples of
+  // highest NICV, the largest over the models
+  int n_samples = config.n_samples;
+  int *poi = NULL;
+  if (config.poi_samples > 0 && config.poi_samples < config.n_samples) {
+    if (config.poi_samples < config.poi_window) {
+      printf("The number of points of interest (%d) is smaller than their window (%d)\n", config.poi_samples, config.poi_window);
+      exit(EXIT_FAILURE);
+    }
+    for (int m = 0; m < n_models; m++) {
+      if (template_profile_init(&profiles[m], n_samples, 0, config.models[m]) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+    for (int t = 0; t < n_threads; t++) {
+      if (template_profile_init(&workers[t], n_samples, 0, config.models[0]) == EXIT_FAILURE)
+        exit(EXIT_FAILURE);
+    }
+    long n_poi = config.poi_traces > 0 ? config.poi_traces : DEFAULT_POI_TRACES;
+    if (open_profiling_set(&config, &reader) == EXIT_FAILURE)
+      exit(EXIT_FAILURE);
+    printf("Selecting %d points of interest (windows of %d samples) from the NICV of the first %ld profiling traces\n", config.poi_samples, config.poi_window, n_poi < n_profile ? n_poi : n_profile);
+    profile(&config, &reader, profiles, workers, n_threads, n_poi < n_profile ? n_poi : n_profile);
+    trace_reader_close(&reader);
+
+    double *nicv = (double *)calloc(n_samples, sizeof(double));
+    double *model_nicv = (double *)malloc(sizeof(double) * n_samples);
+    poi = (int *)malloc(sizeof(int) * n_samples);
+    isMemoryFull((unsigned int *)nicv);
+    isMemoryFull((unsigned int *)model_nicv);
+    isMemoryFull((unsigned int *)poi);
+    for (int m = 0; m < n_models; m++) {
+      template_nicv(&profiles[m], model_nicv);
+      for (int s = 0; s < n_samples; s++)
+        if (model_nicv[s] > nicv[s])
+          nicv[s] = model_nicv[s];
+      template_profile_free(&profiles[m]);
+    }
+    for (int t = 0; t < n_threads; t++)
+      template_profile_free(&workers[t]);
+    n_samples = poi_select_windows(&config, nicv, poi);
+    free(nicv);
+    free(model_nicv);
+    if (n_samples <= 0)
+      exit(EXIT_FAILURE);
+  }
+
+  // Profiling: one pass over the profiling set for all the models
+  for (int m = 0; m < n_models; m++) {
+    if (template_profile_init(&profiles[m], n_samples, 1, config.models[m]) == EXIT_FAILURE)
+      exit(EXIT_FAILURE);
+  }
+  for (int t = 0; t < n_threads; t++) {
+    if (template_profile_init(&workers[t], n_samples, 1, config.models[0]) == EXIT_FAILURE)
+      exit(EXIT_FAILURE);
+  }
+  if (open_profiling_set(&config, &reader) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (poi != NULL)
+    trace_reader_select(&reader, poi, n_samples);
+  long n_profiled = profile(&config, &reader, profiles, workers, n_threads, n_profile);
+  trace_reader_close(&reader);
+  for (int t = 0; t < n_threads; t++)
+    template_profile_free(&workers[t]);
+  free(workers);
+
+  template_set_t templates[N_MODELS];
+  printf("Building the templates of %d samples from %ld profiling traces\n", n_samples, n_profiled);
+  for (int m = 0; m < n_models; m++) {
+    if (template_build(&profiles[m], &templates[m]) == EXIT_FAILURE)
+      exit(EXIT_FAILURE);
+    template_profile_free(&profiles[m]);
+  }
+
+  // The attack traces are streamed from the files in batches, as by the CPA
+  if (trace_reader_open(&reader, config.trace_path, config.ciphertext_path, config.n_samples, config.sensor_width) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (config.n_channels > 1)
+    trace_reader_open_channels(&reader, config.n_channels, config.fuse ? config.channel_weights : NULL);
+  if (config_first_round(&config) && trace_reader_open_plaintexts(&reader, config.plaintext_path) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (config.shift_path[0] != '\0' && trace_reader_open_shifts(&reader, config.shift_path) == EXIT_FAILURE)
+    exit(EXIT_FAILURE);
+  if (poi != NULL)
+    trace_reader_select(&reader, poi, n_samples);
+
+  long batch = get_batch_size(&config, trace_sample_size(&reader) * (config.n_samples + n_samples) + 2 * KEYBYTES, 0);
+  printf("Streaming the traces in batches of %ld traces\n", batch);
+  trace_batch_t traces;
+
+  int n_checkpoints;
+  int *checkpoints = get_checkpoints(&config, &n_checkpoints);
+  unsigned int keyByteIndex[N_MODELS][KEYBYTES];
+
+  template_attack_t *attacks = (template_attack_t *)malloc(sizeof(template_attack_t) * n_models);
+  isMemoryFull((unsigned int *)attacks);
+  for (int m = 0; m < n_models; m++)
+    template_attack_reset(&attacks[m]);
+
+  // Attack until broken (-u), as by the CPA
+  int held[N_MODELS];
+  int disclosure[N_MODELS];
+  for (int m = 0; m < n_models; m++) {
+    held[m] = 0;
+    disclosure[m] = -1;
+  }
+
+  double *scores = (double *)malloc(sizeof(double) * KEYS * KEYBYTES);
+  isMemoryFull((unsigned int *)scores);
+  int i = 0;
+  for (int c = 0; c < n_checkpoints; c++) {
+    i = checkpoints[c];
+    char str_i[10];
+    sprintf(str_i, "%d", i);
+    for (int m = 0; m < n_models; m++) {
+      for (int n = 0; n < KEYBYTES; n++) {
+        keyByteIndex[m][n] = 0;
+      }
+      log_misc_string(str_i, output_path[m]);
+      log_misc_string(",", output_path[m]);
+    }
+
+    fprintf(stderr, "%s %llu %d\n", "Calculating", (unsigned long long)attacks[0].n_traces, i);
+    while (attacks[0].n_traces < (uint64_t)i) {
+      long n = (long)(i - attacks[0].n_traces) < batch ? (long)(i - attacks[0].n_traces) : batch;
+      if (trace_reader_next(&reader, &traces, n) != n)
+        exit(EXIT_FAILURE);
+      for (int m = 0; m < n_models; m++) {
+        const uint8_t *texts = model_first_round(config.models[m]) ? traces.plaintexts : traces.ciphertexts;
+        if (traces.traces_u8 != NULL)
+          template_attack_accumulate(&attacks[m], &templates[m], n_threads, traces.traces_u8, texts, n);
+        else
+          template_attack_accumulate(&attacks[m], &templates[m], n_threads, traces.traces, texts, n);
+      }
+    }
+    for (int m = 0; m < n_models; m++) {
+      // The key guesses are scored by their probabilities from the log-likelihoods
+      template_scores(&attacks[m], scores);
+      log_checkpoint(scores, (unsigned int)attacks[m].n_traces, ROUNDKEY[m], output_path[m], keyByteIndex[m]);
+
+      log_keybyte_summary(i, keyByteIndex[m], output_path[m]);
+      log_misc_string("\n", output_path[m]);
+    }
+
+    if (config.hold > 0) {
+      int broken = 1;
+      for (int m = 0; m < n_models; m++) {
+        if (update_disclosure(i, keyByteIndex[m], &held[m], &disclosure[m]) < config.hold)
+          broken = 0;
+      }
+      if (broken) {
+        printf("Key ranked first for %d checkpoints, stopping after %d traces\n", config.hold, i);
+        break;
+      }
+    }
+  }
+  for (int m = 0; m < n_models && config.hold > 0; m++)
+    log_disclosure(disclosure[m], i, output_path[m]);
+
+  free(scores);
+  free(checkpoints);
+  trace_reader_close(&reader);
+  free(poi);
+  free(attacks);
+  for (int m = 0; m < n_models; m++)
+    template_set_free(&templates[m]);
+  return 0;
+}
+
+// Opens the trace, ciphertext, key and, for the first round models, plaintext files of the profiling set
+int open_profiling_set(config_t *config, trace_reader_t *reader) {
+
+  if (trace_reader_open(reader, config->profile_trace_path, config->profile_ciphertext_path, config->n_samples, config->sensor_width) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (config->n_channels > 1)
+    trace_reader_open_channels(reader, config->n_channels, config->fuse ? config->channel_weights : NULL);
+  if ((config_first_round(config) && trace_reader_open_plaintexts(reader, config->profile_plaintext_path) == EXIT_FAILURE)
+      || trace_reader_open_keys(reader, config->profile_key_path) == EXIT_FAILURE) {
+    trace_reader_close(reader);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+// Adds the first n_traces traces of the profiling set, or all of them if the
+// files are shorter, to the profiles of the models. Returns the number of traces.
+long profile(config_t *config, trace_reader_t *reader, template_profile_t *profiles, template_profile_t *workers, int n_threads, long n_traces) {
+
+  long batch = get_batch_size(config, trace_sample_size(reader) * (config->n_samples + profiles[0].n_samples) + 3 * KEYBYTES, 0);
+  trace_batch_t traces;
+  long read = 0;
+  while (read < n_traces) {
+    long requested = (n_traces - read) < batch ? (n_traces - read) : batch;
+    long n = trace_reader_next(reader, &traces, requested);
+    if (n == 0)
+      break;
+    for (int m = 0; m < config->n_models; m++) {
+      const uint8_t *texts = model_first_round(config->models[m]) ? traces.plaintexts : traces.ciphertexts;
+      if (traces.traces_u8 != NULL)
+        template_profile_parallel(&profiles[m], workers, n_threads, traces.traces_u8, texts, traces.keys, n);
+      else
+        template_profile_parallel(&profiles[m], workers, n_threads, traces.traces, texts, traces.keys, n);
+    }
+    read += n;
+    if (n < requested)
+      break;
+  }
+  return read;
+}
@@ -0,0 +1,421 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Static alignment of the traces (.bin file of uint8 samples or .data file of
+float32 samples) to a reference window, against the jitter of long
+acquisitions.
+
+The reference is the mean of the first traces of the trace file (or of another
+trace file with -r, so that a profiling set and an attack set are aligned to
+the same reference) over the window [start, start + length). Every trace is
+shifted by the shift in [-max_shift, max_shift] that maximises the normalised
+cross-correlation of its samples [start + shift, start + length + shift) with
+the reference window. The cross-correlations of all the shifts are computed
+at once by FFT: the product of the transform of the trace segment with the
+conjugate transform of the zero-mean reference, whose size is the next power
+of two of length + 2 * max_shift, so that no shift wraps around.
+
+The trace file is memory mapped and split into one block of traces per
+thread. The output is either the realigned trace file, in the format of the
+input (the samples shifted out of the trace repeat its first or last sample),
+or the shift index: one int32 shift per trace, that main-CPA, main-CPA-cpu
+and main-TA-cpu apply on the fly to the traces they read (-al).
+*/
+
+#include "utils.cuh"
+#include "fft.hpp"
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#define FORMAT_DATA   0   // float32 samples
+#define FORMAT_BIN    1   // uint8 samples
+#define FORMAT_SHIFTS 2   // output only: int32 shift per trace
+
+// Realigned traces of a thread written at once
+#define ALIGN_CHUNK 1024
+
+typedef struct align_block {
+
+  const uint8_t *traces;        // first trace of the block in the mapping
+  long first_trace;             // index of the first trace in the file
+  long n_traces;
+  int n_samples;
+  int format;
+  int start;                    // reference window
+  int length;
+  int max_shift;
+  int fft_size;
+  const cplx *reference;        // conjugate transform of the zero-mean reference window
+  const cplx *twiddles;
+  int32_t *shifts;              // [trace] of the block
+  int output_fd;                // realigned trace file, -1 for the shift index
+  long n_bounded;               // traces whose best shift is +-max_shift
+
+} align_block_t;
+
+void print_align_help();
+int map_file(const char *path, const char *name, const uint8_t **map, size_t *size);
+void align_block_run(align_block_t *block);
+
+int main(int argc, char *argv[]) {
+
+  char *trace_path = NULL;
+  char *reference_path = NULL;
+  char output_path[1000] = "";
+  long n_traces = -1;
+  int n_samples = -1;
+  int n_threads = 0;
+  int start = -1;
+  int length = -1;
+  int max_shift = 16;
+  long n_reference = 1;
+  int output_format = -1;
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      print_align_help();
+      return 0;
+    } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+      i++;
+      if (sscanf(argv[i], "%d:%d", &start, &length) != 2) {
+        printf("The reference window must be given as start:length\n");
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      i++;
+      max_shift = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-nr") == 0 && i + 1 < argc) {
+      i++;
+      n_reference = atol(argv[i]);
+    } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+      i++;
+      reference_path = argv[i];
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "data") == 0)
+        output_format = FORMAT_DATA;
+      else if (strcmp(argv[i], "bin") == 0)
+        output_format = FORMAT_BIN;
+      else if (strcmp(argv[i], "shifts") == 0)
+        output_format = FORMAT_SHIFTS;
+      else {
+        printf("Unknown output format: %s\n\n", argv[i]);
+        print_align_help();
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      i++;
+      snprintf(output_path, sizeof(output_path), "%s", argv[i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      n_threads = atoi(argv[i]);
+    } else if (positional == 0) {
+      trace_path = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      n_traces = atol(argv[i]);
+      positional++;
+    } else if (positional == 2) {
+      n_samples = atoi(argv[i]);
+      positional++;
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_align_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (positional != 3 || n_traces <= 0 || n_samples <= 0) {
+    print_align_help();
+    return EXIT_FAILURE;
+  }
+
+  int pathLength = strlen(trace_path);
+  int format = (pathLength >= 4 && strcmp(trace_path + pathLength - 4, ".bin") == 0) ? FORMAT_BIN : FORMAT_DATA;
+  size_t sample_size = (format == FORMAT_DATA) ? sizeof(float) : sizeof(uint8_t);
+  size_t trace_size = sample_size * n_samples;
+  if (output_format == -1)
+    output_format = format;
+  if (output_format != FORMAT_SHIFTS && output_format != format) {
+    printf("The realigned traces keep the format of the trace file (-f %s or -f shifts)\n", format == FORMAT_BIN ? "bin" : "data");
+    return EXIT_FAILURE;
+  }
+
+  // By default, the window leaves max_shift samples on both sides of the trace
+  if (start < 0 && length < 0) {
+    start = max_shift;
+    length = n_samples - 2 * max_shift;
+  }
+  if (max_shift < 0 || length <= 1 || start < max_shift || start + length + max_shift > n_samples) {
+    printf("The reference window [%d, %d) shifted by up to %d samples must fit in the %d samples of a trace\n", start, start + length, max_shift, n_samples);
+    return EXIT_FAILURE;
+  }
+  if (n_reference <= 0)
+    n_reference = 1;
+
+  if (output_path[0] == '\0') {
+    snprintf(output_path, sizeof(output_path), "%s", trace_path);
+    char *dot = strrchr(output_path, '.');
+    char *slash = strrchr(output_path, '/');
+    if (dot != NULL && (slash == NULL || dot > slash))
+      *dot = '\0';
+    const char *extension = output_format == FORMAT_SHIFTS ? "_shifts.bin" : (format == FORMAT_BIN ? "_aligned.bin" : "_aligned.data");
+    strncat(output_path, extension, sizeof(output_path) - strlen(output_path) - 1);
+  }
+  if (n_threads <= 0)
+    n_threads = (int)std::thread::hardware_concurrency();
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  printf("Trace file: %s (%s samples)\n", trace_path, format == FORMAT_DATA ? "float32" : "uint8");
+  printf("Reference window: samples %d to %d, shifts up to %d samples\n", start, start + length - 1, max_shift);
+
+  const uint8_t *trace_map;
+  size_t trace_map_size;
+  if (map_file(trace_path, "trace", &trace_map, &trace_map_size) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if ((long)(trace_map_size / trace_size) < n_traces) {
+    n_traces = trace_map_size / trace_size;
+    printf("Trace file %s holds only %ld traces, aligning them all\n", trace_path, n_traces);
+  }
+
+  // Mean of the first n_reference traces of the reference file over the window
+  const uint8_t *reference_map = trace_map;
+  size_t reference_map_size = trace_map_size;
+  if (reference_path != NULL) {
+    int referenceLength = strlen(reference_path);
+    int reference_format = (referenceLength >= 4 && strcmp(reference_path + referenceLength - 4, ".bin") == 0) ? FORMAT_BIN : FORMAT_DATA;
+    if (reference_format != format) {
+      printf("The reference file %s must have the format of the trace file\n", reference_path);
+      munmap((void *)trace_map, trace_map_size);
+      return EXIT_FAILURE;
+    }
+    if (map_file(reference_path, "reference", &reference_map, &reference_map_size) == EXIT_FAILURE) {
+      munmap((void *)trace_map, trace_map_size);
+      return EXIT_FAILURE;
+    }
+  }
+  if ((long)(reference_map_size / trace_size) < n_reference)
+    n_reference = reference_map_size / trace_size;
+  printf("Reference: mean of the first %ld traces of %s\n", n_reference, reference_path != NULL ? reference_path : trace_path);
+
+  std::vector<double> window(length, 0.0);
+  for (long t = 0; t < n_reference; t++) {
+    const uint8_t *trace = reference_map + (size_t)t * trace_size;
+    for (int s = 0; s < length; s++)
+      window[s] += format == FORMAT_BIN ? (double)trace[start + s] : (double)((const float *)trace)[start + s];
+  }
+  double mean = 0;
+  for (int s = 0; s < length; s++)
+    mean += window[s] / n_reference;
+  mean /= length;
+  if (reference_map != trace_map)
+    munmap((void *)reference_map, reference_map_size);
+
+  int n_fft = fft_size(length + 2 * max_shift);
+  std::vector<cplx> twiddles = fft_twiddles(n_fft);
+
+  // Conjugate transform of the zero-mean reference, zero padded
+  std::vector<cplx> reference(n_fft, cplx(0, 0));
+  for (int s = 0; s < length; s++)
+    reference[s] = window[s] / n_reference - mean;
+  fft(reference.data(), twiddles.data(), n_fft, 0);
+  for (int k = 0; k < n_fft; k++)
+    reference[k] = std::conj(reference[k]);
+
+  std::vector<int32_t> shifts(n_traces);
+  int output_fd = -1;
+  if (output_format != FORMAT_SHIFTS) {
+    output_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (output_fd < 0 || ftruncate(output_fd, (off_t)(n_traces * trace_size)) != 0) {
+      printf("Error in opening output file %s\n", output_path);
+      munmap((void *)trace_map, trace_map_size);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (n_threads > n_traces)
+    n_threads = (int)n_traces;
+  std::vector<align_block_t> blocks(n_threads);
+  for (int b = 0; b < n_threads; b++) {
+    long first = n_traces * b / n_threads;
+    memset(&blocks[b], 0, sizeof(align_block_t));
+    blocks[b].first_trace = first;
+    blocks[b].n_traces = n_traces * (b + 1) / n_threads - first;
+    blocks[b].traces = trace_map + (size_t)first * trace_size;
+    blocks[b].n_samples = n_samples;
+    blocks[b].format = format;
+    blocks[b].start = start;
+    blocks[b].length = length;
+    blocks[b].max_shift = max_shift;
+    blocks[b].fft_size = n_fft;
+    blocks[b].reference = reference.data();
+    blocks[b].twiddles = twiddles.data();
+    blocks[b].shifts = &shifts[first];
+    blocks[b].output_fd = output_fd;
+  }
+
+  std::vector<std::thread> threads;
+  for (int b = 0; b < n_threads; b++)
+    threads.push_back(std::thread(align_block_run, &blocks[b]));
+  for (int b = 0; b < n_threads; b++)
+    threads[b].join();
+  munmap((void *)trace_map, trace_map_size);
+
+  int status = EXIT_SUCCESS;
+  if (output_fd >= 0) {
+    close(output_fd);
+  } else {
+    FILE *file = fopen(output_path, "wb");
+    if (file == NULL || fwrite(shifts.data(), sizeof(int32_t), n_traces, file) != (size_t)n_traces) {
+      printf("Error in writing output file %s\n", output_path);
+      status = EXIT_FAILURE;
+    }
+    if (file != NULL)
+      fclose(file);
+  }
+
+  long n_bounded = 0;
+  double mean_shift = 0;
+  for (int b = 0; b < n_threads; b++)
+    n_bounded += blocks[b].n_bounded;
+  for (long t = 0; t < n_traces; t++)
+    mean_shift += abs(shifts[t]);
+  printf("Aligned %ld traces: mean absolute shift %.2f samples, %ld traces at the bound of %d samples\n", n_traces, mean_shift / n_traces, n_bounded, max_shift);
+  if (status == EXIT_SUCCESS)
+    printf("%s written to %s\n", output_format == FORMAT_SHIFTS ? "Shifts" : "Realigned traces", output_path);
+  return status;
+}
+
+void print_align_help() {
+  printf("Usage: ./align-traces /path/to/traces n_traces n_samples [-w start:length] [-s max_shift] [-nr traces] [-r reference_traces] [-f bin|data|shifts] [-o output] [-j threads]\n");
+  printf("\tAligns every trace to a reference window by FFT cross-correlation, with a bounded shift.\n");
+  printf("\tThe trace file is a .bin file of uint8 samples or a .data file of float32 samples.\n");
+  printf("\t-w:  reference window, first sample and number of samples (default: the trace without max_shift samples on both sides).\n");
+  printf("\t-s:  largest shift, in samples (default: 16).\n");
+  printf("\t-nr: number of traces averaged into the reference (default: 1, the first trace).\n");
+  printf("\t-r:  trace file of the reference traces, in the format of the trace file (default: the trace file).\n");
+  printf("\t-f:  output format: the realigned traces in the format of the trace file (default),\n");
+  printf("\t     or shifts, one int32 shift per trace applied on the fly by the attacks (-al).\n");
+  printf("\t-o:  output file path (default: trace file with the _aligned or _shifts.bin extension).\n");
+  printf("\t-j:  number of threads (default: all cores).\n");
+}
+
+int map_file(const char *path, const char *name, const uint8_t **map, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    printf("Error in opening %s file %s\n", name, path);
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+  *size = st.st_size;
+  *map = (const uint8_t *)mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (*map == MAP_FAILED) {
+    printf("Error in mapping %s file %s\n", name, path);
+    return EXIT_FAILURE;
+  }
+  madvise((void *)*map, *size, MADV_SEQUENTIAL);
+  return EXIT_SUCCESS;
+}
+
+static inline double sample_at(const align_block_t *block, const uint8_t *trace, int s) {
+  return block->format == FORMAT_BIN ? (double)trace[s] : (double)((const float *)trace)[s];
+}
+
+// Best shift of one trace. The segment [start - max_shift, start + length +
+// max_shift) is correlated with the zero-mean reference, so that the
+// correlation of the shift d - max_shift is the entry d of the inverse
+// transform; it is normalised by the deviation of the samples under the
+// window, from running sums. Ties keep the smallest shift, 0 first.
+static int best_shift(const align_block_t *block, const uint8_t *trace, cplx *segment, double *sum, double *sum2) {
+  int first = block->start - block->max_shift;
+  int span = block->length + 2 * block->max_shift;
+  int n_shifts = 2 * block->max_shift + 1;
+
+  sum[0] = 0;
+  sum2[0] = 0;
+  for (int i = 0; i < block->fft_size; i++) {
+    double x = i < span ? sample_at(block, trace, first + i) : 0;
+    segment[i] = cplx(x, 0);
+    if (i < span) {
+      sum[i + 1] = sum[i] + x;
+      sum2[i + 1] = sum2[i] + x * x;
+    }
+  }
+  fft(segment, block->twiddles, block->fft_size, 0);
+  for (int k = 0; k < block->fft_size; k++)
+    segment[k] *= block->reference[k];
+  fft(segment, block->twiddles, block->fft_size, 1);
+
+  int best = block->max_shift;
+  double best_score = -INFINITY;
+  for (int i = 0; i < n_shifts; i++) {
+    int d = (i & 1) ? block->max_shift + (i + 1) / 2 : block->max_shift - i / 2;
+    double s1 = sum[d + block->length] - sum[d];
+    double s2 = sum2[d + block->length] - sum2[d];
+    double energy = s2 - s1 * s1 / block->length;
+    if (energy <= 0)
+      continue;
+    double score = segment[d].real() / sqrt(energy);
+    if (score > best_score) {
+      best_score = score;
+      best = d;
+    }
+  }
+  return best - block->max_shift;
+}
+
+// Writes the trace shifted by shift samples, repeating its first or last sample
+static void shift_trace(const align_block_t *block, const uint8_t *trace, int shift, uint8_t *dst) {
+  size_t sample_size = block->format == FORMAT_BIN ? sizeof(uint8_t) : sizeof(float);
+  int n_samples = block->n_samples;
+  int lo = shift < 0 ? -shift : 0;
+  int hi = shift > 0 ? n_samples - shift : n_samples;
+  for (int s = 0; s < lo; s++)
+    memcpy(dst + s * sample_size, trace, sample_size);
+  memcpy(dst + lo * sample_size, trace + (lo + shift) * sample_size, (hi - lo) * sample_size);
+  for (int s = hi; s < n_samples; s++)
+    memcpy(dst + s * sample_size, trace + (n_samples - 1) * sample_size, sample_size);
+}
+
+void align_block_run(align_block_t *block) {
+  size_t trace_size = (block->format == FORMAT_BIN ? sizeof(uint8_t) : sizeof(float)) * block->n_samples;
+  int span = block->length + 2 * block->max_shift;
+  std::vector<cplx> segment(block->fft_size);
+  std::vector<double> sum(span + 1);
+  std::vector<double> sum2(span + 1);
+  std::vector<uint8_t> chunk(block->output_fd >= 0 ? ALIGN_CHUNK * trace_size : 0);
+
+  for (long first = 0; first < block->n_traces; first += ALIGN_CHUNK) {
+    long count = block->n_traces - first < ALIGN_CHUNK ? block->n_traces - first : ALIGN_CHUNK;
+    for (long t = first; t < first + count; t++) {
+      const uint8_t *trace = block->traces + (size_t)t * trace_size;
+      int shift = best_shift(block, trace, segment.data(), sum.data(), sum2.data());
+      block->shifts[t] = shift;
+      if (shift == block->max_shift || shift == -block->max_shift)
+        block->n_bounded++;
+      if (block->output_fd >= 0)
+        shift_trace(block, trace, shift, &chunk[(t - first) * trace_size]);
+    }
+    if (block->output_fd >= 0) {
+      off_t offset = (off_t)((block->first_trace + first) * trace_size);
+      if (pwrite(block->output_fd, chunk.data(), count * trace_size, offset) != (ssize_t)(count * trace_size))
+        printf("Error in writing the realigned traces %ld to %ld\n", block->first_trace + first, block->first_trace + first + count - 1);
+    }
+  }
+}
@@ -0,0 +1,216 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "bitslice_engine.hpp"
+#include "leakage_models.hpp"
+#include <math.h>
+#include <thread>
+#include <vector>
+
+// Blocks of 64 traces whose hypothesis planes are built at once: 2 MiB of
+// planes per plane of the model
+#define BITSLICE_CHUNK 64
+
+// Key guesses whose planes are ANDed with the word of a bit together
+#define BITSLICE_GUESSES 4
+
+// Planes of the hypotheses of a model, enough bits for its largest value classes - 1
+static constexpr int plane_count(int classes) {
+  return classes <= 1 ? 0 : 1 + plane_count((classes + 1) / 2);
+}
+
+int bitslice_batch_init(bitslice_batch_t *batch, int n_bits) {
+  memset(batch, 0, sizeof(bitslice_batch_t));
+  batch->n_bits = n_bits;
+  return EXIT_SUCCESS;
+}
+
+void bitslice_batch_free(bitslice_batch_t *batch) {
+  free(batch->words);
+  batch->words = NULL;
+  batch->capacity = 0;
+}
+
+// Transposes the blocks [first, last) of the batch: the 32-bit words w of
+// the 64 traces of a block give the words of the bits w * 32 to w * 32 + 31
+static void transpose_range(bitslice_batch_t *batch, const uint8_t *traces, size_t first, size_t last) {
+  size_t trace_size = batch->n_bits / 8;
+  int n_words = batch->n_bits / 32;
+
+  for (size_t block = first; block < last; block++) {
+    size_t t0 = block * BITSLICE_TRACES;
+    int tile = (batch->n_traces - t0 < BITSLICE_TRACES) ? (int)(batch->n_traces - t0) : BITSLICE_TRACES;
+    for (int w = 0; w < n_words; w++) {
+      uint64_t columns[32];
+      memset(columns, 0, sizeof(columns));
+      for (int t = 0; t < tile; t++) {
+        uint32_t word;
+        memcpy(&word, &traces[(t0 + t) * trace_size + w * sizeof(uint32_t)], sizeof(uint32_t));
+        for (int b = 0; b < 32; b++)
+          columns[b] |= (uint64_t)((word >> b) & 1) << t;
+      }
+      for (int b = 0; b < 32; b++)
+        batch->words[(size_t)(w * 32 + b) * batch->n_blocks + block] = columns[b];
+    }
+  }
+}
+
+int bitslice_transpose(bitslice_batch_t *batch, int n_threads, const uint8_t *traces, size_t n_traces) {
+  size_t n_blocks = (n_traces + BITSLICE_TRACES - 1) / BITSLICE_TRACES;
+
+  if (n_blocks > batch->capacity) {
+    free(batch->words);
+    batch->words = (uint64_t *)malloc(sizeof(uint64_t) * batch->n_bits * n_blocks);
+    if (batch->words == NULL) {
+      printf("----memory\n");
+      batch->capacity = 0;
+      return EXIT_FAILURE;
+    }
+    batch->capacity = n_blocks;
+  }
+  batch->n_traces = n_traces;
+  batch->n_blocks = n_blocks;
+
+  std::vector<std::thread> threads;
+  size_t block = (n_blocks + n_threads - 1) / n_threads;
+  for (size_t first = 0; first < n_blocks; first += block) {
+    size_t last = (first + block > n_blocks) ? n_blocks : first + block;
+    threads.push_back(std::thread(transpose_range, batch, traces, first, last));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  return EXIT_SUCCESS;
+}
+
+// Builds the hypothesis planes of the key bytes first, first + stride, ...
+// for the blocks [block0, block0 + n_blocks) of the batch, planes[n][k][p][block]
+// holding the bit p of the hypotheses of key byte n and key guess k for the
+// 64 traces of the block, and adds the hypotheses to sum_h and sum_h2
+template <typename model_t>
+static void build_planes(cpa_state_t *state, const bitslice_batch_t *batch, const uint8_t *texts, size_t block0, int n_blocks, uint64_t *planes, int first, int stride) {
+  const int P = plane_count(model_t::classes);
+  uint64_t local[KEYS][P];
+
+  for (int n = first; n < KEYBYTES; n += stride) {
+    for (int b = 0; b < n_blocks; b++) {
+      size_t t0 = (block0 + b) * BITSLICE_TRACES;
+      int tile = (batch->n_traces - t0 < BITSLICE_TRACES) ? (int)(batch->n_traces - t0) : BITSLICE_TRACES;
+      memset(local, 0, sizeof(local));
+      for (int t = 0; t < tile; t++) {
+        const uint8_t *text = &texts[(t0 + t) * KEYBYTES];
+        uint8_t c = text[n];
+        const uint8_t *row = model_t::row(model_t::select(text, n));
+        for (int k = 0; k < KEYS; k++) {
+          uint64_t h = row[c ^ k];
+          state->exact_h[k * KEYBYTES + n] += h;
+          state->exact_h2[k * KEYBYTES + n] += h * h;
+          for (int p = 0; p < P; p++)
+            local[k][p] |= ((h >> p) & 1) << t;
+        }
+      }
+      for (int k = 0; k < KEYS; k++)
+        for (int p = 0; p < P; p++)
+          planes[((size_t)(n * KEYS + k) * P + p) * n_blocks + b] = local[k][p];
+    }
+  }
+}
+
+// Adds the blocks [block0, block0 + n_blocks) of the batch to the samples
+// [first, last): sum_w and sum_w2 from the popcounts of the words of their
+// bits and of their pairs, sum_wh from the popcounts of the planes ANDed with
+// them, BITSLICE_GUESSES key guesses at a time so that every word is loaded once
+template <typename model_t>
+static void accumulate_range(cpa_state_t *state, int group, const bitslice_batch_t *batch, size_t block0, int n_blocks, const uint64_t *planes, int first, int last) {
+  const int P = plane_count(model_t::classes);
+  int n_samples = state->n_samples;
+  size_t stride = batch->n_blocks;
+
+  for (int j = first; j < last; j++) {
+    uint64_t sum_w = 0;
+    uint64_t sum_w2 = 0;
+    for (int i = j * group; i < (j + 1) * group; i++) {
+      const uint64_t *w = &batch->words[i * stride + block0];
+      for (int b = 0; b < n_blocks; b++)
+        sum_w += __builtin_popcountll(w[b]);
+      for (int i2 = i + 1; i2 < (j + 1) * group; i2++) {
+        const uint64_t *w2 = &batch->words[i2 * stride + block0];
+        for (int b = 0; b < n_blocks; b++)
+          sum_w2 += 2 * __builtin_popcountll(w[b] & w2[b]);
+      }
+    }
+    state->exact_w[j] += sum_w;
+    state->exact_w2[j] += sum_w2 + sum_w;
+  }
+
+  for (int n = 0; n < KEYBYTES; n++) {
+    for (int k = 0; k < KEYS; k += BITSLICE_GUESSES) {
+      const uint64_t *hyp = &planes[(size_t)(n * KEYS + k) * P * n_blocks];
+      for (int j = first; j < last; j++) {
+        uint64_t sums[BITSLICE_GUESSES][P];
+        memset(sums, 0, sizeof(sums));
+        for (int i = j * group; i < (j + 1) * group; i++) {
+          const uint64_t *w = &batch->words[i * stride + block0];
+          for (int b = 0; b < n_blocks; b++) {
+            uint64_t x = w[b];
+            for (int g = 0; g < BITSLICE_GUESSES; g++)
+              for (int p = 0; p < P; p++)
+                sums[g][p] += __builtin_popcountll(hyp[(g * P + p) * n_blocks + b] & x);
+          }
+        }
+        for (int g = 0; g < BITSLICE_GUESSES; g++) {
+          uint64_t sum = 0;
+          for (int p = 0; p < P; p++)
+            sum += sums[g][p] << p;
+          state->exact_wh[(size_t)(n * KEYS + k + g) * n_samples + j] += sum;
+        }
+      }
+    }
+  }
+}
+
+template <typename model_t>
+static void accumulate_model(cpa_state_t *state, int group, int n_threads, const bitslice_batch_t *batch, const uint8_t *texts) {
+  const int P = plane_count(model_t::classes);
+  int n_samples = state->n_samples;
+  int n_chunk = batch->n_blocks < BITSLICE_CHUNK ? (int)batch->n_blocks : BITSLICE_CHUNK;
+
+  uint64_t *planes = (uint64_t *)malloc(sizeof(uint64_t) * KEYBYTES * KEYS * P * n_chunk);
+  if (planes == NULL) {
+    printf("----memory\n");
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  int plane_threads = n_threads < KEYBYTES ? n_threads : KEYBYTES;
+  int range = (n_samples + n_threads - 1) / n_threads;
+  for (size_t block0 = 0; block0 < batch->n_blocks; block0 += BITSLICE_CHUNK) {
+    int n_blocks = (batch->n_blocks - block0 < BITSLICE_CHUNK) ? (int)(batch->n_blocks - block0) : BITSLICE_CHUNK;
+
+    // The key bytes of the planes are split over the threads, which each add
+    // to the sums of their own key bytes
+    for (int t = 0; t < plane_threads; t++)
+      threads.push_back(std::thread(build_planes<model_t>, state, batch, texts, block0, n_blocks, planes, t, plane_threads));
+    for (size_t i = 0; i < threads.size(); i++)
+      threads[i].join();
+    threads.clear();
+
+    for (int first = 0; first < n_samples; first += range) {
+      int last = (first + range > n_samples) ? n_samples : first + range;
+      threads.push_back(std::thread(accumulate_range<model_t>, state, group, batch, block0, n_blocks, (const uint64_t *)planes, first, last));
+    }
+    for (size_t i = 0; i < threads.size(); i++)
+      threads[i].join();
+    threads.clear();
+  }
+  state->n_traces += batch->n_traces;
+  free(planes);
+}
+
+void bitslice_accumulate(cpa_state_t *state, int group, int n_threads, const bitslice_batch_t *batch, const uint8_t *texts) {
+  DISPATCH_MODEL(state->model, accumulate_model, state, group, n_threads, batch, texts);
+}
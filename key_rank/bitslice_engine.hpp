@@ -0,0 +1,53 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef BITSLICE_ENGINE_H
+#define BITSLICE_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.cuh"
+#include "cpa_engine.hpp"
+
+// Traces of a block, one per bit of a word
+#define BITSLICE_TRACES 64
+
+// Raw sensor bits of a batch of traces, transposed: bit t of words[bit][block]
+// is the bit of the trace block * 64 + t (bit b of the 32-bit word w of a
+// trace being its bit w * 32 + b, as the samples of the raw traces). The bits
+// of the traces beyond the end of the batch are 0.
+typedef struct bitslice_batch {
+
+  int n_bits;
+  size_t n_traces;
+  size_t n_blocks;
+  size_t capacity;                  // blocks allocated
+  uint64_t *words;                  // [bit][block]
+
+} bitslice_batch_t;
+
+int bitslice_batch_init(bitslice_batch_t *batch, int n_bits);
+void bitslice_batch_free(bitslice_batch_t *batch);
+
+// Transposes the raw sensor words of n_traces traces, n_bits / 8 bytes per
+// trace as returned by a packed trace reader (trace_reader_keep_packed)
+int bitslice_transpose(bitslice_batch_t *batch, int n_threads, const uint8_t *traces, size_t n_traces);
+
+// Adds a transposed batch to a CPA state in exact mode without class sums,
+// whose samples are the groups of group consecutive bits of the traces
+// (n_samples = n_bits / group), a sample being the sum of the bits of its
+// group. The hypotheses of 64 traces are sliced into the bit planes of their
+// values, so that sum_wh of one key guess and one bit adds the popcounts of
+// the planes ANDed with the word of the bit, weighted by the planes. texts are
+// the ciphertexts for the last round model, the plaintexts for the first
+// round ones. The bits are split over the threads, so that the sums do not
+// depend on their number, and cpa_max_correlation works on the state as on
+// any other one.
+void bitslice_accumulate(cpa_state_t *state, int group, int n_threads, const bitslice_batch_t *batch, const uint8_t *texts);
+
+#endif
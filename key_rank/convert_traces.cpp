@@ -0,0 +1,323 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Native replacement of convert_traces.py for the hex sensor trace files
+(sensor_traces_*.csv written by the sakura_x host and by dump_sensor_trace of
+basys3). Every line is a trace and every comma-separated field a sample, given
+as the hexadecimal value of the sensor register; the converted sample is the
+Hamming weight of that value.
+
+The input file is memory mapped and split into one block of lines per thread.
+Every thread converts its lines in small batches and writes them at their
+final position in the output file, either as float32 samples (.data file, as
+convert_traces.py) or as uint8 samples (.bin file, as sensor_traces_hw_*.bin).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+// Number of traces converted by a thread before they are written to the output file
+#define WRITE_BATCH 4096
+
+#define FORMAT_DATA 0   // float32 samples
+#define FORMAT_BIN  1   // uint8 samples
+
+typedef struct convert_job {
+
+  const char *first;      // first line of the block
+  const char *end;        // end of the block
+  long first_trace;       // index of the first line in the file
+  long n_traces;          // number of lines of the block to convert
+  int n_samples;
+  int format;
+  int out_fd;
+  int status;             // EXIT_SUCCESS, or EXIT_FAILURE on a malformed line
+
+} convert_job_t;
+
+void print_help();
+void count_lines(const char *first, const char *end, long *count);
+void convert_block(convert_job_t *job);
+
+int main(int argc, char *argv[]) {
+
+  char *input_path = NULL;
+  char output_path[1000] = "";
+  long n_traces = -1;
+  int n_samples = -1;
+  int format = FORMAT_DATA;
+  int n_threads = 0;
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      print_help();
+      return 0;
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "data") == 0)
+        format = FORMAT_DATA;
+      else if (strcmp(argv[i], "bin") == 0)
+        format = FORMAT_BIN;
+      else {
+        printf("Unknown output format: %s\n", argv[i]);
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      i++;
+      snprintf(output_path, sizeof(output_path), "%s", argv[i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      n_threads = atoi(argv[i]);
+    } else if (positional == 0) {
+      input_path = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      n_traces = atol(argv[i]);
+      positional++;
+    } else if (positional == 2) {
+      n_samples = atoi(argv[i]);
+      positional++;
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (positional != 3 || n_traces <= 0 || n_samples <= 0) {
+    print_help();
+    return EXIT_FAILURE;
+  }
+
+  // Same default output file names as convert_traces.py and the sakura_x host
+  if (output_path[0] == '\0') {
+    snprintf(output_path, sizeof(output_path), "%s", input_path);
+    char *dot = strrchr(output_path, '.');
+    char *slash = strrchr(output_path, '/');
+    if (dot != NULL && (slash == NULL || dot > slash))
+      *dot = '\0';
+    strncat(output_path, format == FORMAT_DATA ? ".data" : "_hw.bin", sizeof(output_path) - strlen(output_path) - 1);
+  }
+  if (n_threads <= 0)
+    n_threads = (int)std::thread::hardware_concurrency();
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  printf("Converting %s to %s...\n", input_path, output_path);
+
+  int in_fd = open(input_path, O_RDONLY);
+  if (in_fd < 0) {
+    printf("Error in opening trace file %s\n", input_path);
+    return EXIT_FAILURE;
+  }
+  struct stat st;
+  if (fstat(in_fd, &st) != 0 || st.st_size == 0) {
+    printf("Trace file %s is empty\n", input_path);
+    close(in_fd);
+    return EXIT_FAILURE;
+  }
+  size_t size = st.st_size;
+  const char *map = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+  close(in_fd);
+  if (map == MAP_FAILED) {
+    printf("Error in mapping trace file %s\n", input_path);
+    return EXIT_FAILURE;
+  }
+  madvise((void *)map, size, MADV_SEQUENTIAL);
+
+  // Split the file into one block per thread, on line boundaries
+  std::vector<const char *> bounds;
+  bounds.push_back(map);
+  for (int t = 1; t < n_threads; t++) {
+    const char *p = map + size * t / n_threads;
+    if (p <= bounds.back())
+      continue;
+    const char *nl = (const char *)memchr(p - 1, '\n', map + size - (p - 1));
+    if (nl == NULL)
+      break;
+    if (nl + 1 > bounds.back() && nl + 1 < map + size)
+      bounds.push_back(nl + 1);
+  }
+  bounds.push_back(map + size);
+  int n_blocks = bounds.size() - 1;
+
+  // Index of the first line of every block, from the number of lines of the previous ones
+  std::vector<long> lines(n_blocks);
+  std::vector<std::thread> threads;
+  for (int b = 0; b < n_blocks; b++) {
+    threads.push_back(std::thread(count_lines, bounds[b], bounds[b + 1], &lines[b]));
+  }
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+  threads.clear();
+
+  long total = 0;
+  for (int b = 0; b < n_blocks; b++)
+    total += lines[b];
+  if (total < n_traces) {
+    printf("Trace file %s holds only %ld traces, converting them all\n", input_path, total);
+    n_traces = total;
+  }
+
+  int out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    printf("Error in opening output file %s\n", output_path);
+    munmap((void *)map, size);
+    return EXIT_FAILURE;
+  }
+  size_t sample_size = (format == FORMAT_DATA) ? sizeof(float) : sizeof(uint8_t);
+  if (ftruncate(out_fd, (off_t)n_traces * n_samples * sample_size) != 0)
+    printf("Error in resizing output file %s\n", output_path);
+
+  std::vector<convert_job_t> jobs(n_blocks);
+  long first_trace = 0;
+  for (int b = 0; b < n_blocks; b++) {
+    long count = lines[b];
+    if (first_trace + count > n_traces)
+      count = n_traces - first_trace;
+    jobs[b].first = bounds[b];
+    jobs[b].end = bounds[b + 1];
+    jobs[b].first_trace = first_trace;
+    jobs[b].n_traces = count > 0 ? count : 0;
+    jobs[b].n_samples = n_samples;
+    jobs[b].format = format;
+    jobs[b].out_fd = out_fd;
+    jobs[b].status = EXIT_SUCCESS;
+    first_trace += lines[b];
+  }
+  for (int b = 0; b < n_blocks; b++)
+    threads.push_back(std::thread(convert_block, &jobs[b]));
+  int status = EXIT_SUCCESS;
+  for (int b = 0; b < n_blocks; b++) {
+    threads[b].join();
+    if (jobs[b].status != EXIT_SUCCESS)
+      status = EXIT_FAILURE;
+  }
+
+  close(out_fd);
+  munmap((void *)map, size);
+
+  if (status == EXIT_SUCCESS)
+    printf("Converted %ld traces of %d samples\n", n_traces, n_samples);
+  return status;
+}
+
+void print_help() {
+  printf("Usage: ./convert-traces /path/to/sensor_traces.csv n_traces n_samples [-f data|bin] [-o output] [-j threads]\n");
+  printf("\t-f data: float32 Hamming weight samples, written to file.data (default, as convert_traces.py).\n");
+  printf("\t-f bin:  uint8 Hamming weight samples, written to file_hw.bin.\n");
+  printf("\t-o:      output file path.\n");
+  printf("\t-j:      number of threads (default: all cores).\n");
+}
+
+// Number of lines between first and end, including a last line without a final new line
+void count_lines(const char *first, const char *end, long *count) {
+  long n = 0;
+  const char *p = first;
+  while (p < end && (p = (const char *)memchr(p, '\n', end - p)) != NULL) {
+    n++;
+    p++;
+  }
+  if (end > first && end[-1] != '\n')
+    n++;
+  *count = n;
+}
+
+// Hamming weight of the len hexadecimal digits at hex. invalid is set if one
+// of them is not a hexadecimal digit. The loop has no branch and no table so
+// that the compiler vectorizes it.
+static inline int hex_hamming_weight(const char *hex, int len, int *invalid) {
+  int hw = 0;
+  int bad = 0;
+  for (int i = 0; i < len; i++) {
+    uint8_t c = hex[i];
+    uint8_t lower = c | 0x20;
+    bad |= !((uint8_t)(c - '0') < 10 || (uint8_t)(lower - 'a') < 6);
+    uint8_t v = (c & 0x0F) + 9 * (c >> 6);
+    hw += (v & 1) + ((v >> 1) & 1) + ((v >> 2) & 1) + ((v >> 3) & 1);
+  }
+  *invalid |= bad;
+  return hw;
+}
+
+// Converts the lines of one block and writes them to the output file
+void convert_block(convert_job_t *job) {
+
+  size_t sample_size = (job->format == FORMAT_DATA) ? sizeof(float) : sizeof(uint8_t);
+  size_t trace_size = sample_size * job->n_samples;
+  uint8_t *buffer = (uint8_t *)malloc(trace_size * WRITE_BATCH);
+  if (buffer == NULL) {
+    printf("----memory\n");
+    job->status = EXIT_FAILURE;
+    return;
+  }
+
+  const char *p = job->first;
+  long done = 0;
+  while (done < job->n_traces) {
+    long count = (job->n_traces - done < WRITE_BATCH) ? job->n_traces - done : WRITE_BATCH;
+
+    for (long t = 0; t < count; t++) {
+      const char *eol = (const char *)memchr(p, '\n', job->end - p);
+      if (eol == NULL)
+        eol = job->end;
+      const char *line_end = (eol > p && eol[-1] == '\r') ? eol - 1 : eol;
+      int invalid = 0;
+
+      for (int s = 0; s < job->n_samples; s++) {
+        const char *comma = (const char *)memchr(p, ',', line_end - p);
+        const char *field_end = (comma == NULL) ? line_end : comma;
+        if (p >= line_end && s < job->n_samples) {
+          printf("Trace %ld holds less than %d samples\n", job->first_trace + done + t, job->n_samples);
+          job->status = EXIT_FAILURE;
+          free(buffer);
+          return;
+        }
+        int hw = hex_hamming_weight(p, field_end - p, &invalid);
+        if (job->format == FORMAT_DATA)
+          ((float *)buffer)[t * job->n_samples + s] = (float)hw;
+        else
+          buffer[t * job->n_samples + s] = (uint8_t)(hw > 255 ? 255 : hw);
+        p = (comma == NULL) ? line_end : comma + 1;
+      }
+      if (invalid) {
+        printf("Trace %ld holds a sample that is not a hexadecimal value\n", job->first_trace + done + t);
+        job->status = EXIT_FAILURE;
+        free(buffer);
+        return;
+      }
+      p = (eol < job->end) ? eol + 1 : job->end;
+    }
+
+    off_t offset = (off_t)(job->first_trace + done) * trace_size;
+    size_t bytes = trace_size * count;
+    size_t written = 0;
+    while (written < bytes) {
+      ssize_t w = pwrite(job->out_fd, buffer + written, bytes - written, offset + written);
+      if (w <= 0) {
+        printf("Error in writing the output file\n");
+        job->status = EXIT_FAILURE;
+        free(buffer);
+        return;
+      }
+      written += w;
+    }
+    done += count;
+  }
+
+  free(buffer);
+}
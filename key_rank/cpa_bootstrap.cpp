@@ -0,0 +1,150 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "cpa_bootstrap.hpp"
+#include <thread>
+#include <vector>
+
+static inline uint64_t splitmix64(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+// The chunks are counted as float32 traces, the largest samples
+size_t cpa_bootstrap_size(int n_rounds, int n_threads, int n_samples, int classes, int model) {
+  if (n_threads > n_rounds)
+    n_threads = n_rounds;
+  return cpa_state_size(n_samples, classes, model, 0) * n_rounds
+      + (sizeof(float) * n_samples + KEYBYTES) * BOOTSTRAP_CHUNK * n_threads;
+}
+
+int cpa_bootstrap_init(cpa_bootstrap_t *bootstrap, int n_rounds, int factor, uint64_t seed, int n_samples, int exact, int classes, int model) {
+  memset(bootstrap, 0, sizeof(cpa_bootstrap_t));
+  bootstrap->n_rounds = n_rounds;
+  bootstrap->factor = factor;
+  bootstrap->seed = seed;
+  bootstrap->rounds = (cpa_state_t *)malloc(sizeof(cpa_state_t) * n_rounds);
+  bootstrap->ranks = (int *)malloc(sizeof(int) * n_rounds * KEYBYTES);
+  if (bootstrap->rounds == NULL || bootstrap->ranks == NULL) {
+    printf("----memory\n");
+    free(bootstrap->rounds);
+    free(bootstrap->ranks);
+    return EXIT_FAILURE;
+  }
+  for (int r = 0; r < n_rounds; r++) {
+    if (cpa_state_init(&bootstrap->rounds[r], n_samples, exact, classes, model, 0) == EXIT_FAILURE) {
+      bootstrap->n_rounds = r;
+      cpa_bootstrap_free(bootstrap);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+void cpa_bootstrap_free(cpa_bootstrap_t *bootstrap) {
+  for (int r = 0; r < bootstrap->n_rounds; r++)
+    cpa_state_free(&bootstrap->rounds[r]);
+  free(bootstrap->rounds);
+  free(bootstrap->ranks);
+  memset(bootstrap, 0, sizeof(cpa_bootstrap_t));
+}
+
+// Subsamples the traces for the rounds first, first + step, ... Every round
+// copies the trace it keeps of every block of factor traces, at a position
+// drawn from the round and the block, to a chunk of BOOTSTRAP_CHUNK traces
+// that is accumulated when it is full.
+template <typename sample_t>
+static void subsample_rounds(cpa_bootstrap_t *bootstrap, int first, int step, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  int n_samples = bootstrap->rounds[0].n_samples;
+  sample_t *chunk_traces = (sample_t *)malloc(sizeof(sample_t) * BOOTSTRAP_CHUNK * n_samples);
+  uint8_t *chunk_texts = (uint8_t *)malloc(sizeof(uint8_t) * BOOTSTRAP_CHUNK * KEYBYTES);
+  if (chunk_traces == NULL || chunk_texts == NULL) {
+    printf("----memory\n");
+    free(chunk_traces);
+    free(chunk_texts);
+    return;
+  }
+
+  for (int r = first; r < bootstrap->n_rounds; r += step) {
+    cpa_state_t *state = &bootstrap->rounds[r];
+    uint64_t round_seed = splitmix64(bootstrap->seed ^ ((uint64_t)r << 40));
+    uint64_t factor = (uint64_t)bootstrap->factor;
+    uint64_t end = bootstrap->n_read + n_traces;
+    size_t n_chunk = 0;
+    for (uint64_t block = bootstrap->n_read / factor; block * factor < end; block++) {
+      uint64_t trace = block * factor + splitmix64(round_seed + block) % factor;
+      if (trace < bootstrap->n_read || trace >= end)
+        continue;
+      size_t t = (size_t)(trace - bootstrap->n_read);
+      memcpy(&chunk_traces[n_chunk * n_samples], &traces[t * n_samples], sizeof(sample_t) * n_samples);
+      memcpy(&chunk_texts[n_chunk * KEYBYTES], &texts[t * KEYBYTES], KEYBYTES);
+      if (++n_chunk == BOOTSTRAP_CHUNK) {
+        cpa_accumulate(state, chunk_traces, chunk_texts, n_chunk);
+        n_chunk = 0;
+      }
+    }
+    if (n_chunk > 0)
+      cpa_accumulate(state, chunk_traces, chunk_texts, n_chunk);
+  }
+
+  free(chunk_traces);
+  free(chunk_texts);
+}
+
+template <typename sample_t>
+static void bootstrap_accumulate(cpa_bootstrap_t *bootstrap, int n_threads, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  std::vector<std::thread> threads;
+  if (n_threads > bootstrap->n_rounds)
+    n_threads = bootstrap->n_rounds;
+  for (int i = 0; i < n_threads; i++)
+    threads.push_back(std::thread(subsample_rounds<sample_t>, bootstrap, i, n_threads, traces, texts, n_traces));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  bootstrap->n_read += n_traces;
+}
+
+void cpa_bootstrap_accumulate(cpa_bootstrap_t *bootstrap, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces) {
+  bootstrap_accumulate(bootstrap, n_threads, traces, texts, n_traces);
+}
+
+void cpa_bootstrap_accumulate(cpa_bootstrap_t *bootstrap, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  bootstrap_accumulate(bootstrap, n_threads, traces, texts, n_traces);
+}
+
+// Ranks of the rounds first, first + step, ...: the number of key guesses
+// with a higher correlation than the correct one
+static void rank_rounds(cpa_bootstrap_t *bootstrap, int first, int step, const int *key) {
+  double *maxCorrelation = (double *)malloc(sizeof(double) * KEYS * KEYBYTES);
+  if (maxCorrelation == NULL) {
+    printf("----memory\n");
+    return;
+  }
+  for (int r = first; r < bootstrap->n_rounds; r += step) {
+    cpa_max_correlation(&bootstrap->rounds[r], maxCorrelation, 1);
+    for (int n = 0; n < KEYBYTES; n++) {
+      double correct = maxCorrelation[key[n] * KEYBYTES + n];
+      int rank = 0;
+      for (int k = 0; k < KEYS; k++)
+        rank += maxCorrelation[k * KEYBYTES + n] > correct;
+      bootstrap->ranks[r * KEYBYTES + n] = rank;
+    }
+  }
+  free(maxCorrelation);
+}
+
+void cpa_bootstrap_ranks(cpa_bootstrap_t *bootstrap, int n_threads, const int key[KEYBYTES]) {
+  std::vector<std::thread> threads;
+  if (n_threads > bootstrap->n_rounds)
+    n_threads = bootstrap->n_rounds;
+  for (int i = 0; i < n_threads; i++)
+    threads.push_back(std::thread(rank_rounds, bootstrap, i, n_threads, key));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
@@ -0,0 +1,51 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef CPA_BOOTSTRAP_H
+#define CPA_BOOTSTRAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.cuh"
+#include "cpa_engine.hpp"
+
+// Number of subsampled traces gathered by a round before they are accumulated
+#define BOOTSTRAP_CHUNK 1024
+
+// Bootstrap attacks run along the main attack, in the same pass over the
+// traces. Every round keeps one trace of every block of factor traces of the
+// files, without replacement, so that at a checkpoint of i traces the state
+// of a round holds a real attack on i / factor distinct traces of the first
+// i. The kept traces only depend on the seed, the round and the index of the
+// block in the files: the results do not depend on the batches nor on the
+// threads.
+typedef struct cpa_bootstrap {
+
+  int n_rounds;
+  int factor;
+  uint64_t seed;
+  uint64_t n_read;              // index in the files of the next trace
+  cpa_state_t *rounds;          // [round]
+  int *ranks;                   // [round][key byte], rank of the correct key byte at the last checkpoint
+
+} cpa_bootstrap_t;
+
+// Memory of the rounds of one model and of the subsampled chunks of n_threads threads
+size_t cpa_bootstrap_size(int n_rounds, int n_threads, int n_samples, int classes, int model);
+
+int cpa_bootstrap_init(cpa_bootstrap_t *bootstrap, int n_rounds, int factor, uint64_t seed, int n_samples, int exact, int classes, int model);
+void cpa_bootstrap_free(cpa_bootstrap_t *bootstrap);
+
+// Adds the next n_traces traces of the files to the rounds, which are run in parallel on n_threads threads
+void cpa_bootstrap_accumulate(cpa_bootstrap_t *bootstrap, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces);
+void cpa_bootstrap_accumulate(cpa_bootstrap_t *bootstrap, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces);
+
+// Computes the rank of every byte of key (0: first guess) in every round
+void cpa_bootstrap_ranks(cpa_bootstrap_t *bootstrap, int n_threads, const int key[KEYBYTES]);
+
+#endif
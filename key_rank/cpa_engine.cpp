@@ -0,0 +1,739 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "cpa_engine.hpp"
+#include "aes_tables.hpp"
+#include "leakage_models.hpp"
+#include <math.h>
+#include <thread>
+#include <vector>
+
+// Tile sizes of the GEMM computing sum_wh: traces per tile, samples per tile,
+// and the hypotheses x samples block of the micro kernel, held in registers
+#define GEMM_TRACES 128
+#define GEMM_SAMPLES 256
+#define GEMM_MR 4
+#define GEMM_NR 8
+
+// Key guesses computed together from the class sums in class mode
+#define CLASS_GUESSES 8
+
+// bit_pairs.pairs[d][b * 8 + b2] = 1 if the bits b and b2 of d are set
+typedef struct bit_pairs {
+  uint8_t pairs[KEYS][CLASS_COUNTS - 1];
+} bit_pairs_t;
+
+static bit_pairs_t make_bit_pairs() {
+  bit_pairs_t table;
+  for (int d = 0; d < KEYS; d++)
+    for (int b = 0; b < 8; b++)
+      for (int b2 = 0; b2 < 8; b2++)
+        table.pairs[d][b * 8 + b2] = ((d >> b) & 1) & ((d >> b2) & 1);
+  return table;
+}
+
+static const bit_pairs_t BIT_PAIRS = make_bit_pairs();
+
+int get_n_threads(int requested) {
+  if (requested > 0)
+    return requested;
+  int n = (int)std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+int cpa_class_rows(int model) {
+  return model_first_round(model) ? 1 : CLASS_ROWS;
+}
+
+size_t cpa_class_size(int n_samples, int model) {
+  return sizeof(double) * KEYBYTES * KEYS * cpa_class_rows(model) * n_samples;
+}
+
+int cpa_worker_model(const int *models, int n_models) {
+  int model = models[0];
+  for (int m = 0; m < n_models; m++) {
+    if (!model_first_round(models[m]))
+      model = models[m];
+  }
+  return model;
+}
+
+// The uint64_t and double sums have the same size
+size_t cpa_state_size(int n_samples, int classes, int model, int worker) {
+  size_t size = sizeof(cpa_state_t) + sizeof(double) * 2 * n_samples;
+  if (!(classes && worker))
+    size += sizeof(double) * KEYBYTES * KEYS * n_samples;
+  if (classes)
+    size += cpa_class_size(n_samples, model) + sizeof(uint64_t) * KEYBYTES * KEYS * CLASS_COUNTS;
+  return size;
+}
+
+size_t cpa_states_size(int n_samples, int classes, const int *models, int n_models, int n_threads) {
+  size_t size = cpa_state_size(n_samples, classes, cpa_worker_model(models, n_models), 1) * n_threads;
+  for (int m = 0; m < n_models; m++)
+    size += cpa_state_size(n_samples, classes, models[m], 0);
+  return size;
+}
+
+int cpa_fit_threads(int n_samples, int classes, const int *models, int n_models, int n_threads, size_t limit) {
+  while (n_threads >= 0 && cpa_states_size(n_samples, classes, models, n_models, n_threads) > limit)
+    n_threads--;
+  return n_threads > 0 ? n_threads : 0;
+}
+
+int cpa_state_init(cpa_state_t *state, int n_samples, int exact, int classes, int model, int worker) {
+  size_t n_wh = (size_t)KEYBYTES * KEYS * n_samples;
+  size_t n_class = (size_t)KEYBYTES * KEYS * cpa_class_rows(model) * n_samples;
+  size_t n_count = (size_t)KEYBYTES * KEYS * CLASS_COUNTS;
+
+  memset(state, 0, sizeof(cpa_state_t));
+  state->n_samples = n_samples;
+  state->exact = exact;
+  state->classes = classes;
+  state->model = model;
+  state->rows = cpa_class_rows(model);
+  state->worker = classes && worker;
+  if (exact) {
+    state->exact_w = (uint64_t *)malloc(sizeof(uint64_t) * n_samples);
+    state->exact_w2 = (uint64_t *)malloc(sizeof(uint64_t) * n_samples);
+    if (!state->worker)
+      state->exact_wh = (uint64_t *)malloc(sizeof(uint64_t) * n_wh);
+    if (classes)
+      state->exact_class = (uint64_t *)malloc(sizeof(uint64_t) * n_class);
+  } else {
+    state->sum_w = (double *)malloc(sizeof(double) * n_samples);
+    state->sum_w2 = (double *)malloc(sizeof(double) * n_samples);
+    if (!state->worker)
+      state->sum_wh = (double *)malloc(sizeof(double) * n_wh);
+    if (classes)
+      state->sum_class = (double *)malloc(sizeof(double) * n_class);
+  }
+  if ((exact ? (state->exact_w == NULL || state->exact_w2 == NULL || (!state->worker && state->exact_wh == NULL))
+             : (state->sum_w == NULL || state->sum_w2 == NULL || (!state->worker && state->sum_wh == NULL)))
+      || (classes && state->sum_class == NULL && state->exact_class == NULL)
+      || (classes && (state->class_count = (uint64_t *)malloc(sizeof(uint64_t) * n_count)) == NULL)) {
+    printf("----memory\n");
+    cpa_state_free(state);
+    return EXIT_FAILURE;
+  }
+  cpa_state_reset(state);
+  return EXIT_SUCCESS;
+}
+
+void cpa_state_reset(cpa_state_t *state) {
+  size_t n_wh = (size_t)KEYBYTES * KEYS * state->n_samples;
+  size_t n_class = (size_t)KEYBYTES * KEYS * state->rows * state->n_samples;
+
+  state->n_traces = 0;
+  if (state->classes)
+    memset(state->class_count, 0, sizeof(uint64_t) * KEYBYTES * KEYS * CLASS_COUNTS);
+  if (state->exact) {
+    memset(state->exact_h, 0, sizeof(state->exact_h));
+    memset(state->exact_h2, 0, sizeof(state->exact_h2));
+    memset(state->exact_w, 0, sizeof(uint64_t) * state->n_samples);
+    memset(state->exact_w2, 0, sizeof(uint64_t) * state->n_samples);
+    if (!state->worker)
+      memset(state->exact_wh, 0, sizeof(uint64_t) * n_wh);
+    if (state->classes)
+      memset(state->exact_class, 0, sizeof(uint64_t) * n_class);
+  } else {
+    memset(state->sum_h, 0, sizeof(state->sum_h));
+    memset(state->sum_h2, 0, sizeof(state->sum_h2));
+    memset(state->sum_w, 0, sizeof(double) * state->n_samples);
+    memset(state->sum_w2, 0, sizeof(double) * state->n_samples);
+    if (!state->worker)
+      memset(state->sum_wh, 0, sizeof(double) * n_wh);
+    if (state->classes)
+      memset(state->sum_class, 0, sizeof(double) * n_class);
+  }
+}
+
+void cpa_state_free(cpa_state_t *state) {
+  free(state->sum_w);
+  free(state->sum_w2);
+  free(state->sum_wh);
+  free(state->exact_w);
+  free(state->exact_w2);
+  free(state->exact_wh);
+  free(state->sum_class);
+  free(state->exact_class);
+  free(state->class_count);
+  state->sum_w = NULL;
+  state->sum_w2 = NULL;
+  state->sum_wh = NULL;
+  state->exact_w = NULL;
+  state->exact_w2 = NULL;
+  state->exact_wh = NULL;
+  state->sum_class = NULL;
+  state->exact_class = NULL;
+  state->class_count = NULL;
+}
+
+// In class mode only the class sums are merged: sum_wh is computed from them
+void cpa_state_merge(cpa_state_t *dst, const cpa_state_t *src) {
+  size_t n_wh = (size_t)KEYBYTES * KEYS * dst->n_samples;
+  size_t n_class = (size_t)KEYBYTES * KEYS * dst->rows * dst->n_samples;
+
+  dst->n_traces += src->n_traces;
+  if (dst->classes) {
+    for (int i = 0; i < KEYBYTES * KEYS * CLASS_COUNTS; i++)
+      dst->class_count[i] += src->class_count[i];
+  }
+  if (dst->exact) {
+    for (int i = 0; i < KEYS * KEYBYTES; i++) {
+      dst->exact_h[i] += src->exact_h[i];
+      dst->exact_h2[i] += src->exact_h2[i];
+    }
+    for (int i = 0; i < dst->n_samples; i++) {
+      dst->exact_w[i] += src->exact_w[i];
+      dst->exact_w2[i] += src->exact_w2[i];
+    }
+    if (dst->classes) {
+      for (size_t i = 0; i < n_class; i++)
+        dst->exact_class[i] += src->exact_class[i];
+    } else {
+      for (size_t i = 0; i < n_wh; i++)
+        dst->exact_wh[i] += src->exact_wh[i];
+    }
+    return;
+  }
+
+  for (int i = 0; i < KEYS * KEYBYTES; i++) {
+    dst->sum_h[i] += src->sum_h[i];
+    dst->sum_h2[i] += src->sum_h2[i];
+  }
+  for (int i = 0; i < dst->n_samples; i++) {
+    dst->sum_w[i] += src->sum_w[i];
+    dst->sum_w2[i] += src->sum_w2[i];
+  }
+  if (dst->classes) {
+    for (size_t i = 0; i < n_class; i++)
+      dst->sum_class[i] += src->sum_class[i];
+  } else {
+    for (size_t i = 0; i < n_wh; i++)
+      dst->sum_wh[i] += src->sum_wh[i];
+  }
+}
+
+// Adds n_traces traces (n_samples samples each) and their 16-byte texts to
+// the accumulators. The hypotheses are those of model_t; the last round one
+// is HD(inv_sbox[ct[n] ^ key], ct[inv_shift[n]]), read from the HD table as
+// in hamming() of CPA_GPU.cu.
+//
+// sum_wh is the matrix product of the hypotheses (KEYBYTES * KEYS x traces)
+// and the traces (traces x samples). It is computed as a blocked GEMM: the
+// traces are taken by tiles of GEMM_TRACES, the samples by tiles of
+// GEMM_SAMPLES, packed in panels of GEMM_NR samples, and the hypotheses by
+// blocks of GEMM_MR. The micro kernel keeps a GEMM_MR x GEMM_NR block of
+// sum_wh in registers over the whole trace tile, with the hypothesis block
+// in L1 and the trace tile in L2.
+template <typename model_t, typename sample_t>
+static void accumulate(cpa_state_t *state, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  int n_samples = state->n_samples;
+  int n_hyp = KEYBYTES * KEYS;
+
+  // Hypotheses of the trace tile, [key byte][key guess][trace]
+  uint8_t *hyp = (uint8_t *)malloc(sizeof(uint8_t) * n_hyp * GEMM_TRACES);
+  // Trace tile, [panel][trace][GEMM_NR samples], and hypothesis block, [trace][GEMM_MR]
+  double *b_pack = (double *)malloc(sizeof(double) * GEMM_SAMPLES * GEMM_TRACES);
+  double *a_pack = (double *)malloc(sizeof(double) * GEMM_MR * GEMM_TRACES);
+  if (hyp == NULL || b_pack == NULL || a_pack == NULL) {
+    printf("----memory\n");
+    free(hyp);
+    free(b_pack);
+    free(a_pack);
+    return;
+  }
+
+  for (size_t first = 0; first < n_traces; first += GEMM_TRACES) {
+    int tile = (n_traces - first < GEMM_TRACES) ? (int)(n_traces - first) : GEMM_TRACES;
+
+    for (int t = 0; t < tile; t++) {
+      const sample_t *wave = &traces[(first + t) * n_samples];
+      const uint8_t *text = &texts[(first + t) * KEYBYTES];
+
+      for (int s = 0; s < n_samples; s++) {
+        double w = (double)wave[s];
+        state->sum_w[s] += w;
+        state->sum_w2[s] += w * w;
+      }
+
+      for (int n = 0; n < KEYBYTES; n++) {
+        uint8_t c = text[n];
+        const uint8_t *row = model_t::row(model_t::select(text, n));
+        for (int k = 0; k < KEYS; k++) {
+          int h = row[c ^ k];
+          state->sum_h[k * KEYBYTES + n] += h;
+          state->sum_h2[k * KEYBYTES + n] += h * h;
+          hyp[(n * KEYS + k) * GEMM_TRACES + t] = h;
+        }
+      }
+    }
+
+    for (int s0 = 0; s0 < n_samples; s0 += GEMM_SAMPLES) {
+      int width = (n_samples - s0 < GEMM_SAMPLES) ? n_samples - s0 : GEMM_SAMPLES;
+      int n_panels = (width + GEMM_NR - 1) / GEMM_NR;
+
+      // Pack the trace tile, padded with zeros up to a whole panel
+      for (int p = 0; p < n_panels; p++) {
+        double *panel = &b_pack[p * GEMM_TRACES * GEMM_NR];
+        for (int t = 0; t < tile; t++) {
+          const sample_t *wave = &traces[(first + t) * n_samples + s0 + p * GEMM_NR];
+          int valid = (width - p * GEMM_NR < GEMM_NR) ? width - p * GEMM_NR : GEMM_NR;
+          for (int j = 0; j < GEMM_NR; j++)
+            panel[t * GEMM_NR + j] = (j < valid) ? (double)wave[j] : 0.0;
+        }
+      }
+
+      for (int i0 = 0; i0 < n_hyp; i0 += GEMM_MR) {
+        for (int t = 0; t < tile; t++)
+          for (int r = 0; r < GEMM_MR; r++)
+            a_pack[t * GEMM_MR + r] = hyp[(i0 + r) * GEMM_TRACES + t];
+
+        for (int p = 0; p < n_panels; p++) {
+          const double *panel = &b_pack[p * GEMM_TRACES * GEMM_NR];
+          double acc[GEMM_MR][GEMM_NR] = {{0}};
+
+          for (int t = 0; t < tile; t++) {
+            const double *a = &a_pack[t * GEMM_MR];
+            const double *b = &panel[t * GEMM_NR];
+            for (int r = 0; r < GEMM_MR; r++)
+              for (int j = 0; j < GEMM_NR; j++)
+                acc[r][j] += a[r] * b[j];
+          }
+
+          int valid = (width - p * GEMM_NR < GEMM_NR) ? width - p * GEMM_NR : GEMM_NR;
+          for (int r = 0; r < GEMM_MR; r++) {
+            double *wh = &state->sum_wh[(size_t)(i0 + r) * n_samples + s0 + p * GEMM_NR];
+            for (int j = 0; j < valid; j++)
+              wh[j] += acc[r][j];
+          }
+        }
+      }
+    }
+  }
+  state->n_traces += n_traces;
+
+  free(hyp);
+  free(b_pack);
+  free(a_pack);
+}
+
+// Exact mode of accumulate for uint8 traces: the same blocked GEMM on 32-bit
+// integer lanes, flushed into the 64-bit sums after every trace tile. A tile
+// adds at most GEMM_TRACES * 255 * 255 to a lane, far below 2^32.
+template <typename model_t>
+static void accumulate_exact(cpa_state_t *state, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  int n_samples = state->n_samples;
+  int n_hyp = KEYBYTES * KEYS;
+
+  uint8_t *hyp = (uint8_t *)malloc(sizeof(uint8_t) * n_hyp * GEMM_TRACES);
+  uint32_t *b_pack = (uint32_t *)malloc(sizeof(uint32_t) * (GEMM_SAMPLES + GEMM_NR) * GEMM_TRACES);
+  uint32_t *a_pack = (uint32_t *)malloc(sizeof(uint32_t) * GEMM_MR * GEMM_TRACES);
+  if (hyp == NULL || b_pack == NULL || a_pack == NULL) {
+    printf("----memory\n");
+    free(hyp);
+    free(b_pack);
+    free(a_pack);
+    return;
+  }
+
+  for (size_t first = 0; first < n_traces; first += GEMM_TRACES) {
+    int tile = (n_traces - first < GEMM_TRACES) ? (int)(n_traces - first) : GEMM_TRACES;
+
+    for (int t = 0; t < tile; t++) {
+      const uint8_t *wave = &traces[(first + t) * n_samples];
+      const uint8_t *text = &texts[(first + t) * KEYBYTES];
+
+      for (int s = 0; s < n_samples; s++) {
+        uint32_t w = wave[s];
+        state->exact_w[s] += w;
+        state->exact_w2[s] += w * w;
+      }
+
+      for (int n = 0; n < KEYBYTES; n++) {
+        uint8_t c = text[n];
+        const uint8_t *row = model_t::row(model_t::select(text, n));
+        for (int k = 0; k < KEYS; k++) {
+          uint32_t h = row[c ^ k];
+          state->exact_h[k * KEYBYTES + n] += h;
+          state->exact_h2[k * KEYBYTES + n] += h * h;
+          hyp[(n * KEYS + k) * GEMM_TRACES + t] = h;
+        }
+      }
+    }
+
+    for (int s0 = 0; s0 < n_samples; s0 += GEMM_SAMPLES) {
+      int width = (n_samples - s0 < GEMM_SAMPLES) ? n_samples - s0 : GEMM_SAMPLES;
+      int n_panels = (width + GEMM_NR - 1) / GEMM_NR;
+
+      for (int p = 0; p < n_panels; p++) {
+        uint32_t *panel = &b_pack[p * GEMM_TRACES * GEMM_NR];
+        int valid = (width - p * GEMM_NR < GEMM_NR) ? width - p * GEMM_NR : GEMM_NR;
+        for (int t = 0; t < tile; t++) {
+          const uint8_t *wave = &traces[(first + t) * n_samples + s0 + p * GEMM_NR];
+          for (int j = 0; j < GEMM_NR; j++)
+            panel[t * GEMM_NR + j] = (j < valid) ? wave[j] : 0;
+        }
+      }
+
+      for (int i0 = 0; i0 < n_hyp; i0 += GEMM_MR) {
+        for (int t = 0; t < tile; t++)
+          for (int r = 0; r < GEMM_MR; r++)
+            a_pack[t * GEMM_MR + r] = hyp[(i0 + r) * GEMM_TRACES + t];
+
+        for (int p = 0; p < n_panels; p++) {
+          const uint32_t *panel = &b_pack[p * GEMM_TRACES * GEMM_NR];
+          uint32_t acc[GEMM_MR][GEMM_NR] = {{0}};
+
+          for (int t = 0; t < tile; t++) {
+            const uint32_t *a = &a_pack[t * GEMM_MR];
+            const uint32_t *b = &panel[t * GEMM_NR];
+            for (int r = 0; r < GEMM_MR; r++)
+              for (int j = 0; j < GEMM_NR; j++)
+                acc[r][j] += a[r] * b[j];
+          }
+
+          int valid = (width - p * GEMM_NR < GEMM_NR) ? width - p * GEMM_NR : GEMM_NR;
+          for (int r = 0; r < GEMM_MR; r++) {
+            uint64_t *wh = &state->exact_wh[(size_t)(i0 + r) * n_samples + s0 + p * GEMM_NR];
+            for (int j = 0; j < valid; j++)
+              wh[j] += acc[r][j];
+          }
+        }
+      }
+    }
+  }
+  state->n_traces += n_traces;
+
+  free(hyp);
+  free(b_pack);
+  free(a_pack);
+}
+
+// Class mode of accumulate. The hypothesis of key byte n only depends on the
+// text bytes c = text[n] and d = select(text, n) of the model. For the last
+// round model, d = ct[inv_shift[n]] and
+// HD(inv_sbox[c ^ k], d) = HW(inv_sbox[c ^ k]) + sum over the bits b of d of
+// (1 - 2 * bit b of inv_sbox[c ^ k]); the first round models do not depend
+// on d (always 0). So every trace is only added to the class sums of c: once
+// to the total row, and once to the row of every bit set in d. The sums of H
+// and H^2 likewise only need the number of traces of the class whose d has
+// the bits b and b' set. class_to_wh then computes the sums of all the key
+// guesses from the class sums, at a cost that does not depend on the number
+// of traces.
+template <typename model_t, typename sample_t, typename sum_t>
+static void accumulate_classes(cpa_state_t *state, sum_t *sum_w, sum_t *sum_w2, sum_t *sum_class, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  int n_samples = state->n_samples;
+  int rows = state->rows;
+
+  for (size_t t = 0; t < n_traces; t++) {
+    const sample_t *wave = &traces[t * n_samples];
+    const uint8_t *text = &texts[t * KEYBYTES];
+
+    for (int s = 0; s < n_samples; s++) {
+      sum_t w = wave[s];
+      sum_w[s] += w;
+      sum_w2[s] += w * w;
+    }
+
+    for (int n = 0; n < KEYBYTES; n++) {
+      uint8_t c = text[n];
+      uint8_t d = model_t::select(text, n);
+
+      uint64_t *count = &state->class_count[(n * KEYS + c) * CLASS_COUNTS];
+      const uint8_t *pairs = BIT_PAIRS.pairs[d];
+      for (int i = 0; i < CLASS_COUNTS - 1; i++)
+        count[i] += pairs[i];
+      count[CLASS_COUNTS - 1]++;
+
+      sum_t *cls = &sum_class[(size_t)(n * KEYS + c) * rows * n_samples];
+      sum_t *total = &cls[(rows - 1) * n_samples];
+      for (int s = 0; s < n_samples; s++)
+        total[s] += wave[s];
+      for (int b = 0; b < 8; b++) {
+        if ((d >> b) & 1) {
+          sum_t *bit = &cls[b * n_samples];
+          for (int s = 0; s < n_samples; s++)
+            bit[s] += wave[s];
+        }
+      }
+    }
+  }
+  state->n_traces += n_traces;
+}
+
+template <typename model_t>
+static void accumulate_model(cpa_state_t *state, const float *traces, const uint8_t *texts, size_t n_traces) {
+  if (state->exact)
+    printf("The exact mode only accumulates uint8 traces\n");
+  else if (state->classes)
+    accumulate_classes<model_t>(state, state->sum_w, state->sum_w2, state->sum_class, traces, texts, n_traces);
+  else
+    accumulate<model_t>(state, traces, texts, n_traces);
+}
+
+template <typename model_t>
+static void accumulate_model(cpa_state_t *state, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  if (state->classes && state->exact)
+    accumulate_classes<model_t>(state, state->exact_w, state->exact_w2, state->exact_class, traces, texts, n_traces);
+  else if (state->classes)
+    accumulate_classes<model_t>(state, state->sum_w, state->sum_w2, state->sum_class, traces, texts, n_traces);
+  else if (state->exact)
+    accumulate_exact<model_t>(state, traces, texts, n_traces);
+  else
+    accumulate<model_t>(state, traces, texts, n_traces);
+}
+
+void cpa_accumulate(cpa_state_t *state, const float *traces, const uint8_t *texts, size_t n_traces) {
+  DISPATCH_MODEL(state->model, accumulate_model, state, traces, texts, n_traces);
+}
+
+void cpa_accumulate(cpa_state_t *state, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  DISPATCH_MODEL(state->model, accumulate_model, state, traces, texts, n_traces);
+}
+
+// Splits the traces into one contiguous block per thread, accumulates every
+// block into its own worker state and merges the workers into state in thread
+// order. The workers are left reset.
+template <typename sample_t>
+static void accumulate_parallel(cpa_state_t *state, cpa_state_t *workers, int n_threads, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  std::vector<std::thread> threads;
+  size_t block = (n_traces + n_threads - 1) / n_threads;
+
+  for (int i = 0; i < n_threads; i++) {
+    size_t start = i * block;
+    if (start >= n_traces)
+      break;
+    size_t count = (start + block > n_traces) ? n_traces - start : block;
+    void (*worker)(cpa_state_t *, const sample_t *, const uint8_t *, size_t) = cpa_accumulate;
+    workers[i].model = state->model;
+    workers[i].rows = state->rows;
+    threads.push_back(std::thread(worker, &workers[i], &traces[start * state->n_samples], &texts[start * KEYBYTES], count));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    cpa_state_merge(state, &workers[i]);
+    cpa_state_reset(&workers[i]);
+  }
+}
+
+void cpa_accumulate_parallel(cpa_state_t *state, cpa_state_t *workers, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces) {
+  accumulate_parallel(state, workers, n_threads, traces, texts, n_traces);
+}
+
+void cpa_accumulate_parallel(cpa_state_t *state, cpa_state_t *workers, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  accumulate_parallel(state, workers, n_threads, traces, texts, n_traces);
+}
+
+// Computes sum_wh, sum_h and sum_h2 (exact_) of the hypotheses first to last
+// of the class mode from the class sums, as described in accumulate_classes.
+// The key guesses are taken by blocks of CLASS_GUESSES, so that every class
+// sum is read once per block.
+template <typename model_t, typename sum_t, typename wh_t, typename h_t>
+static void class_to_wh(const cpa_state_t *state, const sum_t *sum_class, wh_t *sum_wh, h_t *sum_h, h_t *sum_h2, int first, int last) {
+  int n_samples = state->n_samples;
+  int rows = state->rows;
+  wh_t *acc = (wh_t *)malloc(sizeof(wh_t) * CLASS_GUESSES * n_samples);
+  if (acc == NULL) {
+    printf("----memory\n");
+    return;
+  }
+
+  for (int hyp = first; hyp < last; hyp += CLASS_GUESSES) {
+    int n = hyp / KEYS;
+    int k0 = hyp % KEYS;
+    int n_guesses = CLASS_GUESSES;
+    if (n_guesses > last - hyp)
+      n_guesses = last - hyp;
+    if (n_guesses > KEYS - k0)
+      n_guesses = KEYS - k0;
+    int64_t sigmaH[CLASS_GUESSES] = {0}, sigmaH2[CLASS_GUESSES] = {0};
+    wh_t coef[CLASS_GUESSES][CLASS_ROWS];
+
+    for (int i = 0; i < CLASS_GUESSES * n_samples; i++)
+      acc[i] = 0;
+    for (int c = 0; c < KEYS; c++) {
+      const sum_t *cls = &sum_class[(size_t)(n * KEYS + c) * rows * n_samples];
+      const uint64_t *count = &state->class_count[(n * KEYS + c) * CLASS_COUNTS];
+
+      for (int g = 0; g < n_guesses; g++) {
+        // Hypothesis for d = 0, and change of it with bit b of d
+        uint8_t x = c ^ (k0 + g);
+        int64_t hw = model_t::row(0)[x];
+        int64_t sign[8];
+        int64_t linear = 0, square = 0;
+
+        for (int b = 0; b < 8; b++)
+          sign[b] = (int64_t)model_t::row(1 << b)[x] - hw;
+        for (int b = 0; b < 8; b++) {
+          linear += sign[b] * (int64_t)count[b * 8 + b];
+          for (int b2 = 0; b2 < 8; b2++)
+            square += sign[b] * sign[b2] * (int64_t)count[b * 8 + b2];
+        }
+        sigmaH[g] += hw * (int64_t)count[CLASS_COUNTS - 1] + linear;
+        sigmaH2[g] += hw * hw * (int64_t)count[CLASS_COUNTS - 1] + 2 * hw * linear + square;
+
+        // The signs are 0 for the first round models, which only have the total row
+        for (int b = 0; b < rows - 1; b++)
+          coef[g][b] = (wh_t)sign[b];
+        coef[g][rows - 1] = (wh_t)hw;
+      }
+
+      for (int r = 0; r < rows; r++) {
+        const sum_t *row = &cls[r * n_samples];
+        for (int g = 0; g < n_guesses; g++) {
+          wh_t f = coef[g][r];
+          wh_t *a = &acc[g * n_samples];
+          if (f == 0)
+            continue;
+          for (int s = 0; s < n_samples; s++)
+            a[s] += f * (wh_t)row[s];
+        }
+      }
+    }
+
+    for (int g = 0; g < n_guesses; g++) {
+      for (int s = 0; s < n_samples; s++)
+        sum_wh[(size_t)(hyp + g) * n_samples + s] = acc[g * n_samples + s];
+      sum_h[(k0 + g) * KEYBYTES + n] = sigmaH[g];
+      sum_h2[(k0 + g) * KEYBYTES + n] = sigmaH2[g];
+    }
+    hyp -= CLASS_GUESSES - n_guesses;
+  }
+
+  free(acc);
+}
+
+static void class_to_wh_range(cpa_state_t *state, int first, int last) {
+  if (state->exact) {
+    DISPATCH_MODEL(state->model, class_to_wh, state, state->exact_class, (int64_t *)state->exact_wh, state->exact_h, state->exact_h2, first, last);
+  } else {
+    DISPATCH_MODEL(state->model, class_to_wh, state, state->sum_class, state->sum_wh, state->sum_h, state->sum_h2, first, last);
+  }
+}
+
+// Correlation of the exact mode: the numerator and the variances are computed
+// exactly on 128-bit integers, and only then converted to double
+static void max_correlation_range_exact(const cpa_state_t *state, double *maxCorrelation, int first, int last) {
+  __int128 n = state->n_traces;
+
+  for (int hyp = first; hyp < last; hyp++) {
+    int keybyte = hyp / KEYS;
+    int keyguess = hyp % KEYS;
+    __int128 sigmaH = state->exact_h[keyguess * KEYBYTES + keybyte];
+    __int128 sigmaH2 = state->exact_h2[keyguess * KEYBYTES + keybyte];
+    const uint64_t *sigmaWH = &state->exact_wh[(size_t)hyp * state->n_samples];
+    double varianceH = sqrt((double)(n * sigmaH2 - sigmaH * sigmaH));
+    double correlationMax = 0;
+
+    for (int j = 0; j < state->n_samples; j++) {
+      __int128 sigmaW = state->exact_w[j];
+      __int128 sigmaW2 = state->exact_w2[j];
+      double numerator = (double)(n * (__int128)sigmaWH[j] - sigmaW * sigmaH);
+      double denominator = sqrt((double)(n * sigmaW2 - sigmaW * sigmaW)) * varianceH;
+      double correlationTemp = fabs(numerator / denominator);
+
+      if (correlationTemp > correlationMax)
+        correlationMax = correlationTemp;
+    }
+    maxCorrelation[keyguess * KEYBYTES + keybyte] = correlationMax;
+  }
+}
+
+static void max_correlation_range(const cpa_state_t *state, double *maxCorrelation, int first, int last) {
+  double n = (double)state->n_traces;
+
+  if (state->exact) {
+    max_correlation_range_exact(state, maxCorrelation, first, last);
+    return;
+  }
+
+  for (int hyp = first; hyp < last; hyp++) {
+    int keybyte = hyp / KEYS;
+    int keyguess = hyp % KEYS;
+    double sigmaH = state->sum_h[keyguess * KEYBYTES + keybyte];
+    double sigmaH2 = state->sum_h2[keyguess * KEYBYTES + keybyte];
+    const double *sigmaWH = &state->sum_wh[(size_t)hyp * state->n_samples];
+    double correlationMax = 0;
+
+    for (int j = 0; j < state->n_samples; j++) {
+      double sigmaW = state->sum_w[j];
+      double sigmaW2 = state->sum_w2[j];
+      double numerator = n * sigmaWH[j] - sigmaW * sigmaH;
+      double denominator = sqrt(n * sigmaW2 - sigmaW * sigmaW) * sqrt(n * sigmaH2 - sigmaH * sigmaH);
+      double correlationTemp = fabs(numerator / denominator);
+
+      if (correlationTemp > correlationMax)
+        correlationMax = correlationTemp;
+    }
+    maxCorrelation[keyguess * KEYBYTES + keybyte] = correlationMax;
+  }
+}
+
+// Same output as max_correlation_kernel: the highest absolute correlation over
+// all samples, for every key guess and key byte ([key guess][key byte]).
+// In class mode, sum_wh is first computed from the class sums.
+void cpa_max_correlation(cpa_state_t *state, double *maxCorrelation, int n_threads) {
+  std::vector<std::thread> threads;
+  int n_hyp = KEYS * KEYBYTES;
+  int block = (n_hyp + n_threads - 1) / n_threads;
+
+  cpa_state_flatten(state, n_threads);
+
+  for (int first = 0; first < n_hyp; first += block) {
+    int last = (first + block > n_hyp) ? n_hyp : first + block;
+    threads.push_back(std::thread(max_correlation_range, (const cpa_state_t *)state, maxCorrelation, first, last));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+void cpa_state_flatten(cpa_state_t *state, int n_threads) {
+  std::vector<std::thread> threads;
+  int n_hyp = KEYS * KEYBYTES;
+  int block = (n_hyp + n_threads - 1) / n_threads;
+
+  if (!state->classes)
+    return;
+  for (int first = 0; first < n_hyp; first += block) {
+    int last = (first + block > n_hyp) ? n_hyp : first + block;
+    threads.push_back(std::thread(class_to_wh_range, state, first, last));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+void cpa_key_correlations(const cpa_state_t *state, const int key[KEYBYTES], double *correlations) {
+  for (int keybyte = 0; keybyte < KEYBYTES; keybyte++) {
+    int keyguess = key[keybyte];
+    size_t hyp = (size_t)keybyte * KEYS + keyguess;
+
+    for (int j = 0; j < state->n_samples; j++) {
+      double numerator, denominator;
+      if (state->exact) {
+        __int128 n = state->n_traces;
+        __int128 sigmaH = state->exact_h[keyguess * KEYBYTES + keybyte];
+        __int128 sigmaH2 = state->exact_h2[keyguess * KEYBYTES + keybyte];
+        __int128 sigmaW = state->exact_w[j];
+        __int128 sigmaW2 = state->exact_w2[j];
+        numerator = (double)(n * (__int128)state->exact_wh[hyp * state->n_samples + j] - sigmaW * sigmaH);
+        denominator = sqrt((double)(n * sigmaW2 - sigmaW * sigmaW)) * sqrt((double)(n * sigmaH2 - sigmaH * sigmaH));
+      } else {
+        double n = (double)state->n_traces;
+        double sigmaH = state->sum_h[keyguess * KEYBYTES + keybyte];
+        double sigmaH2 = state->sum_h2[keyguess * KEYBYTES + keybyte];
+        double sigmaW = state->sum_w[j];
+        double sigmaW2 = state->sum_w2[j];
+        numerator = n * state->sum_wh[hyp * state->n_samples + j] - sigmaW * sigmaH;
+        denominator = sqrt(n * sigmaW2 - sigmaW * sigmaW) * sqrt(n * sigmaH2 - sigmaH * sigmaH);
+      }
+      correlations[(size_t)j * KEYBYTES + keybyte] = denominator > 0 ? numerator / denominator : 0;
+    }
+  }
+}
@@ -0,0 +1,107 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef CPA_ENGINE_H
+#define CPA_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.cuh"
+
+// Class sums of a key byte n and a ciphertext byte ct[n]: rows 0 to 7 add the
+// traces whose ct[inv_shift[n]] has the bit 0 to 7 set, row 8 all the traces.
+// The first round models only have the row of all the traces.
+#define CLASS_ROWS 9
+// Class counts of a key byte n and a ciphertext byte ct[n]: b * 8 + b2 counts
+// the traces whose ct[inv_shift[n]] has the bits b and b2 set, 64 all the traces.
+#define CLASS_COUNTS 65
+// Smallest batch of traces that the accumulators leave in the memory ceiling (-m)
+#define MIN_BATCH_TRACES 4096
+
+// CPA accumulators for all key bytes and key guesses (sums over the traces).
+// The samples are the innermost dimension of sum_wh so that the update of
+// one hypothesis is a contiguous loop over the trace.
+// In exact mode (uint8 traces only) the sums are kept as 64-bit integers in
+// the exact_ arrays instead of the sum_ arrays: they do not depend on the
+// order of the traces, and are only converted to double by the correlation.
+// In class mode the traces are not multiplied by the hypotheses: sum_class
+// (exact_class) only adds them up by ciphertext class, class_count counts
+// them, and sum_wh and sum_h are computed from those by cpa_max_correlation.
+typedef struct cpa_state {
+
+  uint64_t n_traces;
+  int n_samples;
+  int exact;
+  int classes;
+  int model;                        // MODEL_ leakage model of the hypotheses
+  int rows;                         // class sum rows of the model, CLASS_ROWS or 1
+  int worker;                       // class mode worker: no sum_wh, only class sums merged into a state
+  double sum_h[KEYS * KEYBYTES];    // [key guess][key byte]
+  double sum_h2[KEYS * KEYBYTES];   // [key guess][key byte]
+  double *sum_w;                    // [sample]
+  double *sum_w2;                   // [sample]
+  double *sum_wh;                   // [key byte][key guess][sample]
+  uint64_t exact_h[KEYS * KEYBYTES];
+  uint64_t exact_h2[KEYS * KEYBYTES];
+  uint64_t *exact_w;
+  uint64_t *exact_w2;
+  uint64_t *exact_wh;
+  double *sum_class;                // [key byte][ct[n]][rows][sample]
+  uint64_t *exact_class;
+  uint64_t *class_count;            // [key byte][ct[n]][CLASS_COUNTS]
+
+} cpa_state_t;
+
+int get_n_threads(int requested);
+
+// Class sum rows of a model, memory of the class sums of one state of it,
+// and model of the workers, which take the rows of the last round model if
+// any model needs them
+int cpa_class_rows(int model);
+size_t cpa_class_size(int n_samples, int model);
+int cpa_worker_model(const int *models, int n_models);
+
+// Memory of all the sums of one state, and of the states of n_models models
+// and of their n_threads workers
+size_t cpa_state_size(int n_samples, int classes, int model, int worker);
+size_t cpa_states_size(int n_samples, int classes, const int *models, int n_models, int n_threads);
+
+// Largest number of workers, at most n_threads, whose states fit in limit
+// bytes with those of the models, 0 if not even one fits
+int cpa_fit_threads(int n_samples, int classes, const int *models, int n_models, int n_threads, size_t limit);
+
+// In class mode, a worker state only holds the class sums of the traces
+// given to cpa_accumulate_parallel, which are merged into the state of the
+// model, and not the sums of the key guesses computed from them.
+int cpa_state_init(cpa_state_t *state, int n_samples, int exact, int classes, int model, int worker);
+void cpa_state_reset(cpa_state_t *state);
+void cpa_state_free(cpa_state_t *state);
+void cpa_state_merge(cpa_state_t *dst, const cpa_state_t *src);
+
+// The traces are float32 (.data and text files) or uint8 (.bin files) samples.
+// The float32 traces cannot be accumulated by a state in exact mode. texts are
+// the ciphertexts for the last round model, the plaintexts for the first
+// round ones (model_first_round). The workers take the model of the state,
+// and must have at least its class sum rows (cpa_worker_model).
+void cpa_accumulate(cpa_state_t *state, const float *traces, const uint8_t *texts, size_t n_traces);
+void cpa_accumulate(cpa_state_t *state, const uint8_t *traces, const uint8_t *texts, size_t n_traces);
+void cpa_accumulate_parallel(cpa_state_t *state, cpa_state_t *workers, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces);
+void cpa_accumulate_parallel(cpa_state_t *state, cpa_state_t *workers, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces);
+void cpa_max_correlation(cpa_state_t *state, double *maxCorrelation, int n_threads);
+
+// In class mode, computes sum_wh, sum_h and sum_h2 from the class sums
+// (cpa_max_correlation does it first), so that they hold the sums of the
+// traces accumulated so far as in a state without classes
+void cpa_state_flatten(cpa_state_t *state, int n_threads);
+
+// Correlation of the hypotheses of the key with every sample, [sample][key
+// byte], e.g. to find the samples, taps or channels that leak the most. In
+// class mode, sum_wh must have been computed by cpa_max_correlation.
+void cpa_key_correlations(const cpa_state_t *state, const int key[KEYBYTES], double *correlations);
+
+#endif
@@ -0,0 +1,447 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file. 
+*/
+
+#include "cpa_log.cuh"
+#include <math.h>
+
+void log_correlations_each_iteration(int iteration, double *correlation, unsigned int samplesToProcess, char output_path[1000]) {
+        char file_name[1000];
+        snprintf(file_name, sizeof(char) * 1000, "%s/all_kr_" LOGIDXSTR ".txt", output_path);
+	FILE *file;
+	if (iteration == 0)
+		file = fopen(file_name, "w");
+	else
+		file = fopen(file_name, "a");
+
+	fprintf(file, "%d,  pk0,  pk1,  pk2,  pk3,  pk4,  pk5,  pk6,  pk7,  pk8,  pk9, pk10, pk11, pk12, pk13, pk14, pk15, \n", samplesToProcess);
+	for (int i = 0; i < KEYS; i++) {
+		fprintf(file, "0x%02X,", i);
+		for (int j = 0; j < KEYBYTES; j++) {
+			fprintf(file, "%.15f,", i, correlation[i * KEYBYTES + j]);
+		}
+		fprintf(file, "\n");
+	}
+
+	fprintf(file, "\n\n");
+	fclose(file);
+	return;
+}
+
+//Among the multiple iterations, the maximum correlation for each key byte and key guess
+void log_maxCorrelation(double *maxCorrelation, unsigned int samplesToProcess, unsigned int file_index, char output_path[1000]) {
+  char file_name[1000];
+  snprintf(file_name, sizeof(char) * 1000, "%s/final_kr/%i.txt", output_path, file_index);
+  
+	FILE *file = fopen(file_name, "a");
+	for (int i = 0; i < KEYS; i++) {
+		for (int j = 0; j < KEYBYTES-1; j++) {
+			fprintf(file, "%.15f,", maxCorrelation[i * KEYBYTES + j]);
+		}
+		fprintf(file, "%.15f\n", maxCorrelation[i * KEYBYTES + KEYBYTES - 1]);
+	}
+  fclose(file);
+	return;
+}
+
+void log_correlation_known_key_csv(double *maxCorrelation, int ROUNDKEY[KEYBYTES], char output_path[1000]) {
+	//int key[KEYBYTES] = { ROUNDKEY };
+	int key[KEYBYTES]; 
+        for(int i=0;i<16; i++)
+          key[i] = ROUNDKEY[i];
+
+        char file_name[1000];
+        snprintf(file_name, sizeof(char) * 1000, "%s/corr_coef_key_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "a");
+
+	for (int i = 0; i < KEYBYTES; i++) {
+		for (int j = 0; j < KEYS; j++) {
+			if (key[i] == j) {
+				fprintf(file, "%.15f", maxCorrelation[j * KEYBYTES + i]);
+				if (i < KEYBYTES - 1)
+					fprintf(file, ", ");
+			}
+		}
+	}
+	fprintf(file, "\n");
+	fclose(file);
+	return;
+}
+
+void sort_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], double *maxCorrelation) {
+	double n = 0;
+	for (int j = 0; j < KEYBYTES; j++) {
+		for (int i = 0; i < KEYS; i++) {
+			finalCorrelations[i][j] = maxCorrelation[i * KEYBYTES + j];
+			positions[i][j] = i;
+		}
+		for (int p = 0; p < 255; p++) {
+			for (int i = 0; i < KEYS - p - 1; i++) {
+				if (finalCorrelations[i][j] < finalCorrelations[i + 1][j]) {
+					n = finalCorrelations[i][j];
+					finalCorrelations[i][j] = finalCorrelations[i + 1][j];
+					finalCorrelations[i + 1][j] = n;
+
+					n = positions[i][j];
+					positions[i][j] = positions[i + 1][j];
+					positions[i + 1][j] = n;
+				}
+			}
+		}
+	}
+	return;
+}
+
+void log_highest_correlation_csv(double finalCorrelations[KEYS][KEYBYTES], char output_path[1000]) {
+        char file_name[1000];
+        snprintf(file_name, sizeof(char) * 1000, "%s/corr_coef_highest_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "a");
+
+	for (int j = 0; j < KEYBYTES; j++) {
+		fprintf(file, "%.15f", finalCorrelations[0][j]);
+		if (j < KEYBYTES - 1) {
+			fprintf(file, ", ");
+		}
+	}
+	fprintf(file, "\n");
+	fclose(file);
+	return;
+}
+
+void log_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k, char output_path[1000]) {
+	FILE *file;
+	char filename[1000];
+	char str_k[4];
+	sprintf(str_k, "%d", k);
+        snprintf(filename, sizeof(char) * 1000, "%s/top_%s_keys.txt", output_path, str_k);
+	file = fopen(filename, "a");
+
+	for (int j = 0; j < KEYBYTES; j++) {
+		fprintf(file, "  |%02d|\t", j);
+	}
+	fprintf(file, "\n");
+
+	for (int i = 0; i < k; i++) {
+		for (int j = 0; j < KEYBYTES; j++) {
+			fprintf(file, "  %02x\t", positions[i][j]);
+		}
+		fprintf(file, "\n");
+		for (int j = 0; j < KEYBYTES; j++) {
+			fprintf(file, "%.15f \t", finalCorrelations[i][j]);
+		}
+		fprintf(file, "\n\n");
+	}
+	fprintf(file, "\n\n");
+	fclose(file);
+	return;
+}
+
+void print_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k) {
+	for (int j = 0; j < KEYBYTES; j++) {
+		printf("  |%02d|\t", j);
+	}
+	printf("\n");
+
+	for (int i = 0; i < k; i++) {
+		for (int j = 0; j < KEYBYTES; j++) {
+			printf("  %02x\t", positions[i][j]);
+		}
+		printf("\n");
+		for (int j = 0; j < KEYBYTES; j++) {
+			printf("%.15f \t", finalCorrelations[i][j]);
+		}
+		printf("\n\n");
+	}
+	printf("\n\n");
+	return;
+}
+
+void log_correct_keybyte_count_csv(int positions[KEYS][KEYBYTES], int ROUNDKEY[KEYBYTES], char output_path[1000]) {
+	//int key[KEYBYTES] = { ROUNDKEY };
+	int key[KEYBYTES]; 
+        for(int i=0;i<16; i++)
+          key[i] = ROUNDKEY[i];
+
+        char file_name[1000];
+        snprintf(file_name, sizeof(char) * 1000, "%s/correct_keybyte_count_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "a");
+	int cnt = 0;
+	for (int j = 0; j < KEYBYTES; j++) {
+		if (positions[0][j] == key[j])
+			cnt++;
+	}
+	printf("cnt %d \n", cnt);
+	fprintf(file, "%d", cnt);
+	fclose(file);
+	return;
+}
+
+void log_misc_string(char *str, char output_path[1000]) {
+        char file_name[1000];
+        snprintf(file_name, sizeof(char) * 1000, "%s/correct_keybyte_count_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "a");
+	fprintf(file, "%s", str);
+	fclose(file);
+	return;
+}
+
+// Logs the scores of the key guesses of the CPU backends at a checkpoint of
+// n_traces traces ([key guess][key byte], the highest for the most likely
+// guess): final_kr/<n_traces>.txt, the ranks of the key bytes added to
+// keyByteIndex and the count of key bytes ranked first
+void log_checkpoint(double *scores, unsigned int n_traces, int ROUNDKEY[KEYBYTES], char output_path[1000], unsigned int *keyByteIndex) {
+	log_maxCorrelation(scores, n_traces, n_traces, output_path);
+
+	double finalCorrelations[KEYS][KEYBYTES];
+	int positions[KEYS][KEYBYTES];
+	sort_correlations(finalCorrelations, positions, scores);
+
+	multirun_update_summary(positions, keyByteIndex, ROUNDKEY);
+	log_correct_keybyte_count_csv(positions, ROUNDKEY, output_path);
+	return;
+}
+
+void multirun_update_summary(int positions[KEYS][KEYBYTES], unsigned int keyByteIndex[KEYBYTES], int ROUNDKEY[KEYBYTES]) {
+	//int key[KEYBYTES] = { ROUNDKEY };
+	int key[KEYBYTES]; 
+        for(int i=0;i<16; i++)
+          key[i] = ROUNDKEY[i];
+
+	for (int j = 0; j < KEYBYTES; j++) {
+		for (int i = 0; i < KEYS; i++) {
+			if (positions[i][j] == key[j])
+				keyByteIndex[j] = keyByteIndex[j] + i;
+		}
+	}
+	return;
+}
+
+void log_keybyte_summary(int i, unsigned int keyByteIndex[KEYBYTES], char output_path[1000]) {
+        char file_name[1000];
+        snprintf(file_name, sizeof(char) * 1000, "%s/summary_keybyte_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "a");
+	fprintf(file, "%d", i);
+	for (int j = 0; j < KEYBYTES; j++) {
+		fprintf(file, ", %d", keyByteIndex[j]);
+	}
+	fprintf(file, "\n");
+	fclose(file);
+	return;
+}
+
+// Keeps the lines of the file that start with a checkpoint of at most
+// n_traces, and drops the others and an unfinished last line
+static void truncate_checkpoint_lines(char *file_name, long n_traces) {
+	FILE *file = fopen(file_name, "rb");
+	if (file == NULL)
+		return;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	char *text = (char *)malloc(size + 1);
+	isMemoryFull((unsigned int *)text);
+	if (text == NULL || (long)fread(text, 1, size, file) != size) {
+		printf("Error in reading file %s\n", file_name);
+		free(text);
+		fclose(file);
+		return;
+	}
+	fclose(file);
+	text[size] = '\0';
+
+	file = fopen(file_name, "wb");
+	if (file == NULL) {
+		printf("Error in opening file %s\n", file_name);
+		free(text);
+		return;
+	}
+	char *line = text;
+	char *end;
+	while ((end = strchr(line, '\n')) != NULL) {
+		if (strtol(line, NULL, 10) <= n_traces)
+			fwrite(line, 1, end + 1 - line, file);
+		line = end + 1;
+	}
+	fclose(file);
+	free(text);
+	return;
+}
+
+// Removes the results of the checkpoints after n_traces, logged by an attack
+// that stopped before saving them in its state file, so that the attack
+// resumed from the state file logs them once
+void log_truncate_checkpoints(long n_traces, const int *checkpoints, int n_checkpoints, char output_path[1000]) {
+	char file_name[1000];
+	for (int c = 0; c < n_checkpoints; c++) {
+		if (checkpoints[c] <= n_traces)
+			continue;
+		snprintf(file_name, sizeof(char) * 1000, "%s/final_kr/%i.txt", output_path, checkpoints[c]);
+		remove(file_name);
+	}
+	snprintf(file_name, sizeof(char) * 1000, "%s/correct_keybyte_count_kr_" LOGIDXSTR ".csv", output_path);
+	truncate_checkpoint_lines(file_name, n_traces);
+	snprintf(file_name, sizeof(char) * 1000, "%s/summary_keybyte_kr_" LOGIDXSTR ".csv", output_path);
+	truncate_checkpoint_lines(file_name, n_traces);
+	return;
+}
+
+// Success rate and guessing entropy of every key byte over n_rounds attacks,
+// from the rank of the correct key byte in every attack ([round][key byte]).
+// The success rate is given with its 95% Wilson score interval, the guessing
+// entropy (mean rank, 0 for a key byte ranked first) with the 95% normal
+// interval of the mean. The last line of a checkpoint is the success rate of
+// the whole key and the mean guessing entropy of the key bytes, whose
+// interval is that of the mean over the attacks of their mean rank in every
+// attack, as the ranks of the key bytes of an attack are not independent.
+void log_bootstrap_summary(int i, int *ranks, int n_rounds, char output_path[1000]) {
+	char file_name[1000];
+	snprintf(file_name, sizeof(char) * 1000, "%s/bootstrap_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "a");
+	if (ftell(file) == 0)
+		fprintf(file, "traces,keybyte,sr,sr_low,sr_high,ge,ge_low,ge_high\n");
+
+	const double z = 1.96;
+	for (int j = 0; j <= KEYBYTES; j++) {
+		// Rank of the key byte j in every attack, or mean rank of the key bytes for the key
+		double success = 0, sum = 0, sum2 = 0;
+		for (int r = 0; r < n_rounds; r++) {
+			double rank = 0;
+			if (j < KEYBYTES) {
+				rank = ranks[r * KEYBYTES + j];
+			} else {
+				for (int n = 0; n < KEYBYTES; n++)
+					rank += ranks[r * KEYBYTES + n];
+				rank /= KEYBYTES;
+			}
+			success += (rank == 0);
+			sum += rank;
+			sum2 += rank * rank;
+		}
+		double sr = success / n_rounds;
+		double ge = sum / n_rounds;
+		double var = n_rounds > 1 ? (sum2 - sum * ge) / (n_rounds - 1) : 0;
+		double ge_half = z * sqrt(var > 0 ? var / n_rounds : 0);
+		double ge_low = ge - ge_half > 0 ? ge - ge_half : 0;
+		double ge_high = ge + ge_half < KEYS - 1 ? ge + ge_half : KEYS - 1;
+		double denominator = 1 + z * z / n_rounds;
+		double center = (sr + z * z / (2.0 * n_rounds)) / denominator;
+		double half = z * sqrt(sr * (1 - sr) / n_rounds + z * z / (4.0 * n_rounds * n_rounds)) / denominator;
+		if (j < KEYBYTES)
+			fprintf(file, "%d,%d", i, j);
+		else
+			fprintf(file, "%d,key", i);
+		fprintf(file, ",%.6f,%.6f,%.6f,%.6f,%.6f,%.6f\n", sr, center - half > 0 ? center - half : 0, center + half < 1 ? center + half : 1, ge, ge_low, ge_high);
+	}
+	fclose(file);
+	return;
+}
+
+// Updates the number of consecutive checkpoints held for which all the key
+// bytes are ranked first (keyByteIndex of a single attack holds the rank of
+// every key byte), and the number of traces disclosure of the first of them,
+// -1 while the key is not ranked first. Returns held.
+int update_disclosure(int i, unsigned int keyByteIndex[KEYBYTES], int *held, int *disclosure) {
+	int broken = 1;
+	for (int j = 0; j < KEYBYTES; j++) {
+		if (keyByteIndex[j] != 0)
+			broken = 0;
+	}
+	if (!broken) {
+		*held = 0;
+		*disclosure = -1;
+	} else if ((*held)++ == 0) {
+		*disclosure = i;
+	}
+	return *held;
+}
+
+// Minimum number of traces to disclosure (-1 if the key was not ranked first
+// at the last checkpoint), and number of traces the attack went through
+void log_disclosure(int disclosure, int n_traces, char output_path[1000]) {
+	char file_name[1000];
+	snprintf(file_name, sizeof(char) * 1000, "%s/disclosure_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "w");
+	fprintf(file, "traces_to_disclosure,traces_processed\n");
+	fprintf(file, "%d,%d\n", disclosure, n_traces);
+	fclose(file);
+	return;
+}
+
+// Correlation of the key of every key byte with every sample (group of group
+// raw sensor bits from first_bit) of the bitsliced CPA, [sample][key byte],
+// and the largest absolute one over the key bytes
+void log_tap_correlations(double *correlations, int n_samples, int group, char output_path[1000]) {
+	char file_name[1000];
+	snprintf(file_name, sizeof(char) * 1000, "%s/taps_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "w");
+	if (file == NULL) {
+		printf("Error in opening file %s\n", file_name);
+		return;
+	}
+	fprintf(file, "sample,first_bit");
+	for (int j = 0; j < KEYBYTES; j++)
+		fprintf(file, ",kb%d", j);
+	fprintf(file, ",max\n");
+	for (int i = 0; i < n_samples; i++) {
+		double max = 0;
+		fprintf(file, "%d,%d", i, i * group);
+		for (int j = 0; j < KEYBYTES; j++) {
+			double correlation = correlations[(size_t)i * KEYBYTES + j];
+			fprintf(file, ",%.9f", correlation);
+			if (fabs(correlation) > max)
+				max = fabs(correlation);
+		}
+		fprintf(file, ",%.9f\n", max);
+	}
+	fclose(file);
+	return;
+}
+
+// channels[i] is the channel of the sample i of the attack
+void log_channel_correlations(double *correlations, const int *channels, int n_samples, int n_channels, char output_path[1000]) {
+	char file_name[1000];
+	snprintf(file_name, sizeof(char) * 1000, "%s/channels_kr_" LOGIDXSTR ".csv", output_path);
+	FILE *file = fopen(file_name, "w");
+	if (file == NULL) {
+		printf("Error in opening file %s\n", file_name);
+		return;
+	}
+	fprintf(file, "channel");
+	for (int j = 0; j < KEYBYTES; j++)
+		fprintf(file, ",kb%d", j);
+	fprintf(file, ",max\n");
+	for (int c = 0; c < n_channels; c++) {
+		double maxByte[KEYBYTES];
+		double max = 0;
+		for (int j = 0; j < KEYBYTES; j++)
+			maxByte[j] = 0;
+		for (int i = 0; i < n_samples; i++) {
+			if (channels[i] != c)
+				continue;
+			for (int j = 0; j < KEYBYTES; j++) {
+				double correlation = fabs(correlations[(size_t)i * KEYBYTES + j]);
+				if (correlation > maxByte[j])
+					maxByte[j] = correlation;
+			}
+		}
+		fprintf(file, "%d", c);
+		for (int j = 0; j < KEYBYTES; j++) {
+			fprintf(file, ",%.9f", maxByte[j]);
+			if (maxByte[j] > max)
+				max = maxByte[j];
+		}
+		fprintf(file, ",%.9f\n", max);
+	}
+	fclose(file);
+	return;
+}
+
+void isMemoryFull(unsigned int *ptr){
+	if(ptr == NULL){
+		printf("----memory\n");
+	}
+}
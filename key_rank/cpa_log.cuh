@@ -0,0 +1,41 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file. 
+*/
+
+#ifndef CPA_LOG_H
+#define CPA_LOG_H
+
+#include "utils.cuh"
+
+// Index appended to the names of the result files (the GPU index of the original attack)
+#define LOGIDXSTR "0"
+
+void log_correlations_each_iteration(int iteration, double *correlation, unsigned int samplesToProcess, char output_path[1000]);
+void log_maxCorrelation(double *maxCorrelation, unsigned int samplesToProcess, unsigned int file_index, char output_path[1000]);
+void log_correlation_known_key_csv(double *maxCorrelation, int ROUNDKEY[KEYBYTES], char output_path[1000]);
+void sort_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], double *maxCorrelation);
+void log_highest_correlation_csv(double finalCorrelations[KEYS][KEYBYTES], char output_path[1000]);
+void log_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k, char output_path[1000]);
+void print_top_k_correlations(double finalCorrelations[KEYS][KEYBYTES], int positions[KEYS][KEYBYTES], int k);
+void isMemoryFull(unsigned int *ptr);
+//functions for multiple CPA attacks
+void log_correct_keybyte_count_csv(int positions[KEYS][KEYBYTES], int ROUNDKEY[KEYBYTES], char output_path[1000]);
+void log_misc_string(char *str, char output_path[1000]);
+void log_checkpoint(double *scores, unsigned int n_traces, int ROUNDKEY[KEYBYTES], char output_path[1000], unsigned int *keyByteIndex);
+void multirun_update_summary(int positions[KEYS][KEYBYTES], unsigned int keyByteIndex[KEYBYTES], int ROUNDKEY[KEYBYTES]);
+void log_keybyte_summary(int i, unsigned int keyByteIndex[KEYBYTES], char output_path[1000]);
+void log_bootstrap_summary(int i, int *ranks, int n_rounds, char output_path[1000]);
+void log_truncate_checkpoints(long n_traces, const int *checkpoints, int n_checkpoints, char output_path[1000]);
+//functions for the attack until broken
+int update_disclosure(int i, unsigned int keyByteIndex[KEYBYTES], int *held, int *disclosure);
+void log_disclosure(int disclosure, int n_traces, char output_path[1000]);
+//functions for the bitsliced CPA of the raw sensor bits
+void log_tap_correlations(double *correlations, int n_samples, int group, char output_path[1000]);
+//functions for the traces of several sensors
+void log_channel_correlations(double *correlations, const int *channels, int n_samples, int n_channels, char output_path[1000]);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Distributed CPA of the CPU backend, in three commands:
+
+  cpa accumulate: accumulates the CPA sums of -nt traces, from trace -ft of
+                  the files, and writes them to the accumulator state file -st.
+  cpa merge:      adds up state files of the same samples, e.g. the shards of
+                  one dataset or acquisitions of different days.
+  cpa finalize:   computes the correlations of a state file and writes the
+                  result files of main-CPA-cpu for its number of traces.
+
+The sums do not depend on the key, so the shards can be accumulated on
+several processes or nodes and merged in any order. The sums of the uint8
+traces are 64-bit integers, merged exactly: the result files of the merged
+shards are those of main-CPA-cpu on all their traces.
+*/
+
+#include "utils.cuh"
+#include "cpa_log.cuh"
+#include "cpa_engine.hpp"
+#include "cpa_store.hpp"
+#include "bitslice_engine.hpp"
+#include "trace_io.cuh"
+#include <stdint.h>
+
+void print_cpa_help();
+int cpa_accumulate_command(int argc, char *argv[]);
+int cpa_merge_command(int argc, char *argv[]);
+int cpa_finalize_command(int argc, char *argv[]);
+
+int main(int argc, char *argv[]) {
+
+  if (argc < 2 || strcmp(argv[1], "-h") == 0) {
+    print_cpa_help();
+    return argc < 2 ? EXIT_FAILURE : 0;
+  }
+  if (strcmp(argv[1], "accumulate") == 0)
+    return cpa_accumulate_command(argc - 1, argv + 1);
+  if (strcmp(argv[1], "merge") == 0)
+    return cpa_merge_command(argc - 1, argv + 1);
+  if (strcmp(argv[1], "finalize") == 0)
+    return cpa_finalize_command(argc - 1, argv + 1);
+
+  printf("Unknown command: %s\n\n", argv[1]);
+  print_cpa_help();
+  return EXIT_FAILURE;
+}
+
+void print_cpa_help() {
+  printf("Usage: ./cpa accumulate -t traces -c ciphertexts -nt n_traces -ns n_samples -st state [-ft first_trace] [options of main-CPA-cpu]\n");
+  printf("       ./cpa merge -st merged_state state [state ...]\n");
+  printf("       ./cpa finalize -st state -k last_round_key -o output [-j threads]\n");
+  printf("\taccumulate: CPA sums of the traces first_trace to first_trace + n_traces - 1 of the files, written to the state file.\n");
+  printf("\t            It takes the options of main-CPA-cpu except -k, -ss, -o, -poi, -r, -u and -lra (see ./main-CPA-cpu -h).\n");
+  printf("\tmerge:      sum of state files of the same samples and leakage models, written to merged_state.\n");
+  printf("\tfinalize:   result files of main-CPA-cpu for the traces of the state file, in the output directory.\n");
+}
+
+int cpa_accumulate_command(int argc, char *argv[]) {
+
+  config_t config;
+
+  init_config(&config);
+  config.accumulate = 1;
+  if (parse_args(argc, argv, &config) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (print_config(&config) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+
+  if (config.state_path[0] == '\0') {
+    printf("cpa accumulate writes the accumulator state file given with -st\n");
+    return EXIT_FAILURE;
+  }
+  if (config.lra || config.n_rounds > 0 || config.hold > 0 || config.poi_samples > 0) {
+    printf("cpa accumulate only accumulates the CPA sums of all the samples, without -lra, -r, -u or -poi\n");
+    return EXIT_FAILURE;
+  }
+
+  int n_threads = get_n_threads(config.n_threads);
+  int n_models = config.n_models;
+
+  trace_reader_t reader;
+  if (trace_reader_open(&reader, config.trace_path, config.ciphertext_path, config.n_samples, config.sensor_width) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (config.n_channels > 1)
+    trace_reader_open_channels(&reader, config.n_channels, config.fuse ? config.channel_weights : NULL);
+  if (config_first_round(&config) && trace_reader_open_plaintexts(&reader, config.plaintext_path) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  if (config.shift_path[0] != '\0' && trace_reader_open_shifts(&reader, config.shift_path) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+
+  bitslice_batch_t sliced;
+  if (config.bitslice > 0) {
+    trace_reader_keep_packed(&reader);
+    bitslice_batch_init(&sliced, config.n_samples);
+  }
+
+  // The shard starts at trace -ft of the files
+  if (config.first_trace > 0 && trace_reader_skip(&reader, config.first_trace) != config.first_trace) {
+    printf("The files hold fewer than %ld traces\n", config.first_trace);
+    return EXIT_FAILURE;
+  }
+
+  int n_samples = config.bitslice > 0 ? config.n_samples / config.bitslice : config.n_samples;
+  int exact = config.bitslice > 0 || (trace_sample_size(&reader) == sizeof(uint8_t));
+  if (exact)
+    printf("Accumulating the uint8 traces on exact integer sums\n");
+
+  // The traces are summed by ciphertext class as by main-CPA-cpu, with a
+  // single checkpoint: the class sums are flattened once at the end
+  long limit_mb = config.memory_limit_mb > 0 ? config.memory_limit_mb : DEFAULT_MEMORY_LIMIT_MB;
+  size_t trace_size = config.bitslice > 0 ? config.n_samples / 4 + 2 * KEYBYTES
+      : trace_sample_size(&reader) * 2 * config.n_samples + 2 * KEYBYTES;
+  size_t class_size = cpa_states_size(n_samples, 1, config.models, n_models, n_threads);
+  int class_rows = cpa_class_rows(cpa_worker_model(config.models, n_models));
+  int classes = config.bitslice == 0 && (config.n_traces >= (long)KEYS * class_rows)
+      && class_size + trace_size * MIN_BATCH_TRACES <= ((size_t)limit_mb << 20);
+  if (classes)
+    printf("Accumulating the traces by ciphertext class\n");
+
+  // The sums of the key guesses of the states count in the memory ceiling
+  // as well, as in main-CPA-cpu
+  size_t reserved = cpa_states_size(n_samples, classes, config.models, n_models, 0);
+  if (config.bitslice == 0) {
+    size_t limit = (size_t)limit_mb << 20;
+    size_t batch_min = trace_size * MIN_BATCH_TRACES;
+    int fit = batch_min < limit ? cpa_fit_threads(n_samples, classes, config.models, n_models, n_threads, limit - batch_min) : 0;
+    if (fit == 0) {
+      printf("The CPA needs %zu MB of sums and %zu MB for a batch of %d traces, more than the memory ceiling of %ld MB: raise -m or select fewer samples with -poi\n",
+             (cpa_states_size(n_samples, classes, config.models, n_models, 1) >> 20) + 1, (batch_min >> 20) + 1, MIN_BATCH_TRACES, limit_mb);
+      return EXIT_FAILURE;
+    }
+    if (fit < n_threads) {
+      printf("Running the CPA on %d CPU threads, whose sums fit in the memory ceiling\n", fit);
+      n_threads = fit;
+    }
+    reserved = cpa_states_size(n_samples, classes, config.models, n_models, n_threads);
+  }
+
+  long batch = get_batch_size(&config, trace_size, reserved);
+  printf("Streaming the traces in batches of %ld traces\n", batch);
+  trace_batch_t traces;
+
+  cpa_state_t *states = (cpa_state_t *)malloc(sizeof(cpa_state_t) * n_models);
+  cpa_state_t *workers = NULL;
+  isMemoryFull((unsigned int *)states);
+  for (int m = 0; m < n_models; m++) {
+    if (cpa_state_init(&states[m], n_samples, exact, classes, config.models[m], 0) == EXIT_FAILURE)
+      return EXIT_FAILURE;
+  }
+  if (config.bitslice == 0) {
+    workers = (cpa_state_t *)malloc(sizeof(cpa_state_t) * n_threads);
+    isMemoryFull((unsigned int *)workers);
+    for (int t = 0; t < n_threads; t++) {
+      if (cpa_state_init(&workers[t], n_samples, exact, classes, cpa_worker_model(config.models, n_models), 1) == EXIT_FAILURE)
+        return EXIT_FAILURE;
+    }
+  }
+
+  uint64_t accumulated = 0;
+  while (accumulated < (uint64_t)config.n_traces) {
+    long n = (long)(config.n_traces - accumulated) < batch ? (long)(config.n_traces - accumulated) : batch;
+    if (trace_reader_next(&reader, &traces, n) != n)
+      return EXIT_FAILURE;
+    accumulated += n;
+    if (config.bitslice > 0 && bitslice_transpose(&sliced, n_threads, traces.traces_u8, n) == EXIT_FAILURE)
+      return EXIT_FAILURE;
+    for (int m = 0; m < n_models; m++) {
+      const uint8_t *texts = model_first_round(config.models[m]) ? traces.plaintexts : traces.ciphertexts;
+      if (config.bitslice > 0)
+        bitslice_accumulate(&states[m], config.bitslice, n_threads, &sliced, texts);
+      else if (traces.traces_u8 != NULL)
+        cpa_accumulate_parallel(&states[m], workers, n_threads, traces.traces_u8, texts, n);
+      else
+        cpa_accumulate_parallel(&states[m], workers, n_threads, traces.traces, texts, n);
+    }
+    fprintf(stderr, "%s %llu\n", "Accumulated", (unsigned long long)accumulated);
+  }
+
+  cpa_store_header_t header;
+  cpa_store_header_init(&header, &config, n_samples, exact, 0);
+  header.n_traces = accumulated;
+  for (int m = 0; m < n_models; m++)
+    cpa_state_flatten(&states[m], n_threads);
+  int result = cpa_store_write(config.state_path, &header, states);
+  if (result == EXIT_SUCCESS)
+    printf("Accumulator state of traces %ld to %ld written to %s\n", config.first_trace, config.first_trace + config.n_traces - 1, config.state_path);
+
+  trace_reader_close(&reader);
+  if (config.bitslice > 0)
+    bitslice_batch_free(&sliced);
+  for (int t = 0; t < n_threads && workers != NULL; t++)
+    cpa_state_free(&workers[t]);
+  free(workers);
+  for (int m = 0; m < n_models; m++)
+    cpa_state_free(&states[m]);
+  free(states);
+  return result;
+}
+
+int cpa_merge_command(int argc, char *argv[]) {
+
+  char *merged_path = NULL;
+  char *paths[1000];
+  int n_paths = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-st") == 0 && i + 1 < argc) {
+      i++;
+      merged_path = argv[i];
+    } else if (argv[i][0] != '-' && n_paths < 1000) {
+      paths[n_paths++] = argv[i];
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_cpa_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (merged_path == NULL || n_paths == 0) {
+    print_cpa_help();
+    return EXIT_FAILURE;
+  }
+
+  cpa_store_header_t header;
+  cpa_state_t *states;
+  if (cpa_store_read(paths[0], &header, &states, 0) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  printf("%s: %llu traces\n", paths[0], (unsigned long long)header.n_traces);
+
+  int result = EXIT_SUCCESS;
+  for (int p = 1; p < n_paths && result == EXIT_SUCCESS; p++) {
+    cpa_store_header_t other;
+    cpa_state_t *other_states;
+    if (cpa_store_read(paths[p], &other, &other_states, 0) == EXIT_FAILURE) {
+      result = EXIT_FAILURE;
+      break;
+    }
+    printf("%s: %llu traces\n", paths[p], (unsigned long long)other.n_traces);
+    if (!cpa_store_compatible(&header, &other)) {
+      printf("%s does not hold the sums of the same samples and leakage models as %s\n", paths[p], paths[0]);
+      result = EXIT_FAILURE;
+    } else {
+      for (int m = 0; m < header.n_models; m++)
+        cpa_state_merge(&states[m], &other_states[m]);
+      header.n_traces += other.n_traces;
+    }
+    for (int m = 0; m < other.n_models; m++)
+      cpa_state_free(&other_states[m]);
+    free(other_states);
+  }
+
+  if (result == EXIT_SUCCESS)
+    result = cpa_store_write(merged_path, &header, states);
+  if (result == EXIT_SUCCESS)
+    printf("Accumulator state of %llu traces written to %s\n", (unsigned long long)header.n_traces, merged_path);
+
+  for (int m = 0; m < header.n_models; m++)
+    cpa_state_free(&states[m]);
+  free(states);
+  return result;
+}
+
+int cpa_finalize_command(int argc, char *argv[]) {
+
+  config_t config;
+  init_config(&config);
+  config.dump_path[0] = '\0';
+  char *state_path = NULL;
+  int key_given = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-st") == 0 && i + 1 < argc) {
+      i++;
+      state_path = argv[i];
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      i++;
+      const char *src = argv[i];
+      unsigned int u;
+      int counter = 0;
+      while (counter < KEYBYTES && sscanf(src, "%2x", &u) == 1) {
+        config.key[counter++] = u;
+        src += 2;
+      }
+      if (counter != KEYBYTES || *src != '\0') {
+        printf("Given key does not have size 16. Key size must be 16 bytes.\n");
+        return EXIT_FAILURE;
+      }
+      key_given = 1;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      i++;
+      snprintf(config.dump_path, sizeof(config.dump_path), "%s", argv[i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      config.n_threads = atoi(argv[i]);
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_cpa_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (state_path == NULL || !key_given || config.dump_path[0] == '\0') {
+    print_cpa_help();
+    return EXIT_FAILURE;
+  }
+
+  cpa_store_header_t header;
+  cpa_state_t *states;
+  if (cpa_store_read(state_path, &header, &states, 0) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  printf("Finalizing the CPA of %llu traces of %s\n", (unsigned long long)header.n_traces, state_path);
+
+  // The result files of every model are those of the last checkpoint of main-CPA-cpu
+  int n_threads = get_n_threads(config.n_threads);
+  config.n_models = header.n_models;
+  for (int m = 0; m < header.n_models; m++)
+    config.models[m] = header.models[m];
+
+  char str_n[24];
+  snprintf(str_n, sizeof(str_n), "%llu", (unsigned long long)header.n_traces);
+  double *scores = (double *)malloc(sizeof(double) * KEYS * KEYBYTES);
+  isMemoryFull((unsigned int *)scores);
+  int result = EXIT_SUCCESS;
+  for (int m = 0; m < header.n_models; m++) {
+    int ROUNDKEY[KEYBYTES];
+    char output_path[1000];
+    unsigned int keyByteIndex[KEYBYTES] = {0};
+    get_model_key(&config, header.models[m], ROUNDKEY);
+    if (get_model_output_path(&config, header.models[m], output_path) == EXIT_FAILURE) {
+      result = EXIT_FAILURE;
+      break;
+    }
+    log_misc_string(str_n, output_path);
+    log_misc_string(",", output_path);
+    cpa_max_correlation(&states[m], scores, n_threads);
+    log_checkpoint(scores, (unsigned int)header.n_traces, ROUNDKEY, output_path, keyByteIndex);
+    log_keybyte_summary((int)header.n_traces, keyByteIndex, output_path);
+    log_misc_string("\n", output_path);
+  }
+
+  free(scores);
+  for (int m = 0; m < header.n_models; m++)
+    cpa_state_free(&states[m]);
+  free(states);
+  return result;
+}
@@ -0,0 +1,184 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "cpa_store.hpp"
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+
+// Absolute path of a file of the run, the path as given if it cannot be resolved
+static void run_path(char stored[1000], const char *path) {
+  char resolved[PATH_MAX];
+  if (path[0] != '\0' && realpath(path, resolved) != NULL)
+    snprintf(stored, 1000, "%s", resolved);
+  else
+    snprintf(stored, 1000, "%s", path);
+}
+
+void cpa_store_header_init(cpa_store_header_t *header, config_t *config, int n_samples, int exact, int classes) {
+  memset(header, 0, sizeof(cpa_store_header_t));
+  memcpy(header->magic, CPA_STORE_MAGIC, sizeof(header->magic));
+  header->version = CPA_STORE_VERSION;
+  header->exact = exact;
+  header->n_samples = n_samples;
+  header->n_models = config->n_models;
+  for (int m = 0; m < config->n_models; m++)
+    header->models[m] = config->models[m];
+  header->sensor_width = config->sensor_width;
+  header->bitslice = config->bitslice;
+  header->n_channels = config->n_channels;
+  header->fuse = config->fuse;
+  for (int c = 0; c < config->fuse; c++)
+    header->channel_weights[c] = config->channel_weights[c];
+  header->classes = classes;
+  run_path(header->trace_path, config->trace_path);
+  run_path(header->ciphertext_path, config->ciphertext_path);
+  run_path(header->plaintext_path, config->plaintext_path);
+  run_path(header->shift_path, config->shift_path);
+  header->first_trace = config->first_trace;
+  header->run_traces = config->n_traces;
+  header->step_size = config->step_size;
+}
+
+// The headers are zeroed before being filled, padding included, and classes
+// is the first field that does not describe the samples
+int cpa_store_compatible(const cpa_store_header_t *header, const cpa_store_header_t *other) {
+  return memcmp(header, other, offsetof(cpa_store_header_t, classes)) == 0;
+}
+
+// Same samples, class sums, files and options of the run: n_traces is the
+// last field
+int cpa_store_same_run(const cpa_store_header_t *header, const cpa_store_header_t *other) {
+  return memcmp(header, other, offsetof(cpa_store_header_t, n_traces)) == 0;
+}
+
+// Sums of a state, in the order of the file
+#define STORE_ARRAYS 5
+static void state_arrays(const cpa_state_t *state, void *arrays[STORE_ARRAYS], size_t sizes[STORE_ARRAYS]) {
+  size_t n_wh = (size_t)KEYBYTES * KEYS * state->n_samples;
+  if (state->exact) {
+    arrays[0] = (void *)state->exact_h;
+    arrays[1] = (void *)state->exact_h2;
+    arrays[2] = state->exact_w;
+    arrays[3] = state->exact_w2;
+    arrays[4] = state->exact_wh;
+  } else {
+    arrays[0] = (void *)state->sum_h;
+    arrays[1] = (void *)state->sum_h2;
+    arrays[2] = state->sum_w;
+    arrays[3] = state->sum_w2;
+    arrays[4] = state->sum_wh;
+  }
+  // uint64_t and double sums have the same size
+  sizes[0] = sizeof(uint64_t) * KEYS * KEYBYTES;
+  sizes[1] = sizeof(uint64_t) * KEYS * KEYBYTES;
+  sizes[2] = sizeof(uint64_t) * state->n_samples;
+  sizes[3] = sizeof(uint64_t) * state->n_samples;
+  sizes[4] = sizeof(uint64_t) * n_wh;
+}
+
+// Class sums and counts of a state, which follow its sums in the file
+static void class_arrays(const cpa_state_t *state, void *arrays[2], size_t sizes[2]) {
+  arrays[0] = state->exact ? (void *)state->exact_class : (void *)state->sum_class;
+  arrays[1] = state->class_count;
+  sizes[0] = cpa_class_size(state->n_samples, state->model);
+  sizes[1] = sizeof(uint64_t) * KEYBYTES * KEYS * CLASS_COUNTS;
+}
+
+int cpa_store_write(char *path, const cpa_store_header_t *header, const cpa_state_t *states) {
+  char tmp_path[1100];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+  FILE *file = fopen(tmp_path, "wb");
+  if (file == NULL) {
+    printf("Error in opening file %s\n", tmp_path);
+    return EXIT_FAILURE;
+  }
+
+  int failed = fwrite(header, sizeof(cpa_store_header_t), 1, file) != 1;
+  for (int m = 0; m < header->n_models && !failed; m++) {
+    void *arrays[STORE_ARRAYS];
+    size_t sizes[STORE_ARRAYS];
+    state_arrays(&states[m], arrays, sizes);
+    for (int a = 0; a < STORE_ARRAYS && !failed; a++)
+      failed = fwrite(arrays[a], 1, sizes[a], file) != sizes[a];
+    if (header->classes) {
+      class_arrays(&states[m], arrays, sizes);
+      for (int a = 0; a < 2 && !failed; a++)
+        failed = fwrite(arrays[a], 1, sizes[a], file) != sizes[a];
+    }
+  }
+  // The data is on the disk before the rename replaces the previous state
+  if (!failed)
+    failed = fflush(file) != 0 || fsync(fileno(file)) != 0;
+  if (fclose(file) != 0 || failed || rename(tmp_path, path) != 0) {
+    printf("Error in writing the accumulator state file %s\n", path);
+    remove(tmp_path);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
+
+int cpa_store_read(char *path, cpa_store_header_t *header, cpa_state_t **states, int keep_classes) {
+  *states = NULL;
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    printf("Error in opening file %s\n", path);
+    return EXIT_FAILURE;
+  }
+
+  if (fread(header, sizeof(cpa_store_header_t), 1, file) != 1
+      || memcmp(header->magic, CPA_STORE_MAGIC, sizeof(header->magic)) != 0
+      || header->version != CPA_STORE_VERSION
+      || header->n_models < 1 || header->n_models > N_MODELS || header->n_samples < 1) {
+    printf("%s is not an accumulator state file of this version\n", path);
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+
+  cpa_state_t *read = (cpa_state_t *)malloc(sizeof(cpa_state_t) * header->n_models);
+  if (read == NULL) {
+    printf("----memory\n");
+    fclose(file);
+    return EXIT_FAILURE;
+  }
+  int failed = 0;
+  int m = 0;
+  for (; m < header->n_models && !failed; m++) {
+    if (cpa_state_init(&read[m], header->n_samples, header->exact, header->classes && keep_classes, header->models[m], 0) == EXIT_FAILURE) {
+      failed = 1;
+      break;
+    }
+    read[m].n_traces = header->n_traces;
+    void *arrays[STORE_ARRAYS];
+    size_t sizes[STORE_ARRAYS];
+    state_arrays(&read[m], arrays, sizes);
+    for (int a = 0; a < STORE_ARRAYS && !failed; a++)
+      failed = fread(arrays[a], 1, sizes[a], file) != sizes[a];
+    if (header->classes && keep_classes) {
+      class_arrays(&read[m], arrays, sizes);
+      for (int a = 0; a < 2 && !failed; a++)
+        failed = fread(arrays[a], 1, sizes[a], file) != sizes[a];
+    } else if (header->classes && !failed) {
+      failed = fseeko(file, (off_t)(cpa_class_size(header->n_samples, header->models[m]) + sizeof(uint64_t) * KEYBYTES * KEYS * CLASS_COUNTS), SEEK_CUR) != 0;
+    }
+    if (failed)
+      printf("Accumulator state file %s ended before the sums of model %s\n", path, model_name(header->models[m]));
+  }
+  fclose(file);
+
+  if (failed) {
+    for (int i = 0; i < m; i++)
+      cpa_state_free(&read[i]);
+    free(read);
+    return EXIT_FAILURE;
+  }
+  if (!keep_classes)
+    header->classes = 0;
+  *states = read;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef CPA_STORE_H
+#define CPA_STORE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.cuh"
+#include "cpa_engine.hpp"
+
+#define CPA_STORE_MAGIC   "RDSCPA1"
+#define CPA_STORE_VERSION 4
+
+// Header of an accumulator state file. It is followed by the sums of every
+// model, in the order of models: sum_h, sum_h2, sum_w, sum_w2 and sum_wh
+// (exact_ arrays in exact mode), as they are in memory, then by sum_class
+// (exact_class) and class_count if classes is set. The files are in the
+// byte order of the machine, and the states of two files can be merged when
+// everything before classes is the same: the same samples of the same
+// traces. The files and options of the run that follow classes only let
+// main-CPA-cpu check that it resumes the same attack.
+typedef struct cpa_store_header {
+
+  char magic[8];
+  uint32_t version;
+  int32_t exact;                        // 64-bit integer sums of uint8 traces, double sums otherwise
+  int32_t n_samples;                    // samples of the sums
+  int32_t n_models;
+  int32_t models[N_MODELS];
+  int32_t sensor_width;                 // options that give the samples of the trace file
+  int32_t bitslice;
+  int32_t n_channels;
+  int32_t fuse;
+  float channel_weights[MAX_CHANNELS];
+  int32_t classes;                      // class sums of main-CPA-cpu, kept to resume it in class mode
+  char trace_path[1000];                // absolute paths of the files of the run
+  char ciphertext_path[1000];
+  char plaintext_path[1000];
+  char shift_path[1000];
+  int64_t first_trace;                  // -ft, -nt and -ss of the run
+  int64_t run_traces;
+  int64_t step_size;
+  uint64_t n_traces;                    // traces accumulated by every model
+
+} cpa_store_header_t;
+
+void cpa_store_header_init(cpa_store_header_t *header, config_t *config, int n_samples, int exact, int classes);
+int cpa_store_compatible(const cpa_store_header_t *header, const cpa_store_header_t *other);
+int cpa_store_same_run(const cpa_store_header_t *header, const cpa_store_header_t *other);
+
+// Writes the states of all the models of the header, flattened by
+// cpa_state_flatten in class mode, with their class sums if header->classes
+// is set. The file is written next to path and renamed once complete, so
+// that path always holds a whole state.
+int cpa_store_write(char *path, const cpa_store_header_t *header, const cpa_state_t *states);
+
+// Reads a state file into header->n_models states, allocated by the function
+// and initialized by cpa_state_init. The class sums of the file are only read
+// with keep_classes, the states having no class sums otherwise.
+int cpa_store_read(char *path, cpa_store_header_t *header, cpa_state_t **states, int keep_classes);
+
+#endif
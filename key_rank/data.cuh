@@ -35,6 +35,10 @@ Please give due credit to the original authors by also citing their work:
 
 __device__ unsigned int inv_shift[] = { 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11 };
 
+// Hamming distance between the input of the last round (inv_sbox[ct[n] ^ key]) and the
+// ciphertext byte ct[inv_shift[n]], indexed [ct[inv_shift[n]]][ct[n] ^ key]; filled by hd_table_kernel
+__device__ byte hd_table[256 * 256];
+
 //__device__ byte rkey[]={0x4a, 0xd8, 0x52, 0x96, 0xe2, 0x40, 0x2a, 0x5b, 0xea, 0xb7, 0xee, 0xb2, 0x66, 0xb9, 0x42, 0xce};
 // 40      2a      5b      f1      b7      ee      b2      66      b9      42      ce
 //4a      d8      52      96      e2      40      2a      5b      ea      b7      ee      b2      66      b9      42      ce
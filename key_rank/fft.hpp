@@ -0,0 +1,63 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Radix-2 FFT of the trace tools (align-traces, preprocess-traces).
+*/
+
+#ifndef FFT_H
+#define FFT_H
+
+#include <math.h>
+#include <complex>
+#include <vector>
+
+typedef std::complex<double> cplx;
+
+// Smallest power of two of at least n
+static inline int fft_size(int n) {
+  int size = 1;
+  while (size < n)
+    size <<= 1;
+  return size;
+}
+
+// twiddles[k] = exp(-2 pi i k / n), k < n / 2
+static inline std::vector<cplx> fft_twiddles(int n) {
+  std::vector<cplx> twiddles(n / 2);
+  for (int k = 0; k < n / 2; k++)
+    twiddles[k] = std::polar(1.0, -2 * M_PI * k / n);
+  return twiddles;
+}
+
+// In place FFT of n points (a power of two), with the twiddles of
+// fft_twiddles(n). The inverse transform is not scaled by 1 / n.
+static inline void fft(cplx *x, const cplx *twiddles, int n, int inverse) {
+  for (int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      std::swap(x[i], x[j]);
+  }
+  for (int len = 2; len <= n; len <<= 1) {
+    int step = n / len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < len / 2; k++) {
+        cplx w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+        cplx u = x[i + k];
+        cplx v = x[i + k + len / 2] * w;
+        x[i + k] = u + v;
+        x[i + k + len / 2] = u - v;
+      }
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,406 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Native replacement of calculate_keyrank.py: histogram based key rank estimation
+from the correlation matrices final_kr/<n>.txt written by the CPA, for all the
+checkpoints in parallel. The output keyrank_results.csv is the same as the one
+of calculate_keyrank.py.
+
+For every key byte the 256 correlations are normalised and turned into log2
+probabilities, and binned in 256 bins over the range of the first key byte.
+The histogram of the full key is the convolution of the 16 key byte
+histograms. Its counts go up to 2^128, so it is computed exactly with number
+theoretic transforms (FFTs modulo five primes) and the Chinese remainder
+theorem, instead of a floating point FFT whose rounding errors would hide the
+small ranks.
+*/
+
+#include "utils.cuh"
+#include <stdint.h>
+#include <math.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define N_BINS 256
+
+// Length of the histogram of the full key, as the repeated convolve() of
+// calculate_keyrank.py that appends one zero at every step
+#define H_LEN (N_BINS * KEYBYTES)
+
+// Transform size, a power of two not smaller than the H_LEN - KEYBYTES + 1 bins of the convolution
+#define NTT_LOG 12
+#define NTT_SIZE (1 << NTT_LOG)
+
+#define N_PRIMES 5
+
+typedef unsigned __int128 uint128_t;
+
+// NTT friendly primes (c * 2^k + 1, k >= NTT_LOG) with one of their primitive
+// roots. Their product is above 2^146, so that every count is recovered exactly.
+static const uint64_t PRIMES[N_PRIMES] = {998244353, 167772161, 469762049, 754974721, 2013265921};
+static const uint64_t ROOTS[N_PRIMES] = {3, 3, 3, 11, 31};
+
+typedef struct keyrank_result {
+
+  int status;       // EXIT_SUCCESS, or EXIT_FAILURE if the correlation file is missing or malformed
+  double lower;
+  double upper;
+
+} keyrank_result_t;
+
+void print_keyrank_help();
+void keyrank_checkpoint(char *dump_path, int n, int key[KEYBYTES], keyrank_result_t *result);
+void keyrank_worker(char *dump_path, int *checkpoints, int n_checkpoints, int key[KEYBYTES], keyrank_result_t *results, std::atomic<int> *next);
+void format_double(char *str, size_t size, double value);
+
+int main(int argc, char *argv[]) {
+
+  config_t config;
+  init_config(&config);
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      print_keyrank_help();
+      return 0;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      config.n_threads = atoi(argv[i]);
+    } else if (positional == 0) {
+      unsigned int u;
+      int counter = 0;
+      const char *src = argv[i];
+      while (counter < KEYBYTES && sscanf(src, "%2x", &u) == 1) {
+        config.key[counter++] = u;
+        src += 2;
+      }
+      if (counter != KEYBYTES || *src != '\0') {
+        printf("Given key does not have size 16. Key size must be 16 bytes.\n");
+        return EXIT_FAILURE;
+      }
+      positional++;
+    } else if (positional == 1) {
+      config.step_size = atoi(argv[i]);
+      positional++;
+    } else if (positional == 2) {
+      config.n_traces = atoi(argv[i]);
+      positional++;
+    } else if (positional == 3) {
+      snprintf(config.dump_path, sizeof(config.dump_path), "%s", argv[i]);
+      positional++;
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_keyrank_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (positional != 4) {
+    print_keyrank_help();
+    return EXIT_FAILURE;
+  }
+
+  int n_threads = config.n_threads > 0 ? config.n_threads : (int)std::thread::hardware_concurrency();
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  // The checkpoints of the CPA, in increasing order
+  int n_checkpoints;
+  int *checkpoints = get_checkpoints(&config, &n_checkpoints);
+  keyrank_result_t *results = (keyrank_result_t *)malloc(sizeof(keyrank_result_t) * (n_checkpoints > 0 ? n_checkpoints : 1));
+  if (results == NULL) {
+    printf("----memory\n");
+    return EXIT_FAILURE;
+  }
+
+  std::atomic<int> next(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < n_threads && t < n_checkpoints; t++)
+    threads.push_back(std::thread(keyrank_worker, config.dump_path, checkpoints, n_checkpoints, config.key, results, &next));
+  for (size_t t = 0; t < threads.size(); t++)
+    threads[t].join();
+
+  char file_name[1100];
+  snprintf(file_name, sizeof(file_name), "%s/keyrank_results.csv", config.dump_path);
+  FILE *file = fopen(file_name, "w");
+  if (file == NULL) {
+    printf("Error in opening file %s\n", file_name);
+    return EXIT_FAILURE;
+  }
+  fprintf(file, "traces,upperBound,lowerBound\n");
+
+  int status = EXIT_SUCCESS;
+  for (int c = 0; c < n_checkpoints; c++) {
+    if (results[c].status != EXIT_SUCCESS) {
+      status = EXIT_FAILURE;
+      continue;
+    }
+    char lower[32], upper[32];
+    format_double(lower, sizeof(lower), results[c].lower);
+    format_double(upper, sizeof(upper), results[c].upper);
+    printf("Key Rank after %d traces\n", checkpoints[c]);
+    printf("\t lower bound %s\n", lower);
+    printf("\t upper bound %s\n", upper);
+    fprintf(file, "%d,%s,%s\n", checkpoints[c], upper, lower);
+  }
+  fclose(file);
+
+  free(results);
+  free(checkpoints);
+  return status;
+}
+
+void print_keyrank_help() {
+  printf("Usage: ./calculate-keyrank key step_size n_traces /path/to/results/ [-j threads]\n");
+  printf("\tSame arguments as calculate_keyrank.py, -j is the number of threads (default: all cores).\n");
+}
+
+// Takes the checkpoints one by one until all of them are done
+void keyrank_worker(char *dump_path, int *checkpoints, int n_checkpoints, int key[KEYBYTES], keyrank_result_t *results, std::atomic<int> *next) {
+  int c;
+  while ((c = next->fetch_add(1)) < n_checkpoints)
+    keyrank_checkpoint(dump_path, checkpoints[c], key, &results[c]);
+}
+
+// Shortest representation of value that reads back to the same double, as
+// Python's repr() used by pandas to write the .csv file
+void format_double(char *str, size_t size, double value) {
+  for (int precision = 1; precision <= 17; precision++) {
+    snprintf(str, size, "%.*g", precision, value);
+    if (strtod(str, NULL) == value)
+      break;
+  }
+  if (strpbrk(str, ".eni") == NULL)
+    strncat(str, ".0", size - strlen(str) - 1);
+}
+
+static uint64_t pow_mod(uint64_t base, uint64_t exp, uint64_t p) {
+  uint64_t result = 1;
+  base %= p;
+  while (exp > 0) {
+    if (exp & 1)
+      result = result * base % p;
+    base = base * base % p;
+    exp >>= 1;
+  }
+  return result;
+}
+
+// In place iterative number theoretic transform of NTT_SIZE values modulo p
+static void ntt(uint64_t *a, uint64_t p, uint64_t root, int inverse) {
+
+  for (int i = 1, j = 0; i < NTT_SIZE; i++) {
+    int bit = NTT_SIZE >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      uint64_t tmp = a[i];
+      a[i] = a[j];
+      a[j] = tmp;
+    }
+  }
+
+  for (int len = 2; len <= NTT_SIZE; len <<= 1) {
+    uint64_t w_len = pow_mod(root, (p - 1) / len, p);
+    if (inverse)
+      w_len = pow_mod(w_len, p - 2, p);
+    for (int i = 0; i < NTT_SIZE; i += len) {
+      uint64_t w = 1;
+      for (int j = 0; j < len / 2; j++) {
+        uint64_t u = a[i + j];
+        uint64_t v = a[i + j + len / 2] * w % p;
+        a[i + j] = (u + v) % p;
+        a[i + j + len / 2] = (u + p - v) % p;
+        w = w * w_len % p;
+      }
+    }
+  }
+
+  if (inverse) {
+    uint64_t n_inv = pow_mod(NTT_SIZE, p - 2, p);
+    for (int i = 0; i < NTT_SIZE; i++)
+      a[i] = a[i] * n_inv % p;
+  }
+}
+
+// Exact convolution of the KEYBYTES histograms: H[i] for i < H_LEN
+static void convolve_histograms(int hist[KEYBYTES][N_BINS], uint128_t *H) {
+
+  uint64_t product[N_PRIMES][NTT_SIZE];
+  uint64_t term[NTT_SIZE];
+
+  for (int k = 0; k < N_PRIMES; k++) {
+    uint64_t p = PRIMES[k];
+    for (int n = 0; n < KEYBYTES; n++) {
+      memset(term, 0, sizeof(term));
+      for (int i = 0; i < N_BINS; i++)
+        term[i] = hist[n][i];
+      ntt(term, p, ROOTS[k], 0);
+      if (n == 0)
+        memcpy(product[k], term, sizeof(term));
+      else
+        for (int i = 0; i < NTT_SIZE; i++)
+          product[k][i] = product[k][i] * term[i] % p;
+    }
+    ntt(product[k], p, ROOTS[k], 1);
+  }
+
+  // Garner's algorithm: mixed radix digits of every count, then its value
+  uint64_t inverses[N_PRIMES][N_PRIMES];
+  for (int k = 0; k < N_PRIMES; k++)
+    for (int l = 0; l < k; l++)
+      inverses[k][l] = pow_mod(PRIMES[l], PRIMES[k] - 2, PRIMES[k]);
+
+  for (int i = 0; i < H_LEN; i++) {
+    if (i >= NTT_SIZE) {
+      H[i] = 0;
+      continue;
+    }
+    uint64_t digits[N_PRIMES];
+    for (int k = 0; k < N_PRIMES; k++) {
+      uint64_t p = PRIMES[k];
+      uint64_t x = product[k][i];
+      for (int l = 0; l < k; l++) {
+        x = (x + p - digits[l] % p) % p;
+        x = x * inverses[k][l] % p;
+      }
+      digits[k] = x;
+    }
+    uint128_t value = 0;
+    for (int k = N_PRIMES - 1; k >= 0; k--)
+      value = value * PRIMES[k] + digits[k];
+    H[i] = value;
+  }
+}
+
+// Bin of value among the N_BINS bins given by edges, as np.histogram: the last
+// bin includes its right edge. The values out of the range go to the first and
+// last bins, as the corrections of calculate_keyrank.py.
+static int find_bin(double value, const double *edges) {
+  if (value < edges[0])
+    return 0;
+  if (value > edges[N_BINS])
+    return N_BINS - 1;
+  int low = 0, high = N_BINS;
+  while (high - low > 1) {
+    int mid = (low + high) / 2;
+    if (edges[mid] <= value)
+      low = mid;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+// Python slice H[start:] of the H_LEN counts, with a negative start counting from the end
+static double tail_log2(const uint128_t *H, long start) {
+  if (start < 0)
+    start += H_LEN;
+  if (start < 0)
+    start = 0;
+
+  uint128_t sum = 1;
+  int carry = 0;
+  for (long i = start; i < H_LEN; i++) {
+    uint128_t previous = sum;
+    sum += H[i];
+    if (sum < previous)
+      carry = 1;
+  }
+  return log2((double)sum + (carry ? ldexp(1.0, 128) : 0.0));
+}
+
+// Key rank bounds for the correlation matrix of the first n traces
+void keyrank_checkpoint(char *dump_path, int n, int key[KEYBYTES], keyrank_result_t *result) {
+
+  result->status = EXIT_FAILURE;
+
+  char file_name[1100];
+  snprintf(file_name, sizeof(file_name), "%s/final_kr/%d.txt", dump_path, n);
+  FILE *file = fopen(file_name, "r");
+  if (file == NULL) {
+    printf("Error in opening correlation file %s\n", file_name);
+    return;
+  }
+
+  double M[KEYS][KEYBYTES];
+  for (int i = 0; i < KEYS; i++) {
+    for (int j = 0; j < KEYBYTES; j++) {
+      if (fscanf(file, j == 0 ? "%lf" : " ,%lf", &M[i][j]) != 1) {
+        printf("Correlation file %s holds less than %d rows of %d values\n", file_name, KEYS, KEYBYTES);
+        fclose(file);
+        return;
+      }
+    }
+  }
+  double extra;
+  if (fscanf(file, "%lf", &extra) == 1) {
+    printf("Correlation file %s holds more than %d rows, it was appended to by several runs\n", file_name, KEYS);
+    fclose(file);
+    return;
+  }
+  fclose(file);
+
+  // log2 of the correlations normalised by their sum over the key guesses
+  for (int j = 0; j < KEYBYTES; j++) {
+    double sum = 0;
+    for (int i = 0; i < KEYS; i++)
+      sum += M[i][j];
+    for (int i = 0; i < KEYS; i++)
+      M[i][j] = log2(M[i][j] / sum);
+  }
+
+  // The bins are given by the range of the first key byte, as np.histogram(bins=256)
+  double first_edge = M[0][0], last_edge = M[0][0];
+  for (int i = 1; i < KEYS; i++) {
+    if (M[i][0] < first_edge)
+      first_edge = M[i][0];
+    if (M[i][0] > last_edge)
+      last_edge = M[i][0];
+  }
+  if (!isfinite(first_edge) || !isfinite(last_edge)) {
+    printf("Correlation file %s holds a null correlation for the first key byte\n", file_name);
+    return;
+  }
+  if (first_edge == last_edge) {
+    first_edge -= 0.5;
+    last_edge += 0.5;
+  }
+  double edges[N_BINS + 1];
+  double step = (last_edge - first_edge) / N_BINS;
+  for (int i = 0; i <= N_BINS; i++)
+    edges[i] = i * step + first_edge;
+  edges[N_BINS] = last_edge;
+
+  int hist[KEYBYTES][N_BINS];
+  memset(hist, 0, sizeof(hist));
+  long b = 0;
+  for (int j = 0; j < KEYBYTES; j++) {
+    for (int i = 0; i < KEYS; i++) {
+      if (!isnan(M[i][j]))
+        hist[j][find_bin(M[i][j], edges)]++;
+    }
+    if (!isnan(M[key[j]][j]))
+      b += find_bin(M[key[j]][j], edges) + 1;
+  }
+  b = b - KEYBYTES + 1;
+
+  uint128_t *H = (uint128_t *)malloc(sizeof(uint128_t) * H_LEN);
+  if (H == NULL) {
+    printf("----memory\n");
+    return;
+  }
+  convolve_histograms(hist, H);
+
+  result->lower = tail_log2(H, b + KEYBYTES / 2);
+  result->upper = tail_log2(H, b - KEYBYTES / 2 - 1);
+  result->status = EXIT_SUCCESS;
+  free(H);
+}
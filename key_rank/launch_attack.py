@@ -9,6 +9,43 @@ import os.path
 import subprocess
 import os
 
+# Multiplication in GF(2^8) with the AES polynomial
+def gf_mul(a, b):
+    p = 0
+    while b:
+        if b & 1:
+            p ^= a
+        a = ((a << 1) ^ 0x11b) if a & 0x80 else a << 1
+        b >>= 1
+    return p
+
+# First round (master) key from the last round key, by running the AES-128 key
+# schedule backwards, as get_model_key of utils.cu: the key attacked by the
+# first round leakage models
+def first_round_key(last_round_key):
+    inverse = [0] * 256
+    for x in range(1, 256):
+        inverse[x] = next(y for y in range(1, 256) if gf_mul(x, y) == 1)
+    sbox = []
+    for x in range(256):
+        s = inverse[x]
+        for i in range(1, 5):
+            s ^= ((inverse[x] << i) | (inverse[x] >> (8 - i))) & 0xff
+        sbox.append(s ^ 0x63)
+    rcon = [0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36]
+    w = list(bytes.fromhex(key_hex(last_round_key)))
+    for r in range(9, -1, -1):
+        for n in range(15, 3, -1):
+            w[n] ^= w[n - 4]
+        w[0] ^= sbox[w[13]] ^ rcon[r]
+        w[1] ^= sbox[w[14]]
+        w[2] ^= sbox[w[15]]
+        w[3] ^= sbox[w[12]]
+    return bytes(w).hex()
+
+def key_hex(key):
+    return key[2:] if key.startswith('0x') else key
+
 # Parse all arguments
 parser = argparse.ArgumentParser(description='\n==================================================\nCPA Key Rank Estimation Attack\n\n==================================================\n\nShort summary:\n\t- This program takes the power consumption traces, ciphertexts, and the last round key and computes the log2 key rank estimation metric using CPA.\n\t- The ouput of this program are the upper and lower bounds of the log2(key rank) metric, in a .csv file.\n', formatter_class=argparse.RawTextHelpFormatter );
 parser.add_argument("-k",  "--key",              help="Last round key of 16 bytes, in hexadecimal value.\nExample: -k e07f16bdb9e50346a2277cd382774270", required=True)
@@ -18,7 +55,28 @@ parser.add_argument("-nt", "--n_traces",         help="Number of traces (encrypt
 parser.add_argument("-ns", "--n_samples",        help="Number of sampler per trace (trace length).\nExample: -ns 128", required=True)
 parser.add_argument("-ss", "--step_size",        help="Step size for the attacks.\nExample: -ss 1000", required=True)
 parser.add_argument("-o",  "--output_path",      help="Path to output directory.\nExample: -o /home/user/documents/data/results/", required=True)
-
+parser.add_argument("-m",  "--memory_limit",     help="Memory ceiling for the trace batches streamed from the files, in MiB (default: 1024).\nExample: -m 4096", default="0")
+parser.add_argument("-b",  "--backend",          help="Backend running the attack: gpu (CUDA CPA), cpu (multithreaded C++ CPA) or template (multithreaded C++ template attack, profiled with -pt, -pc and -pk).\nExample: -b cpu", choices=["gpu", "cpu", "template"], default="gpu")
+parser.add_argument("-lm", "--leakage_models",   help="Comma-separated leakage models, attacked in one pass over the traces (default: hd).\nhd: last round Hamming distance; hw, id, bit0 to bit7: Hamming weight, value, or one bit of the first round S-box output.\nWith several models, the results of each one are written to a subdirectory named after it.\nExample: -lm hd,hw,bit0", default="hd")
+parser.add_argument("-p",  "--plaintexts_file",  help="Path to plaintext file of the first round models (default: plaintexts chained from the ciphertexts, as the Alveo host).\nExample: -p /home/user/documents/data/plaintexts.bin", default="")
+parser.add_argument("-r",  "--rounds",           help="Number of bootstrap attacks per step, run along the attack by the cpu backend (default: 0).\nTheir success rate and guessing entropy per key byte, with 95% confidence intervals, are written to bootstrap_kr_0.csv.\nExample: -r 100", default="0")
+parser.add_argument("-rs", "--seed",             help="Seed of the bootstrap subsampling (default: 1).\nExample: -rs 42", default="1")
+parser.add_argument("-rf", "--subsample",        help="Every bootstrap attack keeps one trace of every that many, without replacement (default: 10).\nAt a step of n traces, the bootstrap attacks are attacks on n / that many distinct traces.\nExample: -rf 20", default="10")
+parser.add_argument("-u",  "--until_broken",     help="Attack until broken: stop once every key byte has been ranked first for that many consecutive steps (default: 0, off).\nThe number of traces from which the key stayed ranked first is written to disclosure_kr_0.csv.\nExample: -u 5", default="0")
+parser.add_argument("-poi", "--points_of_interest", help="Number of points of interest: the CPA only processes the samples of highest NICV, computed by a pre-pass over the first traces (default: 0, all the samples).\nThe NICV of every sample is written to poi_kr_0.csv.\nExample: -poi 64", default="0")
+parser.add_argument("-pw", "--poi_window",       help="The points of interest are selected by windows of that many samples (default: 1).\nExample: -pw 8", default="1")
+parser.add_argument("-pn", "--poi_traces",       help="Number of traces of the point of interest pre-pass (default: 20000).\nExample: -pn 50000", default="0")
+parser.add_argument("-sw", "--sensor_width",     help="The trace file holds the raw sensor words of that many bits per sample (traces_raw.bin of the Alveo host, multiple of 32): every bit is a sample of the attack (default: 0, one sample per value).\nExample: -sw 128", default="0")
+parser.add_argument("-nc", "--n_channels",       help="Number of channels of the traces, one per sensor: every trace holds n_samples samples of every channel, one channel after the other (default: 1).\nExample: -nc 4", default="1")
+parser.add_argument("-cw", "--channel_weights",  help="Comma-separated weights of the channels (with -nc): the attack sees their weighted sum instead of all the channels (default: none).\nExample: -cw 1,1,0.5,0.5", default="")
+parser.add_argument("-bs", "--bitslice",         help="Bitsliced CPA of the raw sensor bits (with -sw), run by the cpu backend: every group of that many consecutive bits (1, 2, 4, 8, 16 or 32) is a sample (default: 0, off).\nExample: -bs 1", default="0")
+parser.add_argument("-lra", "--linear_regression", help="Linear regression analysis on the 8 bits of the intermediate instead of the CPA, run by the cpu backend.", action="store_true")
+parser.add_argument("-al", "--shifts_file",      help="Shift index written by align-traces (-f shifts), applied to the traces as they are read.\nExample: -al /home/user/documents/data/traces_shifts.bin", default="")
+parser.add_argument("-pt", "--profiling_traces_file", help="Path to the trace file of the profiling set of the template backend, acquired with a random key per trace (key mode 1), .bin or .data.\nExample: -pt /home/user/documents/profiling/traces.bin", default="")
+parser.add_argument("-pc", "--profiling_ciphertexts_file", help="Path to the ciphertext file of the profiling set.\nExample: -pc /home/user/documents/profiling/ciphertexts.bin", default="")
+parser.add_argument("-pk", "--profiling_keys_file", help="Path to the key file of the profiling set.\nExample: -pk /home/user/documents/profiling/keys.bin", default="")
+parser.add_argument("-pp", "--profiling_plaintexts_file", help="Path to the plaintext file of the profiling set, for the first round models (default: chained from the ciphertexts).\nExample: -pp /home/user/documents/profiling/plaintexts.bin", default="")
+parser.add_argument("-np", "--n_profiling_traces", help="Number of profiling traces (default: 0, all the traces of the profiling files).\nExample: -np 500000", default="0")
 args = parser.parse_args()
 
 if not (os.path.exists('out')):
@@ -36,12 +94,57 @@ print("* Number of traces: "+args.n_traces)
 print("* Number of trace samples: "+args.n_samples)
 print("* Attack step size: "+args.step_size)
 print("* Output path: "+args.output_path)
+print("* Backend: "+args.backend)
+print("* Memory ceiling (MiB, 0 = default): "+args.memory_limit)
+print("* Leakage models: "+args.leakage_models)
+if args.plaintexts_file != "":
+    print("* Plaintext file: "+args.plaintexts_file)
+if int(args.rounds) > 0:
+    print("* Bootstrap attacks per step: "+args.rounds+" on one trace of "+args.subsample+" (seed "+args.seed+")")
+if int(args.until_broken) > 0:
+    print("* Attack until the key is ranked first for "+args.until_broken+" steps")
+if int(args.points_of_interest) > 0:
+    print("* Points of interest: "+args.points_of_interest+" (windows of "+args.poi_window+" samples)")
+if int(args.sensor_width) > 0:
+    print("* Raw sensor words of "+args.sensor_width+" bits")
+if int(args.n_channels) > 1:
+    print("* Channels: "+args.n_channels+(" summed with the weights "+args.channel_weights if args.channel_weights != "" else ""))
+if args.shifts_file != "":
+    print("* Shift file: "+args.shifts_file)
+if args.linear_regression:
+    print("* Linear regression analysis")
+if int(args.bitslice) > 0:
+    print("* Bitsliced CPA: samples of "+args.bitslice+" bits")
+if args.backend == "template":
+    print("* Profiling set: "+args.profiling_traces_file+", "+args.profiling_ciphertexts_file+", "+args.profiling_keys_file)
 
 # Perform checks
+if int(args.rounds) > 0 and args.backend != "cpu":
+    print("The bootstrap attacks (-r) are only run by the cpu backend (-b cpu)!")
+    f.write("The bootstrap attacks (-r) are only run by the cpu backend (-b cpu)!\n")
+    exit()
+if args.linear_regression and args.backend != "cpu":
+    print("The linear regression analysis (-lra) is only run by the cpu backend (-b cpu)!")
+    f.write("The linear regression analysis (-lra) is only run by the cpu backend (-b cpu)!\n")
+    exit()
+if int(args.bitslice) > 0 and args.backend != "cpu":
+    print("The bitsliced CPA (-bs) is only run by the cpu backend (-b cpu)!")
+    f.write("The bitsliced CPA (-bs) is only run by the cpu backend (-b cpu)!\n")
+    exit()
+if args.backend == "template":
+    for name, path in [("Profiling trace", args.profiling_traces_file), ("Profiling ciphertexts", args.profiling_ciphertexts_file), ("Profiling keys", args.profiling_keys_file)]:
+        if not (os.path.exists(path)):
+            print(name+" file ("+path+") does not exist!")
+            f.write(name+" file ("+path+") does not exist!\n")
+            exit()
 if not (os.path.exists(args.trace_file)):
     print("Trace file ("+args.trace_file+") does not exist!")
     f.write("Trace file ("+args.trace_file+") does not exist!\n")
     exit()
+if args.shifts_file != "" and not (os.path.exists(args.shifts_file)):
+    print("Shift file ("+args.shifts_file+") does not exist!")
+    f.write("Shift file ("+args.shifts_file+") does not exist!\n")
+    exit()
 if not (os.path.exists(args.ciphertexts_file)):
     print("Ciphertexts file ("+args.ciphertexts_file+") does not exist!")
     f.write("Ciphertexts file ("+args.ciphertexts_file+") does not exist!\n")
@@ -53,33 +156,52 @@ if not (os.path.exists(args.output_path)):
 
 f.flush()
 
-# Transform binary trace file (where each sample is a uint8_t) to .data file
-print("----------------------------------------------------------")
-f.write("----------------------------------------------------------\n")
-print("Converting trace file to appropriate format...")
-f.write("Converting trace file to appropriate format...\n")
+# The attack maps binary trace files (where each sample is a uint8_t) and
+# binary ciphertext files (where each ciphertext is 16 uint8_t values) directly.
+# The hex .csv sensor traces are transformed to a binary trace file of Hamming
+# weights by the native converter, other trace files to a .data file.
+if args.trace_file.endswith('.bin') or int(args.sensor_width) > 0:
+    trace_file = args.trace_file
+else:
+    print("----------------------------------------------------------")
+    f.write("----------------------------------------------------------\n")
+    print("Converting trace file to appropriate format...")
+    f.write("Converting trace file to appropriate format...\n")
 
-command = 'python3 convert_traces.py '+args.trace_file+' '+args.n_traces+' '+args.n_samples
-print(command)
-f.write(command+"\n")
-f.flush()
-process = subprocess.call(command.split(), stdout=f, stderr=f_err)
-f_err.flush()
-f.flush()
+    if args.trace_file.endswith('.csv'):
+        trace_file = os.path.splitext(args.trace_file)[0]+"_hw.bin"
+        commands = ['make convert',
+                    './convert-traces '+args.trace_file+' '+args.n_traces+' '+args.n_samples+' -f bin -o '+trace_file]
+    else:
+        trace_file = os.path.splitext(args.trace_file)[0]+".data"
+        commands = ['python3 convert_traces.py '+args.trace_file+' '+args.n_traces+' '+args.n_samples]
 
-# Transform binary ciphertext file (where each ciphertext is 16 uint8_t values) to .txt file
-print("----------------------------------------------------------")
-f.write("----------------------------------------------------------\n")
-print("Converting ciphertext file to appropriate format...")
-f.write("Converting ciphertext file to appropriate format...\n")
+    for command in commands:
+        print(command)
+        f.write(command+"\n")
+        f.flush()
+        process = subprocess.call(command.split(), stdout=f, stderr=f_err)
+        f_err.flush()
+        f.flush()
 
-command = 'python3 convert_ciphertexts.py '+args.ciphertexts_file+' '+args.n_traces
-print(command)
-f.write(command+"\n")
-f.flush()
-process = subprocess.call(command.split(), stdout=f, stderr=f_err)
-f_err.flush()
-f.flush()
+# Other binary ciphertext files are transformed to a .txt file
+if args.ciphertexts_file.endswith('.bin'):
+    ciphertexts_file = args.ciphertexts_file
+else:
+    ciphertexts_file = os.path.splitext(args.ciphertexts_file)[0]+".txt"
+
+    print("----------------------------------------------------------")
+    f.write("----------------------------------------------------------\n")
+    print("Converting ciphertext file to appropriate format...")
+    f.write("Converting ciphertext file to appropriate format...\n")
+
+    command = 'python3 convert_ciphertexts.py '+args.ciphertexts_file+' '+args.n_traces
+    print(command)
+    f.write(command+"\n")
+    f.flush()
+    process = subprocess.call(command.split(), stdout=f, stderr=f_err)
+    f_err.flush()
+    f.flush()
 
 # Compile attack
 print("----------------------------------------------------------")
@@ -87,7 +209,7 @@ f.write("----------------------------------------------------------\n")
 print("Compiling CPA key rank estimation attack...")
 f.write("Compiling CPA key rank estimation attack...\n")
 
-command = 'make'
+command = {'gpu': 'make', 'cpu': 'make cpu', 'template': 'make template'}[args.backend]
 print(command)
 f.write(command+"\n")
 f.flush()
@@ -101,13 +223,27 @@ f.write("----------------------------------------------------------\n")
 print("Launching CPA key rank estimation attack...")
 f.write("Launching CPA key rank estimation attack...\n")
 
-command = ('./main-CPA' +
+command = ({'gpu': './main-CPA', 'cpu': './main-CPA-cpu', 'template': './main-TA-cpu'}[args.backend] +
            ' -k '  + args.key +
-           ' -t '  + os.path.splitext(args.trace_file)[0]+".data" +
-           ' -c '  + os.path.splitext(args.ciphertexts_file)[0]+".txt" +
+           ' -t '  + trace_file +
+           ' -c '  + ciphertexts_file +
            ' -nt ' + args.n_traces +
            ' -ns ' + args.n_samples +
            ' -ss ' + args.step_size +
+           ' -m '  + args.memory_limit +
+           ' -lm ' + args.leakage_models +
+           (' -p ' + args.plaintexts_file if args.plaintexts_file != "" else '') +
+           (' -r ' + args.rounds + ' -rs ' + args.seed + ' -rf ' + args.subsample if int(args.rounds) > 0 else '') +
+           (' -u ' + args.until_broken if int(args.until_broken) > 0 else '') +
+           (' -sw ' + args.sensor_width if int(args.sensor_width) > 0 else '') +
+           (' -lra' if args.linear_regression else '') +
+           (' -bs ' + args.bitslice if int(args.bitslice) > 0 else '') +
+           (' -nc ' + args.n_channels if int(args.n_channels) > 1 else '') +
+           (' -cw ' + args.channel_weights if args.channel_weights != "" else '') +
+           (' -al ' + args.shifts_file if args.shifts_file != "" else '') +
+           (' -poi ' + args.points_of_interest + ' -pw ' + args.poi_window + ' -pn ' + args.poi_traces if int(args.points_of_interest) > 0 else '') +
+           (' -pt ' + args.profiling_traces_file + ' -pc ' + args.profiling_ciphertexts_file + ' -pk ' + args.profiling_keys_file + ' -np ' + args.n_profiling_traces if args.backend == 'template' else '') +
+           (' -pp ' + args.profiling_plaintexts_file if args.backend == 'template' and args.profiling_plaintexts_file != "" else '') +
            ' -o  ' + 'out/')
 print(command)
 f.write(command+"\n")
@@ -122,13 +258,30 @@ f.write("----------------------------------------------------------\n")
 print("Creating CPA key rank estimation upper and lower bounds...")
 f.write("Creating CPA key rank estimation upper and lower bounds...\n")
 
-command = 'python3 calculate_keyrank.py '+args.key+' '+args.step_size+' '+args.n_traces+' out/' 
-print(command)
-f.write(command+"\n")
-f.flush()
-process = subprocess.call(command.split(), stdout=f, stderr=f_err)
-f_err.flush()
-f.flush()
+# One key rank per leakage model, in its own directory when there are several,
+# for the key the model attacks
+models = args.leakage_models.split(',')
+commands = ['make keyrank']
+# An attack until broken stops early: the key rank only goes up to the last
+# step it went through
+n_traces = args.n_traces
+if int(args.until_broken) > 0:
+    path = 'out/' if len(models) == 1 else 'out/' + models[0] + '/'
+    if os.path.exists(path + 'disclosure_kr_0.csv'):
+        with open(path + 'disclosure_kr_0.csv') as disclosure_file:
+            disclosure, n_traces = disclosure_file.readlines()[1].strip().split(',')
+        print("Traces to disclosure: "+disclosure+" (attack stopped after "+n_traces+" traces)")
+for model in models:
+    key = args.key if model == 'hd' else first_round_key(args.key)
+    path = 'out/' if len(models) == 1 else 'out/' + model + '/'
+    commands.append('./calculate-keyrank '+key+' '+args.step_size+' '+n_traces+' '+path)
+for command in commands:
+    print(command)
+    f.write(command+"\n")
+    f.flush()
+    process = subprocess.call(command.split(), stdout=f, stderr=f_err)
+    f_err.flush()
+    f.flush()
 
 # Move results to output directory
 print("----------------------------------------------------------")
@@ -0,0 +1,85 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Leakage models of the CPU backends, shared by the CPA and the template attack engines.
+*/
+
+#ifndef LEAKAGE_MODELS_H
+#define LEAKAGE_MODELS_H
+
+#include <stdint.h>
+#include "utils.cuh"
+#include "aes_tables.hpp"
+
+// hd_table.hd[st10][x] = HD(inv_sbox[x], st10), the same table as hd_table in data.cuh
+typedef struct hd_table {
+  uint8_t hd[KEYS][KEYS];
+} hd_table_t;
+
+static hd_table_t make_hd_table() {
+  hd_table_t table;
+  for (int st10 = 0; st10 < KEYS; st10++)
+    for (int x = 0; x < KEYS; x++)
+      table.hd[st10][x] = (uint8_t)__builtin_popcount(inv_sbox[x] ^ st10);
+  return table;
+}
+
+static const hd_table_t HD = make_hd_table();
+
+// Tables of the first round models: HW and bits of the S-box output
+typedef struct model_tables {
+  uint8_t sbox_hw[KEYS];
+  uint8_t sbox_bit[8][KEYS];
+} model_tables_t;
+
+static model_tables_t make_model_tables() {
+  model_tables_t tables;
+  for (int x = 0; x < KEYS; x++) {
+    tables.sbox_hw[x] = (uint8_t)__builtin_popcount(sbox[x]);
+    for (int b = 0; b < 8; b++)
+      tables.sbox_bit[b][x] = (sbox[x] >> b) & 1;
+  }
+  return tables;
+}
+
+static const model_tables_t MODELS = make_model_tables();
+
+// Leakage models (MODEL_ in utils.cuh). The hypothesis of key byte n and key
+// guess k for the 16-byte text of a trace (ciphertext of the last round model,
+// plaintext of the first round ones) is row(select(text, n))[text[n] ^ k]:
+// select returns the other byte of the text the model depends on (0 if none)
+// and row the 256 hypotheses for it, which take the values 0 to classes - 1.
+// The engines are instantiated for every model, so that both are inlined in
+// the inner loops.
+struct model_last_round_hd {
+  static const int classes = 9;
+  static inline uint8_t select(const uint8_t *text, int n) { return text[inv_shift[n]]; }
+  static inline const uint8_t *row(uint8_t d) { return HD.hd[d]; }
+};
+
+struct model_sbox_hw {
+  static const int classes = 9;
+  static inline uint8_t select(const uint8_t *text, int n) { return 0; }
+  static inline const uint8_t *row(uint8_t d) { return MODELS.sbox_hw; }
+};
+
+struct model_identity {
+  static const int classes = KEYS;
+  static inline uint8_t select(const uint8_t *text, int n) { return 0; }
+  static inline const uint8_t *row(uint8_t d) { return sbox; }
+};
+
+template <int bit>
+struct model_sbox_bit {
+  static const int classes = 2;
+  static inline uint8_t select(const uint8_t *text, int n) { return 0; }
+  static inline const uint8_t *row(uint8_t d) { return MODELS.sbox_bit[bit]; }
+};
+
+#endif
@@ -0,0 +1,322 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "lra_engine.hpp"
+#include "leakage_models.hpp"
+#include <math.h>
+#include <thread>
+#include <vector>
+
+// Ridge added to the diagonal of singular normal equations, relative to the number of traces
+#define LRA_RIDGE 1e-9
+
+static int lra_rows(int model) {
+  return model_first_round(model) ? 1 : CLASS_ROWS;
+}
+
+size_t lra_state_size(int n_samples, int model) {
+  return sizeof(double) * KEYBYTES * KEYS * lra_rows(model) * n_samples;
+}
+
+int lra_state_init(lra_state_t *state, int n_samples, int model) {
+  memset(state, 0, sizeof(lra_state_t));
+  state->n_samples = n_samples;
+  state->model = model;
+  state->rows = lra_rows(model);
+  state->sum_w = (double *)malloc(sizeof(double) * n_samples);
+  state->sum_w2 = (double *)malloc(sizeof(double) * n_samples);
+  state->sum_class = (double *)malloc(lra_state_size(n_samples, model));
+  state->class_count = (uint64_t *)malloc(sizeof(uint64_t) * KEYBYTES * KEYS * CLASS_COUNTS);
+  if (state->sum_w == NULL || state->sum_w2 == NULL || state->sum_class == NULL || state->class_count == NULL) {
+    printf("----memory\n");
+    lra_state_free(state);
+    return EXIT_FAILURE;
+  }
+  lra_state_reset(state);
+  return EXIT_SUCCESS;
+}
+
+void lra_state_reset(lra_state_t *state) {
+  state->n_traces = 0;
+  memset(state->sum_w, 0, sizeof(double) * state->n_samples);
+  memset(state->sum_w2, 0, sizeof(double) * state->n_samples);
+  memset(state->sum_class, 0, sizeof(double) * KEYBYTES * KEYS * state->rows * state->n_samples);
+  memset(state->class_count, 0, sizeof(uint64_t) * KEYBYTES * KEYS * CLASS_COUNTS);
+}
+
+void lra_state_free(lra_state_t *state) {
+  free(state->sum_w);
+  free(state->sum_w2);
+  free(state->sum_class);
+  free(state->class_count);
+  state->sum_w = NULL;
+  state->sum_w2 = NULL;
+  state->sum_class = NULL;
+  state->class_count = NULL;
+}
+
+void lra_state_merge(lra_state_t *dst, const lra_state_t *src) {
+  size_t n_class = (size_t)KEYBYTES * KEYS * dst->rows * dst->n_samples;
+
+  dst->n_traces += src->n_traces;
+  for (int i = 0; i < dst->n_samples; i++) {
+    dst->sum_w[i] += src->sum_w[i];
+    dst->sum_w2[i] += src->sum_w2[i];
+  }
+  for (size_t i = 0; i < n_class; i++)
+    dst->sum_class[i] += src->sum_class[i];
+  for (int i = 0; i < KEYBYTES * KEYS * CLASS_COUNTS; i++)
+    dst->class_count[i] += src->class_count[i];
+}
+
+// Adds every trace to the row of all the traces of its text byte class and,
+// for the last round model, to the rows of the bits set in ct[inv_shift[n]],
+// whose pairs are counted, as accumulate_classes of the CPA
+template <typename model_t, typename sample_t>
+static void accumulate(lra_state_t *state, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  int n_samples = state->n_samples;
+  int rows = state->rows;
+
+  for (size_t t = 0; t < n_traces; t++) {
+    const sample_t *trace = &traces[t * n_samples];
+    const uint8_t *text = &texts[t * KEYBYTES];
+    for (int s = 0; s < n_samples; s++) {
+      state->sum_w[s] += (double)trace[s];
+      state->sum_w2[s] += (double)trace[s] * (double)trace[s];
+    }
+    for (int n = 0; n < KEYBYTES; n++) {
+      size_t cls = (size_t)n * KEYS + text[n];
+      double *sums = &state->sum_class[cls * rows * n_samples];
+      uint64_t *count = &state->class_count[cls * CLASS_COUNTS];
+      double *all = &sums[(size_t)(rows - 1) * n_samples];
+      for (int s = 0; s < n_samples; s++)
+        all[s] += (double)trace[s];
+      count[CLASS_COUNTS - 1]++;
+      if (rows == 1)
+        continue;
+      uint8_t d = model_t::select(text, n);
+      for (int b = 0; b < 8; b++) {
+        if (!((d >> b) & 1))
+          continue;
+        double *row = &sums[(size_t)b * n_samples];
+        for (int s = 0; s < n_samples; s++)
+          row[s] += (double)trace[s];
+        for (int b2 = 0; b2 < 8; b2++)
+          count[b * 8 + b2] += (d >> b2) & 1;
+      }
+    }
+  }
+  state->n_traces += n_traces;
+}
+
+template <typename sample_t>
+static void accumulate_block(lra_state_t *state, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  DISPATCH_MODEL(state->model, accumulate, state, traces, texts, n_traces);
+}
+
+template <typename sample_t>
+static void accumulate_parallel(lra_state_t *state, lra_state_t *workers, int n_threads, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  std::vector<std::thread> threads;
+  size_t block = (n_traces + n_threads - 1) / n_threads;
+
+  for (int i = 0; i < n_threads; i++) {
+    size_t start = i * block;
+    if (start >= n_traces)
+      break;
+    size_t count = (start + block > n_traces) ? n_traces - start : block;
+    workers[i].model = state->model;
+    workers[i].rows = state->rows;
+    threads.push_back(std::thread(accumulate_block<sample_t>, &workers[i], &traces[start * state->n_samples], &texts[start * KEYBYTES], count));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    lra_state_merge(state, &workers[i]);
+    lra_state_reset(&workers[i]);
+  }
+}
+
+void lra_accumulate_parallel(lra_state_t *state, lra_state_t *workers, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces) {
+  accumulate_parallel(state, workers, n_threads, traces, texts, n_traces);
+}
+
+void lra_accumulate_parallel(lra_state_t *state, lra_state_t *workers, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  accumulate_parallel(state, workers, n_threads, traces, texts, n_traces);
+}
+
+// Cholesky factorisation in place of the LRA_BASIS x LRA_BASIS matrix a.
+// Returns 0 if a is not positive definite.
+static int cholesky(double a[LRA_BASIS][LRA_BASIS]) {
+  for (int j = 0; j < LRA_BASIS; j++) {
+    double d = a[j][j];
+    for (int k = 0; k < j; k++)
+      d -= a[j][k] * a[j][k];
+    if (d <= 0)
+      return 0;
+    d = sqrt(d);
+    a[j][j] = d;
+    for (int i = j + 1; i < LRA_BASIS; i++) {
+      double v = a[i][j];
+      for (int k = 0; k < j; k++)
+        v -= a[i][k] * a[j][k];
+      a[i][j] = v / d;
+    }
+  }
+  return 1;
+}
+
+// Largest coefficient of determination of the hypotheses first to last
+// (key byte * KEYS + key guess). The bit j of the intermediate of a trace of
+// class x is a_j ^ d_j, with a = inter[x ^ k] and d_j the bit j of
+// ct[inv_shift[n]] (0 for the first round), so that its sum over the traces
+// of the class is the row of all the traces if a_j = 1 minus the row j, or
+// the row j if a_j = 0, and the products of the bits are counted likewise
+// from the pair counts. Then the regression sum of squares of every sample
+// is |L^-1 c|^2, with M = L L^T the normal matrix and c the sums of the
+// basis times the sample.
+static void max_r2_hypotheses(const lra_state_t *state, const uint8_t *inter, const double *row_totals, double *maxR2, int first, int last) {
+  int n_samples = state->n_samples;
+  int rows = state->rows;
+  double n_traces = (double)state->n_traces;
+  double *c = (double *)malloc(sizeof(double) * LRA_BASIS * n_samples);
+  if (c == NULL) {
+    printf("----memory\n");
+    return;
+  }
+
+  for (int hyp = first; hyp < last; hyp++) {
+    int n = hyp / KEYS;
+    int k = hyp % KEYS;
+    double m[LRA_BASIS][LRA_BASIS] = {{0}};
+
+    // c starts from the sums of the rows j over all the classes (the sums of
+    // d_j times the sample), to which the classes with a_j = 1 add all - 2 * row j
+    for (int j = 0; j < 8; j++) {
+      for (int s = 0; s < n_samples; s++)
+        c[j * n_samples + s] = rows > 1 ? row_totals[((size_t)n * 8 + j) * n_samples + s] : 0;
+    }
+    for (int s = 0; s < n_samples; s++)
+      c[8 * n_samples + s] = state->sum_w[s];
+
+    for (int x = 0; x < KEYS; x++) {
+      size_t cls = (size_t)n * KEYS + x;
+      const uint64_t *count = &state->class_count[cls * CLASS_COUNTS];
+      double n_x = (double)count[CLASS_COUNTS - 1];
+      if (n_x == 0)
+        continue;
+      uint8_t a = inter[x ^ k];
+      const double *sums = &state->sum_class[cls * rows * n_samples];
+      const double *all = &sums[(size_t)(rows - 1) * n_samples];
+
+      for (int i = 0; i < 8; i++) {
+        int ai = (a >> i) & 1;
+        double ci = rows > 1 ? (double)count[i * 8 + i] : 0;
+        m[i][8] += ai ? n_x - ci : ci;
+        for (int j = i; j < 8; j++) {
+          int aj = (a >> j) & 1;
+          double cj = rows > 1 ? (double)count[j * 8 + j] : 0;
+          double cij = rows > 1 ? (double)count[i * 8 + j] : 0;
+          if (!ai && !aj)
+            m[i][j] += cij;
+          else if (ai && !aj)
+            m[i][j] += cj - cij;
+          else if (!ai && aj)
+            m[i][j] += ci - cij;
+          else
+            m[i][j] += n_x - ci - cj + cij;
+        }
+        if (!ai)
+          continue;
+        double *cj = &c[i * n_samples];
+        if (rows > 1) {
+          const double *row = &sums[(size_t)i * n_samples];
+          for (int s = 0; s < n_samples; s++)
+            cj[s] += all[s] - 2 * row[s];
+        } else {
+          for (int s = 0; s < n_samples; s++)
+            cj[s] += all[s];
+        }
+      }
+    }
+    m[8][8] = n_traces;
+    for (int i = 0; i < LRA_BASIS; i++)
+      for (int j = 0; j < i; j++)
+        m[i][j] = m[j][i];
+
+    // A bit that is constant over the traces makes the normal matrix singular
+    double l[LRA_BASIS][LRA_BASIS];
+    memcpy(l, m, sizeof(l));
+    if (!cholesky(l)) {
+      memcpy(l, m, sizeof(l));
+      for (int i = 0; i < LRA_BASIS; i++)
+        l[i][i] += LRA_RIDGE * n_traces;
+      if (!cholesky(l)) {
+        maxR2[k * KEYBYTES + n] = 0;
+        continue;
+      }
+    }
+
+    double best = 0;
+    for (int s = 0; s < n_samples; s++) {
+      double mean = state->sum_w[s] / n_traces;
+      double total = state->sum_w2[s] - n_traces * mean * mean;
+      if (total <= 0)
+        continue;
+      double z[LRA_BASIS];
+      double regression = 0;
+      for (int i = 0; i < LRA_BASIS; i++) {
+        double v = c[i * n_samples + s];
+        for (int j = 0; j < i; j++)
+          v -= l[i][j] * z[j];
+        z[i] = v / l[i][i];
+        regression += z[i] * z[i];
+      }
+      double r2 = (regression - n_traces * mean * mean) / total;
+      if (r2 > best)
+        best = r2;
+    }
+    maxR2[k * KEYBYTES + n] = best;
+  }
+  free(c);
+}
+
+void lra_max_r2(lra_state_t *state, double *maxR2, int n_threads) {
+  int n_samples = state->n_samples;
+  int rows = state->rows;
+  const uint8_t *inter = model_first_round(state->model) ? sbox : inv_sbox;
+
+  // Sums of the rows of the bits of ct[inv_shift[n]] over all the classes
+  double *row_totals = (double *)calloc((size_t)KEYBYTES * 8 * n_samples, sizeof(double));
+  if (row_totals == NULL) {
+    printf("----memory\n");
+    return;
+  }
+  for (int n = 0; n < KEYBYTES && rows > 1; n++) {
+    for (int x = 0; x < KEYS; x++) {
+      const double *sums = &state->sum_class[((size_t)n * KEYS + x) * rows * n_samples];
+      for (int j = 0; j < 8; j++) {
+        double *total = &row_totals[((size_t)n * 8 + j) * n_samples];
+        for (int s = 0; s < n_samples; s++)
+          total[s] += sums[(size_t)j * n_samples + s];
+      }
+    }
+  }
+
+  std::vector<std::thread> threads;
+  int n_hyp = KEYS * KEYBYTES;
+  int block = (n_hyp + n_threads - 1) / n_threads;
+  for (int i = 0; i < n_threads; i++) {
+    int first = i * block;
+    if (first >= n_hyp)
+      break;
+    int last = (first + block > n_hyp) ? n_hyp : first + block;
+    threads.push_back(std::thread(max_r2_hypotheses, state, inter, row_totals, maxR2, first, last));
+  }
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  free(row_totals);
+}
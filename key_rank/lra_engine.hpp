@@ -0,0 +1,64 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef LRA_ENGINE_H
+#define LRA_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.cuh"
+#include "cpa_engine.hpp"
+
+// Elements of the regression basis: the 8 bits of the intermediate and a constant
+#define LRA_BASIS 9
+
+// Linear regression analysis accumulators for all key bytes. Every sample is
+// regressed, for every key guess, on the bits of the intermediate of the
+// leakage model: inv_sbox[ct[n] ^ k] ^ ct[inv_shift[n]] (the state register
+// transition) for the last round model, sbox[pt[n] ^ k] for the first round
+// ones, which all share it. The normal equations of every key guess only
+// depend on the sums of the traces by text byte class, which are accumulated
+// as the class sums of the CPA (sum_class and class_count, with CLASS_ROWS
+// rows for the last round model, only the row of all the traces for the
+// first round ones) and turned into the normal equations at every checkpoint.
+// The uint8 traces are summed exactly (integers of less than 53 bits).
+typedef struct lra_state {
+
+  uint64_t n_traces;
+  int n_samples;
+  int model;                        // MODEL_ leakage model of the intermediate
+  int rows;                         // CLASS_ROWS or 1, the last one of all the traces
+  double *sum_w;                    // [sample]
+  double *sum_w2;                   // [sample]
+  double *sum_class;                // [key byte][text byte][rows][sample]
+  uint64_t *class_count;            // [key byte][text byte][CLASS_COUNTS]
+
+} lra_state_t;
+
+// Memory of the class sums of one state
+size_t lra_state_size(int n_samples, int model);
+
+int lra_state_init(lra_state_t *state, int n_samples, int model);
+void lra_state_reset(lra_state_t *state);
+void lra_state_free(lra_state_t *state);
+void lra_state_merge(lra_state_t *dst, const lra_state_t *src);
+
+// Adds the traces to the state, split over n_threads workers as by
+// cpa_accumulate_parallel. The workers are initialised with the same
+// n_samples and a model of at least as many rows, take the model of the
+// state and are left reset. texts are the ciphertexts for the last round
+// model, the plaintexts for the first round ones.
+void lra_accumulate_parallel(lra_state_t *state, lra_state_t *workers, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces);
+void lra_accumulate_parallel(lra_state_t *state, lra_state_t *workers, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces);
+
+// Solves the normal equations of every key guess and sample, and writes the
+// largest coefficient of determination over the samples of every key guess
+// to maxR2, [key guess][key byte] as the maximum correlations of the CPA
+void lra_max_r2(lra_state_t *state, double *maxR2, int n_threads);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "poi.cuh"
+#include "trace_io.cuh"
+#include "cpa_log.cuh"
+#include <stdint.h>
+
+// Text sets whose byte values are the classes of the NICV
+#define POI_CIPHERTEXTS 0   // last round model
+#define POI_PLAINTEXTS  1   // first round models
+#define POI_SETS        2
+
+typedef struct poi_window {
+  int first;
+  double score;
+} poi_window_t;
+
+// Windows by decreasing score, then by increasing first sample
+static int compare_windows(const void *a, const void *b) {
+  const poi_window_t *wa = (const poi_window_t *)a;
+  const poi_window_t *wb = (const poi_window_t *)b;
+  if (wa->score != wb->score)
+    return wa->score < wb->score ? 1 : -1;
+  return wa->first - wb->first;
+}
+
+// Adds the traces to the sums of every sample and of every class: sums holds
+// [set][text byte][byte value][sample] for the sets in use
+template <typename sample_t>
+static void add_poi_traces(const sample_t *traces, const uint8_t *texts[POI_SETS], long n_traces, int n_samples, double *sum, double *sum2, double *sums, uint64_t *counts) {
+  for (long t = 0; t < n_traces; t++) {
+    const sample_t *trace = &traces[(size_t)t * n_samples];
+    for (int s = 0; s < n_samples; s++) {
+      sum[s] += (double)trace[s];
+      sum2[s] += (double)trace[s] * (double)trace[s];
+    }
+    for (int set = 0; set < POI_SETS; set++) {
+      if (texts[set] == NULL)
+        continue;
+      for (int n = 0; n < KEYBYTES; n++) {
+        size_t cls = ((size_t)set * KEYBYTES + n) * KEYS + texts[set][t * KEYBYTES + n];
+        double *row = &sums[cls * n_samples];
+        for (int s = 0; s < n_samples; s++)
+          row[s] += (double)trace[s];
+        counts[cls]++;
+      }
+    }
+  }
+}
+
+int select_points_of_interest(config_t *config, int *samples) {
+
+  int n_samples = config->n_samples;
+  int window = config->poi_window > 0 ? config->poi_window : 1;
+  long n_traces = config->poi_traces > 0 ? config->poi_traces : DEFAULT_POI_TRACES;
+  if (n_traces > config->n_traces)
+    n_traces = config->n_traces;
+  if (config->poi_samples < window) {
+    printf("The number of points of interest (%d) is smaller than their window (%d)\n", config->poi_samples, window);
+    return -1;
+  }
+
+  int use[POI_SETS] = {0, 0};
+  for (int m = 0; m < config->n_models; m++)
+    use[model_first_round(config->models[m]) ? POI_PLAINTEXTS : POI_CIPHERTEXTS] = 1;
+
+  trace_reader_t reader;
+  if (trace_reader_open(&reader, config->trace_path, config->ciphertext_path, n_samples, config->sensor_width) == EXIT_FAILURE)
+    return -1;
+  if (config->n_channels > 1)
+    trace_reader_open_channels(&reader, config->n_channels, config->fuse ? config->channel_weights : NULL);
+  if ((use[POI_PLAINTEXTS] && trace_reader_open_plaintexts(&reader, config->plaintext_path) == EXIT_FAILURE)
+      || (config->shift_path[0] != '\0' && trace_reader_open_shifts(&reader, config->shift_path) == EXIT_FAILURE)) {
+    trace_reader_close(&reader);
+    return -1;
+  }
+
+  printf("Selecting %d points of interest (windows of %d samples) from the NICV of the first %ld traces\n", config->poi_samples, window, n_traces);
+
+  size_t n_classes = (size_t)POI_SETS * KEYBYTES * KEYS;
+  double *sum = (double *)calloc(n_samples, sizeof(double));
+  double *sum2 = (double *)calloc(n_samples, sizeof(double));
+  double *sums = (double *)calloc(n_classes * n_samples, sizeof(double));
+  uint64_t *counts = (uint64_t *)calloc(n_classes, sizeof(uint64_t));
+  double *nicv = (double *)calloc(n_samples, sizeof(double));
+  if (sum == NULL || sum2 == NULL || sums == NULL || counts == NULL || nicv == NULL) {
+    printf("----memory\n");
+    free(sum);
+    free(sum2);
+    free(sums);
+    free(counts);
+    free(nicv);
+    trace_reader_close(&reader);
+    return -1;
+  }
+
+  long batch = get_batch_size(config, trace_sample_size(&reader) * n_samples + 2 * KEYBYTES, 0);
+  trace_batch_t traces;
+  long read = 0;
+  while (read < n_traces) {
+    long n = (n_traces - read) < batch ? (n_traces - read) : batch;
+    n = trace_reader_next(&reader, &traces, n);
+    if (n == 0)
+      break;
+    const uint8_t *texts[POI_SETS];
+    texts[POI_CIPHERTEXTS] = use[POI_CIPHERTEXTS] ? traces.ciphertexts : NULL;
+    texts[POI_PLAINTEXTS] = use[POI_PLAINTEXTS] ? traces.plaintexts : NULL;
+    if (traces.traces_u8 != NULL)
+      add_poi_traces(traces.traces_u8, texts, n, n_samples, sum, sum2, sums, counts);
+    else
+      add_poi_traces(traces.traces, texts, n, n_samples, sum, sum2, sums, counts);
+    read += n;
+  }
+  trace_reader_close(&reader);
+
+  // NICV of a sample: variance of the class means over the variance of the
+  // sample, the largest over the text bytes
+  for (int s = 0; s < n_samples && read > 0; s++) {
+    double mean = sum[s] / read;
+    double var = sum2[s] / read - mean * mean;
+    if (var <= 0)
+      continue;
+    for (int set = 0; set < POI_SETS; set++) {
+      for (int n = 0; n < KEYBYTES && use[set]; n++) {
+        double between = 0;
+        for (int v = 0; v < KEYS; v++) {
+          size_t cls = ((size_t)set * KEYBYTES + n) * KEYS + v;
+          if (counts[cls] == 0)
+            continue;
+          double d = sums[cls * n_samples + s] / counts[cls] - mean;
+          between += counts[cls] * d * d;
+        }
+        if (between / read / var > nicv[s])
+          nicv[s] = between / read / var;
+      }
+    }
+  }
+  free(sum);
+  free(sum2);
+  free(sums);
+  free(counts);
+
+  int n_selected = poi_select_windows(config, nicv, samples);
+  free(nicv);
+  return n_selected;
+}
+
+int poi_select_windows(config_t *config, const double *nicv, int *samples) {
+
+  int n_samples = config->n_samples;
+  int window = config->poi_window > 0 ? config->poi_window : 1;
+
+  // Whole windows of highest NICV, as long as they fit in poi_samples
+  int n_windows = (n_samples + window - 1) / window;
+  poi_window_t *windows = (poi_window_t *)malloc(sizeof(poi_window_t) * n_windows);
+  char *selected = (char *)calloc(n_samples, sizeof(char));
+  isMemoryFull((unsigned int *)windows);
+  isMemoryFull((unsigned int *)selected);
+  for (int w = 0; w < n_windows; w++) {
+    windows[w].first = w * window;
+    windows[w].score = 0;
+    for (int s = w * window; s < (w + 1) * window && s < n_samples; s++) {
+      if (nicv[s] > windows[w].score)
+        windows[w].score = nicv[s];
+    }
+  }
+  qsort(windows, n_windows, sizeof(poi_window_t), compare_windows);
+  int n_selected = 0;
+  for (int w = 0; w < n_windows; w++) {
+    int last = windows[w].first + window < n_samples ? windows[w].first + window : n_samples;
+    if (n_selected + last - windows[w].first > config->poi_samples)
+      continue;
+    for (int s = windows[w].first; s < last; s++)
+      selected[s] = 1;
+    n_selected += last - windows[w].first;
+  }
+
+  char file_name[1100];
+  snprintf(file_name, sizeof(file_name), "%s/poi_kr_" LOGIDXSTR ".csv", config->dump_path);
+  FILE *file = fopen(file_name, "w");
+  if (file != NULL)
+    fprintf(file, "sample,nicv,selected\n");
+  int k = 0;
+  for (int s = 0; s < n_samples; s++) {
+    if (selected[s])
+      samples[k++] = s;
+    if (file != NULL)
+      fprintf(file, "%d,%.9f,%d\n", s, nicv[s], selected[s]);
+  }
+  if (file != NULL)
+    fclose(file);
+
+  printf("Points of interest: %d samples, NICV of the best window %.6f\n", n_selected, n_windows > 0 ? windows[0].score : 0.0);
+  free(windows);
+  free(selected);
+  return n_selected;
+}
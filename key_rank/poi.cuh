@@ -0,0 +1,29 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef POI_H
+#define POI_H
+
+#include "utils.cuh"
+
+// Traces of the point of interest pre-pass when -pn is not given
+#define DEFAULT_POI_TRACES 20000
+
+// Selects the config->poi_samples samples (by windows of config->poi_window
+// samples) of highest NICV, computed on the first traces of the files with
+// the byte values of the texts of the models as classes, and writes the NICV
+// of every sample to poi_kr_0.csv. Returns the number of selected samples,
+// whose indexes are written to samples in increasing order, or -1.
+int select_points_of_interest(config_t *config, int *samples);
+
+// Selects the windows of highest NICV from the NICV of every sample, as
+// select_points_of_interest, for the backends that compute their own NICV
+// (the template attack, on the profiling set). Returns the number of selected samples.
+int poi_select_windows(config_t *config, const double *nicv, int *samples);
+
+#endif
@@ -0,0 +1,446 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Streaming preprocessing of the traces (.bin file of uint8 samples or .data
+file of float32 samples) by a chain of stages, given as a comma-separated
+list applied in order:
+
+  crop:start:length     keeps the samples [start, start + length)
+  avg:width             moving average over width samples
+  fir:taps:low:high     windowed-sinc (Hamming) band-pass FIR filter of taps
+                        coefficients; the cut-off frequencies are fractions
+                        of the Nyquist frequency, low 0 for a low-pass filter
+  bandpass:low:high     FFT band-pass filter, that zeroes the frequencies
+                        outside [low, high] (fractions of the Nyquist frequency)
+  decimate:factor       keeps one sample out of factor
+  std                   per-trace standardisation (zero mean, unit variance)
+
+The filters keep the samples whose window lies within the trace ("valid"
+convolution): avg and fir shorten the trace by width - 1 and taps - 1
+samples. The number of samples of the output is printed, to be given to the
+attack (-ns).
+
+The trace file is memory mapped and read in batches of traces, within the
+memory ceiling given by -m; every thread processes whole batches (batch b
+by thread b % threads) and writes them at their place in the output file,
+a .data file of float32 samples (or a .bin file of uint8 samples, rounded and
+clamped to [0, 255]) that main-CPA, main-CPA-cpu and main-TA-cpu read directly.
+*/
+
+#include "utils.cuh"
+#include "fft.hpp"
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#define FORMAT_DATA 0   // float32 samples
+#define FORMAT_BIN  1   // uint8 samples
+
+// Memory ceiling of the batches of all the threads when -m is not given, in MiB
+#define PREPROCESS_MEMORY_MB 1024
+
+#define STAGE_CROP     0
+#define STAGE_AVG      1
+#define STAGE_FIR      2
+#define STAGE_BANDPASS 3
+#define STAGE_DECIMATE 4
+#define STAGE_STD      5
+
+#define MAX_STAGES 32
+
+typedef struct stage {
+
+  int type;
+  int in_length;                // samples of the traces entering the stage
+  int out_length;
+  int start;                    // crop
+  int width;                    // avg, fir (taps), decimate (factor)
+  double low;                   // fir, bandpass: fractions of the Nyquist frequency
+  double high;
+  std::vector<double> taps;     // fir coefficients
+  int n_fft;                    // bandpass
+  std::vector<cplx> twiddles;
+
+} stage_t;
+
+typedef struct pipeline {
+
+  const uint8_t *traces;        // mapped trace file
+  long n_traces;
+  int n_samples;
+  int format;
+  int output_format;
+  int output_length;
+  long batch;                   // traces per batch
+  int n_stages;
+  stage_t *stages;
+  int output_fd;
+
+} pipeline_t;
+
+void print_preprocess_help();
+int parse_stages(const char *list, int n_samples, stage_t *stages, int *n_stages);
+void pipeline_run(pipeline_t *pipeline, int thread, int n_threads, int *errors);
+
+int main(int argc, char *argv[]) {
+
+  char *trace_path = NULL;
+  char *stage_list = NULL;
+  char output_path[1000] = "";
+  long n_traces = -1;
+  int n_samples = -1;
+  int n_threads = 0;
+  int memory_limit_mb = 0;
+  int output_format = FORMAT_DATA;
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      print_preprocess_help();
+      return 0;
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      i++;
+      stage_list = argv[i];
+    } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "data") == 0)
+        output_format = FORMAT_DATA;
+      else if (strcmp(argv[i], "bin") == 0)
+        output_format = FORMAT_BIN;
+      else {
+        printf("Unknown output format: %s\n\n", argv[i]);
+        print_preprocess_help();
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      i++;
+      snprintf(output_path, sizeof(output_path), "%s", argv[i]);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      i++;
+      memory_limit_mb = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      n_threads = atoi(argv[i]);
+    } else if (positional == 0) {
+      trace_path = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      n_traces = atol(argv[i]);
+      positional++;
+    } else if (positional == 2) {
+      n_samples = atoi(argv[i]);
+      positional++;
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_preprocess_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (positional != 3 || n_traces <= 0 || n_samples <= 0 || stage_list == NULL) {
+    print_preprocess_help();
+    return EXIT_FAILURE;
+  }
+
+  stage_t stages[MAX_STAGES];
+  int n_stages = 0;
+  if (parse_stages(stage_list, n_samples, stages, &n_stages) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+  int output_length = n_stages > 0 ? stages[n_stages - 1].out_length : n_samples;
+
+  int pathLength = strlen(trace_path);
+  int format = (pathLength >= 4 && strcmp(trace_path + pathLength - 4, ".bin") == 0) ? FORMAT_BIN : FORMAT_DATA;
+  size_t trace_size = (format == FORMAT_DATA ? sizeof(float) : sizeof(uint8_t)) * n_samples;
+  size_t output_size = (output_format == FORMAT_DATA ? sizeof(float) : sizeof(uint8_t)) * output_length;
+
+  if (output_path[0] == '\0') {
+    snprintf(output_path, sizeof(output_path), "%s", trace_path);
+    char *dot = strrchr(output_path, '.');
+    char *slash = strrchr(output_path, '/');
+    if (dot != NULL && (slash == NULL || dot > slash))
+      *dot = '\0';
+    strncat(output_path, output_format == FORMAT_DATA ? "_pre.data" : "_pre.bin", sizeof(output_path) - strlen(output_path) - 1);
+  }
+  if (n_threads <= 0)
+    n_threads = (int)std::thread::hardware_concurrency();
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  printf("Trace file: %s (%s samples)\n", trace_path, format == FORMAT_DATA ? "float32" : "uint8");
+
+  int fd = open(trace_path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    printf("Error in opening trace file %s\n", trace_path);
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+  size_t trace_map_size = st.st_size;
+  const uint8_t *trace_map = (const uint8_t *)mmap(NULL, trace_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (trace_map == MAP_FAILED) {
+    printf("Error in mapping trace file %s\n", trace_path);
+    return EXIT_FAILURE;
+  }
+  madvise((void *)trace_map, trace_map_size, MADV_SEQUENTIAL);
+  if ((long)(trace_map_size / trace_size) < n_traces) {
+    n_traces = trace_map_size / trace_size;
+    printf("Trace file %s holds only %ld traces, processing them all\n", trace_path, n_traces);
+  }
+
+  // Every thread holds the output of one batch
+  long limit_mb = memory_limit_mb > 0 ? memory_limit_mb : PREPROCESS_MEMORY_MB;
+  long batch = (long)(((size_t)limit_mb << 20) / n_threads / output_size);
+  if (batch < 1)
+    batch = 1;
+  if (batch > (n_traces + n_threads - 1) / n_threads)
+    batch = (n_traces + n_threads - 1) / n_threads;
+
+  pipeline_t pipeline;
+  pipeline.traces = trace_map;
+  pipeline.n_traces = n_traces;
+  pipeline.n_samples = n_samples;
+  pipeline.format = format;
+  pipeline.output_format = output_format;
+  pipeline.output_length = output_length;
+  pipeline.batch = batch;
+  pipeline.n_stages = n_stages;
+  pipeline.stages = stages;
+  pipeline.output_fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (pipeline.output_fd < 0 || ftruncate(pipeline.output_fd, (off_t)(n_traces * output_size)) != 0) {
+    printf("Error in opening output file %s\n", output_path);
+    munmap((void *)trace_map, trace_map_size);
+    return EXIT_FAILURE;
+  }
+  printf("Processing %ld traces in batches of %ld traces on %d threads\n", n_traces, batch, n_threads);
+
+  std::vector<std::thread> threads;
+  std::vector<int> errors(n_threads, 0);
+  for (int t = 0; t < n_threads; t++)
+    threads.push_back(std::thread(pipeline_run, &pipeline, t, n_threads, &errors[t]));
+  int n_errors = 0;
+  for (int t = 0; t < n_threads; t++) {
+    threads[t].join();
+    n_errors += errors[t];
+  }
+
+  close(pipeline.output_fd);
+  munmap((void *)trace_map, trace_map_size);
+  if (n_errors > 0) {
+    printf("Error in writing output file %s\n", output_path);
+    return EXIT_FAILURE;
+  }
+  printf("%ld traces of %d samples (%s) written to %s\n", n_traces, output_length, output_format == FORMAT_DATA ? "float32" : "uint8", output_path);
+  return EXIT_SUCCESS;
+}
+
+void print_preprocess_help() {
+  printf("Usage: ./preprocess-traces /path/to/traces n_traces n_samples -p stage[,stage...] [-f data|bin] [-o output] [-m MiB] [-j threads]\n");
+  printf("\tPreprocesses the traces by a chain of stages, in one streaming pass over the trace file.\n");
+  printf("\tThe trace file is a .bin file of uint8 samples or a .data file of float32 samples.\n");
+  printf("\t-p:  stages, applied in order:\n");
+  printf("\t     crop:start:length   keeps the samples [start, start + length).\n");
+  printf("\t     avg:width           moving average over width samples (the trace loses width - 1 samples).\n");
+  printf("\t     fir:taps:low:high   windowed-sinc band-pass FIR filter (the trace loses taps - 1 samples), cut-off\n");
+  printf("\t                         frequencies as fractions of the Nyquist frequency, low 0 for a low-pass filter.\n");
+  printf("\t     bandpass:low:high   FFT band-pass filter, frequencies as fractions of the Nyquist frequency.\n");
+  printf("\t     decimate:factor     keeps one sample out of factor.\n");
+  printf("\t     std                 per-trace standardisation (zero mean, unit variance).\n");
+  printf("\t-f:  output format: .data file of float32 samples (default) or .bin file of uint8 samples, rounded and clamped.\n");
+  printf("\t-o:  output file path (default: trace file with the _pre.data or _pre.bin extension).\n");
+  printf("\t-m:  memory ceiling of the batches of all the threads, in MiB (default: 1024).\n");
+  printf("\t-j:  number of threads (default: all cores).\n");
+}
+
+// Parses the stage list and sets the lengths of the traces through the stages
+int parse_stages(const char *list, int n_samples, stage_t *stages, int *n_stages) {
+
+  char buffer[1000];
+  snprintf(buffer, sizeof(buffer), "%s", list);
+  int length = n_samples;
+  *n_stages = 0;
+
+  for (char *name = strtok(buffer, ","); name != NULL; name = strtok(NULL, ",")) {
+    if (*n_stages == MAX_STAGES) {
+      printf("At most %d stages\n", MAX_STAGES);
+      return EXIT_FAILURE;
+    }
+    stage_t *stage = &stages[(*n_stages)++];
+    stage->in_length = length;
+    stage->start = 0;
+    stage->width = 1;
+    stage->low = 0;
+    stage->high = 1;
+    stage->n_fft = 0;
+    int valid = 1;
+
+    if (sscanf(name, "crop:%d:%d", &stage->start, &stage->width) == 2) {
+      stage->type = STAGE_CROP;
+      valid = stage->start >= 0 && stage->width > 0 && stage->start + stage->width <= length;
+      length = stage->width;
+    } else if (sscanf(name, "avg:%d", &stage->width) == 1) {
+      stage->type = STAGE_AVG;
+      valid = stage->width > 0 && stage->width <= length;
+      length -= stage->width - 1;
+    } else if (sscanf(name, "fir:%d:%lf:%lf", &stage->width, &stage->low, &stage->high) == 3) {
+      stage->type = STAGE_FIR;
+      valid = stage->width > 0 && stage->width <= length && stage->low >= 0 && stage->low < stage->high && stage->high <= 1;
+      length -= stage->width - 1;
+      // Difference of two low-pass windowed sincs, of cut-off frequencies
+      // high and low in cycles per sample (half the fractions of Nyquist)
+      double fh = stage->high / 2;
+      double fl = stage->low / 2;
+      double center = (stage->width - 1) / 2.0;
+      stage->taps.resize(stage->width);
+      for (int i = 0; i < stage->width; i++) {
+        double x = i - center;
+        double h = x == 0 ? 2 * (fh - fl) : (sin(2 * M_PI * fh * x) - sin(2 * M_PI * fl * x)) / (M_PI * x);
+        double w = stage->width > 1 ? 0.54 - 0.46 * cos(2 * M_PI * i / (stage->width - 1)) : 1;
+        stage->taps[i] = h * w;
+      }
+    } else if (sscanf(name, "bandpass:%lf:%lf", &stage->low, &stage->high) == 2) {
+      stage->type = STAGE_BANDPASS;
+      valid = stage->low >= 0 && stage->low < stage->high && stage->high <= 1;
+      stage->n_fft = fft_size(length);
+      stage->twiddles = fft_twiddles(stage->n_fft);
+    } else if (sscanf(name, "decimate:%d", &stage->width) == 1) {
+      stage->type = STAGE_DECIMATE;
+      valid = stage->width > 0;
+      length = (length + stage->width - 1) / stage->width;
+    } else if (strcmp(name, "std") == 0) {
+      stage->type = STAGE_STD;
+    } else {
+      printf("Unknown stage: %s\n\n", name);
+      print_preprocess_help();
+      return EXIT_FAILURE;
+    }
+    if (!valid) {
+      printf("Invalid stage %s for traces of %d samples\n", name, stage->in_length);
+      return EXIT_FAILURE;
+    }
+    stage->out_length = length;
+    printf("Stage %d: %s, %d samples\n", *n_stages, name, length);
+  }
+  return EXIT_SUCCESS;
+}
+
+// Runs one stage on the trace in, of stage->in_length samples, into out
+static void run_stage(const stage_t *stage, const double *in, double *out, cplx *spectrum) {
+  int n = stage->in_length;
+
+  switch (stage->type) {
+  case STAGE_CROP:
+    memcpy(out, &in[stage->start], sizeof(double) * stage->width);
+    break;
+  case STAGE_AVG: {
+    double sum = 0;
+    for (int s = 0; s < stage->width - 1; s++)
+      sum += in[s];
+    for (int s = 0; s < stage->out_length; s++) {
+      sum += in[s + stage->width - 1];
+      out[s] = sum / stage->width;
+      sum -= in[s];
+    }
+    break;
+  }
+  case STAGE_FIR:
+    for (int s = 0; s < stage->out_length; s++) {
+      double sum = 0;
+      for (int i = 0; i < stage->width; i++)
+        sum += stage->taps[i] * in[s + stage->width - 1 - i];
+      out[s] = sum;
+    }
+    break;
+  case STAGE_BANDPASS: {
+    // Bin k has the frequency min(k, n_fft - k) / (n_fft / 2) of Nyquist
+    int n_fft = stage->n_fft;
+    for (int s = 0; s < n_fft; s++)
+      spectrum[s] = cplx(s < n ? in[s] : 0, 0);
+    fft(spectrum, stage->twiddles.data(), n_fft, 0);
+    for (int k = 0; k < n_fft; k++) {
+      double f = (k <= n_fft / 2 ? k : n_fft - k) / (n_fft / 2.0);
+      if (f < stage->low || f > stage->high)
+        spectrum[k] = 0;
+    }
+    fft(spectrum, stage->twiddles.data(), n_fft, 1);
+    for (int s = 0; s < n; s++)
+      out[s] = spectrum[s].real() / n_fft;
+    break;
+  }
+  case STAGE_DECIMATE:
+    for (int s = 0; s < stage->out_length; s++)
+      out[s] = in[s * stage->width];
+    break;
+  case STAGE_STD: {
+    double mean = 0;
+    double var = 0;
+    for (int s = 0; s < n; s++)
+      mean += in[s];
+    mean /= n;
+    for (int s = 0; s < n; s++)
+      var += (in[s] - mean) * (in[s] - mean);
+    double scale = var > 0 ? 1 / sqrt(var / n) : 0;
+    for (int s = 0; s < n; s++)
+      out[s] = (in[s] - mean) * scale;
+    break;
+  }
+  }
+}
+
+// Processes the batches thread, thread + n_threads, ... and counts the failed writes in errors
+void pipeline_run(pipeline_t *pipeline, int thread, int n_threads, int *errors) {
+  size_t sample_size = pipeline->format == FORMAT_DATA ? sizeof(float) : sizeof(uint8_t);
+  size_t output_size = (pipeline->output_format == FORMAT_DATA ? sizeof(float) : sizeof(uint8_t)) * pipeline->output_length;
+
+  int longest = pipeline->n_samples;
+  int n_fft = 0;
+  for (int i = 0; i < pipeline->n_stages; i++) {
+    if (pipeline->stages[i].n_fft > n_fft)
+      n_fft = pipeline->stages[i].n_fft;
+  }
+  std::vector<double> a(longest);
+  std::vector<double> b(longest);
+  std::vector<cplx> spectrum(n_fft);
+  std::vector<uint8_t> output(pipeline->batch * output_size);
+
+  long n_batches = (pipeline->n_traces + pipeline->batch - 1) / pipeline->batch;
+  for (long batch = thread; batch < n_batches; batch += n_threads) {
+    long first = batch * pipeline->batch;
+    long count = pipeline->n_traces - first < pipeline->batch ? pipeline->n_traces - first : pipeline->batch;
+
+    for (long t = 0; t < count; t++) {
+      const uint8_t *trace = pipeline->traces + (size_t)(first + t) * sample_size * pipeline->n_samples;
+      for (int s = 0; s < pipeline->n_samples; s++)
+        a[s] = pipeline->format == FORMAT_DATA ? (double)((const float *)trace)[s] : (double)trace[s];
+      double *in = a.data();
+      double *out = b.data();
+      for (int i = 0; i < pipeline->n_stages; i++) {
+        run_stage(&pipeline->stages[i], in, out, spectrum.data());
+        std::swap(in, out);
+      }
+      uint8_t *dst = &output[t * output_size];
+      for (int s = 0; s < pipeline->output_length; s++) {
+        if (pipeline->output_format == FORMAT_DATA) {
+          ((float *)dst)[s] = (float)in[s];
+        } else {
+          double v = floor(in[s] + 0.5);
+          dst[s] = (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+      }
+    }
+    off_t offset = (off_t)(first * output_size);
+    if (pwrite(pipeline->output_fd, output.data(), count * output_size, offset) != (ssize_t)(count * output_size))
+      (*errors)++;
+  }
+}
@@ -0,0 +1,546 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Synthetic RDS acquisitions, to test and benchmark the analysis without a
+board. The AES-128 encryptions are run in software with the key and
+plaintext modes of the sakura_x host:
+
+  key mode 0            constant key (-k)
+  key mode 1            random key per trace
+  plaintext mode 0      fixed plaintext (-fp)
+  plaintext mode 1      chained plaintexts: every plaintext is the previous
+                        ciphertext, starting from 0 (as the Alveo host)
+  plaintext mode 2      fixed-vs-random: the chained plaintext and the fixed
+                        one alternate, starting with the chained one (tvla)
+
+Every sensor sees a clock-like pattern of the delay of its line, the leakage
+of the encryption on -lw samples from sample -lp, Gaussian noise and a
+random shift of the whole trace (jitter). The leakage is the Hamming distance
+of the last round (the sum over the 16 bytes of HD(inv_sbox[ct[n] ^ k[n]],
+ct[inv_shift[n]])) or the Hamming weight of the first round S-box outputs,
+scaled by -a / (sensor + 1). The delay of a sample is its number of ones,
+the register word being thermometer encoded: its lowest bits are set, as the
+delay line of an RDS register.
+
+The files are those of the acquisitions: traces_encoded.bin (uint8 delays),
+traces_raw.bin (the words of the registers, SENSOR_WIDTH / 32 32-bit words
+per sample), one channel per sensor, one after the other, as the Alveo host;
+ciphertexts.bin, plaintexts.bin and keys.bin (16 bytes per trace); and with
+-csv the hexadecimal registers of sensor_traces_<n>k.csv, as the sakura_x host.
+
+The encryptions of a batch of traces are run first, in order since the
+plaintexts may be chained. The traces of the batch are then split over the
+threads, which write them at their place in the output files. The random
+numbers of a trace only depend on the seed and on its index, so that the
+files do not depend on the number of threads.
+*/
+
+#include "utils.cuh"
+#include "aes_tables.hpp"
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+// Memory ceiling of a batch of traces and texts when -m is not given, in MiB
+#define SYNTH_MEMORY_MB 1024
+
+// Period and amplitude (fraction of the sensor width) of the clock pattern of the delays
+#define CLOCK_PERIOD    8
+#define CLOCK_AMPLITUDE 0.0625
+
+#define FILE_ENCODED     0
+#define FILE_RAW         1
+#define FILE_CSV         2
+#define FILE_CIPHERTEXTS 3
+#define FILE_PLAINTEXTS  4
+#define FILE_KEYS        5
+#define N_FILES          6
+
+typedef struct synth_config {
+
+  long n_traces;
+  int n_samples;                // samples per sensor
+  int n_sensors;
+  int sensor_width;             // bits of a register, multiple of 32
+  int key_mode;
+  int plain_mode;
+  int model;                    // MODEL_LAST_ROUND_HD or MODEL_SBOX_HW
+  int leak_sample;
+  int leak_width;
+  double amplitude;             // ones per bit of leakage of the first sensor
+  double noise;                 // standard deviation of the noise, in ones
+  int jitter;                   // largest shift of a trace, in samples
+  int csv;
+  uint64_t seed;
+  uint8_t key[KEYBYTES];
+  uint8_t fixed[KEYBYTES];
+
+} synth_config_t;
+
+typedef struct synth_batch {
+
+  const synth_config_t *config;
+  long first;                   // index of the first trace of the batch
+  long n_traces;
+  const uint8_t *plaintexts;
+  const uint8_t *ciphertexts;
+  const uint8_t *keys;
+  const uint8_t *last_round_keys;
+  int fds[N_FILES];
+
+} synth_batch_t;
+
+void print_synth_help();
+int parse_hex_key(const char *hex, uint8_t key[KEYBYTES]);
+void aes_encrypt(const uint8_t key[KEYBYTES], const uint8_t plaintext[KEYBYTES], uint8_t ciphertext[KEYBYTES], uint8_t last_round_key[KEYBYTES]);
+void synth_range(const synth_batch_t *batch, long first, long last, int *errors);
+
+// Random numbers: splitmix64, seeded by the seed and the index of the trace
+static inline uint64_t next_random(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+static inline uint64_t trace_random(uint64_t seed, long trace, uint64_t stream) {
+  uint64_t state = seed ^ (stream << 56) ^ ((uint64_t)trace * 0xd1b54a32d192ed03ULL);
+  next_random(&state);
+  return state;
+}
+
+int main(int argc, char *argv[]) {
+
+  synth_config_t config;
+  memset(&config, 0, sizeof(config));
+  config.n_sensors = 1;
+  config.sensor_width = 128;
+  config.plain_mode = 1;
+  config.model = MODEL_LAST_ROUND_HD;
+  config.leak_sample = -1;
+  config.leak_width = 1;
+  config.amplitude = 1.0;
+  config.noise = 4.0;
+  config.seed = 1;
+  const uint8_t default_key[KEYBYTES] = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0};
+  memcpy(config.key, default_key, KEYBYTES);
+
+  char *output_dir = NULL;
+  int n_threads = 0;
+  int memory_limit_mb = 0;
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      print_synth_help();
+      return 0;
+    } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+      i++;
+      if (parse_hex_key(argv[i], config.key) == EXIT_FAILURE) {
+        printf("Given key does not have size 16. Key size must be 16 bytes.\n");
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-fp") == 0 && i + 1 < argc) {
+      i++;
+      if (parse_hex_key(argv[i], config.fixed) == EXIT_FAILURE) {
+        printf("Given fixed plaintext does not have size 16. Plaintext size must be 16 bytes.\n");
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-km") == 0 && i + 1 < argc) {
+      i++;
+      config.key_mode = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-pm") == 0 && i + 1 < argc) {
+      i++;
+      config.plain_mode = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-lm") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "hd") == 0)
+        config.model = MODEL_LAST_ROUND_HD;
+      else if (strcmp(argv[i], "hw") == 0)
+        config.model = MODEL_SBOX_HW;
+      else {
+        printf("Unknown leakage model: %s\n\n", argv[i]);
+        print_synth_help();
+        return EXIT_FAILURE;
+      }
+    } else if (strcmp(argv[i], "-lp") == 0 && i + 1 < argc) {
+      i++;
+      config.leak_sample = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-lw") == 0 && i + 1 < argc) {
+      i++;
+      config.leak_width = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+      i++;
+      config.amplitude = atof(argv[i]);
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      i++;
+      config.noise = atof(argv[i]);
+    } else if (strcmp(argv[i], "-jt") == 0 && i + 1 < argc) {
+      i++;
+      config.jitter = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-sn") == 0 && i + 1 < argc) {
+      i++;
+      config.n_sensors = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-sw") == 0 && i + 1 < argc) {
+      i++;
+      config.sensor_width = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-csv") == 0) {
+      config.csv = 1;
+    } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      i++;
+      config.seed = strtoull(argv[i], NULL, 10);
+    } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      i++;
+      memory_limit_mb = atoi(argv[i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      n_threads = atoi(argv[i]);
+    } else if (positional == 0) {
+      output_dir = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      config.n_traces = atol(argv[i]);
+      positional++;
+    } else if (positional == 2) {
+      config.n_samples = atoi(argv[i]);
+      positional++;
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_synth_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (positional != 3 || config.n_traces <= 0 || config.n_samples <= 0) {
+    print_synth_help();
+    return EXIT_FAILURE;
+  }
+  if (config.key_mode < 0 || config.key_mode > 1 || config.plain_mode < 0 || config.plain_mode > 2) {
+    printf("Unknown key mode %d or plaintext mode %d\n", config.key_mode, config.plain_mode);
+    return EXIT_FAILURE;
+  }
+  // The delays of a register are stored as uint8 samples
+  if (config.sensor_width < 32 || config.sensor_width > 255 || config.sensor_width % 32 != 0 || config.n_sensors < 1) {
+    printf("The sensor width must be a multiple of 32 below 256, with at least one sensor\n");
+    return EXIT_FAILURE;
+  }
+  if (config.leak_sample < 0)
+    config.leak_sample = config.n_samples / 2;
+  if (config.leak_width < 1 || config.leak_sample + config.leak_width > config.n_samples || config.jitter < 0) {
+    printf("The leakage (-lp, -lw) must lie within the %d samples of the traces\n", config.n_samples);
+    return EXIT_FAILURE;
+  }
+  if (n_threads <= 0)
+    n_threads = (int)std::thread::hardware_concurrency();
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  long n_values = (long)config.n_sensors * config.n_samples;
+  int chunks = config.sensor_width / 32;
+  size_t sizes[N_FILES];
+  sizes[FILE_ENCODED] = n_values;
+  sizes[FILE_RAW] = sizeof(uint32_t) * chunks * n_values;
+  sizes[FILE_CSV] = (config.sensor_width / 4 + 1) * n_values;
+  sizes[FILE_CIPHERTEXTS] = KEYBYTES;
+  sizes[FILE_PLAINTEXTS] = KEYBYTES;
+  sizes[FILE_KEYS] = KEYBYTES;
+
+  mkdir(output_dir, 0755);
+  const char *names[N_FILES] = {"traces_encoded.bin", "traces_raw.bin", "sensor_traces", "ciphertexts.bin", "plaintexts.bin", "keys.bin"};
+  synth_batch_t batch;
+  batch.config = &config;
+  for (int f = 0; f < N_FILES; f++) {
+    char path[1100];
+    if (f == FILE_CSV)
+      snprintf(path, sizeof(path), "%s/sensor_traces_%ldk.csv", output_dir, config.n_traces / 1000);
+    else
+      snprintf(path, sizeof(path), "%s/%s", output_dir, names[f]);
+    batch.fds[f] = -1;
+    if (f == FILE_CSV && !config.csv)
+      continue;
+    batch.fds[f] = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (batch.fds[f] < 0 || ftruncate(batch.fds[f], (off_t)(config.n_traces * sizes[f])) != 0) {
+      printf("Error in opening output file %s\n", path);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The texts and keys of a batch are held in memory, the traces being
+  // generated by blocks of about 1 MiB per thread
+  long limit_mb = memory_limit_mb > 0 ? memory_limit_mb : SYNTH_MEMORY_MB;
+  long batch_size = (long)(((size_t)limit_mb << 20) / (4 * KEYBYTES));
+  if (batch_size > config.n_traces)
+    batch_size = config.n_traces;
+  std::vector<uint8_t> plaintexts(batch_size * KEYBYTES);
+  std::vector<uint8_t> ciphertexts(batch_size * KEYBYTES);
+  std::vector<uint8_t> keys(batch_size * KEYBYTES);
+  std::vector<uint8_t> last_round_keys(batch_size * KEYBYTES);
+
+  printf("Generating %ld traces of %d sensors of %d samples of %d bits in %s on %d threads\n",
+         config.n_traces, config.n_sensors, config.n_samples, config.sensor_width, output_dir, n_threads);
+  printf("Leakage: %s on samples %d to %d, amplitude %.2f, noise %.2f, jitter %d samples\n",
+         config.model == MODEL_LAST_ROUND_HD ? "last round Hamming distance" : "first round S-box Hamming weight",
+         config.leak_sample, config.leak_sample + config.leak_width - 1, config.amplitude, config.noise, config.jitter);
+
+  uint8_t plain[KEYBYTES] = {0};
+  uint8_t chained[KEYBYTES] = {0};
+  uint8_t key[KEYBYTES];
+  memcpy(key, config.key, KEYBYTES);
+  if (config.plain_mode == 0)
+    memcpy(plain, config.fixed, KEYBYTES);
+
+  int n_errors = 0;
+  for (long first = 0; first < config.n_traces; first += batch_size) {
+    long count = config.n_traces - first < batch_size ? config.n_traces - first : batch_size;
+
+    for (long t = 0; t < count; t++) {
+      if (config.key_mode == 1) {
+        uint64_t state = trace_random(config.seed, first + t, 1);
+        for (int n = 0; n < KEYBYTES; n++)
+          key[n] = (uint8_t)(next_random(&state) >> 56);
+      }
+      memcpy(&plaintexts[t * KEYBYTES], plain, KEYBYTES);
+      memcpy(&keys[t * KEYBYTES], key, KEYBYTES);
+      aes_encrypt(key, plain, &ciphertexts[t * KEYBYTES], &last_round_keys[t * KEYBYTES]);
+
+      // Next plaintext, as the sakura_x host
+      if (config.plain_mode == 1) {
+        memcpy(plain, &ciphertexts[t * KEYBYTES], KEYBYTES);
+      } else if (config.plain_mode == 2) {
+        if ((first + t) % 2 == 0) {
+          memcpy(chained, &ciphertexts[t * KEYBYTES], KEYBYTES);
+          memcpy(plain, config.fixed, KEYBYTES);
+        } else {
+          memcpy(plain, chained, KEYBYTES);
+        }
+      }
+    }
+    for (int f = FILE_CIPHERTEXTS; f < N_FILES; f++) {
+      const uint8_t *texts = f == FILE_CIPHERTEXTS ? ciphertexts.data() : (f == FILE_PLAINTEXTS ? plaintexts.data() : keys.data());
+      if (pwrite(batch.fds[f], texts, count * KEYBYTES, (off_t)(first * KEYBYTES)) != (ssize_t)(count * KEYBYTES))
+        n_errors++;
+    }
+
+    batch.first = first;
+    batch.n_traces = count;
+    batch.plaintexts = plaintexts.data();
+    batch.ciphertexts = ciphertexts.data();
+    batch.keys = keys.data();
+    batch.last_round_keys = last_round_keys.data();
+
+    std::vector<std::thread> threads;
+    std::vector<int> errors(n_threads, 0);
+    long range = (count + n_threads - 1) / n_threads;
+    for (int th = 0; th < n_threads && th * range < count; th++) {
+      long last = (th + 1) * range < count ? (th + 1) * range : count;
+      threads.push_back(std::thread(synth_range, (const synth_batch_t *)&batch, th * range, last, &errors[th]));
+    }
+    for (size_t th = 0; th < threads.size(); th++) {
+      threads[th].join();
+      n_errors += errors[th];
+    }
+  }
+
+  for (int f = 0; f < N_FILES; f++) {
+    if (batch.fds[f] >= 0)
+      close(batch.fds[f]);
+  }
+  if (n_errors > 0) {
+    printf("Error in writing the output files of %s\n", output_dir);
+    return EXIT_FAILURE;
+  }
+  printf("%ld traces written to %s: attack them with -ns %d -nc %d", config.n_traces, output_dir, config.n_samples, config.n_sensors);
+  if (config.key_mode == 0) {
+    printf(" -k ");
+    for (int n = 0; n < KEYBYTES; n++)
+      printf("%02x", last_round_keys[n]);
+  }
+  printf("\n");
+  return EXIT_SUCCESS;
+}
+
+void print_synth_help() {
+  printf("Usage: ./synth-traces output_dir n_traces n_samples [-k key] [-km 0|1] [-pm 0|1|2] [-fp plaintext] [-lm hd|hw] [-lp sample] [-lw samples]\n");
+  printf("                      [-a amplitude] [-n noise] [-jt samples] [-sn sensors] [-sw bits] [-csv] [-s seed] [-m MiB] [-j threads]\n");
+  printf("\tGenerates a synthetic RDS acquisition of n_traces traces of n_samples samples per sensor in output_dir:\n");
+  printf("\ttraces_encoded.bin, traces_raw.bin, ciphertexts.bin, plaintexts.bin and keys.bin, as the Alveo host.\n");
+  printf("\t-k:   AES key (default: 0123456789abcdef123456789abcdef0, the default key of the sakura_x host).\n");
+  printf("\t-km:  key mode: 0 constant key (default), 1 random key per trace.\n");
+  printf("\t-pm:  plaintext mode: 0 fixed plaintext, 1 chained plaintexts from 0 (default), 2 chained and fixed plaintexts alternately.\n");
+  printf("\t-fp:  fixed plaintext of the plaintext modes 0 and 2 (default: 0).\n");
+  printf("\t-lm:  leakage: hd, Hamming distance of the last round (default), or hw, Hamming weight of the first round S-box outputs.\n");
+  printf("\t-lp:  first sample of the leakage (default: n_samples / 2).\n");
+  printf("\t-lw:  number of samples of the leakage (default: 1).\n");
+  printf("\t-a:   ones of the register per bit of leakage on the first sensor, divided by sensor + 1 on the others (default: 1.0).\n");
+  printf("\t-n:   standard deviation of the Gaussian noise, in ones of the register (default: 4.0).\n");
+  printf("\t-jt:  jitter: every trace is shifted by a random number of samples in [-jt, jt] (default: 0).\n");
+  printf("\t-sn:  number of sensors, whose channels follow each other in a trace (-nc of the attack, default: 1).\n");
+  printf("\t-sw:  bits of the register of a sensor, a multiple of 32 (default: 128).\n");
+  printf("\t-csv: also writes the registers in hexadecimal to sensor_traces_<n_traces / 1000>k.csv, as the sakura_x host.\n");
+  printf("\t-s:   seed of the keys, the noise and the jitter (default: 1).\n");
+  printf("\t-m:   memory ceiling of the texts of a batch, in MiB (default: 1024).\n");
+  printf("\t-j:   number of threads (default: all cores).\n");
+}
+
+int parse_hex_key(const char *hex, uint8_t key[KEYBYTES]) {
+  unsigned int u;
+  int counter = 0;
+  while (counter < KEYBYTES && sscanf(hex, "%2x", &u) == 1) {
+    key[counter++] = u;
+    hex += 2;
+  }
+  return (counter == KEYBYTES && *hex == '\0') ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static inline uint8_t xtime(uint8_t x) {
+  return (uint8_t)((x << 1) ^ ((x >> 7) * 0x1b));
+}
+
+// AES-128 encryption of one block, the state being stored by columns as the
+// texts; also returns the last round key, of the Hamming distance leakage
+void aes_encrypt(const uint8_t key[KEYBYTES], const uint8_t plaintext[KEYBYTES], uint8_t ciphertext[KEYBYTES], uint8_t last_round_key[KEYBYTES]) {
+  uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+  uint8_t w[KEYBYTES];
+  uint8_t s[KEYBYTES];
+  uint8_t t[KEYBYTES];
+
+  memcpy(w, key, KEYBYTES);
+  for (int n = 0; n < KEYBYTES; n++)
+    s[n] = plaintext[n] ^ w[n];
+
+  for (int round = 0; round < 10; round++) {
+    // SubBytes and ShiftRows: byte n of the state comes from byte inv_shift[n]
+    for (int n = 0; n < KEYBYTES; n++)
+      t[n] = sbox[s[inv_shift[n]]];
+    // MixColumns, but in the last round
+    if (round < 9) {
+      for (int c = 0; c < 4; c++) {
+        uint8_t *col = &t[4 * c];
+        uint8_t all = col[0] ^ col[1] ^ col[2] ^ col[3];
+        uint8_t first = col[0];
+        col[0] ^= all ^ xtime(col[0] ^ col[1]);
+        col[1] ^= all ^ xtime(col[1] ^ col[2]);
+        col[2] ^= all ^ xtime(col[2] ^ col[3]);
+        col[3] ^= all ^ xtime(col[3] ^ first);
+      }
+    }
+    // Round key
+    w[0] ^= sbox[w[13]] ^ rcon[round];
+    w[1] ^= sbox[w[14]];
+    w[2] ^= sbox[w[15]];
+    w[3] ^= sbox[w[12]];
+    for (int n = 4; n < KEYBYTES; n++)
+      w[n] ^= w[n - 4];
+    for (int n = 0; n < KEYBYTES; n++)
+      s[n] = t[n] ^ w[n];
+  }
+  memcpy(ciphertext, s, KEYBYTES);
+  memcpy(last_round_key, w, KEYBYTES);
+}
+
+// Leakage of the trace t of the batch, centred on its mean of 64 bits
+static double leakage(const synth_batch_t *batch, long t) {
+  const uint8_t *plaintext = &batch->plaintexts[t * KEYBYTES];
+  const uint8_t *ciphertext = &batch->ciphertexts[t * KEYBYTES];
+  const uint8_t *key = &batch->keys[t * KEYBYTES];
+  const uint8_t *last_round_key = &batch->last_round_keys[t * KEYBYTES];
+  int bits = 0;
+  if (batch->config->model == MODEL_LAST_ROUND_HD) {
+    for (int n = 0; n < KEYBYTES; n++)
+      bits += __builtin_popcount(inv_sbox[ciphertext[n] ^ last_round_key[n]] ^ ciphertext[inv_shift[n]]);
+  } else {
+    for (int n = 0; n < KEYBYTES; n++)
+      bits += __builtin_popcount(sbox[plaintext[n] ^ key[n]]);
+  }
+  return bits - 8.0 * KEYBYTES / 2;
+}
+
+// Generates the traces [first, last) of the batch and writes them to the trace files
+void synth_range(const synth_batch_t *batch, long first, long last, int *errors) {
+  const synth_config_t *config = batch->config;
+  int n_samples = config->n_samples;
+  long n_values = (long)config->n_sensors * n_samples;
+  int chunks = config->sensor_width / 32;
+  int digits = config->sensor_width / 4;
+  size_t line = (size_t)(digits + 1) * n_values;
+
+  // Traces written at once, about 1 MiB of raw words
+  long block = (1 << 20) / (sizeof(uint32_t) * chunks * n_values) + 1;
+  std::vector<uint8_t> encoded(block * n_values);
+  std::vector<uint32_t> raw(block * chunks * n_values);
+  std::vector<char> csv(config->csv ? block * line : 0);
+  std::vector<double> noise(n_values + 1);
+  std::vector<double> clock(n_samples);
+  for (int j = 0; j < n_samples; j++)
+    clock[j] = config->sensor_width / 2.0 + config->sensor_width * CLOCK_AMPLITUDE * sin(2 * M_PI * j / CLOCK_PERIOD);
+  const char *hex = "0123456789abcdef";
+
+  for (long b0 = first; b0 < last; b0 += block) {
+    long count = last - b0 < block ? last - b0 : block;
+    for (long b = 0; b < count; b++) {
+      long t = b0 + b;
+      long trace = batch->first + t;
+      uint64_t state = trace_random(config->seed, trace, 0);
+      double leak = leakage(batch, t);
+      int shift = config->jitter > 0 ? (int)(next_random(&state) % (2 * config->jitter + 1)) - config->jitter : 0;
+
+      // Box-Muller transform of pairs of uniform numbers in (0, 1], two
+      // Gaussian numbers each
+      for (long v = 0; v < n_values; v += 2) {
+        double u1 = ((next_random(&state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+        double u2 = (next_random(&state) >> 11) * (1.0 / 9007199254740992.0);
+        double radius = config->noise * sqrt(-2 * log(u1));
+        noise[v] = radius * cos(2 * M_PI * u2);
+        noise[v + 1] = radius * sin(2 * M_PI * u2);
+      }
+
+      for (int sensor = 0; sensor < config->n_sensors; sensor++) {
+        double amplitude = config->amplitude / (sensor + 1);
+        for (int j = 0; j < n_samples; j++) {
+          // Sample of the trace before its shift
+          int source = j - shift;
+          source = source < 0 ? 0 : (source >= n_samples ? n_samples - 1 : source);
+          double value = clock[source];
+          if (source >= config->leak_sample && source < config->leak_sample + config->leak_width)
+            value += amplitude * leak;
+          value = floor(value + noise[(long)sensor * n_samples + j] + 0.5);
+          int ones = value < 0 ? 0 : (value > config->sensor_width ? config->sensor_width : (int)value);
+
+          // Thermometer code: the lowest ones bits of the register are set
+          long v = b * n_values + (long)sensor * n_samples + j;
+          encoded[v] = (uint8_t)ones;
+          for (int c = 0; c < chunks; c++) {
+            int set = ones - 32 * c;
+            raw[v * chunks + c] = set >= 32 ? 0xffffffffu : (set <= 0 ? 0 : (1u << set) - 1);
+          }
+          if (config->csv) {
+            char *field = &csv[(size_t)b * line + (size_t)((long)sensor * n_samples + j) * (digits + 1)];
+            for (int d = 0; d < digits; d++) {
+              uint32_t word = raw[v * chunks + chunks - 1 - d / 8];
+              field[d] = hex[(word >> (28 - 4 * (d % 8))) & 0xf];
+            }
+            field[digits] = (sensor * n_samples + j == n_values - 1) ? '\n' : ',';
+          }
+        }
+      }
+    }
+
+    long trace0 = batch->first + b0;
+    if (pwrite(batch->fds[FILE_ENCODED], encoded.data(), count * n_values, (off_t)(trace0 * n_values)) != (ssize_t)(count * n_values))
+      (*errors)++;
+    size_t raw_size = sizeof(uint32_t) * chunks * n_values;
+    if (pwrite(batch->fds[FILE_RAW], raw.data(), count * raw_size, (off_t)(trace0 * raw_size)) != (ssize_t)(count * raw_size))
+      (*errors)++;
+    if (config->csv && pwrite(batch->fds[FILE_CSV], csv.data(), count * line, (off_t)(trace0 * line)) != (ssize_t)(count * line))
+      (*errors)++;
+  }
+}
@@ -0,0 +1,424 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#include "template_engine.hpp"
+#include "leakage_models.hpp"
+#include <math.h>
+#include <thread>
+#include <vector>
+
+// Attack traces whose class scores are computed together for one key byte
+#define TEMPLATE_BLOCK 64
+
+// Largest ridge added to the diagonal of a pooled covariance that is not
+// positive definite, relative to its mean variance
+#define TEMPLATE_MAX_RIDGE 1e-2
+
+template <typename model_t>
+static void get_classes(int *n_classes) {
+  *n_classes = model_t::classes;
+}
+
+int template_profile_init(template_profile_t *profile, int n_samples, int full, int model) {
+  memset(profile, 0, sizeof(template_profile_t));
+  profile->n_samples = n_samples;
+  profile->full = full;
+  profile->model = model;
+  DISPATCH_MODEL(model, get_classes, &profile->n_classes);
+  profile->sum_class = (double *)malloc(sizeof(double) * KEYBYTES * KEYS * n_samples);
+  profile->sum_ww = (double *)malloc(sizeof(double) * (full ? (size_t)n_samples * n_samples : n_samples));
+  if (profile->sum_class == NULL || profile->sum_ww == NULL) {
+    printf("----memory\n");
+    template_profile_free(profile);
+    return EXIT_FAILURE;
+  }
+  template_profile_reset(profile);
+  return EXIT_SUCCESS;
+}
+
+void template_profile_reset(template_profile_t *profile) {
+  int n_samples = profile->n_samples;
+  profile->n_traces = 0;
+  memset(profile->counts, 0, sizeof(profile->counts));
+  memset(profile->sum_class, 0, sizeof(double) * KEYBYTES * KEYS * n_samples);
+  memset(profile->sum_ww, 0, sizeof(double) * (profile->full ? (size_t)n_samples * n_samples : n_samples));
+}
+
+void template_profile_free(template_profile_t *profile) {
+  free(profile->sum_class);
+  free(profile->sum_ww);
+  profile->sum_class = NULL;
+  profile->sum_ww = NULL;
+}
+
+void template_profile_merge(template_profile_t *dst, const template_profile_t *src) {
+  int n_samples = dst->n_samples;
+  size_t n_ww = dst->full ? (size_t)n_samples * n_samples : n_samples;
+
+  dst->n_traces += src->n_traces;
+  for (int i = 0; i < KEYBYTES * KEYS; i++)
+    dst->counts[i] += src->counts[i];
+  for (size_t i = 0; i < (size_t)KEYBYTES * KEYS * n_samples; i++)
+    dst->sum_class[i] += src->sum_class[i];
+  for (size_t i = 0; i < n_ww; i++)
+    dst->sum_ww[i] += src->sum_ww[i];
+}
+
+// Adds the traces to the class sums of their key bytes and to the products of
+// their samples. The products are only summed on the upper triangle, row by
+// row, so that the inner loop is contiguous.
+template <typename model_t, typename sample_t>
+static void profile_traces(template_profile_t *profile, const sample_t *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces) {
+  int n_samples = profile->n_samples;
+  int last_round = !model_first_round(profile->model);
+  double *x = (double *)malloc(sizeof(double) * n_samples);
+  if (x == NULL) {
+    printf("----memory\n");
+    return;
+  }
+
+  for (size_t t = 0; t < n_traces; t++) {
+    const sample_t *trace = &traces[t * n_samples];
+    const uint8_t *text = &texts[t * KEYBYTES];
+    uint8_t key[KEYBYTES];
+    if (last_round)
+      get_last_round_key(&keys[t * KEYBYTES], key);
+    else
+      memcpy(key, &keys[t * KEYBYTES], KEYBYTES);
+    for (int s = 0; s < n_samples; s++)
+      x[s] = (double)trace[s];
+
+    for (int n = 0; n < KEYBYTES; n++) {
+      int c = model_t::row(model_t::select(text, n))[text[n] ^ key[n]];
+      double *sum = &profile->sum_class[((size_t)n * KEYS + c) * n_samples];
+      for (int s = 0; s < n_samples; s++)
+        sum[s] += x[s];
+      profile->counts[n * KEYS + c]++;
+    }
+
+    if (profile->full) {
+      for (int i = 0; i < n_samples; i++) {
+        double *row = &profile->sum_ww[(size_t)i * n_samples];
+        double xi = x[i];
+        for (int j = i; j < n_samples; j++)
+          row[j] += xi * x[j];
+      }
+    } else {
+      for (int s = 0; s < n_samples; s++)
+        profile->sum_ww[s] += x[s] * x[s];
+    }
+  }
+  profile->n_traces += n_traces;
+  free(x);
+}
+
+template <typename sample_t>
+static void profile_block(template_profile_t *profile, const sample_t *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces) {
+  DISPATCH_MODEL(profile->model, profile_traces, profile, traces, texts, keys, n_traces);
+}
+
+// Splits the traces into one contiguous block per thread, accumulates every
+// block into its own worker and merges the workers into profile in thread
+// order, as cpa_accumulate_parallel
+template <typename sample_t>
+static void profile_parallel(template_profile_t *profile, template_profile_t *workers, int n_threads, const sample_t *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces) {
+  std::vector<std::thread> threads;
+  size_t block = (n_traces + n_threads - 1) / n_threads;
+
+  for (int i = 0; i < n_threads; i++) {
+    size_t start = i * block;
+    if (start >= n_traces)
+      break;
+    size_t count = (start + block > n_traces) ? n_traces - start : block;
+    workers[i].model = profile->model;
+    workers[i].n_classes = profile->n_classes;
+    threads.push_back(std::thread(profile_block<sample_t>, &workers[i], &traces[start * profile->n_samples], &texts[start * KEYBYTES], &keys[start * KEYBYTES], count));
+  }
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+    template_profile_merge(profile, &workers[i]);
+    template_profile_reset(&workers[i]);
+  }
+}
+
+void template_profile_parallel(template_profile_t *profile, template_profile_t *workers, int n_threads, const float *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces) {
+  profile_parallel(profile, workers, n_threads, traces, texts, keys, n_traces);
+}
+
+void template_profile_parallel(template_profile_t *profile, template_profile_t *workers, int n_threads, const uint8_t *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces) {
+  profile_parallel(profile, workers, n_threads, traces, texts, keys, n_traces);
+}
+
+void template_nicv(const template_profile_t *profile, double *nicv) {
+  int n_samples = profile->n_samples;
+  double n_traces = (double)profile->n_traces;
+
+  for (int s = 0; s < n_samples; s++) {
+    nicv[s] = 0;
+    if (profile->n_traces == 0)
+      continue;
+    double sum = 0;
+    for (int c = 0; c < profile->n_classes; c++)
+      sum += profile->sum_class[(size_t)c * n_samples + s];
+    double mean = sum / n_traces;
+    double sum2 = profile->full ? profile->sum_ww[(size_t)s * n_samples + s] : profile->sum_ww[s];
+    double var = sum2 / n_traces - mean * mean;
+    if (var <= 0)
+      continue;
+    for (int n = 0; n < KEYBYTES; n++) {
+      double between = 0;
+      for (int c = 0; c < profile->n_classes; c++) {
+        uint64_t count = profile->counts[n * KEYS + c];
+        if (count == 0)
+          continue;
+        double d = profile->sum_class[((size_t)n * KEYS + c) * n_samples + s] / count - mean;
+        between += count * d * d;
+      }
+      if (between / n_traces / var > nicv[s])
+        nicv[s] = between / n_traces / var;
+    }
+  }
+}
+
+// Cholesky factorisation in place of the n x n matrix a (lower triangle).
+// Returns 0 if a is not positive definite.
+static int cholesky(double *a, int n) {
+  for (int j = 0; j < n; j++) {
+    double d = a[(size_t)j * n + j];
+    for (int k = 0; k < j; k++)
+      d -= a[(size_t)j * n + k] * a[(size_t)j * n + k];
+    if (d <= 0)
+      return 0;
+    d = sqrt(d);
+    a[(size_t)j * n + j] = d;
+    for (int i = j + 1; i < n; i++) {
+      double v = a[(size_t)i * n + j];
+      for (int k = 0; k < j; k++)
+        v -= a[(size_t)i * n + k] * a[(size_t)j * n + k];
+      a[(size_t)i * n + j] = v / d;
+    }
+  }
+  return 1;
+}
+
+// Solves L L^T x = b in place in b, with the factor L of cholesky
+static void cholesky_solve(const double *l, int n, double *b) {
+  for (int i = 0; i < n; i++) {
+    double v = b[i];
+    for (int k = 0; k < i; k++)
+      v -= l[(size_t)i * n + k] * b[k];
+    b[i] = v / l[(size_t)i * n + i];
+  }
+  for (int i = n - 1; i >= 0; i--) {
+    double v = b[i];
+    for (int k = i + 1; k < n; k++)
+      v -= l[(size_t)k * n + i] * b[k];
+    b[i] = v / l[(size_t)i * n + i];
+  }
+}
+
+int template_build(const template_profile_t *profile, template_set_t *templates) {
+  int n_samples = profile->n_samples;
+  int n_classes = profile->n_classes;
+  size_t n_cov = (size_t)n_samples * n_samples;
+
+  memset(templates, 0, sizeof(template_set_t));
+  templates->n_samples = n_samples;
+  templates->model = profile->model;
+  templates->n_classes = n_classes;
+  templates->weights = (double *)malloc(sizeof(double) * KEYBYTES * n_classes * n_samples);
+  templates->offsets = (double *)malloc(sizeof(double) * KEYBYTES * n_classes);
+  double *cov = (double *)malloc(sizeof(double) * n_cov);
+  double *l = (double *)malloc(sizeof(double) * n_cov);
+  double *mean = (double *)malloc(sizeof(double) * n_samples);
+  double *class_mean = (double *)malloc(sizeof(double) * n_samples);
+  int status = EXIT_SUCCESS;
+  if (templates->weights == NULL || templates->offsets == NULL || cov == NULL || l == NULL || mean == NULL || class_mean == NULL) {
+    printf("----memory\n");
+    status = EXIT_FAILURE;
+  } else if (!profile->full || profile->n_traces <= (uint64_t)n_classes) {
+    printf("Not enough profiling traces for the templates: %llu\n", (unsigned long long)profile->n_traces);
+    status = EXIT_FAILURE;
+  }
+
+  for (int s = 0; s < n_samples && status == EXIT_SUCCESS; s++) {
+    mean[s] = 0;
+    for (int c = 0; c < n_classes; c++)
+      mean[s] += profile->sum_class[(size_t)c * n_samples + s];
+    mean[s] /= profile->n_traces;
+  }
+
+  for (int n = 0; n < KEYBYTES && status == EXIT_SUCCESS; n++) {
+
+    // Pooled covariance: the products of the samples minus the products of
+    // the class sums over their counts, over the traces minus the classes
+    int present = 0;
+    for (int i = 0; i < n_samples; i++)
+      for (int j = i; j < n_samples; j++)
+        cov[(size_t)i * n_samples + j] = profile->sum_ww[(size_t)i * n_samples + j];
+    for (int c = 0; c < n_classes; c++) {
+      uint64_t count = profile->counts[n * KEYS + c];
+      if (count == 0)
+        continue;
+      present++;
+      const double *sum = &profile->sum_class[((size_t)n * KEYS + c) * n_samples];
+      for (int i = 0; i < n_samples; i++)
+        for (int j = i; j < n_samples; j++)
+          cov[(size_t)i * n_samples + j] -= sum[i] * sum[j] / count;
+    }
+    double mean_var = 0;
+    for (int i = 0; i < n_samples; i++) {
+      for (int j = i; j < n_samples; j++) {
+        cov[(size_t)i * n_samples + j] /= (double)(profile->n_traces - present);
+        cov[(size_t)j * n_samples + i] = cov[(size_t)i * n_samples + j];
+      }
+      mean_var += cov[(size_t)i * n_samples + i] / n_samples;
+    }
+
+    // Constant or linearly dependent samples make the covariance singular: a
+    // ridge is added to its diagonal, growing until it can be factorised
+    double ridge = 0;
+    memcpy(l, cov, sizeof(double) * n_cov);
+    while (!cholesky(l, n_samples)) {
+      ridge = ridge == 0 ? 1e-9 * (mean_var > 0 ? mean_var : 1.0) : ridge * 10;
+      if (ridge > TEMPLATE_MAX_RIDGE * (mean_var > 0 ? mean_var : 1.0)) {
+        printf("The pooled covariance of key byte %d cannot be inverted\n", n);
+        status = EXIT_FAILURE;
+        break;
+      }
+      memcpy(l, cov, sizeof(double) * n_cov);
+      for (int i = 0; i < n_samples; i++)
+        l[(size_t)i * n_samples + i] += ridge;
+    }
+    if (status == EXIT_FAILURE)
+      break;
+    if (ridge > 0)
+      printf("Key byte %d: ridge of %g added to the pooled covariance\n", n, ridge);
+
+    // The classes without profiling trace take the mean of all the traces
+    for (int c = 0; c < n_classes; c++) {
+      uint64_t count = profile->counts[n * KEYS + c];
+      const double *sum = &profile->sum_class[((size_t)n * KEYS + c) * n_samples];
+      double *w = &templates->weights[((size_t)n * n_classes + c) * n_samples];
+      for (int s = 0; s < n_samples; s++)
+        w[s] = class_mean[s] = count > 0 ? sum[s] / count : mean[s];
+      cholesky_solve(l, n_samples, w);
+      double offset = 0;
+      for (int s = 0; s < n_samples; s++)
+        offset += class_mean[s] * w[s];
+      templates->offsets[n * n_classes + c] = -0.5 * offset;
+    }
+  }
+
+  if (status == EXIT_FAILURE)
+    template_set_free(templates);
+  free(cov);
+  free(l);
+  free(mean);
+  free(class_mean);
+  return status;
+}
+
+void template_set_free(template_set_t *templates) {
+  free(templates->weights);
+  free(templates->offsets);
+  templates->weights = NULL;
+  templates->offsets = NULL;
+}
+
+void template_attack_reset(template_attack_t *attack) {
+  memset(attack, 0, sizeof(template_attack_t));
+}
+
+// Adds the log-likelihoods of the key bytes first, first + step, ... The
+// scores of all the classes are computed for a block of traces, then added
+// to the key guesses through the model.
+template <typename model_t, typename sample_t>
+static void attack_bytes(template_attack_t *attack, const template_set_t *templates, int first, int step, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  int n_samples = templates->n_samples;
+  int n_classes = model_t::classes;
+  double *x = (double *)malloc(sizeof(double) * TEMPLATE_BLOCK * n_samples);
+  double *scores = (double *)malloc(sizeof(double) * TEMPLATE_BLOCK * n_classes);
+  if (x == NULL || scores == NULL) {
+    printf("----memory\n");
+    free(x);
+    free(scores);
+    return;
+  }
+
+  for (size_t t0 = 0; t0 < n_traces; t0 += TEMPLATE_BLOCK) {
+    int block = (n_traces - t0) < TEMPLATE_BLOCK ? (int)(n_traces - t0) : TEMPLATE_BLOCK;
+    for (size_t i = 0; i < (size_t)block * n_samples; i++)
+      x[i] = (double)traces[t0 * n_samples + i];
+
+    for (int n = first; n < KEYBYTES; n += step) {
+      for (int c = 0; c < n_classes; c++) {
+        const double *w = &templates->weights[((size_t)n * n_classes + c) * n_samples];
+        double offset = templates->offsets[n * n_classes + c];
+        for (int t = 0; t < block; t++) {
+          const double *trace = &x[(size_t)t * n_samples];
+          double score = offset;
+          for (int s = 0; s < n_samples; s++)
+            score += w[s] * trace[s];
+          scores[t * n_classes + c] = score;
+        }
+      }
+      for (int t = 0; t < block; t++) {
+        const uint8_t *text = &texts[(t0 + t) * KEYBYTES];
+        const uint8_t *row = model_t::row(model_t::select(text, n));
+        const double *score = &scores[t * n_classes];
+        for (int k = 0; k < KEYS; k++)
+          attack->log_likelihood[k * KEYBYTES + n] += score[row[text[n] ^ k]];
+      }
+    }
+  }
+
+  free(x);
+  free(scores);
+}
+
+template <typename sample_t>
+static void attack_model(template_attack_t *attack, const template_set_t *templates, int first, int step, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  DISPATCH_MODEL(templates->model, attack_bytes, attack, templates, first, step, traces, texts, n_traces);
+}
+
+template <typename sample_t>
+static void attack_accumulate(template_attack_t *attack, const template_set_t *templates, int n_threads, const sample_t *traces, const uint8_t *texts, size_t n_traces) {
+  std::vector<std::thread> threads;
+  if (n_threads > KEYBYTES)
+    n_threads = KEYBYTES;
+  for (int i = 0; i < n_threads; i++)
+    threads.push_back(std::thread(attack_model<sample_t>, attack, templates, i, n_threads, traces, texts, n_traces));
+  for (size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+  attack->n_traces += n_traces;
+}
+
+void template_attack_accumulate(template_attack_t *attack, const template_set_t *templates, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces) {
+  attack_accumulate(attack, templates, n_threads, traces, texts, n_traces);
+}
+
+void template_attack_accumulate(template_attack_t *attack, const template_set_t *templates, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces) {
+  attack_accumulate(attack, templates, n_threads, traces, texts, n_traces);
+}
+
+void template_scores(const template_attack_t *attack, double *scores) {
+  for (int n = 0; n < KEYBYTES; n++) {
+    double max = attack->log_likelihood[n];
+    for (int k = 1; k < KEYS; k++)
+      if (attack->log_likelihood[k * KEYBYTES + n] > max)
+        max = attack->log_likelihood[k * KEYBYTES + n];
+    double sum = 0;
+    for (int k = 0; k < KEYS; k++)
+      sum += exp(attack->log_likelihood[k * KEYBYTES + n] - max);
+    for (int k = 0; k < KEYS; k++) {
+      double p = exp(attack->log_likelihood[k * KEYBYTES + n] - max) / sum;
+      scores[k * KEYBYTES + n] = p > TEMPLATE_MIN_SCORE ? p : TEMPLATE_MIN_SCORE;
+    }
+  }
+}
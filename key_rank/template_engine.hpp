@@ -0,0 +1,97 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+#ifndef TEMPLATE_ENGINE_H
+#define TEMPLATE_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "utils.cuh"
+
+// Probability written for the key guesses whose probability is smaller, so
+// that the log2 of the key rank estimation stays finite (the result files
+// have 15 decimals)
+#define TEMPLATE_MIN_SCORE 1e-15
+
+// Profiling accumulators of the Gaussian templates of one leakage model.
+// The class of a profiling trace for key byte n is the value of the model
+// for the key of the trace (keys.bin of the random key acquisitions): its
+// last round key for the last round model, itself for the first round ones.
+// The samples are summed by key byte and class, and the products of every
+// pair of samples over all the traces, from which the pooled covariance of
+// every key byte is computed. Without full, only the squares of the samples
+// are summed, which is enough for the NICV of the point of interest pre-pass.
+// The uint8 traces are summed exactly (integers of less than 53 bits), so
+// that their templates do not depend on the number of threads.
+typedef struct template_profile {
+
+  uint64_t n_traces;
+  int n_samples;
+  int model;                        // MODEL_ leakage model of the classes
+  int n_classes;                    // values of the model
+  int full;
+  uint64_t counts[KEYBYTES * KEYS]; // [key byte][class]
+  double *sum_class;                // [key byte][class (KEYS)][sample]
+  double *sum_ww;                   // full: [sample][sample], upper triangle; else [sample]
+
+} template_profile_t;
+
+// Templates of every key byte built from a profile. With the pooled
+// covariance S and the mean m of a class, the log-likelihood of a trace x is,
+// up to a term that does not depend on the class, x.weights + offset with
+// weights = S^-1 m and offset = -m.S^-1 m / 2.
+typedef struct template_set {
+
+  int n_samples;
+  int model;
+  int n_classes;
+  double *weights;                  // [key byte][class][sample]
+  double *offsets;                  // [key byte][class]
+
+} template_set_t;
+
+// Log-likelihood of every key guess, summed over the attack traces
+typedef struct template_attack {
+
+  uint64_t n_traces;
+  double log_likelihood[KEYS * KEYBYTES];   // [key guess][key byte]
+
+} template_attack_t;
+
+int template_profile_init(template_profile_t *profile, int n_samples, int full, int model);
+void template_profile_reset(template_profile_t *profile);
+void template_profile_free(template_profile_t *profile);
+void template_profile_merge(template_profile_t *dst, const template_profile_t *src);
+
+// Adds the profiling traces to the profile. texts are the ciphertexts for the
+// last round model, the plaintexts for the first round ones, keys the key of
+// every trace. The traces are split over n_threads workers, initialised with
+// the same n_samples and full as the profile, which take its model and are
+// left reset.
+void template_profile_parallel(template_profile_t *profile, template_profile_t *workers, int n_threads, const float *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces);
+void template_profile_parallel(template_profile_t *profile, template_profile_t *workers, int n_threads, const uint8_t *traces, const uint8_t *texts, const uint8_t *keys, size_t n_traces);
+
+// NICV of every sample: the variance of the class means over the variance of
+// the sample, the largest over the key bytes
+void template_nicv(const template_profile_t *profile, double *nicv);
+
+// Builds the templates of a full profile
+int template_build(const template_profile_t *profile, template_set_t *templates);
+void template_set_free(template_set_t *templates);
+
+// Adds the log-likelihoods of the attack traces, with the key bytes split
+// over n_threads threads so that the sums do not depend on their number
+void template_attack_reset(template_attack_t *attack);
+void template_attack_accumulate(template_attack_t *attack, const template_set_t *templates, int n_threads, const float *traces, const uint8_t *texts, size_t n_traces);
+void template_attack_accumulate(template_attack_t *attack, const template_set_t *templates, int n_threads, const uint8_t *traces, const uint8_t *texts, size_t n_traces);
+
+// Probability of every key guess given the attack traces, [key guess][key
+// byte] as the maximum correlations of the CPA, at least TEMPLATE_MIN_SCORE
+void template_scores(const template_attack_t *attack, double *scores);
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file. 
+*/
+
+#include "trace_io.cuh"
+#include "cpa_log.cuh"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static int has_extension(char *path, const char *extension) {
+  int pathLength = strlen(path);
+  int extensionLength = strlen(extension);
+  return pathLength >= extensionLength && strcmp(path + pathLength - extensionLength, extension) == 0;
+}
+
+// Maps a whole file read-only. The pages are read ahead sequentially by the
+// kernel as the batches go through them.
+static const uint8_t *map_file(char *path, size_t *size) {
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("Error in opening file %s\n", path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    printf("Error in reading the size of file %s\n", path);
+    close(fd);
+    return NULL;
+  }
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    printf("Error in mapping file %s\n", path);
+    return NULL;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  *size = st.st_size;
+  return (const uint8_t *)map;
+}
+
+// Opens the trace file (.bin file of uint8 samples, .data file written by
+// convert_traces.py, or a text file with one integer per sample) and the
+// ciphertext file (.bin file of 16-byte records, or the text file written by
+// convert_ciphertexts.py). With a sensor_width, the trace file holds the raw
+// sensor words of sensor_width bits (traces_raw.bin of the Alveo host), and
+// n_samples is the number of their bits in a trace.
+int trace_reader_open(trace_reader_t *reader, char *trace_path, char *ciphertext_path, int n_samples, int sensor_width) {
+
+  memset(reader, 0, sizeof(trace_reader_t));
+  reader->n_samples = n_samples;
+  reader->sensor_width = sensor_width;
+  reader->n_channels = 1;
+
+  if (sensor_width > 0)
+    reader->trace_format = TRACE_RAW;
+  else if (has_extension(trace_path, ".bin"))
+    reader->trace_format = TRACE_UINT8;
+  else if (has_extension(trace_path, "data"))
+    reader->trace_format = TRACE_FLOAT;
+  else
+    reader->trace_format = TRACE_TEXT;
+  reader->binary_ciphertexts = has_extension(ciphertext_path, ".bin");
+
+  const char *formats[] = {".txt file detected", ".data file detected", ".bin file detected", "raw sensor file detected"};
+  fprintf(stderr, "%s\n", formats[reader->trace_format]);
+
+  printf("Trace file: %s\n", trace_path);
+  if (reader->trace_format == TRACE_TEXT) {
+    reader->trace_file = fopen(trace_path, "r");
+    if (reader->trace_file == NULL) {
+      printf("Error in opening trace file %s\n", trace_path);
+      trace_reader_close(reader);
+      return EXIT_FAILURE;
+    }
+  } else {
+    reader->trace_map = map_file(trace_path, &reader->trace_map_size);
+    if (reader->trace_map == NULL) {
+      trace_reader_close(reader);
+      return EXIT_FAILURE;
+    }
+  }
+
+  printf("Ciph file: %s\n", ciphertext_path);
+  if (reader->binary_ciphertexts) {
+    reader->ciphertext_map = map_file(ciphertext_path, &reader->ciphertext_map_size);
+    if (reader->ciphertext_map == NULL) {
+      trace_reader_close(reader);
+      return EXIT_FAILURE;
+    }
+  } else {
+    reader->ciphertext_file = fopen(ciphertext_path, "r");
+    if (reader->ciphertext_file == NULL) {
+      printf("Error in opening ciphertext file %s\n", ciphertext_path);
+      trace_reader_close(reader);
+      return EXIT_FAILURE;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
+
+// Adds the plaintexts to the batches: read from plaintext_path (.bin file of
+// 16-byte records, or text file as the ciphertexts), or chained from the
+// ciphertexts when plaintext_path is empty. Must be called before the first batch.
+int trace_reader_open_plaintexts(trace_reader_t *reader, char *plaintext_path) {
+
+  if (plaintext_path[0] == '\0') {
+    reader->plaintexts = PLAINTEXT_CHAINED;
+    memset(reader->last_ciphertext, 0, sizeof(reader->last_ciphertext));
+    printf("Plaintexts chained from the ciphertexts\n");
+    return EXIT_SUCCESS;
+  }
+
+  printf("Plain file: %s\n", plaintext_path);
+  if (has_extension(plaintext_path, ".bin")) {
+    reader->plaintexts = PLAINTEXT_BINARY;
+    reader->plaintext_map = map_file(plaintext_path, &reader->plaintext_map_size);
+    if (reader->plaintext_map == NULL)
+      return EXIT_FAILURE;
+  } else {
+    reader->plaintexts = PLAINTEXT_TEXT;
+    reader->plaintext_file = fopen(plaintext_path, "r");
+    if (reader->plaintext_file == NULL) {
+      printf("Error in opening plaintext file %s\n", plaintext_path);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+// Adds the keys of the traces to the batches, read from key_path (keys.bin of
+// the random key acquisitions, 16-byte records). Must be called before the first batch.
+int trace_reader_open_keys(trace_reader_t *reader, char *key_path) {
+
+  printf("Key file: %s\n", key_path);
+  reader->key_map = map_file(key_path, &reader->key_map_size);
+  return reader->key_map == NULL ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Realigns the traces of the batches by the shift index of align-traces
+// (one int32 per trace): the sample s of a trace becomes its sample s + shift,
+// the first or last one beyond its ends. With raw sensor words, the shifts
+// are in samples of the sensor, sensor_width bits. Must be called before the first batch.
+int trace_reader_open_shifts(trace_reader_t *reader, char *shift_path) {
+
+  printf("Shift file: %s\n", shift_path);
+  reader->shift_map = (const int32_t *)map_file(shift_path, &reader->shift_map_size);
+  return reader->shift_map == NULL ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// Splits every trace into n_channels channels of the same length, one after
+// the other (one per sensor of the Alveo host): the shift of a trace realigns
+// each of its channels. With weights, the batches hold the sum of the channels
+// weighted by them, and n_samples given to trace_reader_open is the number of
+// samples of one channel. Must be called before the first batch and before
+// trace_reader_select, whose samples are then those of the sums.
+void trace_reader_open_channels(trace_reader_t *reader, int n_channels, const float *weights) {
+  reader->n_channels = n_channels;
+  reader->channel_weights = weights;
+  if (weights != NULL) {
+    reader->n_samples *= n_channels;
+    printf("Summing the %d channels of the traces, weighted by %g", n_channels, weights[0]);
+    for (int c = 1; c < n_channels; c++)
+      printf(",%g", weights[c]);
+    printf("\n");
+  } else {
+    printf("Traces of %d channels of %d samples\n", n_channels, reader->n_samples / n_channels);
+  }
+}
+
+// Restricts the batches to the given samples (in increasing order), e.g. the
+// points of interest. samples must stay valid until the reader is closed.
+void trace_reader_select(trace_reader_t *reader, const int *samples, int n_selected) {
+  reader->samples = samples;
+  reader->n_selected = n_selected;
+}
+
+// Keeps the selected samples of the n_traces traces of batch: the parsed text
+// traces are compacted in place, the mapped ones copied to select_buffer
+template <typename sample_t>
+static const sample_t *select_samples(trace_reader_t *reader, const sample_t *traces, sample_t *dst, long n_traces) {
+  int length = reader->channel_weights != NULL ? reader->n_samples / reader->n_channels : reader->n_samples;
+  for (long t = 0; t < n_traces; t++) {
+    const sample_t *src = &traces[(size_t)t * length];
+    sample_t *out = &dst[(size_t)t * reader->n_selected];
+    for (int s = 0; s < reader->n_selected; s++)
+      out[s] = src[reader->samples[s]];
+  }
+  return dst;
+}
+
+// Returns the raw sensor words of the batches as they are in the file, one
+// bit per sample, instead of one uint8 sample per bit (bitsliced CPA). The
+// samples cannot be selected. Must be called before the first batch.
+void trace_reader_keep_packed(trace_reader_t *reader) {
+  reader->packed = (reader->trace_format == TRACE_RAW);
+}
+
+// Expands the raw sensor words of n_traces traces to one sample per bit,
+// the bit b of the 32-bit word w of a trace being its sample w * 32 + b
+static const uint8_t *expand_raw_words(trace_reader_t *reader, const uint8_t *words, long n_traces) {
+  if (n_traces > reader->raw_traces) {
+    free(reader->raw_buffer);
+    reader->raw_buffer = (uint8_t *)malloc((size_t)n_traces * reader->n_samples);
+    isMemoryFull((unsigned int *)reader->raw_buffer);
+    reader->raw_traces = n_traces;
+  }
+  size_t n_words = (size_t)n_traces * reader->n_samples / 32;
+  for (size_t w = 0; w < n_words; w++) {
+    uint32_t word;
+    memcpy(&word, &words[w * sizeof(uint32_t)], sizeof(uint32_t));
+    uint8_t *bits = &reader->raw_buffer[w * 32];
+    for (int b = 0; b < 32; b++)
+      bits[b] = (word >> b) & 1;
+  }
+  return reader->raw_buffer;
+}
+
+// Size in bytes of one sample of the trace file (one bit of the raw sensor words)
+static size_t file_sample_size(trace_reader_t *reader) {
+  return (reader->trace_format == TRACE_UINT8 || reader->trace_format == TRACE_RAW) ? sizeof(uint8_t) : sizeof(float);
+}
+
+// Sums the channels of the n_traces traces of the batch, weighted by channel_weights, into fuse_buffer
+template <typename sample_t>
+static const float *fuse_channels(trace_reader_t *reader, const sample_t *traces, long n_traces) {
+  int length = reader->n_samples / reader->n_channels;
+  if (n_traces > reader->fuse_traces) {
+    free(reader->fuse_buffer);
+    reader->fuse_buffer = (float *)malloc(sizeof(float) * n_traces * length);
+    isMemoryFull((unsigned int *)reader->fuse_buffer);
+    reader->fuse_traces = n_traces;
+  }
+  for (long t = 0; t < n_traces; t++) {
+    const sample_t *src = &traces[(size_t)t * reader->n_samples];
+    float *dst = &reader->fuse_buffer[(size_t)t * length];
+    for (int s = 0; s < length; s++)
+      dst[s] = 0;
+    for (int c = 0; c < reader->n_channels; c++) {
+      float weight = reader->channel_weights[c];
+      for (int s = 0; s < length; s++)
+        dst[s] += weight * src[c * length + s];
+    }
+  }
+  return reader->fuse_buffer;
+}
+
+// Copies the n_traces traces of the batch, as they are in the file, to
+// shift_buffer, every channel shifted by the entry of its trace in the shift index
+static const uint8_t *shift_samples(trace_reader_t *reader, const uint8_t *traces, long n_traces) {
+  size_t unit = reader->trace_format == TRACE_RAW ? reader->sensor_width / 8 : file_sample_size(reader);
+  long length = (reader->trace_format == TRACE_RAW ? reader->n_samples / reader->sensor_width : reader->n_samples) / reader->n_channels;
+  size_t channel_size = unit * length;
+  size_t trace_size = channel_size * reader->n_channels;
+  if (n_traces > reader->shift_traces) {
+    free(reader->shift_buffer);
+    reader->shift_buffer = (uint8_t *)malloc(trace_size * n_traces);
+    isMemoryFull((unsigned int *)reader->shift_buffer);
+    reader->shift_traces = n_traces;
+  }
+  for (long t = 0; t < n_traces; t++) {
+    long shift = reader->shift_map[reader->n_read + t];
+    long lo = shift < 0 ? (-shift < length ? -shift : length) : 0;
+    long hi = shift > 0 ? (shift < length ? length - shift : 0) : length;
+    for (int c = 0; c < reader->n_channels; c++) {
+      const uint8_t *src = &traces[t * trace_size + c * channel_size];
+      uint8_t *dst = &reader->shift_buffer[t * trace_size + c * channel_size];
+      for (long s = 0; s < lo; s++)
+        memcpy(&dst[s * unit], src, unit);
+      if (hi > lo)
+        memcpy(&dst[lo * unit], &src[(lo + shift) * unit], (hi - lo) * unit);
+      for (long s = hi > lo ? hi : lo; s < length; s++)
+        memcpy(&dst[s * unit], &src[(length - 1) * unit], unit);
+    }
+  }
+  return reader->shift_buffer;
+}
+
+// Parses the next n_traces traces of the text trace file into trace_buffer
+static long read_text_traces(trace_reader_t *reader, long n_traces) {
+
+  long int dat;
+  for (long t = 0; t < n_traces; t++) {
+    float *wave = &reader->trace_buffer[(size_t)t * reader->n_samples];
+    for (int j = 0; j < reader->n_samples; j++) {
+      if (fscanf(reader->trace_file, "%ld", &dat) != 1)
+        return t;
+      wave[j] = (float)dat;
+    }
+  }
+  return n_traces;
+}
+
+// Parses the next n_traces 16-byte records (ciphertexts or plaintexts) of a text file into buffer
+static long read_text_records(FILE *file, uint8_t *buffer, long n_traces) {
+
+  unsigned int ct;
+  for (long t = 0; t < n_traces; t++) {
+    for (int n = 0; n < KEYBYTES; n++) {
+      if (fscanf(file, "%X", &ct) != 1)
+        return t;
+      buffer[t * KEYBYTES + n] = (uint8_t)ct;
+    }
+  }
+  return n_traces;
+}
+
+// Returns the next n_traces traces and ciphertexts in batch. Returns the number
+// of traces in the batch, which is smaller than n_traces only if one of the
+// files ends early.
+long trace_reader_next(trace_reader_t *reader, trace_batch_t *batch, long n_traces) {
+
+  // The buffers are only needed for the text files and the chained
+  // plaintexts, and grow to the largest batch
+  int plaintext_buffer = (reader->plaintexts == PLAINTEXT_CHAINED || reader->plaintexts == PLAINTEXT_TEXT);
+  if (n_traces > reader->buffer_traces && (reader->trace_format == TRACE_TEXT || !reader->binary_ciphertexts || plaintext_buffer)) {
+    free(reader->trace_buffer);
+    free(reader->ciphertext_buffer);
+    free(reader->plaintext_buffer);
+    reader->trace_buffer = NULL;
+    reader->ciphertext_buffer = NULL;
+    reader->plaintext_buffer = NULL;
+    if (reader->trace_format == TRACE_TEXT) {
+      reader->trace_buffer = (float *)malloc(sizeof(float) * n_traces * reader->n_samples);
+      isMemoryFull((unsigned int *)reader->trace_buffer);
+    }
+    if (!reader->binary_ciphertexts) {
+      reader->ciphertext_buffer = (uint8_t *)malloc(sizeof(uint8_t) * n_traces * KEYBYTES);
+      isMemoryFull((unsigned int *)reader->ciphertext_buffer);
+    }
+    if (plaintext_buffer) {
+      reader->plaintext_buffer = (uint8_t *)malloc(sizeof(uint8_t) * n_traces * KEYBYTES);
+      isMemoryFull((unsigned int *)reader->plaintext_buffer);
+    }
+    reader->buffer_traces = n_traces;
+  }
+
+  long n = n_traces;
+  size_t trace_size = reader->trace_format == TRACE_RAW ? reader->n_samples / 8 : file_sample_size(reader) * reader->n_samples;
+  batch->traces = NULL;
+  batch->traces_u8 = NULL;
+
+  if (reader->trace_format == TRACE_TEXT) {
+    n = read_text_traces(reader, n);
+    batch->traces = reader->trace_buffer;
+  } else {
+    long available = (long)(reader->trace_map_size / trace_size) - reader->n_read;
+    if (available < n)
+      n = available > 0 ? available : 0;
+    const uint8_t *first = reader->trace_map + (size_t)reader->n_read * trace_size;
+    if (reader->trace_format == TRACE_FLOAT)
+      batch->traces = (const float *)first;
+    else
+      batch->traces_u8 = first;
+  }
+
+  if (reader->binary_ciphertexts) {
+    long available = (long)(reader->ciphertext_map_size / KEYBYTES) - reader->n_read;
+    if (available < n)
+      n = available > 0 ? available : 0;
+    batch->ciphertexts = reader->ciphertext_map + (size_t)reader->n_read * KEYBYTES;
+  } else {
+    n = read_text_records(reader->ciphertext_file, reader->ciphertext_buffer, n);
+    batch->ciphertexts = reader->ciphertext_buffer;
+  }
+
+  batch->plaintexts = NULL;
+  if (reader->plaintexts == PLAINTEXT_BINARY) {
+    long available = (long)(reader->plaintext_map_size / KEYBYTES) - reader->n_read;
+    if (available < n)
+      n = available > 0 ? available : 0;
+    batch->plaintexts = reader->plaintext_map + (size_t)reader->n_read * KEYBYTES;
+  } else if (reader->plaintexts == PLAINTEXT_TEXT) {
+    n = read_text_records(reader->plaintext_file, reader->plaintext_buffer, n);
+    batch->plaintexts = reader->plaintext_buffer;
+  } else if (reader->plaintexts == PLAINTEXT_CHAINED && n > 0) {
+    memcpy(reader->plaintext_buffer, reader->last_ciphertext, KEYBYTES);
+    memcpy(reader->plaintext_buffer + KEYBYTES, batch->ciphertexts, (size_t)(n - 1) * KEYBYTES);
+    memcpy(reader->last_ciphertext, batch->ciphertexts + (size_t)(n - 1) * KEYBYTES, KEYBYTES);
+    batch->plaintexts = reader->plaintext_buffer;
+  }
+
+  batch->keys = NULL;
+  if (reader->key_map != NULL) {
+    long available = (long)(reader->key_map_size / KEYBYTES) - reader->n_read;
+    if (available < n)
+      n = available > 0 ? available : 0;
+    batch->keys = reader->key_map + (size_t)reader->n_read * KEYBYTES;
+  }
+
+  if (reader->shift_map != NULL) {
+    long available = (long)(reader->shift_map_size / sizeof(int32_t)) - reader->n_read;
+    if (available < n)
+      n = available > 0 ? available : 0;
+    if (batch->traces != NULL)
+      batch->traces = (const float *)shift_samples(reader, (const uint8_t *)batch->traces, n);
+    else
+      batch->traces_u8 = shift_samples(reader, batch->traces_u8, n);
+  }
+
+  if (reader->trace_format == TRACE_RAW && !reader->packed)
+    batch->traces_u8 = expand_raw_words(reader, batch->traces_u8, n);
+
+  if (reader->channel_weights != NULL && batch->traces != NULL) {
+    batch->traces = fuse_channels(reader, batch->traces, n);
+  } else if (reader->channel_weights != NULL) {
+    batch->traces = fuse_channels(reader, batch->traces_u8, n);
+    batch->traces_u8 = NULL;
+  }
+
+  if (reader->samples != NULL && reader->trace_format == TRACE_TEXT) {
+    batch->traces = select_samples(reader, batch->traces, reader->trace_buffer, n);
+  } else if (reader->samples != NULL) {
+    if (n > reader->select_traces) {
+      free(reader->select_buffer);
+      reader->select_buffer = (uint8_t *)malloc(trace_sample_size(reader) * n * reader->n_selected);
+      isMemoryFull((unsigned int *)reader->select_buffer);
+      reader->select_traces = n;
+    }
+    if (batch->traces != NULL)
+      batch->traces = select_samples(reader, batch->traces, (float *)reader->select_buffer, n);
+    else
+      batch->traces_u8 = select_samples(reader, batch->traces_u8, reader->select_buffer, n);
+  }
+
+  if (n < n_traces)
+    printf("Trace, ciphertext, plaintext, key or shift file ended after %ld traces\n", reader->n_read + n);
+  reader->n_read += n;
+  batch->n_traces = n;
+  return n;
+}
+
+// Skips the next n_traces traces, e.g. those before the first trace of a
+// shard. The mapped files are only skipped over, the text files are parsed
+// and dropped batch by batch.
+long trace_reader_skip(trace_reader_t *reader, long n_traces) {
+
+  if (reader->trace_format != TRACE_TEXT && reader->binary_ciphertexts && reader->plaintexts != PLAINTEXT_TEXT) {
+    size_t trace_size = reader->trace_format == TRACE_RAW ? reader->n_samples / 8 : file_sample_size(reader) * reader->n_samples;
+    long available = (long)(reader->ciphertext_map_size / KEYBYTES) - reader->n_read;
+    long n = (long)(reader->trace_map_size / trace_size) - reader->n_read;
+    if (available < n)
+      n = available;
+    if (n_traces < n)
+      n = n_traces;
+    if (n <= 0)
+      return 0;
+    if (reader->plaintexts == PLAINTEXT_CHAINED)
+      memcpy(reader->last_ciphertext, reader->ciphertext_map + (size_t)(reader->n_read + n - 1) * KEYBYTES, KEYBYTES);
+    reader->n_read += n;
+    return n;
+  }
+
+  trace_batch_t batch;
+  long skipped = 0;
+  while (skipped < n_traces) {
+    long n = trace_reader_next(reader, &batch, n_traces - skipped < 4096 ? n_traces - skipped : 4096);
+    if (n <= 0)
+      break;
+    skipped += n;
+  }
+  return skipped;
+}
+
+void trace_reader_close(trace_reader_t *reader) {
+  if (reader->trace_file != NULL)
+    fclose(reader->trace_file);
+  if (reader->ciphertext_file != NULL)
+    fclose(reader->ciphertext_file);
+  if (reader->trace_map != NULL)
+    munmap((void *)reader->trace_map, reader->trace_map_size);
+  if (reader->ciphertext_map != NULL)
+    munmap((void *)reader->ciphertext_map, reader->ciphertext_map_size);
+  if (reader->plaintext_file != NULL)
+    fclose(reader->plaintext_file);
+  if (reader->plaintext_map != NULL)
+    munmap((void *)reader->plaintext_map, reader->plaintext_map_size);
+  if (reader->key_map != NULL)
+    munmap((void *)reader->key_map, reader->key_map_size);
+  if (reader->shift_map != NULL)
+    munmap((void *)reader->shift_map, reader->shift_map_size);
+  free(reader->trace_buffer);
+  free(reader->ciphertext_buffer);
+  free(reader->plaintext_buffer);
+  free(reader->select_buffer);
+  free(reader->raw_buffer);
+  free(reader->shift_buffer);
+  free(reader->fuse_buffer);
+  memset(reader, 0, sizeof(trace_reader_t));
+}
+
+// Size in bytes of one sample of the batches: float32 for the sums of the channels
+size_t trace_sample_size(trace_reader_t *reader) {
+  return reader->channel_weights != NULL ? sizeof(float) : file_sample_size(reader);
+}
+
+// Number of traces per batch so that a batch of bytes_per_trace bytes per trace
+// fits in the memory ceiling (-m) less the reserved bytes, at least one trace
+// and at most n_traces
+long get_batch_size(config_t *config, size_t bytes_per_trace, size_t reserved) {
+
+  long limit_mb = config->memory_limit_mb > 0 ? config->memory_limit_mb : DEFAULT_MEMORY_LIMIT_MB;
+  size_t limit = (size_t)limit_mb << 20;
+  long batch = reserved < limit ? (long)((limit - reserved) / bytes_per_trace) : 0;
+
+  if (batch < 1)
+    batch = 1;
+  if (batch > config->n_traces)
+    batch = config->n_traces;
+  return batch;
+}
@@ -0,0 +1,114 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file. 
+*/
+
+#ifndef TRACE_IO_H
+#define TRACE_IO_H
+
+#include <stdint.h>
+#include "utils.cuh"
+
+// Memory ceiling for the trace batches when -m is not given, in MiB
+#define DEFAULT_MEMORY_LIMIT_MB 1024
+
+// Formats of the trace file, chosen from its extension
+#define TRACE_TEXT  0   // text file with one integer per sample
+#define TRACE_FLOAT 1   // .data file of float32 samples, written by convert_traces.py
+#define TRACE_UINT8 2   // .bin file of uint8 samples (traces_encoded.bin, sensor_traces_hw_*.bin)
+#define TRACE_RAW   3   // .bin file of raw sensor words (traces_raw.bin), one uint8 sample of 0 or 1 per bit
+
+// Sources of the plaintexts
+#define PLAINTEXT_NONE    0
+#define PLAINTEXT_CHAINED 1   // plaintext of a trace = ciphertext of the previous one, 0 for the first (Alveo host)
+#define PLAINTEXT_TEXT    2   // text file of hex bytes, as the ciphertexts
+#define PLAINTEXT_BINARY  3   // .bin file of 16-byte records (plaintexts.bin of basys3 and sakura_x)
+
+// One batch of traces, [trace][sample], and of their 16-byte ciphertexts and
+// plaintexts. Exactly one of traces and traces_u8 is set, depending on the
+// trace format; plaintexts is only set once trace_reader_open_plaintexts has
+// been called, keys once trace_reader_open_keys has been called. Once trace_reader_open_shifts
+// has been called, the traces are realigned by their shifts. Once trace_reader_open_channels has been called
+// with weights, the traces hold the weighted sum of their channels, as float32 samples. Once trace_reader_select has been
+// called, the traces only hold the selected samples. Once trace_reader_keep_packed has been called, the raw
+// sensor words are not expanded. The pointers are valid until the next call to trace_reader_next.
+typedef struct trace_batch {
+
+  long n_traces;
+  const float *traces;
+  const uint8_t *traces_u8;
+  const uint8_t *ciphertexts;
+  const uint8_t *plaintexts;
+  const uint8_t *keys;
+
+} trace_batch_t;
+
+// Sequential reader of the trace and ciphertext files. The binary files
+// (.data and .bin traces, .bin ciphertexts) are memory mapped and the batches
+// point into the mapping without any copy. The text files are parsed batch by
+// batch into buffers owned by the reader, so that only one batch is held in
+// memory at any time.
+typedef struct trace_reader {
+
+  int n_samples;                // samples of a trace in the file, all its channels
+  int trace_format;
+  int sensor_width;             // bits of a raw sensor word, TRACE_RAW only
+  int binary_ciphertexts;
+  long n_read;                  // number of traces read so far
+
+  FILE *trace_file;             // text files
+  FILE *ciphertext_file;
+  const uint8_t *trace_map;     // mapped binary files
+  size_t trace_map_size;
+  const uint8_t *ciphertext_map;
+  size_t ciphertext_map_size;
+
+  float *trace_buffer;          // batch buffers of the text files
+  uint8_t *ciphertext_buffer;
+  long buffer_traces;
+
+  int plaintexts;               // PLAINTEXT_ source of the plaintexts
+  FILE *plaintext_file;
+  const uint8_t *plaintext_map;
+  size_t plaintext_map_size;
+  uint8_t *plaintext_buffer;    // text file or chained plaintexts
+  uint8_t last_ciphertext[KEYBYTES];
+
+  const uint8_t *key_map;       // mapped key file of the random key acquisitions
+  size_t key_map_size;
+
+  const int *samples;           // selected samples, in increasing order, NULL for all
+  int n_selected;
+  uint8_t *select_buffer;       // selected samples of the mapped traces
+  long select_traces;
+  uint8_t *raw_buffer;          // bits of the raw sensor words
+  long raw_traces;
+  int packed;                   // raw sensor words returned as they are in the file, n_samples / 8 bytes per trace
+  const int32_t *shift_map;     // mapped shift index of align-traces, one shift per trace
+  size_t shift_map_size;
+  uint8_t *shift_buffer;        // shifted traces
+  long shift_traces;
+  int n_channels;               // channels of a trace (one per sensor), one after the other
+  const float *channel_weights; // weights of the sum of the channels, NULL to keep them
+  float *fuse_buffer;           // weighted sums of the channels
+  long fuse_traces;
+
+} trace_reader_t;
+
+int trace_reader_open(trace_reader_t *reader, char *trace_path, char *ciphertext_path, int n_samples, int sensor_width);
+int trace_reader_open_plaintexts(trace_reader_t *reader, char *plaintext_path);
+int trace_reader_open_keys(trace_reader_t *reader, char *key_path);
+int trace_reader_open_shifts(trace_reader_t *reader, char *shift_path);
+void trace_reader_open_channels(trace_reader_t *reader, int n_channels, const float *weights);
+void trace_reader_select(trace_reader_t *reader, const int *samples, int n_selected);
+void trace_reader_keep_packed(trace_reader_t *reader);
+long trace_reader_next(trace_reader_t *reader, trace_batch_t *batch, long n_traces);
+long trace_reader_skip(trace_reader_t *reader, long n_traces);
+void trace_reader_close(trace_reader_t *reader);
+size_t trace_sample_size(trace_reader_t *reader);
+long get_batch_size(config_t *config, size_t bytes_per_trace, size_t reserved);
+
+#endif
@@ -0,0 +1,481 @@
+/*
+ RDS: FPGA Routing Delay Sensors for Effective Remote Power Analysis Attacks
+ Copyright 2023, School of Computer and Communication Sciences, EPFL.
+
+ All rights reserved. Use of this source code is governed by a
+ BSD-style license that can be found in the LICENSE.md file.
+*/
+
+/*
+Fixed-vs-random Welch t-test (TVLA) of the traces acquired with plain_mode 2
+by the sakura_x and basys3 hosts. They alternate the chained (random)
+plaintext and the fixed one, starting with the chained one: the even traces
+are random, the odd ones fixed. With the plaintext file of the acquisition,
+the traces are instead split by comparing their plaintext to the fixed one.
+
+The trace file (.bin file of uint8 samples, e.g. sensor_traces_hw_*.bin, or
+.data file of float32 samples) is memory mapped and split into one block of
+traces per thread, read in a single pass. The uint8 samples are counted in
+one histogram per class and sample, from which the exact mean and the
+central moments are computed at the end. The float32 samples update online
+central moments (Pebay's single point update), which are merged in thread
+order (Pebay's pairwise update). Both keep the central moments up to the
+sixth order, which the third order test needs.
+
+The output file holds the first, second and third order t-statistics of
+every sample (Schneider and Moradi, "Leakage assessment methodology", 2015).
+*/
+
+#include "utils.cuh"
+#include <stdint.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+#define FORMAT_DATA 0   // float32 samples
+#define FORMAT_BIN  1   // uint8 samples
+
+#define CLASS_RANDOM 0
+#define CLASS_FIXED  1
+#define N_CLASSES    2
+
+#define N_ORDERS  3
+#define N_MOMENTS (2 * N_ORDERS)    // central moments 2 to N_MOMENTS are kept
+
+// Threshold of the TVLA on the absolute t-statistic
+#define TVLA_THRESHOLD 4.5
+
+typedef struct tvla_block {
+
+  const uint8_t *traces;        // first trace of the block in the mapping
+  const uint8_t *plaintexts;    // first plaintext of the block, NULL for alternating classes
+  const uint8_t *fixed;         // fixed plaintext
+  long first_trace;             // index of the first trace in the file
+  long n_traces;
+  int n_samples;
+  int format;
+  double count[N_CLASSES];
+  uint64_t *histogram;          // uint8 samples: [class][sample][value]
+  double *mean;                 // float32 samples: [class][sample]
+  double *moments;              // float32 samples: [class][order - 2][sample], sums of (x - mean)^order
+
+} tvla_block_t;
+
+void print_tvla_help();
+int tvla_block_init(tvla_block_t *block, int n_samples, int format);
+void tvla_block_free(tvla_block_t *block);
+void tvla_block_run(tvla_block_t *block);
+void tvla_block_merge(tvla_block_t *dst, const tvla_block_t *src);
+void tvla_central_moments(const tvla_block_t *block, int c, int s, double *mean, double cm[N_MOMENTS + 1]);
+
+static const double BINOMIAL[N_MOMENTS + 1][N_MOMENTS + 1] = {
+  {1, 0, 0, 0, 0, 0, 0},
+  {1, 1, 0, 0, 0, 0, 0},
+  {1, 2, 1, 0, 0, 0, 0},
+  {1, 3, 3, 1, 0, 0, 0},
+  {1, 4, 6, 4, 1, 0, 0},
+  {1, 5, 10, 10, 5, 1, 0},
+  {1, 6, 15, 20, 15, 6, 1},
+};
+
+int main(int argc, char *argv[]) {
+
+  char *trace_path = NULL;
+  char *plaintext_path = NULL;
+  char output_path[1000] = "";
+  long n_traces = -1;
+  int n_samples = -1;
+  int n_threads = 0;
+  int fixed_given = 0;
+  uint8_t fixed[KEYBYTES] = {0};
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-h") == 0) {
+      print_tvla_help();
+      return 0;
+    } else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+      i++;
+      plaintext_path = argv[i];
+    } else if (strcmp(argv[i], "-fp") == 0 && i + 1 < argc) {
+      i++;
+      const char *src = argv[i];
+      unsigned int u;
+      int counter = 0;
+      while (counter < KEYBYTES && sscanf(src, "%2x", &u) == 1) {
+        fixed[counter++] = u;
+        src += 2;
+      }
+      if (counter != KEYBYTES || *src != '\0') {
+        printf("Given fixed plaintext does not have size 16. Plaintext size must be 16 bytes.\n");
+        return EXIT_FAILURE;
+      }
+      fixed_given = 1;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      i++;
+      snprintf(output_path, sizeof(output_path), "%s", argv[i]);
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      i++;
+      n_threads = atoi(argv[i]);
+    } else if (positional == 0) {
+      trace_path = argv[i];
+      positional++;
+    } else if (positional == 1) {
+      n_traces = atol(argv[i]);
+      positional++;
+    } else if (positional == 2) {
+      n_samples = atoi(argv[i]);
+      positional++;
+    } else {
+      printf("Unknown argument: %s\n\n", argv[i]);
+      print_tvla_help();
+      return EXIT_FAILURE;
+    }
+  }
+  if (positional != 3 || n_traces <= 0 || n_samples <= 0) {
+    print_tvla_help();
+    return EXIT_FAILURE;
+  }
+  if (fixed_given && plaintext_path == NULL) {
+    printf("The fixed plaintext (-fp) needs the plaintext file (-p)\n");
+    return EXIT_FAILURE;
+  }
+
+  int pathLength = strlen(trace_path);
+  int format = (pathLength >= 4 && strcmp(trace_path + pathLength - 4, ".bin") == 0) ? FORMAT_BIN : FORMAT_DATA;
+  size_t sample_size = (format == FORMAT_DATA) ? sizeof(float) : sizeof(uint8_t);
+  size_t trace_size = sample_size * n_samples;
+
+  if (output_path[0] == '\0') {
+    snprintf(output_path, sizeof(output_path), "%s", trace_path);
+    char *dot = strrchr(output_path, '.');
+    char *slash = strrchr(output_path, '/');
+    if (dot != NULL && (slash == NULL || dot > slash))
+      *dot = '\0';
+    strncat(output_path, "_tvla.csv", sizeof(output_path) - strlen(output_path) - 1);
+  }
+  if (n_threads <= 0)
+    n_threads = (int)std::thread::hardware_concurrency();
+  if (n_threads <= 0)
+    n_threads = 1;
+
+  printf("Trace file: %s (%s samples)\n", trace_path, format == FORMAT_DATA ? "float32" : "uint8");
+
+  int fd = open(trace_path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+    printf("Error in opening trace file %s\n", trace_path);
+    if (fd >= 0)
+      close(fd);
+    return EXIT_FAILURE;
+  }
+  size_t trace_map_size = st.st_size;
+  const uint8_t *trace_map = (const uint8_t *)mmap(NULL, trace_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (trace_map == MAP_FAILED) {
+    printf("Error in mapping trace file %s\n", trace_path);
+    return EXIT_FAILURE;
+  }
+  madvise((void *)trace_map, trace_map_size, MADV_SEQUENTIAL);
+  if ((long)(trace_map_size / trace_size) < n_traces) {
+    n_traces = trace_map_size / trace_size;
+    printf("Trace file %s holds only %ld traces, testing them all\n", trace_path, n_traces);
+  }
+
+  const uint8_t *plaintext_map = NULL;
+  size_t plaintext_map_size = 0;
+  if (plaintext_path != NULL) {
+    printf("Plain file: %s\n", plaintext_path);
+    fd = open(plaintext_path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+      printf("Error in opening plaintext file %s\n", plaintext_path);
+      if (fd >= 0)
+        close(fd);
+      munmap((void *)trace_map, trace_map_size);
+      return EXIT_FAILURE;
+    }
+    plaintext_map_size = st.st_size;
+    plaintext_map = (const uint8_t *)mmap(NULL, plaintext_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (plaintext_map == MAP_FAILED) {
+      printf("Error in mapping plaintext file %s\n", plaintext_path);
+      munmap((void *)trace_map, trace_map_size);
+      return EXIT_FAILURE;
+    }
+    if ((long)(plaintext_map_size / KEYBYTES) < n_traces) {
+      n_traces = plaintext_map_size / KEYBYTES;
+      printf("Plaintext file %s holds only %ld plaintexts, testing %ld traces\n", plaintext_path, n_traces, n_traces);
+    }
+    // The first fixed plaintext of plain_mode 2 is the one of the second trace
+    if (!fixed_given && n_traces > 1)
+      memcpy(fixed, plaintext_map + KEYBYTES, KEYBYTES);
+    printf("Fixed plaintext: ");
+    for (int n = 0; n < KEYBYTES; n++)
+      printf("%02x", fixed[n]);
+    printf("\n");
+  } else {
+    printf("Alternating classes: even traces random, odd traces fixed\n");
+  }
+
+  if (n_threads > n_traces)
+    n_threads = (int)n_traces;
+  std::vector<tvla_block_t> blocks(n_threads);
+  for (int b = 0; b < n_threads; b++) {
+    if (tvla_block_init(&blocks[b], n_samples, format) == EXIT_FAILURE)
+      return EXIT_FAILURE;
+    long first = n_traces * b / n_threads;
+    blocks[b].first_trace = first;
+    blocks[b].n_traces = n_traces * (b + 1) / n_threads - first;
+    blocks[b].traces = trace_map + (size_t)first * trace_size;
+    blocks[b].plaintexts = plaintext_map != NULL ? plaintext_map + (size_t)first * KEYBYTES : NULL;
+    blocks[b].fixed = fixed;
+  }
+
+  std::vector<std::thread> threads;
+  for (int b = 0; b < n_threads; b++)
+    threads.push_back(std::thread(tvla_block_run, &blocks[b]));
+  for (int b = 0; b < n_threads; b++)
+    threads[b].join();
+  for (int b = 1; b < n_threads; b++)
+    tvla_block_merge(&blocks[0], &blocks[b]);
+
+  munmap((void *)trace_map, trace_map_size);
+  if (plaintext_map != NULL)
+    munmap((void *)plaintext_map, plaintext_map_size);
+
+  tvla_block_t *total = &blocks[0];
+  printf("Traces: %.0f random, %.0f fixed\n", total->count[CLASS_RANDOM], total->count[CLASS_FIXED]);
+  if (total->count[CLASS_RANDOM] < 2 || total->count[CLASS_FIXED] < 2) {
+    printf("Both classes need at least 2 traces\n");
+    return EXIT_FAILURE;
+  }
+
+  FILE *file = fopen(output_path, "w");
+  if (file == NULL) {
+    printf("Error in opening output file %s\n", output_path);
+    return EXIT_FAILURE;
+  }
+  fprintf(file, "sample,t1,t2,t3\n");
+
+  double max_t[N_ORDERS] = {0};
+  int max_sample[N_ORDERS] = {0};
+  int n_leaky[N_ORDERS] = {0};
+  for (int s = 0; s < n_samples; s++) {
+    // Mean and variance of the preprocessed traces of every order and class:
+    // x, (x - mean)^2, and ((x - mean) / sd)^3
+    double m[N_CLASSES][N_ORDERS];
+    double v[N_CLASSES][N_ORDERS];
+    for (int c = 0; c < N_CLASSES; c++) {
+      double mean;
+      double cm[N_MOMENTS + 1];
+      tvla_central_moments(total, c, s, &mean, cm);
+      m[c][0] = mean;
+      v[c][0] = cm[2];
+      m[c][1] = cm[2];
+      v[c][1] = cm[4] - cm[2] * cm[2];
+      m[c][2] = cm[2] > 0 ? cm[3] / pow(cm[2], 1.5) : 0;
+      v[c][2] = cm[2] > 0 ? (cm[6] - cm[3] * cm[3]) / (cm[2] * cm[2] * cm[2]) : 0;
+    }
+    fprintf(file, "%d", s);
+    for (int o = 0; o < N_ORDERS; o++) {
+      double se = sqrt(v[CLASS_RANDOM][o] / total->count[CLASS_RANDOM] + v[CLASS_FIXED][o] / total->count[CLASS_FIXED]);
+      double t = se > 0 ? (m[CLASS_RANDOM][o] - m[CLASS_FIXED][o]) / se : 0;
+      fprintf(file, ",%.6f", t);
+      if (fabs(t) > max_t[o]) {
+        max_t[o] = fabs(t);
+        max_sample[o] = s;
+      }
+      n_leaky[o] += fabs(t) > TVLA_THRESHOLD;
+    }
+    fprintf(file, "\n");
+  }
+  fclose(file);
+
+  for (int o = 0; o < N_ORDERS; o++)
+    printf("Order %d: max |t| = %.2f at sample %d, %d samples over %.1f\n", o + 1, max_t[o], max_sample[o], n_leaky[o], TVLA_THRESHOLD);
+  printf("t-statistics written to %s\n", output_path);
+
+  for (int b = 0; b < n_threads; b++)
+    tvla_block_free(&blocks[b]);
+  return EXIT_SUCCESS;
+}
+
+void print_tvla_help() {
+  printf("Usage: ./tvla-ttest /path/to/traces n_traces n_samples [-p plaintexts.bin] [-fp fixed_plaintext] [-o output] [-j threads]\n");
+  printf("\tFixed-vs-random Welch t-test of traces acquired with plain_mode 2, of order 1 to 3.\n");
+  printf("\tThe trace file is a .bin file of uint8 samples or a .data file of float32 samples.\n");
+  printf("\t-p:  plaintext file of the acquisition; the traces are split by their plaintext\n");
+  printf("\t     (default: alternating classes, even traces random, odd traces fixed).\n");
+  printf("\t-fp: fixed plaintext, in hexadecimal (default: plaintext of the second trace).\n");
+  printf("\t-o:  output file path (default: trace file with the _tvla.csv extension).\n");
+  printf("\t-j:  number of threads (default: all cores).\n");
+}
+
+int tvla_block_init(tvla_block_t *block, int n_samples, int format) {
+  memset(block, 0, sizeof(tvla_block_t));
+  block->n_samples = n_samples;
+  block->format = format;
+  if (format == FORMAT_BIN) {
+    block->histogram = (uint64_t *)calloc((size_t)N_CLASSES * n_samples * 256, sizeof(uint64_t));
+    if (block->histogram == NULL) {
+      printf("----memory\n");
+      return EXIT_FAILURE;
+    }
+  } else {
+    block->mean = (double *)calloc((size_t)N_CLASSES * n_samples, sizeof(double));
+    block->moments = (double *)calloc((size_t)N_CLASSES * (N_MOMENTS - 1) * n_samples, sizeof(double));
+    if (block->mean == NULL || block->moments == NULL) {
+      printf("----memory\n");
+      tvla_block_free(block);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+}
+
+void tvla_block_free(tvla_block_t *block) {
+  free(block->histogram);
+  free(block->mean);
+  free(block->moments);
+  block->histogram = NULL;
+  block->mean = NULL;
+  block->moments = NULL;
+}
+
+static inline int trace_class(const tvla_block_t *block, long t) {
+  if (block->plaintexts != NULL)
+    return memcmp(block->plaintexts + t * KEYBYTES, block->fixed, KEYBYTES) == 0 ? CLASS_FIXED : CLASS_RANDOM;
+  return ((block->first_trace + t) & 1) ? CLASS_FIXED : CLASS_RANDOM;
+}
+
+// Sums of (x - mean)^order of one class, order 2 to N_MOMENTS
+static inline double *class_moments(const tvla_block_t *block, int c, int order) {
+  return &block->moments[((size_t)c * (N_MOMENTS - 1) + order - 2) * block->n_samples];
+}
+
+// Adds one float32 trace to the moments of its class: with n the new count
+// and delta = x - mean, every sum M_p of (x - mean)^p becomes
+//   M_p + sum_{k=1}^{p-2} C(p,k) M_{p-k} (-delta/n)^k + (delta/n)^p (n-1) ((n-1)^{p-1} + (-1)^p)
+// from the highest order down, so that the lower orders are still the old ones
+static void add_float_trace(tvla_block_t *block, int c, const float *trace) {
+  double n = ++block->count[c];
+  double *mean = &block->mean[(size_t)c * block->n_samples];
+  double *M[N_MOMENTS + 1];
+  for (int p = 2; p <= N_MOMENTS; p++)
+    M[p] = class_moments(block, c, p);
+
+  double tail[N_MOMENTS + 1];
+  for (int p = 2; p <= N_MOMENTS; p++)
+    tail[p] = (n - 1) * (pow(n - 1, p - 1) + ((p & 1) ? -1 : 1));
+
+  for (int s = 0; s < block->n_samples; s++) {
+    double delta = (double)trace[s] - mean[s];
+    double b = -delta / n;
+    double bk[N_MOMENTS + 1];
+    bk[0] = 1;
+    for (int k = 1; k <= N_MOMENTS; k++)
+      bk[k] = bk[k - 1] * b;
+    for (int p = N_MOMENTS; p >= 2; p--) {
+      double sum = 0;
+      for (int k = 1; k <= p - 2; k++)
+        sum += BINOMIAL[p][k] * M[p - k][s] * bk[k];
+      // (delta / n)^p = (-b)^p
+      M[p][s] += sum + ((p & 1) ? -bk[p] : bk[p]) * tail[p];
+    }
+    mean[s] += delta / n;
+  }
+}
+
+void tvla_block_run(tvla_block_t *block) {
+  if (block->format == FORMAT_BIN) {
+    for (long t = 0; t < block->n_traces; t++) {
+      int c = trace_class(block, t);
+      const uint8_t *trace = block->traces + (size_t)t * block->n_samples;
+      uint64_t *histogram = &block->histogram[(size_t)c * block->n_samples * 256];
+      for (int s = 0; s < block->n_samples; s++)
+        histogram[s * 256 + trace[s]]++;
+      block->count[c]++;
+    }
+  } else {
+    const float *traces = (const float *)block->traces;
+    for (long t = 0; t < block->n_traces; t++)
+      add_float_trace(block, trace_class(block, t), &traces[(size_t)t * block->n_samples]);
+  }
+}
+
+// Adds the traces of src to dst. The histograms are summed; the float32
+// moments of the two sets A (dst) and B (src) are combined with delta =
+// mean_B - mean_A and n = n_A + n_B:
+//   M_p = M_p,A + M_p,B + sum_{k=1}^{p-2} C(p,k) ((-n_B/n)^k M_{p-k},A + (n_A/n)^k M_{p-k},B) delta^k
+//         + (n_A n_B delta / n)^p (1 / n_B^{p-1} - (-1 / n_A)^{p-1})
+void tvla_block_merge(tvla_block_t *dst, const tvla_block_t *src) {
+  if (dst->format == FORMAT_BIN) {
+    size_t size = (size_t)N_CLASSES * dst->n_samples * 256;
+    for (size_t i = 0; i < size; i++)
+      dst->histogram[i] += src->histogram[i];
+  } else {
+    for (int c = 0; c < N_CLASSES; c++) {
+      double na = dst->count[c];
+      double nb = src->count[c];
+      if (nb == 0)
+        continue;
+      double n = na + nb;
+      double *mean_a = &dst->mean[(size_t)c * dst->n_samples];
+      const double *mean_b = &src->mean[(size_t)c * src->n_samples];
+      double *Ma[N_MOMENTS + 1];
+      const double *Mb[N_MOMENTS + 1];
+      for (int p = 2; p <= N_MOMENTS; p++) {
+        Ma[p] = class_moments(dst, c, p);
+        Mb[p] = class_moments(src, c, p);
+      }
+      for (int s = 0; s < dst->n_samples; s++) {
+        double delta = mean_b[s] - mean_a[s];
+        for (int p = N_MOMENTS; p >= 2; p--) {
+          double sum = Ma[p][s] + Mb[p][s];
+          for (int k = 1; k <= p - 2; k++)
+            sum += BINOMIAL[p][k] * (pow(-nb / n, k) * Ma[p - k][s] + pow(na / n, k) * Mb[p - k][s]) * pow(delta, k);
+          if (na > 0)
+            sum += pow(na * nb * delta / n, p) * (1 / pow(nb, p - 1) - pow(-1 / na, p - 1));
+          Ma[p][s] = sum;
+        }
+        mean_a[s] += delta * nb / n;
+      }
+    }
+  }
+  for (int c = 0; c < N_CLASSES; c++)
+    dst->count[c] += src->count[c];
+}
+
+// Mean and central moments cm[2..N_MOMENTS] (mean of (x - mean)^order) of one class and sample
+void tvla_central_moments(const tvla_block_t *block, int c, int s, double *mean, double cm[N_MOMENTS + 1]) {
+  double n = block->count[c];
+  for (int p = 0; p <= N_MOMENTS; p++)
+    cm[p] = 0;
+  if (block->format == FORMAT_BIN) {
+    const uint64_t *histogram = &block->histogram[((size_t)c * block->n_samples + s) * 256];
+    uint64_t sum = 0;
+    for (int x = 0; x < 256; x++)
+      sum += histogram[x] * x;
+    *mean = (double)sum / n;
+    for (int x = 0; x < 256; x++) {
+      if (histogram[x] == 0)
+        continue;
+      double d = x - *mean;
+      double dp = d;
+      for (int p = 2; p <= N_MOMENTS; p++) {
+        dp *= d;
+        cm[p] += histogram[x] * dp;
+      }
+    }
+    for (int p = 2; p <= N_MOMENTS; p++)
+      cm[p] /= n;
+  } else {
+    *mean = block->mean[(size_t)c * block->n_samples + s];
+    for (int p = 2; p <= N_MOMENTS; p++)
+      cm[p] = class_moments(block, c, p)[s] / n;
+  }
+}
@@ -7,6 +7,10 @@
  */
 
 #include "utils.cuh"
+#include "aes_tables.hpp"
+#include <sys/stat.h>
+
+static const char *model_names[N_MODELS] = {"hd", "hw", "id", "bit0", "bit1", "bit2", "bit3", "bit4", "bit5", "bit6", "bit7"};
 
 void print_help() {
   printf("HELP\n");
@@ -26,6 +30,50 @@ void print_help() {
   printf("\t-ns <number>:    number of samples per trace (trace lenght).\n");
   printf("\t-ss <number>:    step size for the attack.\n");
   printf("\t-o <dir-path>:   output directory.\n");
+  printf("\nOptional arguments:\n");
+  printf("\t-j <number>:     number of worker threads of the CPU backend (default: all cores).\n");
+  printf("\t-m <number>:     memory ceiling for the trace batches, in MiB (default: 1024). The traces are streamed from the files in batches that fit in it, with the sums of the CPU backend.\n");
+  printf("\t-lm <models>:    comma-separated leakage models, all attacked in one pass over the traces (default: hd).\n");
+  printf("\t                 hd: Hamming distance of the last round (last round key, ciphertexts).\n");
+  printf("\t                 hw, id, bit0 to bit7: Hamming weight, value, or one bit of the first round S-box output (first round key, plaintexts).\n");
+  printf("\t                 With several models, the results of each model are written to a subdirectory of the output directory named after it.\n");
+  printf("\t-p <file-path>:  path to the plaintext file of the first round models (default: plaintexts chained from the ciphertexts, starting from 0, as the Alveo host).\n");
+  printf("\t-r <number>:     number of bootstrap attacks per checkpoint of the CPU backend (default: 0). Their success rate and guessing entropy are written to bootstrap_kr_0.csv.\n");
+  printf("\t-rs <number>:    seed of the bootstrap subsampling (default: 1).\n");
+  printf("\t-rf <number>:    every bootstrap attack keeps one trace of every that many, without replacement (default: 10):\n");
+  printf("\t                 at a checkpoint of n traces, the bootstrap attacks are attacks on n / that many distinct traces.\n");
+  printf("\t-u <number>:     attack until broken: stop once every key byte has been ranked first for that many consecutive checkpoints (default: 0, off).\n");
+  printf("\t                 The number of traces from which the key stayed ranked first is written to disclosure_kr_0.csv.\n");
+  printf("\t-poi <number>:   number of points of interest: the CPA only processes the samples of highest NICV (default: 0, all the samples).\n");
+  printf("\t                 The NICV is computed by a pre-pass over the first traces, with the byte values of the ciphertexts (plaintexts) as classes, and written to poi_kr_0.csv.\n");
+  printf("\t-pw <number>:    the points of interest are selected by windows of that many samples (default: 1).\n");
+  printf("\t-pn <number>:    number of traces of the point of interest pre-pass (default: 20000).\n");
+  printf("\t-sw <number>:    the trace file holds the raw sensor words of that many bits per sample (traces_raw.bin of the Alveo host, multiple of 32):\n");
+  printf("\t                 every bit is a sample of the attack, which sees -ns times -sw samples per trace.\n");
+  printf("\t-lra:            linear regression analysis of the CPU backend instead of the CPA: every sample is regressed on the 8 bits of the intermediate\n");
+  printf("\t                 of the leakage model and a constant, and the coefficient of determination replaces the correlation in the result files.\n");
+  printf("\t-bs <number>:    bitsliced CPA of the CPU backend on the raw sensor bits (with -sw): every group of that many consecutive bits of a sensor word\n");
+  printf("\t                 (1, 2, 4, 8, 16 or 32) is a sample, the sum of its bits. The traces are not expanded to one sample per bit, and the correlation\n");
+  printf("\t                 of the key of every key byte with every sample is written to taps_kr_0.csv.\n");
+  printf("\t-nc <number>:    number of channels of the traces, one per sensor (default: 1): every trace holds -ns samples of every channel, one channel\n");
+  printf("\t                 after the other (traces_encoded.bin and traces_raw.bin of the Alveo host with N_SENSORS sensors). The attack sees the samples\n");
+  printf("\t                 of all the channels, so that its correlation is the largest over the channels, and the CPU backend writes the largest correlation\n");
+  printf("\t                 of the key with the samples of every channel to channels_kr_0.csv.\n");
+  printf("\t-cw <weights>:   comma-separated weights of the channels (with -nc): the attack sees the weighted sum of the channels, -ns samples per trace.\n");
+  printf("\t-al <file-path>: shift index written by align-traces (-f shifts): every trace is realigned by its shift as it is read.\n");
+  printf("\nAccumulator state arguments (cpa accumulate, which does not take -k, -ss and -o):\n");
+  printf("\t-st <file-path>: accumulator state file written by cpa accumulate, and combined by cpa merge and cpa finalize.\n");
+  printf("\t                 main-CPA-cpu saves its accumulators to it while it runs, and resumes from it if it exists (without -r, -u and -lra).\n");
+  printf("\t-ft <number>:    first trace of the files accumulated by cpa accumulate, which accumulates -nt traces from it (default: 0).\n");
+  printf("\t-ci <number>:    least number of seconds between two saves of the state file of main-CPA-cpu (default: 300), raised so that\n");
+  printf("\t                 the saves take at most 5%% of the time of the attack.\n");
+  printf("\nTemplate attack arguments (main-TA-cpu):\n");
+  printf("\t-pt <file-path>: path to the trace file of the profiling set, acquired with a random key per trace (key mode 1).\n");
+  printf("\t-pc <file-path>: path to the ciphertext file of the profiling set.\n");
+  printf("\t-pk <file-path>: path to the key file of the profiling set (keys.bin).\n");
+  printf("\t-pp <file-path>: path to the plaintext file of the profiling set, for the first round models (default: chained from the ciphertexts).\n");
+  printf("\t-np <number>:    number of profiling traces (default: all the traces of the profiling files).\n");
+  printf("\t                 With -poi, the points of interest are selected on the profiling set, with the values of the leakage models as classes.\n");
   printf("\n\n\n");
 
   return;
@@ -69,12 +117,37 @@ int parse_args(int argc, char* argv[], config_t* config) {
         return EXIT_FAILURE;
       }
       memcpy(config->key, buffer, sizeof(buffer));
-      used_arguments++;
+      used_arguments += !config->accumulate;
     } else if(argv[i][1] == 't') {
       i++;
       memcpy(config->trace_path, argv[i], strlen(argv[i]));
       config->trace_path[strlen(argv[i])] = '\0';
       used_arguments++;
+    } else if(strcmp(argv[i], "-st") == 0) {
+      i++;
+      snprintf(config->state_path, sizeof(config->state_path), "%s", argv[i]);
+    } else if(strcmp(argv[i], "-ft") == 0) {
+      i++;
+      config->first_trace = atol(argv[i]);
+    } else if(strcmp(argv[i], "-ci") == 0) {
+      i++;
+      config->state_interval = atoi(argv[i]);
+    } else if(strcmp(argv[i], "-nc") == 0) {
+      i++;
+      config->n_channels = atoi(argv[i]);
+    } else if(strcmp(argv[i], "-cw") == 0) {
+      i++;
+      int n_weights = 0;
+      char weights[1000];
+      snprintf(weights, sizeof(weights), "%s", argv[i]);
+      for (char *weight = strtok(weights, ","); weight != NULL; weight = strtok(NULL, ",")) {
+        if (n_weights == MAX_CHANNELS) {
+          printf("More than %d channel weights\n", MAX_CHANNELS);
+          return EXIT_FAILURE;
+        }
+        config->channel_weights[n_weights++] = (float)atof(weight);
+      }
+      config->fuse = n_weights;
     } else if(argv[i][1] == 'c') {
       i++;
       memcpy(config->ciphertext_path, argv[i], strlen(argv[i]));
@@ -88,15 +161,92 @@ int parse_args(int argc, char* argv[], config_t* config) {
       i++;
       config->n_samples = atoi(argv[i]);
       used_arguments++;
+    } else if(argv[i][1] == 's' && argv[i][2] == 'w') {
+      i++;
+      config->sensor_width = atoi(argv[i]);
     } else if(argv[i][1] == 's' && argv[i][2] == 's') {
       i++;
       config->step_size = atoi(argv[i]);
-      used_arguments++;
+      used_arguments += !config->accumulate;
     } else if(argv[i][1] == 'o') {
       i++;
       memcpy(config->dump_path, argv[i], strlen(argv[i]));
       config->dump_path[strlen(argv[i])] = '\0';
-      used_arguments++;
+      used_arguments += !config->accumulate;
+    } else if(argv[i][1] == 'j') {
+      i++;
+      config->n_threads = atoi(argv[i]);
+    } else if(argv[i][1] == 'm') {
+      i++;
+      config->memory_limit_mb = atoi(argv[i]);
+    } else if(strcmp(argv[i], "-al") == 0) {
+      i++;
+      snprintf(config->shift_path, sizeof(config->shift_path), "%s", argv[i]);
+    } else if(strcmp(argv[i], "-lra") == 0) {
+      config->lra = 1;
+    } else if(strcmp(argv[i], "-bs") == 0) {
+      i++;
+      config->bitslice = atoi(argv[i]);
+    } else if(argv[i][1] == 'l' && argv[i][2] == 'm') {
+      i++;
+      config->n_models = 0;
+      char models[1000];
+      snprintf(models, sizeof(models), "%s", argv[i]);
+      for (char *name = strtok(models, ","); name != NULL; name = strtok(NULL, ",")) {
+        int model = 0;
+        while (model < N_MODELS && strcmp(name, model_names[model]) != 0)
+          model++;
+        if (model == N_MODELS) {
+          printf("Unknown leakage model: %s\n", name);
+          return EXIT_FAILURE;
+        }
+        for (int m = 0; m < config->n_models; m++) {
+          if (config->models[m] == model) {
+            printf("A leakage model is given more than once: %s\n", name);
+            return EXIT_FAILURE;
+          }
+        }
+        config->models[config->n_models++] = model;
+      }
+    } else if(strcmp(argv[i], "-poi") == 0) {
+      i++;
+      config->poi_samples = atoi(argv[i]);
+    } else if(strcmp(argv[i], "-pw") == 0) {
+      i++;
+      config->poi_window = atoi(argv[i]);
+    } else if(strcmp(argv[i], "-pn") == 0) {
+      i++;
+      config->poi_traces = atoi(argv[i]);
+    } else if(strcmp(argv[i], "-pt") == 0) {
+      i++;
+      snprintf(config->profile_trace_path, sizeof(config->profile_trace_path), "%s", argv[i]);
+    } else if(strcmp(argv[i], "-pc") == 0) {
+      i++;
+      snprintf(config->profile_ciphertext_path, sizeof(config->profile_ciphertext_path), "%s", argv[i]);
+    } else if(strcmp(argv[i], "-pk") == 0) {
+      i++;
+      snprintf(config->profile_key_path, sizeof(config->profile_key_path), "%s", argv[i]);
+    } else if(strcmp(argv[i], "-pp") == 0) {
+      i++;
+      snprintf(config->profile_plaintext_path, sizeof(config->profile_plaintext_path), "%s", argv[i]);
+    } else if(argv[i][1] == 'n' && argv[i][2] == 'p') {
+      i++;
+      config->profile_traces = atoi(argv[i]);
+    } else if(argv[i][1] == 'p') {
+      i++;
+      snprintf(config->plaintext_path, sizeof(config->plaintext_path), "%s", argv[i]);
+    } else if(argv[i][1] == 'r' && argv[i][2] == 's') {
+      i++;
+      config->seed = strtoull(argv[i], NULL, 0);
+    } else if(argv[i][1] == 'r' && argv[i][2] == 'f') {
+      i++;
+      config->subsample = atoi(argv[i]);
+    } else if(argv[i][1] == 'r') {
+      i++;
+      config->n_rounds = atoi(argv[i]);
+    } else if(argv[i][1] == 'u') {
+      i++;
+      config->hold = atoi(argv[i]);
     }else {
       printf("Unknown argument: -%c\n\n", argv[i][1]);
       print_help();
@@ -104,14 +254,55 @@ int parse_args(int argc, char* argv[], config_t* config) {
     }
   }
 
-  if(used_arguments != 7){
+  if(used_arguments != (config->accumulate ? 4 : 7)){
     printf("Not enough arguments used. All arguments except help need to be specified!\n");
     print_help();
     return EXIT_FAILURE;
-  } else {
-    return EXIT_SUCCESS;
   }
 
+  // Every bit of a raw sensor word is a sample of the attack
+  if (config->sensor_width != 0) {
+    if (config->sensor_width < 0 || config->sensor_width % 32 != 0) {
+      printf("The sensor width (%d) must be a multiple of 32 bits\n", config->sensor_width);
+      return EXIT_FAILURE;
+    }
+    config->n_samples *= config->sensor_width;
+  }
+
+  // The attack sees the samples of all the channels, or their weighted sum
+  if (config->n_channels < 1 || config->n_channels > MAX_CHANNELS) {
+    printf("The number of channels (%d) must be between 1 and %d\n", config->n_channels, MAX_CHANNELS);
+    return EXIT_FAILURE;
+  }
+  if (config->fuse != 0 && config->fuse != config->n_channels) {
+    printf("%d channel weights given for %d channels\n", config->fuse, config->n_channels);
+    return EXIT_FAILURE;
+  }
+  if (config->fuse != 0 && config->bitslice != 0) {
+    printf("The bitsliced CPA (-bs) attacks the raw sensor bits, which cannot be summed over the channels (-cw)\n");
+    return EXIT_FAILURE;
+  }
+  if (config->fuse == 0)
+    config->n_samples *= config->n_channels;
+
+  if (config->subsample < 1) {
+    printf("The bootstrap attacks (-rf) must keep one trace of every 1 or more\n");
+    return EXIT_FAILURE;
+  }
+
+  // The bitsliced CPA groups bits of the same 32-bit word
+  if (config->bitslice != 0) {
+    if (config->sensor_width == 0) {
+      printf("The bitsliced CPA (-bs) attacks the raw sensor bits, given with -sw\n");
+      return EXIT_FAILURE;
+    }
+    if (config->bitslice < 0 || config->bitslice > 32 || (config->bitslice & (config->bitslice - 1)) != 0) {
+      printf("The bits per sample of the bitsliced CPA (%d) must be 1, 2, 4, 8, 16 or 32\n", config->bitslice);
+      return EXIT_FAILURE;
+    }
+  }
+  return EXIT_SUCCESS;
+
 }
 
 int init_config(config_t* config){
@@ -131,6 +322,33 @@ int init_config(config_t* config){
   config->n_traces     = 100; 
   config->n_samples    = 128; 
   config->step_size    = 10; 
+  config->n_threads    = 0; 
+  config->memory_limit_mb = 0; 
+  config->models[0]    = MODEL_LAST_ROUND_HD; 
+  config->n_models     = 1; 
+  config->plaintext_path[0] = '\0'; 
+  config->n_rounds     = 0; 
+  config->seed         = 1; 
+  config->subsample    = 10; 
+  config->hold         = 0; 
+  config->poi_samples  = 0; 
+  config->poi_window   = 1; 
+  config->poi_traces   = 0; 
+  config->profile_trace_path[0] = '\0'; 
+  config->profile_ciphertext_path[0] = '\0'; 
+  config->profile_plaintext_path[0] = '\0'; 
+  config->profile_key_path[0] = '\0'; 
+  config->profile_traces = 0; 
+  config->sensor_width = 0; 
+  config->lra          = 0; 
+  config->bitslice     = 0; 
+  config->n_channels   = 1; 
+  config->fuse         = 0; 
+  config->shift_path[0] = '\0'; 
+  config->accumulate   = 0; 
+  config->state_path[0] = '\0'; 
+  config->first_trace  = 0; 
+  config->state_interval = 300; 
   return EXIT_SUCCESS;
 
 }
@@ -149,12 +367,146 @@ int print_config(config_t* config){
   printf("\t- ciphertext file path: %s\n\n", config->ciphertext_path);
   printf("\t- number of traces: %d\n", config->n_traces);
   printf("\t- number of trace samples: %d\n", config->n_samples);
+  if (config->sensor_width > 0)
+    printf("\t- raw sensor words of %d bits: %d samples of one bit\n", config->sensor_width, config->n_samples);
   printf("\t- step size for attack: %d\n", config->step_size);
+  printf("\t- number of CPU threads: %d (0 = all cores)\n", config->n_threads);
+  printf("\t- memory ceiling for the trace batches: %d MiB (0 = default)\n", config->memory_limit_mb);
+  printf("\t- leakage models: %s", model_names[config->models[0]]);
+  for(int m=1;m<config->n_models; m++)
+    printf(",%s", model_names[config->models[m]]);
+  printf("\n");
+  if (config_first_round(config))
+    printf("\t- plaintext file path: %s\n", config->plaintext_path[0] != '\0' ? config->plaintext_path : "chained from the ciphertexts");
+  if (config->shift_path[0] != '\0')
+    printf("\t- shift file path: %s\n", config->shift_path);
+  if (config->n_channels > 1 && config->fuse)
+    printf("\t- %d channels, summed: %d samples per trace\n", config->n_channels, config->n_samples);
+  else if (config->n_channels > 1)
+    printf("\t- %d channels of %d samples\n", config->n_channels, config->n_samples / config->n_channels);
+  if (config->lra)
+    printf("\t- linear regression analysis\n");
+  if (config->bitslice > 0)
+    printf("\t- bitsliced CPA: %d samples of %d bits\n", config->n_samples / config->bitslice, config->bitslice);
+  if (config->n_rounds > 0)
+    printf("\t- bootstrap attacks per checkpoint: %d on one trace of %d (seed %llu)\n", config->n_rounds, config->subsample, config->seed);
+  if (config->hold > 0)
+    printf("\t- attack until the key is ranked first for %d checkpoints\n", config->hold);
+  if (config->poi_samples > 0)
+    printf("\t- points of interest: %d (windows of %d samples)\n", config->poi_samples, config->poi_window);
+  if (config->profile_trace_path[0] != '\0')
+    printf("\t- profiling set: %s, %s, %s (%d traces, 0 = all)\n", config->profile_trace_path, config->profile_ciphertext_path, config->profile_key_path, config->profile_traces);
+  if (config->state_path[0] != '\0')
+    printf("\t- accumulator state file: %s (from trace %ld)\n", config->state_path, config->first_trace);
   printf("\t- output path: %s\n\n", config->trace_path);
 
   return EXIT_SUCCESS;
 
 }
 
+// Trace counts at which the attack is evaluated: n_traces, n_traces - step_size, ...
+// down to step_size, returned in increasing order
+int *get_checkpoints(config_t *config, int *n_checkpoints) {
+
+  int upper = config->n_traces;
+  int lower = config->step_size;
+  int step = config->step_size;
+  int count = (step > 0 && upper >= lower) ? (upper - lower) / step + 1 : 0;
+
+  int *checkpoints = (int *)malloc(sizeof(int) * (count > 0 ? count : 1));
+  for (int c = 0; c < count; c++)
+    checkpoints[c] = upper - (count - 1 - c) * step;
+
+  *n_checkpoints = count;
+  return checkpoints;
+
+}
+
+const char *model_name(int model) {
+  return model_names[model];
+}
+
+// 1 if the model attacks the first round key with the plaintexts, 0 if it
+// attacks the last round key with the ciphertexts
+int model_first_round(int model) {
+  return model != MODEL_LAST_ROUND_HD;
+}
+
+// 1 if one of the models of the attack needs the plaintexts
+int config_first_round(config_t *config) {
+
+  for (int m = 0; m < config->n_models; m++)
+    if (model_first_round(config->models[m]))
+      return 1;
+  return 0;
+
+}
+
+// Key attacked by the model: the last round key given by -k, or the first
+// round (master) key computed from it by running the AES-128 key schedule backwards
+void get_model_key(config_t *config, int model, int key[KEYBYTES]) {
 
+  uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+  uint8_t w[KEYBYTES];
 
+  for (int n = 0; n < KEYBYTES; n++)
+    w[n] = (uint8_t)config->key[n];
+
+  if (model_first_round(model)) {
+    for (int round = 9; round >= 0; round--) {
+      for (int n = KEYBYTES - 1; n >= 4; n--)
+        w[n] ^= w[n - 4];
+      w[0] ^= sbox[w[13]] ^ rcon[round];
+      w[1] ^= sbox[w[14]];
+      w[2] ^= sbox[w[15]];
+      w[3] ^= sbox[w[12]];
+    }
+  }
+
+  for (int n = 0; n < KEYBYTES; n++)
+    key[n] = w[n];
+
+}
+
+// Last round key of an AES-128 key, computed by running the key schedule forwards
+void get_last_round_key(const uint8_t key[KEYBYTES], uint8_t last_round_key[KEYBYTES]) {
+
+  uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36};
+  uint8_t w[KEYBYTES];
+
+  memcpy(w, key, KEYBYTES);
+  for (int round = 0; round < 10; round++) {
+    w[0] ^= sbox[w[13]] ^ rcon[round];
+    w[1] ^= sbox[w[14]];
+    w[2] ^= sbox[w[15]];
+    w[3] ^= sbox[w[12]];
+    for (int n = 4; n < KEYBYTES; n++)
+      w[n] ^= w[n - 4];
+  }
+  memcpy(last_round_key, w, KEYBYTES);
+
+}
+
+// Directory of the result files of the model: the output directory with a
+// single model, or its subdirectory named after the model with several,
+// created with its final_kr directory
+int get_model_output_path(config_t *config, int model, char output_path[1000]) {
+
+  if (config->n_models == 1) {
+    snprintf(output_path, 1000, "%s", config->dump_path);
+    return EXIT_SUCCESS;
+  }
+
+  char final_path[1000];
+  snprintf(output_path, 1000, "%s/%s/", config->dump_path, model_names[model]);
+  snprintf(final_path, sizeof(final_path), "%sfinal_kr", output_path);
+  mkdir(output_path, 0755);
+  mkdir(final_path, 0755);
+  struct stat st;
+  if (stat(final_path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    printf("Error in creating the output directory %s\n", final_path);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+
+}
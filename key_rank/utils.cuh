@@ -6,9 +6,48 @@
  BSD-style license that can be found in the LICENSE.md file. 
 */
 
+#ifndef UTILS_H
+#define UTILS_H
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+// length of the key
+#define KEYBYTES 16
+
+// there are 2^8 = 256 possibilities for each byte
+#define KEYS 256
+
+// Leakage models of the hypotheses (-lm). The last round model attacks the
+// last round key with the ciphertexts, the first round models the first round
+// (master) key with the plaintexts.
+#define MODEL_LAST_ROUND_HD 0   // hd:     HD(inv_sbox[ct[n] ^ k], ct[inv_shift[n]])
+#define MODEL_SBOX_HW       1   // hw:     HW(sbox[pt[n] ^ k])
+#define MODEL_IDENTITY      2   // id:     sbox[pt[n] ^ k]
+#define MODEL_SBOX_BIT      3   // bit<b>: bit b of sbox[pt[n] ^ k], model MODEL_SBOX_BIT + b
+#define N_MODELS            11
+
+// Largest number of channels of a trace file (sensors of the Alveo host)
+#define MAX_CHANNELS 16
+
+// Calls function<model>(...) with the model struct of a MODEL_ value; the
+// model structs are defined by the backends
+#define DISPATCH_MODEL(model, function, ...) \
+  switch (model) { \
+  case MODEL_LAST_ROUND_HD:    function<model_last_round_hd>(__VA_ARGS__); break; \
+  case MODEL_SBOX_HW:          function<model_sbox_hw>(__VA_ARGS__); break; \
+  case MODEL_IDENTITY:         function<model_identity>(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 0:     function<model_sbox_bit<0> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 1:     function<model_sbox_bit<1> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 2:     function<model_sbox_bit<2> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 3:     function<model_sbox_bit<3> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 4:     function<model_sbox_bit<4> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 5:     function<model_sbox_bit<5> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 6:     function<model_sbox_bit<6> >(__VA_ARGS__); break; \
+  case MODEL_SBOX_BIT + 7:     function<model_sbox_bit<7> >(__VA_ARGS__); break; \
+  }
 
 typedef struct config {
 
@@ -19,9 +58,46 @@ typedef struct config {
   int n_samples;
   int step_size;
   char dump_path[1000];
+  int n_threads;
+  int memory_limit_mb;
+  int models[N_MODELS];
+  int n_models;
+  char plaintext_path[1000];    // empty: plaintexts chained from the ciphertexts
+  int n_rounds;                 // bootstrap attacks per checkpoint, 0: none
+  unsigned long long seed;      // seed of the bootstrap subsampling
+  int subsample;                // the bootstrap attacks keep one trace of every that many
+  int hold;                     // attack until broken: checkpoints the key must stay ranked first, 0: off
+  int poi_samples;              // points of interest kept for the CPA, 0: all the samples
+  int poi_window;               // points of interest selected by windows of that many samples
+  int poi_traces;               // traces of the point of interest pre-pass, 0: default
+  char profile_trace_path[1000];      // profiling set of the template attack, random keys
+  char profile_ciphertext_path[1000];
+  char profile_plaintext_path[1000];  // empty: plaintexts chained from the ciphertexts
+  char profile_key_path[1000];        // keys.bin, key of every profiling trace
+  int profile_traces;                 // number of profiling traces, 0: all the traces of the files
+  int sensor_width;             // raw sensor traces: bits per sample, n_samples counts the bits; 0: not raw
+  int lra;                      // linear regression analysis instead of the CPA (CPU backend)
+  int bitslice;                 // bitsliced CPA of the raw sensor bits (CPU backend): bits per sample, 0: off
+  char shift_path[1000];        // shift index of align-traces applied to the attack traces, "" for none
+  int n_channels;               // channels of the traces (one per sensor), -ns samples each
+  int fuse;                     // the channels are summed, weighted by channel_weights, instead of attacked side by side
+  float channel_weights[MAX_CHANNELS];
+  int accumulate;               // cpa accumulate: no key, step size or output directory
+  char state_path[1000];        // accumulator state file of the cpa command, "" for none
+  long first_trace;             // first trace of the file accumulated by cpa accumulate
+  int state_interval;           // main-CPA-cpu with -st: least seconds between two saves of the state file
 } config_t;
 
 void print_help();
 int parse_args(int argc, char* argv[], config_t* config); 
 int init_config(config_t* config);
 int print_config(config_t* config);
+int *get_checkpoints(config_t *config, int *n_checkpoints);
+const char *model_name(int model);
+int model_first_round(int model);
+int config_first_round(config_t *config);
+void get_model_key(config_t *config, int model, int key[KEYBYTES]);
+void get_last_round_key(const uint8_t key[KEYBYTES], uint8_t last_round_key[KEYBYTES]);
+int get_model_output_path(config_t *config, int model, char output_path[1000]);
+
+#endif